@@ -0,0 +1,171 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+/* Every allocation is aligned as strictly as any of these */
+union arena_align {
+    long double ld;
+    long long ll;
+    void *ptr;
+    void (*fn)(void);
+};
+
+#define ARENA_ALIGN sizeof(union arena_align)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(struct arena_chunk))
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+    int heap; /* taken from the heap, not the caller's buffer */
+};
+
+static struct arena_chunk *arena_chunk_new(struct arena *arena, size_t size);
+
+void arena_init(struct arena *arena, void *buf, size_t size) {
+    struct arena_chunk *chunk;
+    uintptr_t addr, pad;
+
+    ASSERT(arena);
+
+    arena->head = NULL;
+    arena->curr = NULL;
+    arena->allocs = 0;
+    arena->chunks = 0;
+
+    if (!buf) {
+        return;
+    }
+
+    addr = (uintptr_t)buf;
+    pad = ARENA_ROUND(addr) - addr;
+
+    /* Too small to hold anything, every allocation goes to the heap */
+    if (size <= pad + ARENA_HEADER + ARENA_ALIGN) {
+        return;
+    }
+
+    chunk = (struct arena_chunk *)(addr + pad);
+    chunk->next = NULL;
+    chunk->size = (size - pad - ARENA_HEADER) & ~(ARENA_ALIGN - 1);
+    chunk->used = 0;
+    chunk->heap = 0;
+
+    arena->head = chunk;
+    arena->curr = chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    struct arena_chunk *chunk, *last = NULL;
+    unsigned char *ptr;
+
+    ASSERT(arena);
+
+    size = size ? ARENA_ROUND(size) : ARENA_ALIGN;
+
+    /* Chunks after curr are left over from before a reset */
+    for (chunk = arena->curr; chunk; chunk = chunk->next) {
+        if (chunk->size - chunk->used >= size) {
+            break;
+        }
+        last = chunk;
+    }
+
+    if (!chunk) {
+        chunk = arena_chunk_new(arena, size);
+        if (!chunk) {
+            return NULL;
+        }
+        if (last) {
+            last->next = chunk;
+        } else {
+            arena->head = chunk;
+        }
+    }
+
+    arena->curr = chunk;
+    arena->allocs++;
+
+    ptr = (unsigned char *)chunk + ARENA_HEADER + chunk->used;
+    chunk->used += size;
+
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+char *arena_strdup(struct arena *arena, const char *str) {
+    size_t n;
+    char *ptr;
+
+    ASSERT(str);
+
+    n = strlen(str) + 1;
+
+    ptr = arena_alloc(arena, n);
+    if (!ptr) {
+        return NULL;
+    }
+
+    memcpy(ptr, str, n);
+
+    return ptr;
+}
+
+void arena_reset(struct arena *arena) {
+    struct arena_chunk *chunk;
+
+    ASSERT(arena);
+
+    for (chunk = arena->head; chunk; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+
+    arena->curr = arena->head;
+}
+
+void arena_free(struct arena *arena) {
+    struct arena_chunk *chunk, *next;
+
+    ASSERT(arena);
+
+    for (chunk = arena->head; chunk; chunk = next) {
+        next = chunk->next;
+        if (chunk->heap) {
+            free(chunk);
+        }
+    }
+
+    arena->head = NULL;
+    arena->curr = NULL;
+}
+
+static struct arena_chunk *arena_chunk_new(struct arena *arena, size_t size) {
+    struct arena_chunk *chunk;
+
+    if (size < ARENA_CHUNK_SIZE - ARENA_HEADER) {
+        size = ARENA_CHUNK_SIZE - ARENA_HEADER;
+    }
+
+    chunk = malloc(ARENA_HEADER + size);
+    if (!chunk) {
+        DBGERR("malloc error");
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->heap = 1;
+
+    arena->chunks++;
+
+    return chunk;
+}
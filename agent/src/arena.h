@@ -0,0 +1,40 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/* Size of the chunks taken from the heap once the first one is full */
+#define ARENA_CHUNK_SIZE 4096
+
+struct arena_chunk;
+
+/*
+ * A region allocator for the memory of one operation, such as a lookup or
+ * a connect: allocations are bumped out of chunks and released together by
+ * arena_reset or arena_free, there is no per-allocation free. The first
+ * chunk may be a buffer owned by the caller, usually on the stack, so an
+ * operation fitting in it makes no heap allocation at all. Not thread safe.
+ */
+struct arena {
+    struct arena_chunk *head;
+    struct arena_chunk *curr;
+    size_t allocs; /* allocations served since arena_init */
+    size_t chunks; /* chunks taken from the heap since arena_init */
+};
+
+/* buf may be NULL, otherwise it backs the first chunk until arena_free */
+void arena_init(struct arena *arena, void *buf, size_t size);
+
+/* Returns size zeroed bytes aligned for any type, NULL on error */
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *str);
+
+/* Release every allocation, the chunks are kept for reuse */
+void arena_reset(struct arena *arena);
+
+/* Release every allocation and return the chunks to the heap */
+void arena_free(struct arena *arena);
+
+#endif /* arena.h */
@@ -0,0 +1,215 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "checkin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_CATEGORY TRACE_CHECKIN
+#include "debug.h"
+
+/* Extra seconds to wait for the response after the hold expires */
+#define CHECKIN_SLACK 10
+
+static int checkin_read_response(net_context *ctx, char *buf, size_t size);
+static uint32_t checkin_get32(const char *buf);
+
+int checkin_poll(net_context *ctx, const char *host, const char *id, int hold,
+                 char *buf, size_t size) {
+    char req[512];
+    int ret;
+
+    ASSERT(ctx);
+    ASSERT(host);
+    ASSERT(id);
+    ASSERT(buf);
+    ASSERT(size);
+
+    if (hold < 0) {
+        hold = 0;
+    } else if (hold > CHECKIN_HOLD_MAX) {
+        hold = CHECKIN_HOLD_MAX;
+    }
+
+    ret = snprintf(req, sizeof(req),
+                   "GET /?id=%s&wait=%d HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "Connection: keep-alive\r\n\r\n",
+                   id, hold, host);
+    if (ret <= 0 || (size_t)ret >= sizeof(req)) {
+        DBG("check-in request too long");
+        return -1;
+    }
+
+    if (net_set_timeout(ctx, hold + CHECKIN_SLACK) == -1) {
+        DBG("net_set_timeout error");
+        return -1;
+    }
+
+    if (net_send(ctx, req, (size_t)ret) != ret) {
+        DBG("net_send error");
+        return -1;
+    }
+
+    return checkin_read_response(ctx, buf, size);
+}
+
+/*
+ * HTTP/1.1 200 OK
+ * Content-Length: 42
+ *
+ * <body>
+ */
+static int checkin_read_response(net_context *ctx, char *buf, size_t size) {
+    char head[2048], *body, *ptr;
+    size_t len = 0, body_len, content_length = 0;
+    unsigned long retry_after;
+    int ret, status;
+
+    /* read the status line and headers */
+    while (1) {
+        if (len >= sizeof(head) - 1) {
+            DBG("response header too large");
+            return -1;
+        }
+
+        ret = net_recv(ctx, head + len, sizeof(head) - 1 - len);
+        if (ret <= 0) {
+            DBG("net_recv error");
+            return -1;
+        }
+
+        len += ret;
+        head[len] = '\0';
+
+        body = strstr(head, "\r\n\r\n");
+        if (body) {
+            body += 4;
+            break;
+        }
+    }
+
+    if (sscanf(head, "HTTP/1.%*d %d", &status) != 1) {
+        DBGF("invalid response: %s", head);
+        return -1;
+    }
+
+    ptr = strstr(head, "Content-Length: ");
+    if (ptr && ptr < body) {
+        content_length = strtoul(ptr + 16, NULL, 10);
+    }
+
+    if (status == 204) {
+        return 0;
+    }
+
+    if ((status == 429 || status == 503) && content_length < CHECKIN_BUSY_SIZE) {
+        /* no busy frame, as from a proxy: build it from Retry-After */
+        ptr = strstr(head, "Retry-After: ");
+        if (!ptr || ptr > body || size < CHECKIN_BUSY_SIZE) {
+            DBGF("check-in failed: %d", status);
+            return -1;
+        }
+        retry_after = strtoul(ptr + 13, NULL, 10);
+        memset(buf, 0xff, 4);
+        buf[4] = (char)(retry_after >> 24);
+        buf[5] = (char)(retry_after >> 16);
+        buf[6] = (char)(retry_after >> 8);
+        buf[7] = (char)retry_after;
+        return CHECKIN_BUSY_SIZE;
+    }
+
+    if (status != 200 && status != 429 && status != 503) {
+        DBGF("check-in failed: %d", status);
+        return -1;
+    }
+
+    if (content_length > size) {
+        DBGF("response body too large: %lu", (unsigned long)content_length);
+        return -1;
+    }
+
+    body_len = len - (size_t)(body - head);
+    if (body_len > content_length) {
+        body_len = content_length;
+    }
+
+    memcpy(buf, body, body_len);
+
+    while (body_len < content_length) {
+        ret = net_recv(ctx, buf + body_len, content_length - body_len);
+        if (ret <= 0) {
+            DBG("net_recv error");
+            return -1;
+        }
+        body_len += ret;
+    }
+
+    return (int)body_len;
+}
+
+static uint32_t checkin_get32(const char *buf) {
+    const unsigned char *p = (const unsigned char *)buf;
+
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           (uint32_t)p[3];
+}
+
+int checkin_retry_after(const char *buf, int len) {
+    uint32_t retry_after;
+
+    ASSERT(buf);
+
+    if (len < CHECKIN_BUSY_SIZE || checkin_get32(buf) != CHECKIN_BUSY) {
+        return 0;
+    }
+
+    retry_after = checkin_get32(buf + 4);
+    if (retry_after < 1) {
+        retry_after = 1;
+    } else if (retry_after > 3600) {
+        retry_after = 3600;
+    }
+    return (int)retry_after;
+}
+
+int checkin_next_task(const char *buf, int len, size_t *off,
+                      struct checkin_task *task) {
+    size_t n = (size_t)len;
+
+    ASSERT(buf);
+    ASSERT(off);
+    ASSERT(task);
+
+    if (*off == 0) {
+        /* a 204 of the HTTP listener has no frame at all */
+        if (n == 0) {
+            return 0;
+        }
+        if (n < CHECKIN_FRAME_HEADER || checkin_get32(buf) == CHECKIN_BUSY) {
+            return -1;
+        }
+        *off = CHECKIN_FRAME_HEADER;
+    }
+
+    if (*off == n) {
+        return 0;
+    }
+    if (n - *off < CHECKIN_TASK_HEADER) {
+        DBG("truncated task header");
+        return -1;
+    }
+
+    buf += *off;
+    task->id = (uint64_t)checkin_get32(buf) << 32 | checkin_get32(buf + 4);
+    task->len = checkin_get32(buf + 8);
+    if (task->len > n - *off - CHECKIN_TASK_HEADER) {
+        DBG("truncated task data");
+        return -1;
+    }
+    task->data = buf + CHECKIN_TASK_HEADER;
+    *off += CHECKIN_TASK_HEADER + task->len;
+
+    return 1;
+}
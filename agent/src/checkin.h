@@ -0,0 +1,56 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _CHECKIN_H
+#define _CHECKIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "net.h"
+
+/* Default number of seconds the cc may hold a check-in open */
+#define CHECKIN_HOLD 30
+/* Upper limit accepted by the cc HTTP listener */
+#define CHECKIN_HOLD_MAX 120
+
+/* COUNT of a busy frame, followed by the 32-bit retry-after in seconds */
+#define CHECKIN_BUSY 0xffffffffUL
+#define CHECKIN_BUSY_SIZE 8
+
+/* Headers of a task frame and of each of its tasks */
+#define CHECKIN_FRAME_HEADER 4
+#define CHECKIN_TASK_HEADER 12
+
+/* A task of a frame, data points into the frame */
+struct checkin_task {
+    uint64_t id;
+    const char *data;
+    size_t len;
+};
+
+/*
+ * Long-poll the cc HTTP listener over the connected ctx. The request is held
+ * by the cc for up to hold seconds until work is queued for the agent, a hold
+ * of 0 performs a plain check-in. Returns the body length copied to buf, 0 if
+ * the hold expired without work, -1 on error. When the cc defers the agent
+ * buf holds a busy frame, see checkin_retry_after.
+ */
+int checkin_poll(net_context *ctx, const char *host, const char *id, int hold,
+                 char *buf, size_t size);
+
+/*
+ * Returns the seconds to wait before the next check-in if the task frame
+ * of len bytes in buf is a busy frame sent by an overloaded cc, 0 otherwise.
+ * The value can be returned as is by a sched_job.
+ */
+int checkin_retry_after(const char *buf, int len);
+
+/*
+ * Walk the tasks of the frame of len bytes in buf, *off is 0 on the first
+ * call. Returns 1 with the next task, 0 after the last one, -1 if the frame
+ * is malformed or a busy frame.
+ */
+int checkin_next_task(const char *buf, int len, size_t *off,
+                      struct checkin_task *task);
+
+#endif /* checkin.h */
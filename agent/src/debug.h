@@ -3,40 +3,33 @@
 #ifndef _DEBUG_H
 #define _DEBUG_H
 
+#include <errno.h>
+#include <string.h>
+
+#include "trace.h"
+
 #ifndef NDEBUG
 #include <assert.h>
-#include <stdio.h>
-
-#include "config.h"
-#include "util.h"
 #endif /* NDEBUG */
 
-#ifdef NDEBUG
+/* Category of the DBG events of a source file, defined before this header */
+#ifndef TRACE_CATEGORY
+#define TRACE_CATEGORY TRACE_GENERAL
+#endif /* TRACE_CATEGORY */
 
+#ifdef NDEBUG
 #define ASSERT(expr)
-#define DBG(str)
-#define DBGF(fmt, ...)
-#define DBGERR(str)
-
 #else /* No define NDEBUG */
-
 #define ASSERT(expr) assert(expr)
-
-#define DBG(str)                                                               \
-    fprintf(stdout, "\033[1;90m[%s:%d] \033[0m" str "\n", xbasename(__FILE__), \
-            __LINE__);
-
-#define DBGF(fmt, ...)                                                         \
-    fprintf(stdout, "\033[1;90m[%s:%d] \033[0m" fmt "\n", xbasename(__FILE__), \
-            __LINE__, __VA_ARGS__);
-
-#define DBGERR(str)                                                       \
-    do {                                                                  \
-        fprintf(stderr, "\033[1;90m[%s:%d] \033[0m", xbasename(__FILE__), \
-                __LINE__);                                                \
-        perror(str);                                                      \
-    } while (0)
-
 #endif /* NDEBUG */
 
+/*
+ * Trace events of the file's category. DBG and DBGF are debug events,
+ * compiled out of release builds, DBGERR records errors in every build.
+ */
+#define DBG(str) TRACE(TRACE_DEBUG, TRACE_CATEGORY, "%s", str)
+#define DBGF(fmt, ...) TRACE(TRACE_DEBUG, TRACE_CATEGORY, fmt, __VA_ARGS__)
+#define DBGERR(str) \
+    TRACE(TRACE_ERROR, TRACE_CATEGORY, "%s: %s", str, strerror(errno))
+
 #endif /* debug.h */
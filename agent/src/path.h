@@ -0,0 +1,117 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _PATH_H
+#define _PATH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "net.h"
+#include "pool.h"
+#include "proxy.h"
+#include "socks.h"
+
+/* Transports, matching the cc listener protocols */
+#define PATH_TCP 0
+#define PATH_UDP 1
+#define PATH_HTTP 2
+#define PATH_DNS 3
+
+/* Routes to the cc, only TCP based transports go through proxies */
+#define PATH_DIRECT 0
+#define PATH_HTTP_PROXY 1
+#define PATH_SOCKS5 2
+
+/* Paths a table holds, the -c options and their proxied routes */
+#define PATH_TABLE_SIZE 16
+
+/* Longest a probe may take, in seconds */
+#define PATH_PROBE_TIMEOUT 5
+/* Seconds between two races of the whole table */
+#define PATH_REPROBE_INTERVAL (15 * 60)
+
+/*
+ * Largest task frame of a check-in, MaxFrameSize of the cc: one task of the
+ * largest size, the tasks left over come with the next check-in.
+ */
+#define PATH_FRAME_SIZE (4 + 12 + (1 << 20))
+
+/*
+ * Receives the task frames of the probes: a probe is a check-in like any
+ * other, the tasks it took off the cc queue are not to be dropped.
+ */
+typedef void (*path_handler)(const char *frame, int len, void *arg);
+
+struct path {
+    int transport;
+    int route;
+    char host[256];
+    uint16_t port;
+    int rtt;            /* smoothed check-in round trip in ms, -1 unknown */
+    unsigned long rate; /* smoothed bytes per second of frames received */
+    int failures;       /* consecutive failures */
+};
+
+/*
+ * Table of the ways to reach the cc, ranked best first: paths that work
+ * before failing ones, then by round trip time.
+ */
+typedef struct {
+    struct path paths[PATH_TABLE_SIZE];
+    int count;
+    const char *id; /* agent id sent on check-ins */
+    int hold;       /* seconds the cc may hold HTTP check-ins */
+    struct http_proxy *proxy;
+    struct socks5_client *socks5;
+    path_handler handler;
+    void *arg;
+    struct pool *pool; /* runs the probes of the races */
+} path_table;
+
+void path_init(path_table *table, const char *id);
+int path_add(path_table *table, int transport, int route, const char *host,
+             uint16_t port);
+void path_set_proxy(path_table *table, struct http_proxy *proxy);
+void path_set_socks5(path_table *table, struct socks5_client *socks5);
+void path_set_handler(path_table *table, path_handler handler, void *arg);
+void path_set_pool(path_table *table, struct pool *pool);
+
+/*
+ * Long-poll HTTP check-ins for up to hold seconds, see checkin_poll. Probes
+ * never wait, and held check-ins are not folded into the round trip.
+ */
+void path_set_hold(path_table *table, int hold);
+
+/*
+ * Probe every path at once with a check-in on the pool of the table and rank
+ * the table. Once the first path answers, the others get no more than a few
+ * times its round trip, so a dead path costs little; probes still running
+ * then count as failed. The race runs the pool completions while it waits,
+ * it is called from the thread running them. The frames received are passed
+ * to the handler of the table, those of late probes too. Returns the number
+ * of working paths.
+ */
+int path_race(path_table *table);
+
+/* Best path, NULL if the table is empty */
+struct path *path_best(path_table *table);
+
+/*
+ * Check in over path p: buf receives the task frame, see checkin_poll, and
+ * should hold PATH_FRAME_SIZE bytes. The
+ * round trip and transfer rate are folded into the path's estimates, and a
+ * failure demotes it below the working paths. Returns the frame length or
+ * -1 on error.
+ */
+int path_checkin(path_table *table, struct path *p, char *buf, size_t size);
+
+/*
+ * Check in over the best path, falling back to the next ones on failure.
+ * Returns the frame length, -1 if every path failed.
+ */
+int path_checkin_best(path_table *table, char *buf, size_t size);
+
+/* sched_job racing the table, to run every PATH_REPROBE_INTERVAL */
+int path_job(void *arg);
+
+#endif /* path.h */
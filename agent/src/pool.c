@@ -0,0 +1,496 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif /* _WIN32 */
+
+#include "pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else /* No define _WIN32 */
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_CATEGORY TRACE_SCHED
+#include "debug.h"
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION pool_mutex;
+typedef CONDITION_VARIABLE pool_cond;
+typedef HANDLE pool_thread;
+#else  /* No define _WIN32 */
+typedef pthread_mutex_t pool_mutex;
+typedef pthread_cond_t pool_cond;
+typedef pthread_t pool_thread;
+#endif /* _WIN32 */
+
+/* Deque of a worker, the owner works at the tail and thieves at the head */
+struct pool_worker {
+    pool_mutex lock;
+    pool_task *head;
+    pool_task *tail;
+    pool_thread thread;
+    int index;
+    struct pool *pool;
+};
+
+struct pool {
+    struct pool_worker workers[POOL_MAX_WORKERS];
+    int count;
+    int started;
+    int next; /* worker of the next task submitted from outside */
+    pool_mutex lock;
+    pool_cond work; /* signaled when tasks are queued or on stop */
+    pool_cond done; /* signaled when a task completes */
+    int queued;     /* tasks of the deques no worker claimed yet */
+    int stop;
+    pool_task *done_head; /* completed tasks, oldest first */
+    pool_task *done_tail;
+#ifdef _WIN32
+    DWORD key;
+#else  /* No define _WIN32 */
+    pthread_key_t key; /* struct pool_worker of the calling thread */
+#endif /* _WIN32 */
+};
+
+static void pool_lock(pool_mutex *mutex);
+static void pool_unlock(pool_mutex *mutex);
+static void pool_signal(pool_cond *cond, int all);
+static int pool_cond_wait(pool_cond *cond, pool_mutex *mutex, int ms);
+static struct pool_worker *pool_self(struct pool *pool);
+static void pool_push(struct pool_worker *worker, pool_task *task, int head);
+static pool_task *pool_pop(struct pool_worker *worker);
+static pool_task *pool_steal(struct pool_worker *worker);
+static pool_task *pool_take(struct pool_worker *worker);
+static void pool_finish(struct pool *pool, pool_task *task);
+static void pool_loop(struct pool_worker *worker);
+
+int pool_cores(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else  /* No define _WIN32 */
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+#endif /* _WIN32 */
+}
+
+static void pool_lock(pool_mutex *mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else  /* No define _WIN32 */
+    pthread_mutex_lock(mutex);
+#endif /* _WIN32 */
+}
+
+static void pool_unlock(pool_mutex *mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else  /* No define _WIN32 */
+    pthread_mutex_unlock(mutex);
+#endif /* _WIN32 */
+}
+
+static void pool_signal(pool_cond *cond, int all) {
+#ifdef _WIN32
+    if (all) {
+        WakeAllConditionVariable(cond);
+    } else {
+        WakeConditionVariable(cond);
+    }
+#else  /* No define _WIN32 */
+    if (all) {
+        pthread_cond_broadcast(cond);
+    } else {
+        pthread_cond_signal(cond);
+    }
+#endif /* _WIN32 */
+}
+
+/* Wait on cond for up to ms milliseconds, -1 for ever. Returns 0 on timeout */
+static int pool_cond_wait(pool_cond *cond, pool_mutex *mutex, int ms) {
+#ifdef _WIN32
+    return SleepConditionVariableCS(cond, mutex,
+                                    ms < 0 ? INFINITE : (DWORD)ms) ||
+           GetLastError() != ERROR_TIMEOUT;
+#else  /* No define _WIN32 */
+    struct timespec ts;
+
+    if (ms < 0) {
+        return pthread_cond_wait(cond, mutex) == 0;
+    }
+
+    /* the condition variables are on the monotonic clock, see pool_new */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, mutex, &ts) == 0;
+#endif /* _WIN32 */
+}
+
+static struct pool_worker *pool_self(struct pool *pool) {
+#ifdef _WIN32
+    return TlsGetValue(pool->key);
+#else  /* No define _WIN32 */
+    return pthread_getspecific(pool->key);
+#endif /* _WIN32 */
+}
+
+/*
+ * A worker's own tasks go at the tail, where it works. Tasks from outside go
+ * at the head: the owner reaches them in submission order.
+ */
+static void pool_push(struct pool_worker *worker, pool_task *task, int head) {
+    pool_lock(&worker->lock);
+    if (head) {
+        task->prev = NULL;
+        task->next = worker->head;
+        if (worker->head) {
+            worker->head->prev = task;
+        } else {
+            worker->tail = task;
+        }
+        worker->head = task;
+    } else {
+        task->next = NULL;
+        task->prev = worker->tail;
+        if (worker->tail) {
+            worker->tail->next = task;
+        } else {
+            worker->head = task;
+        }
+        worker->tail = task;
+    }
+    pool_unlock(&worker->lock);
+}
+
+/* Newest task of the worker's own deque, its data is likely still cached */
+static pool_task *pool_pop(struct pool_worker *worker) {
+    pool_task *task;
+
+    pool_lock(&worker->lock);
+    task = worker->tail;
+    if (task) {
+        worker->tail = task->prev;
+        if (worker->tail) {
+            worker->tail->next = NULL;
+        } else {
+            worker->head = NULL;
+        }
+    }
+    pool_unlock(&worker->lock);
+
+    return task;
+}
+
+/* Oldest task of a victim's deque, the one its owner would run last */
+static pool_task *pool_steal(struct pool_worker *worker) {
+    pool_task *task;
+
+    pool_lock(&worker->lock);
+    task = worker->head;
+    if (task) {
+        worker->head = task->next;
+        if (worker->head) {
+            worker->head->prev = NULL;
+        } else {
+            worker->tail = NULL;
+        }
+    }
+    pool_unlock(&worker->lock);
+
+    return task;
+}
+
+/* Own work first, then steal from the other workers in turn */
+static pool_task *pool_take(struct pool_worker *worker) {
+    struct pool *pool = worker->pool;
+    pool_task *task;
+    int i;
+
+    task = pool_pop(worker);
+    for (i = 1; !task && i < pool->count; i++) {
+        task = pool_steal(&pool->workers[(worker->index + i) % pool->count]);
+    }
+
+    return task;
+}
+
+static void pool_finish(struct pool *pool, pool_task *task) {
+    task->next = NULL;
+
+    pool_lock(&pool->lock);
+    if (pool->done_tail) {
+        pool->done_tail->next = task;
+    } else {
+        pool->done_head = task;
+    }
+    pool->done_tail = task;
+    pool_signal(&pool->done, 1);
+    pool_unlock(&pool->lock);
+}
+
+static void pool_loop(struct pool_worker *worker) {
+    struct pool *pool = worker->pool;
+    pool_task *task;
+
+#ifdef _WIN32
+    TlsSetValue(pool->key, worker);
+#else  /* No define _WIN32 */
+    pthread_setspecific(pool->key, worker);
+#endif /* _WIN32 */
+
+    for (;;) {
+        pool_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop) {
+            pool_cond_wait(&pool->work, &pool->lock, -1);
+        }
+        if (pool->queued == 0) {
+            pool_unlock(&pool->lock);
+            break;
+        }
+        /* claim a task: it was pushed before it was counted */
+        pool->queued--;
+        pool_unlock(&pool->lock);
+
+        /*
+         * Every claim is backed by a queued task, a miss only means another
+         * claimer took the task this one was about to reach.
+         */
+        do {
+            task = pool_take(worker);
+        } while (!task);
+
+        task->work(task->arg);
+        pool_finish(pool, task);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_thread_main(LPVOID arg) {
+    pool_loop(arg);
+    return 0;
+}
+#else  /* No define _WIN32 */
+static void *pool_thread_main(void *arg) {
+    pool_loop(arg);
+    return NULL;
+}
+#endif /* _WIN32 */
+
+struct pool *pool_new(int workers) {
+    struct pool *pool;
+    int i;
+#ifndef _WIN32
+    pthread_condattr_t attr;
+#endif /* _WIN32 */
+
+    if (workers <= 0) {
+        workers = pool_cores();
+    }
+    if (workers > POOL_MAX_WORKERS) {
+        workers = POOL_MAX_WORKERS;
+    }
+
+    pool = calloc(1, sizeof(struct pool));
+    if (!pool) {
+        DBGERR("calloc");
+        return NULL;
+    }
+
+    pool->count = workers;
+
+#ifdef _WIN32
+    pool->key = TlsAlloc();
+    if (pool->key == TLS_OUT_OF_INDEXES) {
+        DBG("TlsAlloc error");
+        free(pool);
+        return NULL;
+    }
+    InitializeCriticalSection(&pool->lock);
+    InitializeConditionVariable(&pool->work);
+    InitializeConditionVariable(&pool->done);
+#else  /* No define _WIN32 */
+    if (pthread_key_create(&pool->key, NULL) != 0) {
+        DBG("pthread_key_create error");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->work, &attr);
+    pthread_cond_init(&pool->done, &attr);
+    pthread_condattr_destroy(&attr);
+#endif /* _WIN32 */
+
+    for (i = 0; i < workers; i++) {
+        pool->workers[i].index = i;
+        pool->workers[i].pool = pool;
+#ifdef _WIN32
+        InitializeCriticalSection(&pool->workers[i].lock);
+#else  /* No define _WIN32 */
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+#endif /* _WIN32 */
+    }
+
+    for (i = 0; i < workers; i++) {
+#ifdef _WIN32
+        pool->workers[i].thread =
+            CreateThread(NULL, 0, pool_thread_main, &pool->workers[i], 0, NULL);
+        if (!pool->workers[i].thread) {
+            DBG("CreateThread error");
+            goto err;
+        }
+#else  /* No define _WIN32 */
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_thread_main,
+                           &pool->workers[i]) != 0) {
+            DBG("pthread_create error");
+            goto err;
+        }
+#endif /* _WIN32 */
+        pool->started++;
+    }
+
+    DBGF("pool of %d workers", workers);
+    return pool;
+
+err:
+    pool_free(pool);
+    return NULL;
+}
+
+void pool_submit(struct pool *pool, pool_task *task, pool_work work,
+                 pool_done done, void *arg) {
+    struct pool_worker *worker;
+
+    ASSERT(pool);
+    ASSERT(task);
+    ASSERT(work);
+
+    task->work = work;
+    task->done = done;
+    task->arg = arg;
+
+    worker = pool_self(pool);
+    if (worker) {
+        pool_push(worker, task, 0);
+    } else {
+        pool_lock(&pool->lock);
+        worker = &pool->workers[pool->next];
+        pool->next = (pool->next + 1) % pool->started;
+        pool_unlock(&pool->lock);
+        pool_push(worker, task, 1);
+    }
+
+    pool_lock(&pool->lock);
+    pool->queued++;
+    pool_signal(&pool->work, 0);
+    pool_unlock(&pool->lock);
+}
+
+int pool_wait(struct pool *pool, int ms) {
+    pool_task *task;
+    int n = 0;
+
+    ASSERT(pool);
+
+    pool_lock(&pool->lock);
+    if (!pool->done_head && ms != 0) {
+        /* a spurious wakeup ends the wait early, the event loop comes back */
+        pool_cond_wait(&pool->done, &pool->lock, ms);
+    }
+    for (task = pool->done_head; task; task = task->next) {
+        n++;
+    }
+    pool_unlock(&pool->lock);
+
+    return n;
+}
+
+int pool_complete(struct pool *pool) {
+    pool_task *task, *next;
+    int n = 0;
+
+    ASSERT(pool);
+
+    pool_lock(&pool->lock);
+    task = pool->done_head;
+    pool->done_head = NULL;
+    pool->done_tail = NULL;
+    pool_unlock(&pool->lock);
+
+    for (; task; task = next) {
+        /* the callback may free or resubmit the task */
+        next = task->next;
+        if (task->done) {
+            task->done(task->arg);
+        }
+        n++;
+    }
+
+    return n;
+}
+
+int pool_size(struct pool *pool) {
+    ASSERT(pool);
+    return pool->count;
+}
+
+void pool_free(struct pool *pool) {
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    /* the workers drain the deques before they see stop */
+    pool_lock(&pool->lock);
+    pool->stop = 1;
+    pool_signal(&pool->work, 1);
+    pool_unlock(&pool->lock);
+
+    for (i = 0; i < pool->started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->workers[i].thread, INFINITE);
+        CloseHandle(pool->workers[i].thread);
+#else  /* No define _WIN32 */
+        pthread_join(pool->workers[i].thread, NULL);
+#endif /* _WIN32 */
+    }
+
+    pool_complete(pool);
+
+    for (i = 0; i < pool->count; i++) {
+#ifdef _WIN32
+        DeleteCriticalSection(&pool->workers[i].lock);
+#else  /* No define _WIN32 */
+        pthread_mutex_destroy(&pool->workers[i].lock);
+#endif /* _WIN32 */
+    }
+
+#ifdef _WIN32
+    DeleteCriticalSection(&pool->lock);
+    TlsFree(pool->key);
+#else  /* No define _WIN32 */
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_key_delete(pool->key);
+#endif /* _WIN32 */
+
+    free(pool);
+}
@@ -0,0 +1,70 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+/* Upper limit of worker threads, whatever the number of cores */
+#define POOL_MAX_WORKERS 16
+
+/* Runs on a worker thread */
+typedef void (*pool_work)(void *arg);
+/* Runs on the thread collecting completions with pool_complete */
+typedef void (*pool_done)(void *arg);
+
+/*
+ * A unit of work, owned by the caller until its completion has run. The
+ * task must not be touched between pool_submit and its done callback.
+ */
+typedef struct pool_task {
+    pool_work work;
+    pool_done done;
+    void *arg;
+    struct pool_task *prev;
+    struct pool_task *next;
+} pool_task;
+
+struct pool;
+
+/*
+ * Start a pool of workers threads, one per core when workers <= 0, at most
+ * POOL_MAX_WORKERS. Returns NULL on error.
+ */
+struct pool *pool_new(int workers);
+
+/*
+ * Queue task to run work(arg) on a worker, then done(arg) on the event
+ * loop. Each worker keeps its own deque: a worker runs its newest task
+ * first and an idle worker steals the oldest task of another one, so
+ * tasks submitted from a worker stay on it while they are cheap and
+ * spread when it is busy. Tasks submitted from elsewhere are dealt round
+ * robin, a worker runs those in submission order. done may be NULL.
+ */
+void pool_submit(struct pool *pool, pool_task *task, pool_work work,
+                 pool_done done, void *arg);
+
+/*
+ * Wait up to ms milliseconds, -1 for ever, for a completed task. The event
+ * loop waits here instead of sleeping, with the delay given by sched_next.
+ * Returns the number of completions ready.
+ */
+int pool_wait(struct pool *pool, int ms);
+
+/*
+ * Run the done callbacks of the completed tasks on the calling thread, in
+ * completion order. Returns the number of callbacks run.
+ */
+int pool_complete(struct pool *pool);
+
+/* Number of workers */
+int pool_size(struct pool *pool);
+
+/* Number of cores online, the default number of workers */
+int pool_cores(void);
+
+/*
+ * Wait for every submitted task, run the pending completions and stop the
+ * workers.
+ */
+void pool_free(struct pool *pool);
+
+#endif /* pool.h */
@@ -8,6 +8,7 @@
 
 #include <mbedtls/base64.h>
 
+#define TRACE_CATEGORY TRACE_PROXY
 #include "debug.h"
 
 struct http_proxy {
@@ -58,6 +59,7 @@ int http_proxy_connect(struct http_proxy *proxy, net_context *ctx,
                        const char *host, uint16_t port) {
     unsigned char base64[512] = {0}, str[256] = {0};
     char buf[1024] = {0};
+    uint64_t start = 0;
     int ret;
     size_t olen, len = 0;
 
@@ -104,7 +106,7 @@ int http_proxy_connect(struct http_proxy *proxy, net_context *ctx,
 
     net_init(ctx);
 
-    DBGF("%s:%hd", proxy->host, proxy->port);
+    DBGF("%s:%hu", proxy->host, proxy->port);
 
     ret = net_connect(ctx, proxy->host, proxy->port, NET_TCP);
     if (ret != 0) {
@@ -112,16 +114,28 @@ int http_proxy_connect(struct http_proxy *proxy, net_context *ctx,
         goto err;
     }
 
+    start = trace_clock();
+
     ret = net_send(ctx, (unsigned char *)buf, len);
     if (ret <= 0) {
         DBG("net_send error");
         goto err;
     }
 
-    ret = net_recv(ctx, (unsigned char *)buf, sizeof(buf));
-    if (ret <= 0) {
-        DBG("net_recv error");
-        goto err;
+    /* The response may come in pieces, read up to the end of its header */
+    len = 0;
+    memset(buf, 0, sizeof(buf));
+    while (!strstr(buf, "\r\n\r\n")) {
+        if (len == sizeof(buf) - 1) {
+            DBG("response header too long");
+            goto err;
+        }
+        ret = net_recv(ctx, (unsigned char *)buf + len, sizeof(buf) - 1 - len);
+        if (ret <= 0) {
+            DBG("net_recv error");
+            goto err;
+        }
+        len += ret;
     }
 
     if (!strstr(buf, " 200 Connection established\r\n")) {
@@ -129,9 +143,16 @@ int http_proxy_connect(struct http_proxy *proxy, net_context *ctx,
         goto err;
     }
 
+    trace_latency(TRACE_STAT_PROXY, start, 1);
+    TRACE(TRACE_INFO, TRACE_PROXY, "http proxy CONNECT %s:%hu in %lluus", host,
+          port, (unsigned long long)(trace_clock() - start));
+
     return 0;
 
 err:
+    if (start) {
+        trace_latency(TRACE_STAT_PROXY, start, 0);
+    }
     net_free(ctx);
     return -1;
 }
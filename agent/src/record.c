@@ -0,0 +1,240 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "record.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_AESNI_C) && defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#define RECORD_AESNI
+#endif /* MBEDTLS_AESNI_C */
+
+#define TRACE_CATEGORY TRACE_TLS
+#include "debug.h"
+
+#define RECORD_NONCE_SIZE (RECORD_SALT_SIZE + 8)
+
+static void record_put32(unsigned char *p, uint32_t v);
+static void record_put64(unsigned char *p, uint64_t v);
+static uint32_t record_get32(const unsigned char *p);
+static uint64_t record_get64(const unsigned char *p);
+static void record_nonce(record_context *ctx, unsigned char *nonce);
+static int record_encrypt(record_context *ctx, record_buffer *rb,
+                          const unsigned char *input, size_t len);
+
+int record_init(record_context *ctx, const unsigned char *key,
+                const unsigned char *salt) {
+    ASSERT(ctx);
+    ASSERT(key);
+    ASSERT(salt);
+
+    mbedtls_gcm_init(&ctx->gcm);
+    if (mbedtls_gcm_setkey(&ctx->gcm, MBEDTLS_CIPHER_ID_AES, key,
+                           RECORD_KEY_SIZE * 8) != 0) {
+        DBG("mbedtls_gcm_setkey error");
+        mbedtls_gcm_free(&ctx->gcm);
+        return -1;
+    }
+
+    memcpy(ctx->salt, salt, RECORD_SALT_SIZE);
+    ctx->seq = 0;
+
+    TRACE(TRACE_INFO, TRACE_TLS, "records sealed with %s AES-GCM",
+          record_accelerated() ? "AES-NI" : "portable");
+
+    return 0;
+}
+
+void record_free(record_context *ctx) {
+    ASSERT(ctx);
+    mbedtls_gcm_free(&ctx->gcm);
+}
+
+void record_buffer_init(record_buffer *rb, void *buf, size_t size) {
+    ASSERT(rb);
+    ASSERT(buf);
+
+    rb->buf = (unsigned char *)buf;
+    rb->size = size;
+    rb->len = 0;
+}
+
+unsigned char *record_reserve(record_buffer *rb, size_t len) {
+    ASSERT(rb);
+
+    if (len > RECORD_MAX_PAYLOAD ||
+        rb->size - rb->len < len + RECORD_OVERHEAD) {
+        return NULL;
+    }
+
+    return rb->buf + rb->len + RECORD_HEADER_SIZE;
+}
+
+int record_seal(record_context *ctx, record_buffer *rb, size_t len) {
+    ASSERT(ctx);
+    ASSERT(rb);
+    ASSERT(len <= RECORD_MAX_PAYLOAD);
+    ASSERT(rb->size - rb->len >= len + RECORD_OVERHEAD);
+
+    /* GCM encrypts in place when input and output are the same */
+    return record_encrypt(ctx, rb, rb->buf + rb->len + RECORD_HEADER_SIZE,
+                          len);
+}
+
+int record_append(record_context *ctx, record_buffer *rb, const void *data,
+                  size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t records, n;
+
+    ASSERT(ctx);
+    ASSERT(rb);
+    ASSERT(data || !len);
+
+    records = len ? (len + RECORD_MAX_PAYLOAD - 1) / RECORD_MAX_PAYLOAD : 1;
+    if (rb->size - rb->len < len + records * RECORD_OVERHEAD) {
+        DBG("send buffer full");
+        return -1;
+    }
+
+    do {
+        n = len < RECORD_MAX_PAYLOAD ? len : RECORD_MAX_PAYLOAD;
+        if (record_encrypt(ctx, rb, p, n) == -1) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    } while (len);
+
+    return 0;
+}
+
+int record_flush(record_buffer *rb, net_context *net) {
+    size_t sent = 0;
+    int ret;
+
+    ASSERT(rb);
+    ASSERT(net);
+
+    while (sent < rb->len) {
+        ret = net_send(net, rb->buf + sent, rb->len - sent);
+        if (ret <= 0) {
+            DBG("net_send error");
+            return -1;
+        }
+        sent += ret;
+    }
+
+    rb->len = 0;
+    return 0;
+}
+
+int record_open(record_context *ctx, unsigned char *buf, size_t len,
+                unsigned char **payload, size_t *payload_len) {
+    unsigned char nonce[RECORD_NONCE_SIZE];
+    uint32_t n;
+
+    ASSERT(ctx);
+    ASSERT(buf);
+    ASSERT(payload);
+    ASSERT(payload_len);
+
+    if (len < RECORD_HEADER_SIZE) {
+        return 0;
+    }
+
+    n = record_get32(buf);
+    if (n > RECORD_MAX_PAYLOAD) {
+        DBGF("record too large: %lu", (unsigned long)n);
+        return -1;
+    }
+    if (len < n + RECORD_OVERHEAD) {
+        return 0;
+    }
+    if (record_get64(buf + 4) != ctx->seq) {
+        DBG("record out of order");
+        return -1;
+    }
+
+    record_nonce(ctx, nonce);
+
+    if (mbedtls_gcm_auth_decrypt(&ctx->gcm, n, nonce, sizeof(nonce), buf,
+                                 RECORD_HEADER_SIZE,
+                                 buf + RECORD_HEADER_SIZE + n, RECORD_TAG_SIZE,
+                                 buf + RECORD_HEADER_SIZE,
+                                 buf + RECORD_HEADER_SIZE) != 0) {
+        DBG("record does not authenticate");
+        return -1;
+    }
+
+    ctx->seq++;
+    *payload = buf + RECORD_HEADER_SIZE;
+    *payload_len = n;
+    return (int)(n + RECORD_OVERHEAD);
+}
+
+int record_accelerated(void) {
+#ifdef RECORD_AESNI
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ecx & bit_AES) && (ecx & bit_PCLMUL);
+#else  /* No define RECORD_AESNI */
+    return 0;
+#endif /* RECORD_AESNI */
+}
+
+/*
+ * Seal the next record at the end of the send buffer, its payload encrypted
+ * from input in the same pass: no plaintext copy is made in the buffer.
+ */
+static int record_encrypt(record_context *ctx, record_buffer *rb,
+                          const unsigned char *input, size_t len) {
+    unsigned char nonce[RECORD_NONCE_SIZE], *hdr, *payload;
+
+    hdr = rb->buf + rb->len;
+    payload = hdr + RECORD_HEADER_SIZE;
+
+    record_put32(hdr, (uint32_t)len);
+    record_put64(hdr + 4, ctx->seq);
+    record_nonce(ctx, nonce);
+
+    if (mbedtls_gcm_crypt_and_tag(&ctx->gcm, MBEDTLS_GCM_ENCRYPT, len, nonce,
+                                  sizeof(nonce), hdr, RECORD_HEADER_SIZE,
+                                  input, payload, RECORD_TAG_SIZE,
+                                  payload + len) != 0) {
+        DBG("mbedtls_gcm_crypt_and_tag error");
+        return -1;
+    }
+
+    ctx->seq++;
+    rb->len += len + RECORD_OVERHEAD;
+    return 0;
+}
+
+static void record_nonce(record_context *ctx, unsigned char *nonce) {
+    memcpy(nonce, ctx->salt, RECORD_SALT_SIZE);
+    record_put64(nonce + RECORD_SALT_SIZE, ctx->seq);
+}
+
+static void record_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void record_put64(unsigned char *p, uint64_t v) {
+    record_put32(p, (uint32_t)(v >> 32));
+    record_put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t record_get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           (uint32_t)p[3];
+}
+
+static uint64_t record_get64(const unsigned char *p) {
+    return (uint64_t)record_get32(p) << 32 | record_get32(p + 4);
+}
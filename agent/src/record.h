@@ -0,0 +1,91 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mbedtls/gcm.h>
+
+#include "net.h"
+
+/*
+ * Agent payloads are sealed in records with AES-256-GCM, big-endian:
+ *
+ * +--------+-----+------------+-----+
+ * | LENGTH | SEQ | CIPHERTEXT | TAG |
+ * +--------+-----+------------+-----+
+ * |   4    |  8  |   LENGTH   | 16  |
+ * +--------+-----+------------+-----+
+ *
+ * The header is authenticated with the payload. The nonce is the salt
+ * followed by SEQ, which counts the records of a sender from 0: a key and
+ * salt pair belongs to one sender.
+ */
+#define RECORD_KEY_SIZE 32
+#define RECORD_SALT_SIZE 4
+#define RECORD_HEADER_SIZE 12
+#define RECORD_TAG_SIZE 16
+#define RECORD_OVERHEAD (RECORD_HEADER_SIZE + RECORD_TAG_SIZE)
+/* Largest payload of a record, record_append splits larger ones */
+#define RECORD_MAX_PAYLOAD (16 * 1024)
+
+typedef struct {
+    mbedtls_gcm_context gcm;
+    unsigned char salt[RECORD_SALT_SIZE];
+    uint64_t seq; /* of the next record sealed or opened */
+} record_context;
+
+/*
+ * Records are sealed straight into the send buffer and batched there, a
+ * record_flush sends them all at once.
+ */
+typedef struct {
+    unsigned char *buf;
+    size_t size;
+    size_t len; /* bytes of sealed records */
+} record_buffer;
+
+int record_init(record_context *ctx, const unsigned char *key,
+                const unsigned char *salt);
+void record_free(record_context *ctx);
+
+void record_buffer_init(record_buffer *rb, void *buf, size_t size);
+
+/*
+ * Room for the next record's payload of len bytes in the send buffer. The
+ * caller writes the plaintext there and seals it in place with record_seal,
+ * nothing is copied. NULL if it does not fit.
+ */
+unsigned char *record_reserve(record_buffer *rb, size_t len);
+int record_seal(record_context *ctx, record_buffer *rb, size_t len);
+
+/*
+ * Seal len bytes of data into the send buffer, split in records of at most
+ * RECORD_MAX_PAYLOAD. Each is encrypted from data straight to the buffer,
+ * data must not be in it. Returns -1 and leaves the buffer as is if they do
+ * not all fit.
+ */
+int record_append(record_context *ctx, record_buffer *rb, const void *data,
+                  size_t len);
+
+/* Send the batched records and empty the buffer */
+int record_flush(record_buffer *rb, net_context *net);
+
+/*
+ * Open the record at the start of the len bytes of buf, decrypting it in
+ * place. Returns the bytes of the record, 0 if it is not all there yet, -1
+ * if it is malformed, out of order or does not authenticate, the stream can
+ * not be read any further then. The payload is left in buf, at *payload.
+ */
+int record_open(record_context *ctx, unsigned char *buf, size_t len,
+                unsigned char **payload, size_t *payload_len);
+
+/*
+ * Whether AES and GCM run on AES-NI and PCLMULQDQ: the build has them and
+ * the CPU reports them. mbedtls makes the same check before each use.
+ */
+int record_accelerated(void);
+
+#endif /* record.h */
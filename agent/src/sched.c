@@ -0,0 +1,274 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif /* _WIN32 */
+
+#include "sched.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else /* No define _WIN32 */
+#include <time.h>
+#endif /* _WIN32 */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#define TRACE_CATEGORY TRACE_SCHED
+#include "debug.h"
+
+static void sched_sleep(int ms);
+static int sched_jitter(int ms);
+static void sched_up(sched_context *sched, int i);
+static void sched_down(sched_context *sched, int i);
+static void sched_swap(sched_context *sched, int i, int j);
+static void sched_push(sched_context *sched, sched_timer *timer);
+static void sched_fix(sched_context *sched, sched_timer *timer);
+
+uint64_t sched_now(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else  /* No define _WIN32 */
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif /* _WIN32 */
+}
+
+static void sched_sleep(int ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else  /* No define _WIN32 */
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        /* interrupted, sleep the remaining time */
+    }
+#endif /* _WIN32 */
+}
+
+/* Random number of milliseconds in [0, ms] */
+static int sched_jitter(int ms) {
+    if (ms <= 0) {
+        return 0;
+    }
+    return (int)((double)rand() / RAND_MAX * ms);
+}
+
+int sched_backoff(int failures) {
+    int delay = SCHED_BACKOFF_MIN;
+
+    while (--failures > 0 && delay < SCHED_BACKOFF_MAX) {
+        delay *= 2;
+    }
+    if (delay > SCHED_BACKOFF_MAX) {
+        delay = SCHED_BACKOFF_MAX;
+    }
+
+    return delay / 2 + sched_jitter(delay / 2);
+}
+
+static void sched_swap(sched_context *sched, int i, int j) {
+    sched_timer *timer = sched->heap[i];
+
+    sched->heap[i] = sched->heap[j];
+    sched->heap[j] = timer;
+    sched->heap[i]->index = i;
+    sched->heap[j]->index = j;
+}
+
+static void sched_up(sched_context *sched, int i) {
+    int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (sched->heap[parent]->when <= sched->heap[i]->when) {
+            break;
+        }
+        sched_swap(sched, parent, i);
+        i = parent;
+    }
+}
+
+static void sched_down(sched_context *sched, int i) {
+    int child;
+
+    while (1) {
+        child = 2 * i + 1;
+        if (child >= sched->count) {
+            break;
+        }
+        if (child + 1 < sched->count &&
+            sched->heap[child + 1]->when < sched->heap[child]->when) {
+            child++;
+        }
+        if (sched->heap[i]->when <= sched->heap[child]->when) {
+            break;
+        }
+        sched_swap(sched, i, child);
+        i = child;
+    }
+}
+
+static void sched_push(sched_context *sched, sched_timer *timer) {
+    timer->index = sched->count++;
+    sched->heap[timer->index] = timer;
+    sched_up(sched, timer->index);
+}
+
+/* Restore the heap after the due time of timer changed */
+static void sched_fix(sched_context *sched, sched_timer *timer) {
+    sched_up(sched, timer->index);
+    sched_down(sched, timer->index);
+}
+
+void sched_init(sched_context *sched) {
+    ASSERT(sched);
+    sched->count = 0;
+}
+
+int sched_add(sched_context *sched, sched_timer *timer, int interval,
+              sched_job job, void *arg) {
+    ASSERT(sched);
+    ASSERT(timer);
+    ASSERT(job);
+    ASSERT(interval > 0);
+
+    if (sched->count == SCHED_MAX_TIMERS) {
+        DBG("too many timers");
+        return -1;
+    }
+
+    timer->interval = interval;
+    timer->failures = 0;
+    timer->pending = 0;
+    timer->deferred = 0;
+    timer->job = job;
+    timer->arg = arg;
+    timer->when = sched_now() + (uint64_t)sched_jitter(interval);
+
+    sched_push(sched, timer);
+    return 0;
+}
+
+void sched_remove(sched_context *sched, sched_timer *timer) {
+    int i;
+
+    ASSERT(sched);
+    ASSERT(timer);
+
+    i = timer->index;
+    if (i < 0 || i >= sched->count || sched->heap[i] != timer) {
+        return;
+    }
+
+    sched->count--;
+    if (i != sched->count) {
+        sched_swap(sched, i, sched->count);
+        sched_fix(sched, sched->heap[i]);
+    }
+    timer->index = -1;
+}
+
+void sched_kick(sched_context *sched, sched_timer *timer, int delay) {
+    uint64_t when;
+
+    ASSERT(sched);
+    ASSERT(timer);
+
+    if (timer->pending) {
+        /* coalesced into the run queued before */
+        return;
+    }
+
+    timer->pending = 1;
+    if (timer->failures > 0 || timer->index < 0) {
+        return;
+    }
+
+    when = sched_now() + (uint64_t)(delay > 0 ? delay : 0);
+    if (when < timer->deferred) {
+        when = timer->deferred;
+    }
+    if (when < timer->when) {
+        timer->when = when;
+        sched_fix(sched, timer);
+    }
+}
+
+int sched_next(sched_context *sched) {
+    uint64_t now;
+
+    ASSERT(sched);
+
+    if (sched->count == 0) {
+        return -1;
+    }
+
+    now = sched_now();
+    if (sched->heap[0]->when <= now) {
+        return 0;
+    }
+    return (int)(sched->heap[0]->when - now);
+}
+
+int sched_run(sched_context *sched) {
+    sched_timer *timer;
+    uint64_t now;
+    int next, ret, n = 0;
+
+    ASSERT(sched);
+
+    next = sched_next(sched);
+    if (next == -1) {
+        return -1;
+    }
+    if (next > 0) {
+        sched_sleep(next);
+    }
+
+    now = sched_now();
+    while (sched->count > 0 && sched->heap[0]->when <= now) {
+        timer = sched->heap[0];
+        timer->pending = 0;
+
+        ret = timer->job(timer->arg);
+        n++;
+
+        if (timer->index != 0 || sched->heap[0] != timer) {
+            /* the job removed its timer */
+            continue;
+        }
+
+        now = sched_now();
+        timer->deferred = 0;
+        if (ret == SCHED_DONE) {
+            timer->failures = 0;
+            /* work queued while the job ran is not left for the interval */
+            timer->when = now;
+            if (!timer->pending) {
+                timer->when += (uint64_t)timer->interval;
+            }
+        } else if (ret > 0) {
+            /*
+             * The cc is overloaded: honor its retry-after, spread by up to a
+             * quarter so deferred agents do not come back together.
+             */
+            timer->when = now + (uint64_t)ret * 1000 +
+                          (uint64_t)sched_jitter(ret * 250);
+            timer->deferred = now + (uint64_t)ret * 1000;
+        } else {
+            timer->failures++;
+            timer->when = now + (uint64_t)sched_backoff(timer->failures);
+            DBGF("job failed %d times, retry in %d ms", timer->failures,
+                 (int)(timer->when - now));
+        }
+        sched_down(sched, 0);
+    }
+
+    return n;
+}
@@ -0,0 +1,83 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stdint.h>
+
+/* Maximum number of timers of a scheduler */
+#define SCHED_MAX_TIMERS 32
+
+/* First and largest delay in milliseconds of the failure backoff */
+#define SCHED_BACKOFF_MIN 1000
+#define SCHED_BACKOFF_MAX (15 * 60 * 1000)
+
+/* Return values of a job, a positive value is a retry-after in seconds */
+#define SCHED_DONE 0
+#define SCHED_FAIL -1
+
+/*
+ * A job returns SCHED_DONE to run again after its interval, SCHED_FAIL to be
+ * retried with exponential backoff, or the number of seconds the cc asked it
+ * to wait before trying again.
+ */
+typedef int (*sched_job)(void *arg);
+
+typedef struct {
+    uint64_t when;     /* due time, milliseconds of sched_now */
+    uint64_t deferred; /* retry-after of the cc, no run before it */
+    int interval;      /* milliseconds between runs */
+    int failures;      /* consecutive failures */
+    int pending;       /* work queued with sched_kick awaits a run */
+    int index;         /* position in the heap, -1 when not scheduled */
+    sched_job job;
+    void *arg;
+} sched_timer;
+
+/*
+ * Timers are kept in a binary min-heap on their due time, all jobs share a
+ * single wakeup: sched_run sleeps until the earliest timer only.
+ */
+typedef struct {
+    sched_timer *heap[SCHED_MAX_TIMERS];
+    int count;
+} sched_context;
+
+void sched_init(sched_context *sched);
+
+/*
+ * Schedule job every interval milliseconds. The first run is jittered within
+ * the interval so that agents started together do not check in together.
+ */
+int sched_add(sched_context *sched, sched_timer *timer, int interval,
+              sched_job job, void *arg);
+void sched_remove(sched_context *sched, sched_timer *timer);
+
+/*
+ * Queue work for the timer's job: it runs within delay milliseconds, and
+ * all the work queued meanwhile is coalesced into that single run, later
+ * kicks do not move it. Work queued while the job runs gets a run of its
+ * own right after. A timer backing off after failures is not brought
+ * forward, nor before the end of a retry-after of the cc.
+ */
+void sched_kick(sched_context *sched, sched_timer *timer, int delay);
+
+/* Milliseconds until the earliest timer is due, -1 if there is none */
+int sched_next(sched_context *sched);
+
+/*
+ * Sleep until the earliest timer is due and run every due job. Returns the
+ * number of jobs run, -1 if there is no timer.
+ */
+int sched_run(sched_context *sched);
+
+/*
+ * Delay of the given failure: exponential from SCHED_BACKOFF_MIN up to
+ * SCHED_BACKOFF_MAX, with half of it randomized ("equal jitter").
+ */
+int sched_backoff(int failures);
+
+/* Monotonic clock in milliseconds */
+uint64_t sched_now(void);
+
+#endif /* sched.h */
@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#define TRACE_CATEGORY TRACE_PROXY
 #include "debug.h"
 
 #define SOCKS5_VERSION 0x05
@@ -55,6 +56,23 @@ struct socks5_client {
     char passwd[256];
 };
 
+/* Handshake replies may come in pieces, read exactly size bytes */
+static int socks5_recv_full(net_context *ctx, unsigned char *buf,
+                            size_t size) {
+    size_t len = 0;
+    int ret;
+
+    while (len < size) {
+        ret = net_recv(ctx, buf + len, size - len);
+        if (ret <= 0) {
+            return -1;
+        }
+        len += ret;
+    }
+
+    return 0;
+}
+
 struct socks5_client *socks5_client_new(const char *host, uint16_t port,
                                         const char *user, const char *passwd) {
     struct socks5_client *client;
@@ -111,8 +129,8 @@ static int socks5_client_negotiate_auth_method(net_context *ctx,
         return -1;
     }
 
-    ret = net_recv(ctx, buf, sizeof(buf));
-    if (ret <= 0) {
+    ret = socks5_recv_full(ctx, buf, 2);
+    if (ret != 0) {
         DBG("net_recv error");
         return -1;
     }
@@ -124,7 +142,6 @@ static int socks5_client_negotiate_auth_method(net_context *ctx,
      * | 1  |   1    |
      * +----+--------+
      */
-    ASSERT(ret >= 2);
 
     /* version */
     if (buf[0] != SOCKS5_VERSION) {
@@ -168,8 +185,8 @@ static int socks5_client_username_password_auth(struct socks5_client *client,
         return -1;
     }
 
-    ret = net_recv(ctx, buf, sizeof(buf));
-    if (ret <= 0) {
+    ret = socks5_recv_full(ctx, buf, 2);
+    if (ret != 0) {
         DBG("net_recv auth response error");
         return -1;
     }
@@ -181,7 +198,6 @@ static int socks5_client_username_password_auth(struct socks5_client *client,
      * | 1  |   1    |
      * +----+--------+
      */
-    ASSERT(ret >= 2);
 
     /* version */
     if (buf[0] != SOCKS5_VERSION) {
@@ -248,13 +264,39 @@ static int socks5_client_request(net_context *sock, uint8_t cmd, uint8_t atyp,
         return -1;
     }
 
-    ret = net_recv(sock, (unsigned char *)buf, sizeof(buf));
-    if (ret <= 0) {
+    /*
+     * +----+-----+-------+------+----------+----------+
+     * |VER | REP |  RSV  | ATYP | BND.ADDR | BND.PORT |
+     * +----+-----+-------+------+----------+----------+
+     * | 1  |  1  | X'00' |  1   | Variable |    2     |
+     * +----+-----+-------+------+----------+----------+
+     */
+    ret = socks5_recv_full(sock, buf, 5);
+    if (ret != 0) {
         DBG("net_recv response error");
         return -1;
     }
 
-    ASSERT(ret >= 2);
+    /* The rest of the bound address, so the tunnel starts clean */
+    switch (buf[3]) {
+    case SOCKS5_IPV4_ADDRESS:
+        len = 4 - 1 + 2;
+        break;
+    case SOCKS5_DOMAINNAME:
+        len = buf[4] + 2;
+        break;
+    case 0x04: /* IPv6 address */
+        len = 16 - 1 + 2;
+        break;
+    default:
+        len = 0;
+        break;
+    }
+
+    if (len && socks5_recv_full(sock, buf + 5, len) != 0) {
+        DBG("net_recv response error");
+        return -1;
+    }
 
     /* version */
     if (buf[0] != SOCKS5_VERSION) {
@@ -268,6 +310,7 @@ static int socks5_client_request(net_context *sock, uint8_t cmd, uint8_t atyp,
 int socks5_client_connect(struct socks5_client *client, net_context *ctx,
                           const char *host, uint16_t port) {
     uint8_t atyp, nmethods, methods[255];
+    uint64_t start = 0;
     int ret;
     char ip[4];
 
@@ -284,6 +327,8 @@ int socks5_client_connect(struct socks5_client *client, net_context *ctx,
         goto err;
     }
 
+    start = trace_clock();
+
     nmethods = 0;
     methods[nmethods++] = SOCKS5_NO_AUTHENTICATION_REQUIRED;
 
@@ -324,9 +369,16 @@ int socks5_client_connect(struct socks5_client *client, net_context *ctx,
         goto err;
     }
 
+    trace_latency(TRACE_STAT_PROXY, start, 1);
+    TRACE(TRACE_INFO, TRACE_PROXY, "socks5 CONNECT %s:%hu in %lluus", host, port,
+          (unsigned long long)(trace_clock() - start));
+
     return 0;
 
 err:
+    if (start) {
+        trace_latency(TRACE_STAT_PROXY, start, 0);
+    }
     net_free(ctx);
     return -1;
 }
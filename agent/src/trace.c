@@ -0,0 +1,317 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _WIN32
+#define _XOPEN_SOURCE 600
+#endif /* _WIN32 */
+
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else /* No define _WIN32 */
+#include <pthread.h>
+#include <time.h>
+#endif /* _WIN32 */
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifdef _MSC_VER
+#define TRACE_THREAD __declspec(thread)
+#define trace_add(p, v) InterlockedExchangeAdd64((volatile LONG64 *)(p), (v))
+#else /* No define _MSC_VER */
+#define TRACE_THREAD __thread
+#define trace_add(p, v) __sync_fetch_and_add((p), (v))
+#endif /* _MSC_VER */
+
+struct trace_record {
+    uint64_t time; /* trace_clock */
+    int thread;
+    int level;
+    int category;
+    const char *file;
+    int line;
+    char msg[TRACE_MSG_SIZE];
+};
+
+/*
+ * Written by its thread only, so recording needs no lock: the slot is
+ * filled first and head published after.
+ */
+struct trace_ring {
+    volatile uint64_t head; /* events recorded */
+    int thread; /* registration order */
+    struct trace_record records[TRACE_RING_SIZE];
+};
+
+static struct trace_ring *rings[TRACE_MAX_THREADS];
+static int ring_count;
+static uint64_t dropped;
+static struct trace_stat stats[TRACE_STATS];
+static volatile sig_atomic_t dump_requested;
+static uint64_t epoch;
+
+static TRACE_THREAD struct trace_ring *ring;
+static TRACE_THREAD int ring_failed;
+
+#ifdef _WIN32
+static SRWLOCK rings_lock = SRWLOCK_INIT;
+#else  /* No define _WIN32 */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif /* _WIN32 */
+
+static const char *const level_names[] = {"", "ERROR", "WARN", "INFO",
+                                          "DEBUG"};
+static const char *const stat_names[] = {"dns", "connect", "proxy", "tls",
+                                         "checkin"};
+
+static struct trace_ring *trace_ring(void);
+static const char *trace_category_name(int category);
+static int trace_compare(const void *a, const void *b);
+static uint64_t trace_percentile(const struct trace_stat *stat, double q);
+#ifndef _WIN32
+static void trace_signal(int sig);
+#endif /* _WIN32 */
+
+uint64_t trace_clock(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart * 1000000 +
+                      now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else  /* No define _WIN32 */
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif /* _WIN32 */
+}
+
+#ifndef _WIN32
+static void trace_signal(int sig) {
+    (void)sig;
+    trace_request_dump();
+}
+#endif /* _WIN32 */
+
+void trace_init(void) {
+#ifndef _WIN32
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+#endif /* _WIN32 */
+    epoch = trace_clock();
+}
+
+/* Ring of the calling thread, registered on its first event */
+static struct trace_ring *trace_ring(void) {
+    if (ring || ring_failed) {
+        return ring;
+    }
+
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&rings_lock);
+#else  /* No define _WIN32 */
+    pthread_mutex_lock(&rings_lock);
+#endif /* _WIN32 */
+
+    if (ring_count < TRACE_MAX_THREADS) {
+        ring = calloc(1, sizeof(struct trace_ring));
+    }
+    if (ring) {
+        ring->thread = ring_count;
+        rings[ring_count++] = ring;
+    } else {
+        ring_failed = 1;
+    }
+
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&rings_lock);
+#else  /* No define _WIN32 */
+    pthread_mutex_unlock(&rings_lock);
+#endif /* _WIN32 */
+
+    return ring;
+}
+
+static const char *trace_category_name(int category) {
+    switch (category) {
+    case TRACE_DNS:
+        return "dns";
+    case TRACE_NET:
+        return "net";
+    case TRACE_PROXY:
+        return "proxy";
+    case TRACE_TLS:
+        return "tls";
+    case TRACE_CHECKIN:
+        return "checkin";
+    case TRACE_SCHED:
+        return "sched";
+    default:
+        return "general";
+    }
+}
+
+void trace_event(int level, int category, const char *file, int line,
+                 const char *fmt, ...) {
+    struct trace_ring *r = trace_ring();
+    struct trace_record *rec;
+    va_list ap;
+
+    if (!r) {
+        trace_add(&dropped, 1);
+        return;
+    }
+
+    rec = &r->records[r->head % TRACE_RING_SIZE];
+    rec->time = trace_clock();
+    rec->thread = r->thread;
+    rec->level = level;
+    rec->category = category;
+    rec->file = file;
+    rec->line = line;
+
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+
+    r->head++;
+
+#ifdef TRACE_ECHO
+    fprintf(level <= TRACE_WARN ? stderr : stdout,
+            "\033[1;90m[%s:%d] \033[0m%s\n", xbasename(file), line, rec->msg);
+#endif /* TRACE_ECHO */
+}
+
+void trace_latency(int stat, uint64_t start, int ok) {
+    struct trace_stat *s = &stats[stat];
+    uint64_t us = trace_clock() - start;
+    int i = 0;
+
+    while (i < TRACE_BUCKETS - 1 && us >> (i + 1)) {
+        i++;
+    }
+
+    trace_add(&s->count, 1);
+    trace_add(&s->total, us);
+    trace_add(&s->buckets[i], 1);
+    if (!ok) {
+        trace_add(&s->errors, 1);
+    }
+}
+
+void trace_get_stat(int stat, struct trace_stat *out) {
+    /* each field is read atomically, the set of them is not */
+    memcpy(out, &stats[stat], sizeof(*out));
+}
+
+/* Upper bound of the bucket holding the q quantile, in microseconds */
+static uint64_t trace_percentile(const struct trace_stat *stat, double q) {
+    uint64_t n = 0, rank = (uint64_t)((double)stat->count * q);
+    int i;
+
+    for (i = 0; i < TRACE_BUCKETS; i++) {
+        n += stat->buckets[i];
+        if (n > rank) {
+            break;
+        }
+    }
+    return (uint64_t)1 << (i + 1);
+}
+
+static int trace_compare(const void *a, const void *b) {
+    const struct trace_record *x = *(struct trace_record *const *)a;
+    const struct trace_record *y = *(struct trace_record *const *)b;
+
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+void trace_dump(FILE *fp) {
+    struct trace_record **all;
+    struct trace_stat s;
+    uint64_t head, i;
+    int n = 0, t, k;
+
+    for (k = 0; k < TRACE_STATS; k++) {
+        trace_get_stat(k, &s);
+        if (s.count == 0) {
+            continue;
+        }
+        fprintf(fp,
+                "stat %s count=%llu errors=%llu avg=%lluus p50<%lluus "
+                "p99<%lluus\n",
+                stat_names[k], (unsigned long long)s.count,
+                (unsigned long long)s.errors,
+                (unsigned long long)(s.total / s.count),
+                (unsigned long long)trace_percentile(&s, 0.5),
+                (unsigned long long)trace_percentile(&s, 0.99));
+    }
+
+    all = malloc(sizeof(*all) * TRACE_MAX_THREADS * TRACE_RING_SIZE);
+    if (!all) {
+        return;
+    }
+
+#ifdef _WIN32
+    AcquireSRWLockShared(&rings_lock);
+#else  /* No define _WIN32 */
+    pthread_mutex_lock(&rings_lock);
+#endif /* _WIN32 */
+
+    for (t = 0; t < ring_count; t++) {
+        head = rings[t]->head;
+        i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (; i < head; i++) {
+            all[n++] = &rings[t]->records[i % TRACE_RING_SIZE];
+        }
+    }
+
+    qsort(all, (size_t)n, sizeof(*all), trace_compare);
+
+    for (k = 0; k < n; k++) {
+        fprintf(fp, "%10.6f t%d %-5s %-7s %s:%d %.*s\n",
+                (double)(all[k]->time - epoch) / 1e6, all[k]->thread,
+                level_names[all[k]->level],
+                trace_category_name(all[k]->category),
+                xbasename(all[k]->file), all[k]->line, TRACE_MSG_SIZE,
+                all[k]->msg);
+    }
+
+#ifdef _WIN32
+    ReleaseSRWLockShared(&rings_lock);
+#else  /* No define _WIN32 */
+    pthread_mutex_unlock(&rings_lock);
+#endif /* _WIN32 */
+
+    if (dropped) {
+        fprintf(fp, "%llu events of unregistered threads dropped\n",
+                (unsigned long long)dropped);
+    }
+    fflush(fp);
+    free(all);
+}
+
+void trace_request_dump(void) {
+    dump_requested = 1;
+}
+
+void trace_poll(FILE *fp) {
+    if (dump_requested) {
+        dump_requested = 0;
+        trace_dump(fp);
+    }
+}
@@ -0,0 +1,111 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Levels, an event is recorded if its level is at most TRACE_LEVEL */
+#define TRACE_ERROR 1
+#define TRACE_WARN 2
+#define TRACE_INFO 3
+#define TRACE_DEBUG 4
+
+/* Categories, an event is recorded if its category is in TRACE_CATEGORIES */
+#define TRACE_GENERAL 0x01
+#define TRACE_DNS 0x02
+#define TRACE_NET 0x04
+#define TRACE_PROXY 0x08
+#define TRACE_TLS 0x10
+#define TRACE_CHECKIN 0x20
+#define TRACE_SCHED 0x40
+
+#ifndef TRACE_LEVEL
+#ifdef NDEBUG
+#define TRACE_LEVEL TRACE_INFO
+#else /* No define NDEBUG */
+#define TRACE_LEVEL TRACE_DEBUG
+#endif /* NDEBUG */
+#endif /* TRACE_LEVEL */
+
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES 0xff
+#endif /* TRACE_CATEGORIES */
+
+/* Events also printed to stdout as they are recorded, for debug builds */
+#if !defined(TRACE_ECHO) && !defined(NDEBUG)
+#define TRACE_ECHO 1
+#endif /* TRACE_ECHO */
+
+/* Events kept per thread, the oldest are overwritten */
+#define TRACE_RING_SIZE 256
+/* Threads with a ring, events of further threads are dropped */
+#define TRACE_MAX_THREADS 32
+#define TRACE_MSG_SIZE 112
+
+/*
+ * Record an event. The level and category are compile-time constants, an
+ * event filtered out costs nothing: the call is removed by the compiler.
+ */
+#define TRACE(level, category, ...)                                        \
+    do {                                                                   \
+        if ((level) <= TRACE_LEVEL && ((category)&TRACE_CATEGORIES)) {     \
+            trace_event((level), (category), __FILE__, __LINE__,           \
+                        __VA_ARGS__);                                      \
+        }                                                                  \
+    } while (0)
+
+/* Latency statistics, always kept */
+#define TRACE_STAT_DNS 0     /* name resolution */
+#define TRACE_STAT_CONNECT 1 /* TCP connect */
+#define TRACE_STAT_PROXY 2   /* HTTP and SOCKS5 proxy handshake */
+#define TRACE_STAT_TLS 3     /* TLS handshake */
+#define TRACE_STAT_CHECKIN 4 /* check-in round trip */
+#define TRACE_STATS 5
+
+/* Power of two microsecond buckets: 1us, 2us, ... about 16s and more */
+#define TRACE_BUCKETS 25
+
+struct trace_stat {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total; /* microseconds */
+    uint64_t buckets[TRACE_BUCKETS];
+};
+
+/* Install the on-demand dump: SIGUSR1 where there are signals */
+void trace_init(void);
+
+void trace_event(int level, int category, const char *file, int line,
+                 const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 5, 6)))
+#endif /* __GNUC__ */
+    ;
+
+/* Monotonic clock in microseconds */
+uint64_t trace_clock(void);
+
+/*
+ * Count an operation of stat started at start, a trace_clock value, and
+ * failed if ok is 0. Lock-free, safe from any thread.
+ */
+void trace_latency(int stat, uint64_t start, int ok);
+
+/* Copy of the statistics of stat */
+void trace_get_stat(int stat, struct trace_stat *out);
+
+/*
+ * Write the statistics and the events of every thread, oldest first. The
+ * events of threads still running may be torn, the dump is a diagnostic.
+ */
+void trace_dump(FILE *fp);
+
+/* Ask for a dump at the next trace_poll, async-signal-safe */
+void trace_request_dump(void);
+
+/* Dump to fp if a dump was requested, from the event loop */
+void trace_poll(FILE *fp);
+
+#endif /* trace.h */
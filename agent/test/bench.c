@@ -0,0 +1,181 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+/*
+ * agent_bench [-r rounds] [-s scale] [-t host:port] [name...]
+ *
+ * Runs the agent microbenchmarks whose name contains one of the given
+ * names, all of them by default, and writes the results as JSON on
+ * stdout. Each benchmark runs a warmup and then rounds of a fixed number
+ * of operations, the median and the best round are reported so runs on
+ * the same machine can be compared.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "record.h"
+#include "trace.h"
+
+#define BENCH_ROUNDS 5
+#define BENCH_MAX_ROUNDS 100
+
+const char *bench_tls_host = NULL;
+uint16_t bench_tls_port = 0;
+
+static const struct bench *tables[] = {bench_dns, bench_net, bench_crypto};
+
+static int selected(const char *name, char **filters, int count);
+static int compare(const void *a, const void *b);
+static int run(const struct bench *bench, int rounds, long scale, int first);
+
+void bench_start(struct bench_run *b) {
+    b->start = trace_clock();
+}
+
+void bench_stop(struct bench_run *b) {
+    b->elapsed += trace_clock() - b->start;
+}
+
+int main(int argc, char *argv[]) {
+    const struct bench *bench;
+    int i, rounds = BENCH_ROUNDS, first = 1, failed = 0, ret;
+    long scale = 1;
+    char *ptr;
+    size_t t;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (i + 1 >= argc) {
+            break;
+        }
+        if (strcmp(argv[i], "-r") == 0) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            scale = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            bench_tls_host = argv[++i];
+            ptr = strrchr(argv[i], ':');
+            if (ptr) {
+                *ptr = '\0';
+                bench_tls_port = (uint16_t)atoi(ptr + 1);
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (rounds < 1 || rounds > BENCH_MAX_ROUNDS || scale < 1 ||
+        (bench_tls_host && !bench_tls_port) ||
+        (i < argc && argv[i][0] == '-')) {
+        fprintf(stderr,
+                "usage: %s [-r rounds] [-s scale] [-t host:port] [name...]\n",
+                argv[0]);
+        return 2;
+    }
+
+    trace_init();
+
+    printf("{\n  \"version\": \"%s\",\n  \"rounds\": %d,\n  \"scale\": %ld,\n"
+           "  \"aesni\": %s,\n  \"benchmarks\": [",
+           PROJECT_VERSION, rounds, scale,
+           record_accelerated() ? "true" : "false");
+
+    for (t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        for (bench = tables[t]; bench->name; bench++) {
+            if (!selected(bench->name, argv + i, argc - i)) {
+                continue;
+            }
+            ret = run(bench, rounds, scale, first);
+            if (ret == -1) {
+                failed = 1;
+            }
+            first = 0;
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    return failed;
+}
+
+static int selected(const char *name, char **filters, int count) {
+    int i;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (strstr(name, filters[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int run(const struct bench *bench, int rounds, long scale, int first) {
+    double ns[BENCH_MAX_ROUNDS], median;
+    struct bench_run b;
+    long allocs = 0;
+    int i, ret;
+
+    printf("%s\n    {\"name\": \"%s\"", first ? "" : ",", bench->name);
+    fflush(stdout);
+
+    /* Warm the caches and the connections up, the result is dropped */
+    memset(&b, 0, sizeof(b));
+    b.iterations = bench->iterations / 10 ? bench->iterations / 10 : 1;
+    b.allocs = -1;
+
+    ret = bench->func(&b);
+
+    for (i = 0; i < rounds && ret == 0; i++) {
+        memset(&b, 0, sizeof(b));
+        b.iterations = bench->iterations * scale;
+        b.allocs = -1;
+
+        ret = bench->func(&b);
+
+        ns[i] = b.elapsed * 1000.0 / b.iterations;
+        allocs = b.allocs < 0 || allocs < 0 ? -1 : allocs + b.allocs;
+    }
+
+    if (ret == 1) {
+        printf(", \"skipped\": true}");
+        return 0;
+    }
+    if (ret == -1) {
+        printf(", \"error\": true}");
+        return -1;
+    }
+
+    qsort(ns, rounds, sizeof(ns[0]), compare);
+    median = rounds % 2 ? ns[rounds / 2]
+                        : (ns[rounds / 2 - 1] + ns[rounds / 2]) / 2;
+
+    printf(", \"iterations\": %ld, \"ns_per_op\": %.1f, "
+           "\"min_ns_per_op\": %.1f, \"ops_per_sec\": %.0f",
+           bench->iterations * scale, median, ns[0],
+           median > 0 ? 1e9 / median : 0.0);
+
+    if (b.bytes) {
+        printf(", \"mb_per_sec\": %.1f",
+               median > 0 ? b.bytes * 1e3 / median : 0.0);
+    }
+    if (allocs >= 0) {
+        printf(", \"allocs_per_op\": %.2f",
+               (double)allocs / rounds / (bench->iterations * scale));
+    }
+
+    printf("}");
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* State of one round of a benchmark */
+struct bench_run {
+    long iterations; /* operations to run */
+    uint64_t start;
+    uint64_t elapsed; /* microseconds spent between start and stop */
+    size_t bytes;     /* payload bytes per operation, for a MB/s figure */
+    long allocs;      /* heap allocations over the round, -1 if unknown */
+};
+
+/*
+ * Runs b->iterations operations and returns 0, or -1 on error. Only the
+ * time between bench_start and bench_stop is counted, setup outside of it
+ * is free. A benchmark without its requirements returns 1 to be skipped.
+ */
+typedef int (*bench_func)(struct bench_run *b);
+
+struct bench {
+    const char *name;
+    bench_func func;
+    long iterations; /* per round at scale 1 */
+};
+
+void bench_start(struct bench_run *b);
+void bench_stop(struct bench_run *b);
+
+/* TLS server for the handshake benchmark, set with -t host:port */
+extern const char *bench_tls_host;
+extern uint16_t bench_tls_port;
+
+/* Tables terminated by an entry with a NULL name */
+extern const struct bench bench_dns[];
+extern const struct bench bench_net[];
+extern const struct bench bench_crypto[];
+
+#endif /* bench.h */
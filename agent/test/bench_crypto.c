@@ -0,0 +1,360 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/ssl.h>
+
+#include "net.h"
+#include "record.h"
+
+#define PAYLOAD_SIZE (16 * 1024)
+#define RECORD_SIZE 256
+/* Send buffer the records are batched in */
+#define BATCH_SIZE (64 * 1024)
+
+static unsigned char payload[PAYLOAD_SIZE];
+static unsigned char output[PAYLOAD_SIZE + 1024];
+static unsigned char batch[BATCH_SIZE];
+
+/* Results are summed here so the work is not optimized away */
+static volatile size_t sink;
+
+/* Text shaped like task results, compressible like the real ones */
+static void fill_payload(void) {
+    size_t len = 0;
+    int n, i = 0;
+
+    while (len < sizeof(payload)) {
+        n = snprintf((char *)payload + len, sizeof(payload) - len,
+                     "{\"task\":%d,\"status\":0,\"output\":\"uid=%d(user) "
+                     "gid=%d(user) groups=%d(user),27(sudo)\"}\n",
+                     i, 1000 + i % 7, 1000 + i % 7, 1000 + i % 7);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+        i++;
+    }
+}
+
+static int bench_zlib_compress(struct bench_run *b) {
+    uLongf len;
+    long i;
+
+    fill_payload();
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        len = sizeof(output);
+        if (compress2(output, &len, payload, sizeof(payload),
+                      Z_DEFAULT_COMPRESSION) != Z_OK) {
+            return -1;
+        }
+        sink += len;
+    }
+    bench_stop(b);
+
+    b->bytes = sizeof(payload);
+    return 0;
+}
+
+static int bench_zlib_uncompress(struct bench_run *b) {
+    unsigned char compressed[PAYLOAD_SIZE + 1024];
+    uLongf len, clen = sizeof(compressed);
+    long i;
+
+    fill_payload();
+
+    if (compress2(compressed, &clen, payload, sizeof(payload),
+                  Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        len = sizeof(output);
+        if (uncompress(output, &len, compressed, clen) != Z_OK) {
+            return -1;
+        }
+        sink += len;
+    }
+    bench_stop(b);
+
+    b->bytes = sizeof(payload);
+    return 0;
+}
+
+static int bench_gcm(struct bench_run *b, size_t size) {
+    unsigned char key[32], iv[12], tag[16];
+    mbedtls_gcm_context gcm;
+    long i;
+    int ret = 0;
+
+    memset(key, 0x42, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    fill_payload();
+
+    mbedtls_gcm_init(&gcm);
+    if (mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, 256) != 0) {
+        mbedtls_gcm_free(&gcm);
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        /* a fresh nonce per record, as a record layer would */
+        memcpy(iv, &i, sizeof(i) < sizeof(iv) ? sizeof(i) : sizeof(iv));
+        if (mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, size, iv,
+                                      sizeof(iv), NULL, 0, payload, output,
+                                      sizeof(tag), tag) != 0) {
+            ret = -1;
+            break;
+        }
+        sink += tag[0];
+    }
+    bench_stop(b);
+
+    mbedtls_gcm_free(&gcm);
+
+    b->bytes = size;
+    return ret;
+}
+
+static int bench_gcm_record(struct bench_run *b) {
+    return bench_gcm(b, RECORD_SIZE);
+}
+
+static int bench_gcm_payload(struct bench_run *b) {
+    return bench_gcm(b, PAYLOAD_SIZE);
+}
+
+static int record_setup(record_context *ctx) {
+    unsigned char key[RECORD_KEY_SIZE], salt[RECORD_SALT_SIZE];
+
+    memset(key, 0x42, sizeof(key));
+    memset(salt, 0x24, sizeof(salt));
+    fill_payload();
+
+    return record_init(ctx, key, salt);
+}
+
+/*
+ * The payload is written where the record goes and sealed there, records
+ * are batched until the send buffer is full.
+ */
+static int bench_record_seal(struct bench_run *b, size_t size) {
+    record_context ctx;
+    record_buffer rb;
+    unsigned char *p;
+    long i;
+    int ret = 0;
+
+    if (record_setup(&ctx) != 0) {
+        return -1;
+    }
+    record_buffer_init(&rb, batch, sizeof(batch));
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        p = record_reserve(&rb, size);
+        if (!p) {
+            rb.len = 0; /* as if flushed */
+            p = record_reserve(&rb, size);
+        }
+        memcpy(p, payload, size);
+        if (record_seal(&ctx, &rb, size) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    bench_stop(b);
+
+    sink += rb.len;
+    record_free(&ctx);
+
+    b->bytes = size;
+    return ret;
+}
+
+static int bench_record_seal_small(struct bench_run *b) {
+    return bench_record_seal(b, RECORD_SIZE);
+}
+
+static int bench_record_seal_payload(struct bench_run *b) {
+    return bench_record_seal(b, PAYLOAD_SIZE);
+}
+
+/* The payload is encrypted from where it is into the send buffer */
+static int bench_record_append(struct bench_run *b) {
+    record_context ctx;
+    record_buffer rb;
+    long i;
+    int ret = 0;
+
+    if (record_setup(&ctx) != 0) {
+        return -1;
+    }
+    record_buffer_init(&rb, batch, sizeof(batch));
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        if (rb.size - rb.len < sizeof(payload) + RECORD_OVERHEAD) {
+            rb.len = 0;
+        }
+        if (record_append(&ctx, &rb, payload, sizeof(payload)) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    bench_stop(b);
+
+    sink += rb.len;
+    record_free(&ctx);
+
+    b->bytes = sizeof(payload);
+    return ret;
+}
+
+/* A record sealed by one side and opened by the other */
+static int bench_record_roundtrip(struct bench_run *b) {
+    record_context sender, receiver;
+    record_buffer rb;
+    unsigned char *p;
+    size_t len;
+    long i;
+    int ret = 0;
+
+    if (record_setup(&sender) != 0) {
+        return -1;
+    }
+    if (record_setup(&receiver) != 0) {
+        record_free(&sender);
+        return -1;
+    }
+    record_buffer_init(&rb, batch, sizeof(batch));
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        rb.len = 0;
+        if (record_append(&sender, &rb, payload, sizeof(payload)) != 0 ||
+            record_open(&receiver, rb.buf, rb.len, &p, &len) <= 0) {
+            ret = -1;
+            break;
+        }
+        sink += len;
+    }
+    bench_stop(b);
+
+    record_free(&receiver);
+    record_free(&sender);
+
+    b->bytes = sizeof(payload);
+    return ret;
+}
+
+static int tls_send(void *ctx, const unsigned char *buf, size_t len) {
+    return net_send(ctx, buf, len);
+}
+
+static int tls_recv(void *ctx, unsigned char *buf, size_t len) {
+    return net_recv(ctx, buf, len);
+}
+
+/* A full handshake, no resumption, against the server given with -t */
+static int bench_tls_handshake(struct bench_run *b) {
+    static const char pers[] = "agent_bench";
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    net_context ctx;
+    long i;
+    int ret;
+
+    if (!bench_tls_host) {
+        return 1;
+    }
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_init(&ssl);
+
+    ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                (const unsigned char *)pers, sizeof(pers) - 1);
+    if (ret != 0) {
+        goto out;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        goto out;
+    }
+
+    /* the handshake cost is the same, the certificate is not the point */
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+
+    ret = mbedtls_ssl_setup(&ssl, &conf);
+    if (ret != 0) {
+        goto out;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations && ret == 0; i++) {
+        net_init(&ctx);
+        ret = net_connect(&ctx, bench_tls_host, bench_tls_port, NET_TCP);
+        if (ret != 0) {
+            break;
+        }
+
+        mbedtls_ssl_set_bio(&ssl, &ctx, tls_send, tls_recv, NULL);
+
+        do {
+            ret = mbedtls_ssl_handshake(&ssl);
+        } while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+                 ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+        if (ret == 0) {
+            mbedtls_ssl_close_notify(&ssl);
+            ret = mbedtls_ssl_session_reset(&ssl);
+        }
+        net_free(&ctx);
+    }
+    bench_stop(b);
+
+out:
+    if (ret != 0) {
+        fprintf(stderr, "tls handshake with %s:%hu failed: %d\n",
+                bench_tls_host, bench_tls_port, ret);
+    }
+
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+
+    return ret == 0 ? 0 : -1;
+}
+
+const struct bench bench_crypto[] = {
+    {"zlib_compress_16k", bench_zlib_compress, 2000},
+    {"zlib_uncompress_16k", bench_zlib_uncompress, 10000},
+    {"aes_gcm_256b", bench_gcm_record, 200000},
+    {"aes_gcm_16k", bench_gcm_payload, 10000},
+    {"record_seal_256b", bench_record_seal_small, 200000},
+    {"record_seal_16k", bench_record_seal_payload, 10000},
+    {"record_append_16k", bench_record_append, 10000},
+    {"record_roundtrip_16k", bench_record_roundtrip, 5000},
+    {"tls_handshake", bench_tls_handshake, 100},
+    {NULL, NULL, 0},
+};
@@ -0,0 +1,222 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "bench.h"
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "dns.h"
+
+#define ANSWER_RECORDS 4
+
+static const char *nameservers[] = {"192.168.1.1", "8.8.8.8", "9.9.9.9",
+                                    "1.1.1.1", "1.2.4.8"};
+
+static const char *addresses[] = {"192.168.1.1", "www.h1zzz.net", "256.1.1.1",
+                                  "10.0.0.1", "1.2.3", "127.0.0.1"};
+
+/* Results are summed here so the work is not optimized away */
+static volatile size_t sink;
+
+/* A response to an A query with ANSWER_RECORDS compressed records */
+static int build_answer(char *buf, size_t size) {
+    unsigned char *rr;
+    int n, i;
+
+    n = dns_build_query(buf, size, "www.h1zzz.net", DNS_A);
+    if (n == -1 || (size_t)n + ANSWER_RECORDS * 16 > size) {
+        return -1;
+    }
+
+    /* flags: response, recursion desired and available */
+    buf[2] = (char)0x81;
+    buf[3] = (char)0x80;
+    /* an_count */
+    buf[6] = 0;
+    buf[7] = ANSWER_RECORDS;
+
+    for (i = 0; i < ANSWER_RECORDS; i++) {
+        rr = (unsigned char *)buf + n;
+        rr[0] = 0xc0; /* name: pointer to the question */
+        rr[1] = 0x0c;
+        rr[2] = 0;
+        rr[3] = DNS_A;
+        rr[4] = 0;
+        rr[5] = 1; /* class IN */
+        rr[6] = 0;
+        rr[7] = 0;
+        rr[8] = 0x0e;
+        rr[9] = 0x10; /* ttl 3600 */
+        rr[10] = 0;
+        rr[11] = 4;
+        rr[12] = 10;
+        rr[13] = 0;
+        rr[14] = 0;
+        rr[15] = (unsigned char)(i + 1);
+        n += 16;
+    }
+
+    return n;
+}
+
+static int bench_build_query(struct bench_run *b) {
+    char buf[512];
+    long i;
+    int n;
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        n = dns_build_query(buf, sizeof(buf), "www.h1zzz.net", DNS_A);
+        if (n == -1) {
+            return -1;
+        }
+        sink += n;
+    }
+    bench_stop(b);
+
+    return 0;
+}
+
+static int bench_parse_answer(struct bench_run *b, struct arena *arena) {
+    struct dns_node *node;
+    char answer[512];
+    long i;
+    int n;
+
+    n = build_answer(answer, sizeof(answer));
+    if (n == -1) {
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        node = NULL;
+        if (dns_parse_answer(arena, &node, answer, n) == -1 || !node) {
+            return -1;
+        }
+        sink += node->data_len;
+
+        if (arena) {
+            arena_reset(arena);
+        } else {
+            dns_node_destroy(node);
+        }
+    }
+    bench_stop(b);
+
+    b->allocs = arena ? (long)arena->chunks : b->iterations * ANSWER_RECORDS;
+
+    return 0;
+}
+
+static int bench_parse_answer_heap(struct bench_run *b) {
+    return bench_parse_answer(b, NULL);
+}
+
+static int bench_parse_answer_arena(struct bench_run *b) {
+    unsigned char scratch[ARENA_CHUNK_SIZE];
+    struct arena arena;
+    int ret;
+
+    arena_init(&arena, scratch, sizeof(scratch));
+    ret = bench_parse_answer(b, &arena);
+    arena_free(&arena);
+
+    return ret;
+}
+
+static int bench_check_is_ipv4(struct bench_run *b) {
+    size_t count = sizeof(addresses) / sizeof(addresses[0]);
+    long i;
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        sink += check_is_ipv4(addresses[i % count]);
+    }
+    bench_stop(b);
+
+    return 0;
+}
+
+/*
+ * What dns_query_ret does before and after the network round trip: the
+ * nameserver list and the answer record of an address.
+ */
+static int lookup(struct arena *arena) {
+    struct dns_node *node;
+    dns_context ctx;
+    size_t i;
+
+    dns_init(&ctx, arena);
+
+    for (i = 0; i < sizeof(nameservers) / sizeof(nameservers[0]); i++) {
+        if (dns_add_ns(&ctx, nameservers[i], 53) == -1) {
+            dns_free(&ctx);
+            return -1;
+        }
+    }
+
+    node = dns_query(&ctx, "127.0.0.1", DNS_A);
+    dns_free(&ctx);
+
+    if (!node) {
+        return -1;
+    }
+    sink += node->data_len;
+
+    if (!arena) {
+        dns_node_destroy(node);
+    }
+    return 0;
+}
+
+static int bench_lookup_heap(struct bench_run *b) {
+    long i;
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        if (lookup(NULL) == -1) {
+            return -1;
+        }
+    }
+    bench_stop(b);
+
+    /* a node and a string per nameserver, and the answer */
+    b->allocs = b->iterations *
+                (long)(sizeof(nameservers) / sizeof(nameservers[0]) * 2 + 1);
+
+    return 0;
+}
+
+static int bench_lookup_arena(struct bench_run *b) {
+    unsigned char scratch[ARENA_CHUNK_SIZE];
+    struct arena arena;
+    long i;
+
+    arena_init(&arena, scratch, sizeof(scratch));
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        if (lookup(&arena) == -1) {
+            arena_free(&arena);
+            return -1;
+        }
+        arena_reset(&arena);
+    }
+    bench_stop(b);
+
+    b->allocs = (long)arena.chunks;
+    arena_free(&arena);
+
+    return 0;
+}
+
+const struct bench bench_dns[] = {
+    {"dns_build_query", bench_build_query, 1000000},
+    {"dns_parse_answer_heap", bench_parse_answer_heap, 500000},
+    {"dns_parse_answer_arena", bench_parse_answer_arena, 500000},
+    {"check_is_ipv4", bench_check_is_ipv4, 2000000},
+    {"dns_lookup_heap", bench_lookup_heap, 200000},
+    {"dns_lookup_arena", bench_lookup_arena, 200000},
+    {NULL, NULL, 0},
+};
@@ -0,0 +1,216 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "bench.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else /* No define _WIN32 */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include <string.h>
+
+#include "arena.h"
+#include "dns.h"
+#include "net.h"
+#include "proxy.h"
+#include "socks.h"
+#include "standin.h"
+
+#ifdef _WIN32
+typedef SOCKET sock_t;
+#else /* No define _WIN32 */
+typedef int sock_t;
+#define INVALID_SOCKET -1
+#define closesocket(fd) close(fd)
+#endif /* _WIN32 */
+
+/* Target the proxies are asked to connect to, the stand-ins do not dial */
+#define TARGET_HOST "127.0.0.1"
+#define TARGET_PORT 443
+
+static sock_t listen_loopback(uint16_t *port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    sock_t fd;
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return INVALID_SOCKET;
+    }
+#endif /* _WIN32 */
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* A TCP connect to a loopback listener, accept included */
+static int bench_net_connect(struct bench_run *b) {
+    net_context ctx;
+    uint16_t port;
+    sock_t fd, conn;
+    long i;
+    int ret = 0;
+
+    fd = listen_loopback(&port);
+    if (fd == INVALID_SOCKET) {
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        net_init(&ctx);
+        if (net_connect(&ctx, "127.0.0.1", port, NET_TCP) == -1) {
+            ret = -1;
+            break;
+        }
+        conn = accept(fd, NULL, NULL);
+        net_free(&ctx);
+        if (conn == INVALID_SOCKET) {
+            ret = -1;
+            break;
+        }
+        closesocket(conn);
+    }
+    bench_stop(b);
+
+    closesocket(fd);
+    return ret;
+}
+
+static int bench_socks5_handshake(struct bench_run *b) {
+    struct socks5_client *client;
+    struct standin *standin;
+    net_context ctx;
+    long i;
+    int ret = 0;
+
+    standin = standin_start(STANDIN_SOCKS5, 0, NULL);
+    if (!standin) {
+        return -1;
+    }
+
+    client = socks5_client_new("127.0.0.1", standin_port(standin), NULL, NULL);
+    if (!client) {
+        standin_stop(standin);
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        if (socks5_client_connect(client, &ctx, TARGET_HOST, TARGET_PORT) ==
+            -1) {
+            ret = -1;
+            break;
+        }
+        net_free(&ctx);
+    }
+    bench_stop(b);
+
+    socks5_client_free(client);
+    standin_stop(standin);
+    return ret;
+}
+
+static int bench_http_proxy_handshake(struct bench_run *b) {
+    struct http_proxy *proxy;
+    struct standin *standin;
+    net_context ctx;
+    long i;
+    int ret = 0;
+
+    standin = standin_start(STANDIN_HTTP_PROXY, 0, NULL);
+    if (!standin) {
+        return -1;
+    }
+
+    proxy = http_proxy_new("127.0.0.1", standin_port(standin), NULL, NULL);
+    if (!proxy) {
+        standin_stop(standin);
+        return -1;
+    }
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        if (http_proxy_connect(proxy, &ctx, TARGET_HOST, TARGET_PORT) == -1) {
+            ret = -1;
+            break;
+        }
+        net_free(&ctx);
+    }
+    bench_stop(b);
+
+    http_proxy_free(proxy);
+    standin_stop(standin);
+    return ret;
+}
+
+/* A query to a loopback resolver, answered without delay */
+static int bench_dns_query(struct bench_run *b) {
+    unsigned char scratch[ARENA_CHUNK_SIZE];
+    struct standin *standin;
+    struct dns_node *node;
+    struct arena arena;
+    dns_context ctx;
+    long i;
+    int ret = 0;
+
+    standin = standin_start(STANDIN_DNS, 0, NULL);
+    if (!standin) {
+        return -1;
+    }
+
+    arena_init(&arena, scratch, sizeof(scratch));
+
+    bench_start(b);
+    for (i = 0; i < b->iterations; i++) {
+        dns_init(&ctx, &arena);
+        if (dns_add_ns(&ctx, "127.0.0.1", standin_port(standin)) == -1) {
+            ret = -1;
+            break;
+        }
+        node = dns_query(&ctx, "www.h1zzz.net", DNS_A);
+        dns_free(&ctx);
+        arena_reset(&arena);
+        if (!node) {
+            ret = -1;
+            break;
+        }
+    }
+    bench_stop(b);
+
+    b->allocs = (long)arena.chunks;
+    arena_free(&arena);
+    standin_stop(standin);
+    return ret;
+}
+
+const struct bench bench_net[] = {
+    {"dns_query_loopback", bench_dns_query, 5000},
+    {"net_connect_loopback", bench_net_connect, 2000},
+    {"socks5_handshake", bench_socks5_handshake, 2000},
+    {"http_proxy_handshake", bench_http_proxy_handshake, 2000},
+    {NULL, NULL, 0},
+};
@@ -0,0 +1,541 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#include "standin.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else /* No define _WIN32 */
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net.h"
+#include "pool.h"
+#include "trace.h"
+
+#ifdef _WIN32
+typedef SOCKET sock_t;
+#else /* No define _WIN32 */
+typedef int sock_t;
+#define INVALID_SOCKET -1
+#define closesocket(fd) close(fd)
+#endif /* _WIN32 */
+
+/* How often the serving loop looks at the stop flag, in ms */
+#define STANDIN_POLL 100
+
+struct standin {
+    int kind;
+    sock_t fd;
+    uint16_t port;
+    struct standin_config config;
+    char answer[256];
+    struct pool *pool;
+    pool_task task; /* the accept or receive loop */
+    volatile int stop;
+};
+
+/* A connection, or a DNS query with the address to answer */
+struct request {
+    pool_task task;
+    struct standin *standin;
+    sock_t fd;
+    struct sockaddr_in addr;
+    char buf[512];
+    int len;
+    uint32_t seed;
+};
+
+static void standin_sleep(int ms);
+static uint32_t standin_random(struct request *req);
+static int standin_roll(struct request *req, int percent);
+static void standin_delay(struct request *req);
+static int standin_send(struct request *req, const char *data, int len);
+static int standin_wait(sock_t fd, int ms);
+static void standin_relay(sock_t fd, net_context *up);
+static int standin_dial(struct request *req, const char *host, uint16_t port,
+                        net_context *up);
+static void serve_dns(void *arg);
+static void serve_socks5(struct request *req);
+static void serve_http_proxy(struct request *req);
+static void serve_conn(void *arg);
+static void request_done(void *arg);
+static void standin_run(void *arg);
+
+struct standin *standin_start(int kind, uint16_t port,
+                              const struct standin_config *config) {
+    struct standin *standin;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return NULL;
+    }
+#endif /* _WIN32 */
+
+    standin = calloc(1, sizeof(struct standin));
+    if (!standin) {
+        return NULL;
+    }
+
+    standin->kind = kind;
+    if (config) {
+        standin->config = *config;
+    }
+
+    /* A for an address, TXT for anything */
+    snprintf(standin->answer, sizeof(standin->answer), "%s",
+             standin->config.answer ? standin->config.answer : "127.0.0.1");
+
+    if (kind == STANDIN_DNS) {
+        standin->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    } else {
+        standin->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
+    if (standin->fd == INVALID_SOCKET) {
+        free(standin);
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(standin->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        (kind != STANDIN_DNS && listen(standin->fd, SOMAXCONN) != 0) ||
+        getsockname(standin->fd, (struct sockaddr *)&addr, &len) != 0) {
+        goto err;
+    }
+    standin->port = ntohs(addr.sin_port);
+
+    /* one worker runs the loop, the others the requests */
+    standin->pool = pool_new(STANDIN_WORKERS + 1);
+    if (!standin->pool) {
+        goto err;
+    }
+
+    pool_submit(standin->pool, &standin->task, standin_run, NULL, standin);
+    return standin;
+
+err:
+    closesocket(standin->fd);
+    free(standin);
+    return NULL;
+}
+
+uint16_t standin_port(struct standin *standin) {
+    return standin->port;
+}
+
+void standin_stop(struct standin *standin) {
+    if (!standin) {
+        return;
+    }
+
+    standin->stop = 1;
+    pool_free(standin->pool);
+
+    closesocket(standin->fd);
+    free(standin);
+}
+
+static void standin_sleep(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else  /* No define _WIN32 */
+    struct timeval tv;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    select(0, NULL, NULL, NULL, &tv);
+#endif /* _WIN32 */
+}
+
+/* xorshift32, each request draws from its own state */
+static uint32_t standin_random(struct request *req) {
+    req->seed ^= req->seed << 13;
+    req->seed ^= req->seed >> 17;
+    req->seed ^= req->seed << 5;
+    return req->seed;
+}
+
+static int standin_roll(struct request *req, int percent) {
+    return percent > 0 && (int)(standin_random(req) % 100) < percent;
+}
+
+static void standin_delay(struct request *req) {
+    const struct standin_config *config = &req->standin->config;
+    int ms = config->latency;
+
+    if (config->jitter > 0) {
+        ms += (int)(standin_random(req) % (uint32_t)(config->jitter + 1));
+    }
+    if (ms > 0) {
+        standin_sleep(ms);
+    }
+}
+
+/*
+ * Send a reply over the connection with the truncation and drip faults.
+ * Returns -1 if it was cut short or failed, the connection is then closed.
+ */
+static int standin_send(struct request *req, const char *data, int len) {
+    const struct standin_config *config = &req->standin->config;
+    int i, n = len;
+
+    standin_delay(req);
+
+    if (config->truncate > 0 && config->truncate < len) {
+        n = config->truncate;
+    }
+
+    if (config->drip > 0) {
+        for (i = 0; i < n; i++) {
+            if (i) {
+                standin_sleep(config->drip);
+            }
+            if (send(req->fd, data + i, 1, 0) != 1) {
+                return -1;
+            }
+        }
+    } else if (send(req->fd, data, n, 0) != n) {
+        return -1;
+    }
+
+    return n == len ? 0 : -1;
+}
+
+/* Wait up to ms for fd to be readable, returns 1 if it is */
+static int standin_wait(sock_t fd, int ms) {
+    struct timeval tv;
+    fd_set rfds;
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+
+    return select((int)fd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+/* Copy both ways until either side closes */
+static void standin_relay(sock_t fd, net_context *up) {
+    sock_t upfd = (sock_t)up->fd;
+    char buf[16384];
+    fd_set rfds;
+    int n;
+
+    while (1) {
+        FD_ZERO(&rfds);
+        FD_SET(fd, &rfds);
+        FD_SET(upfd, &rfds);
+
+        if (select((int)(fd > upfd ? fd : upfd) + 1, &rfds, NULL, NULL,
+                   NULL) <= 0) {
+            return;
+        }
+        if (FD_ISSET(fd, &rfds)) {
+            n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0 || net_send(up, buf, n) != n) {
+                return;
+            }
+        }
+        if (FD_ISSET(upfd, &rfds)) {
+            n = recv(upfd, buf, sizeof(buf), 0);
+            if (n <= 0 || send(fd, buf, n, 0) != n) {
+                return;
+            }
+        }
+    }
+}
+
+/* Connect to the proxied target, or pretend to without tunnel */
+static int standin_dial(struct request *req, const char *host, uint16_t port,
+                        net_context *up) {
+    net_init(up);
+
+    if (!req->standin->config.tunnel) {
+        return 0;
+    }
+
+    if (net_connect(up, host, port, NET_TCP) == -1) {
+        net_init(up);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Answer the query in req->buf with one record, A with the configured
+ * address or TXT with the configured text.
+ */
+static void serve_dns(void *arg) {
+    struct request *req = arg;
+    struct standin *standin = req->standin;
+    unsigned char out[1024], *rr;
+    int pos = 12, type, n, rcode = 0;
+    size_t len;
+
+    if (req->len < 12 + 5 || standin_roll(req, standin->config.loss)) {
+        return;
+    }
+
+    /* skip the question name */
+    while (pos < req->len && req->buf[pos]) {
+        pos += 1 + (unsigned char)req->buf[pos];
+    }
+    if (pos + 5 > req->len) {
+        return;
+    }
+    type = (unsigned char)req->buf[pos + 1] << 8 |
+           (unsigned char)req->buf[pos + 2];
+    pos += 5;
+
+    memcpy(out, req->buf, pos);
+
+    if (standin_roll(req, standin->config.refuse)) {
+        rcode = 5;
+    }
+
+    out[2] = 0x80 | (out[2] & 0x01); /* response, recursion desired */
+    out[3] = 0x80 | rcode;           /* recursion available */
+    out[4] = 0;
+    out[5] = 1;
+    memset(out + 6, 0, 6);
+    n = pos;
+
+    if (rcode == 0 && (type == 1 || type == 16)) {
+        out[7] = 1;
+
+        rr = out + n;
+        rr[0] = 0xc0; /* name: pointer to the question */
+        rr[1] = 0x0c;
+        rr[2] = 0;
+        rr[3] = (unsigned char)type;
+        rr[4] = 0;
+        rr[5] = 1; /* class IN */
+        rr[6] = 0;
+        rr[7] = 0;
+        rr[8] = 0;
+        rr[9] = 60; /* ttl */
+        n += 12;
+
+        if (type == 1) {
+            if (inet_pton(AF_INET, standin->answer, out + n) != 1) {
+                inet_pton(AF_INET, "127.0.0.1", out + n);
+            }
+            len = 4;
+        } else {
+            len = strlen(standin->answer);
+            out[n] = (unsigned char)len;
+            memcpy(out + n + 1, standin->answer, len);
+            len++;
+        }
+        rr[10] = (unsigned char)(len >> 8);
+        rr[11] = (unsigned char)len;
+        n += (int)len;
+    }
+
+    if (standin->config.truncate > 0 && standin->config.truncate < n) {
+        n = standin->config.truncate;
+        if (n > 2) {
+            out[2] |= 0x02; /* TC */
+        }
+    }
+
+    standin_delay(req);
+
+    sendto(standin->fd, (const char *)out, n, 0,
+           (struct sockaddr *)&req->addr, sizeof(req->addr));
+}
+
+static void serve_socks5(struct request *req) {
+    char reply[10] = {0x05, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+    static const char method[] = {0x05, 0x00};
+    char *buf = req->buf, host[256];
+    net_context up;
+    uint16_t port;
+    int n, len;
+
+    /* greeting, no authentication */
+    n = recv(req->fd, buf, sizeof(req->buf), 0);
+    if (n < 3 || buf[0] != 0x05 || standin_send(req, method, 2) == -1) {
+        return;
+    }
+
+    n = recv(req->fd, buf, sizeof(req->buf), 0);
+    if (n < 10 || buf[0] != 0x05 || buf[1] != 0x01) {
+        return;
+    }
+
+    switch (buf[3]) {
+    case 0x01:
+        inet_ntop(AF_INET, buf + 4, host, sizeof(host));
+        port = (uint16_t)((unsigned char)buf[8] << 8 | (unsigned char)buf[9]);
+        break;
+    case 0x03:
+        len = (unsigned char)buf[4];
+        if (n < 5 + len + 2) {
+            return;
+        }
+        memcpy(host, buf + 5, len);
+        host[len] = '\0';
+        port = (uint16_t)((unsigned char)buf[5 + len] << 8 |
+                          (unsigned char)buf[6 + len]);
+        break;
+    default:
+        reply[1] = 0x08; /* address type not supported */
+        standin_send(req, reply, sizeof(reply));
+        return;
+    }
+
+    if (standin_dial(req, host, port, &up) == -1) {
+        reply[1] = 0x05; /* connection refused */
+        standin_send(req, reply, sizeof(reply));
+        return;
+    }
+
+    if (standin_send(req, reply, sizeof(reply)) == 0 &&
+        req->standin->config.tunnel) {
+        standin_relay(req->fd, &up);
+    }
+    net_free(&up);
+}
+
+static void serve_http_proxy(struct request *req) {
+    static const char ok[] = "HTTP/1.1 200 Connection established\r\n\r\n";
+    static const char fail[] = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+    char *buf = req->buf, host[256];
+    unsigned short port;
+    net_context up;
+    int n, len = 0;
+
+    while (1) {
+        if (len == (int)sizeof(req->buf) - 1) {
+            return;
+        }
+        n = recv(req->fd, buf + len, (int)sizeof(req->buf) - 1 - len, 0);
+        if (n <= 0) {
+            return;
+        }
+        len += n;
+        buf[len] = '\0';
+        if (strstr(buf, "\r\n\r\n")) {
+            break;
+        }
+    }
+
+    if (sscanf(buf, "CONNECT %255[^: ]:%hu ", host, &port) != 2) {
+        return;
+    }
+
+    if (standin_dial(req, host, port, &up) == -1) {
+        standin_send(req, fail, sizeof(fail) - 1);
+        return;
+    }
+
+    if (standin_send(req, ok, sizeof(ok) - 1) == 0 &&
+        req->standin->config.tunnel) {
+        standin_relay(req->fd, &up);
+    }
+    net_free(&up);
+}
+
+static void serve_conn(void *arg) {
+    struct request *req = arg;
+    struct standin *standin = req->standin;
+    struct linger linger;
+    char buf[512];
+
+    if (standin_roll(req, standin->config.refuse)) {
+        /* a reset rather than an orderly close */
+        linger.l_onoff = 1;
+        linger.l_linger = 0;
+        setsockopt(req->fd, SOL_SOCKET, SO_LINGER, (const char *)&linger,
+                   sizeof(linger));
+        closesocket(req->fd);
+        return;
+    }
+
+    if (!standin_roll(req, standin->config.loss)) {
+        if (standin->kind == STANDIN_SOCKS5) {
+            serve_socks5(req);
+        } else {
+            serve_http_proxy(req);
+        }
+    }
+
+    /* let the client close first, unanswered ones wait until it gives up */
+    while (recv(req->fd, buf, sizeof(buf), 0) > 0) {
+    }
+    closesocket(req->fd);
+}
+
+static void request_done(void *arg) {
+    free(arg);
+}
+
+/* Runs on a worker until standin_stop, hands each request to the others */
+static void standin_run(void *arg) {
+    struct standin *standin = arg;
+    struct request *req;
+    socklen_t len;
+#ifdef _WIN32
+    DWORD tv = STANDIN_IDLE * 1000;
+#else  /* No define _WIN32 */
+    struct timeval tv = {STANDIN_IDLE, 0};
+#endif /* _WIN32 */
+
+    while (!standin->stop) {
+        pool_complete(standin->pool);
+
+        if (!standin_wait(standin->fd, STANDIN_POLL)) {
+            continue;
+        }
+
+        req = calloc(1, sizeof(struct request));
+        if (!req) {
+            standin_sleep(STANDIN_POLL);
+            continue;
+        }
+
+        req->standin = standin;
+        req->seed = (uint32_t)trace_clock() ^ (uint32_t)(uintptr_t)req;
+        req->seed |= 1;
+
+        if (standin->kind == STANDIN_DNS) {
+            len = sizeof(req->addr);
+            req->len = recvfrom(standin->fd, req->buf, sizeof(req->buf), 0,
+                                (struct sockaddr *)&req->addr, &len);
+            if (req->len <= 0) {
+                free(req);
+                continue;
+            }
+            pool_submit(standin->pool, &req->task, serve_dns, request_done,
+                        req);
+            continue;
+        }
+
+        req->fd = accept(standin->fd, NULL, NULL);
+        if (req->fd == INVALID_SOCKET) {
+            free(req);
+            continue;
+        }
+
+        setsockopt(req->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv,
+                   sizeof(tv));
+        pool_submit(standin->pool, &req->task, serve_conn, request_done, req);
+    }
+}
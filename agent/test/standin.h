@@ -0,0 +1,46 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _STANDIN_H
+#define _STANDIN_H
+
+#include <stdint.h>
+
+/*
+ * Loopback stand-ins for the servers on the agent's network paths, so
+ * timeouts, retries and path racing can be measured without real resolvers
+ * or proxies.
+ */
+#define STANDIN_DNS 0        /* UDP, A and TXT queries */
+#define STANDIN_SOCKS5 1     /* TCP, CONNECT without authentication */
+#define STANDIN_HTTP_PROXY 2 /* TCP, HTTP CONNECT */
+
+/* Requests served at once, more wait for a free worker */
+#define STANDIN_WORKERS 8
+/* Seconds a connection may stay idle before the stand-in closes it */
+#define STANDIN_IDLE 10
+
+/*
+ * Faults apply to the stand-in's own replies: the DNS answer and the proxy
+ * handshake responses. Percentages are drawn per request or connection.
+ */
+struct standin_config {
+    int latency;  /* ms before each reply */
+    int jitter;   /* up to this many ms more, drawn per reply */
+    int loss;     /* % of requests never answered, the client has to time out */
+    int refuse;   /* % of requests refused: REFUSED rcode, or a TCP reset */
+    int truncate; /* bytes of each reply sent, 0 for all; then TC or close */
+    int drip;     /* ms between the bytes of a reply, TCP only */
+    int tunnel;   /* proxies connect to the target and relay, or just say yes */
+    const char *answer; /* DNS A address, or TXT text; default 127.0.0.1 */
+};
+
+struct standin;
+
+/* Serve kind on 127.0.0.1:port, 0 for any free port. NULL on error. */
+struct standin *standin_start(int kind, uint16_t port,
+                              const struct standin_config *config);
+uint16_t standin_port(struct standin *standin);
+/* Stop accepting and wait for the requests in progress */
+void standin_stop(struct standin *standin);
+
+#endif /* standin.h */
@@ -0,0 +1,140 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+/*
+ * agent_standin <kind>[:port] [key=value...] [<kind>[:port] ...]
+ *
+ * Serves stand-ins on loopback until killed. kind is dns, socks5 or http,
+ * the key=value options after one apply to it:
+ *
+ *   latency=ms jitter=ms loss=% refuse=% truncate=bytes drip=ms
+ *   tunnel=0|1 answer=address-or-text
+ *
+ * Proxies tunnel to the target by default. Each stand-in is printed as
+ * "<kind> 127.0.0.1:<port>" once it listens, port 0 picks a free one:
+ *
+ *   agent_standin dns:5353 loss=20 socks5 latency=50 jitter=20
+ *   agent -n 127.0.0.1:5353
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "standin.h"
+#include "util.h"
+
+#define MAX_STANDINS 16
+
+static const char *kinds[] = {"dns", "socks5", "http"};
+
+static int parse_kind(const char *arg, uint16_t *port);
+static int parse_option(struct standin_config *config, const char *arg);
+static void usage(const char *program);
+
+int main(int argc, char *argv[]) {
+    struct standin_config configs[MAX_STANDINS];
+    uint16_t ports[MAX_STANDINS];
+    int types[MAX_STANDINS];
+    struct standin *standin;
+    int i, n = 0, kind;
+
+    for (i = 1; i < argc; i++) {
+        kind = parse_kind(argv[i], &ports[n]);
+        if (kind != -1) {
+            if (n == MAX_STANDINS) {
+                usage(argv[0]);
+                return 2;
+            }
+            types[n] = kind;
+            memset(&configs[n], 0, sizeof(configs[n]));
+            configs[n].tunnel = 1;
+            n++;
+            continue;
+        }
+        if (n == 0 || parse_option(&configs[n - 1], argv[i]) == -1) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (n == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (i = 0; i < n; i++) {
+        standin = standin_start(types[i], ports[i], &configs[i]);
+        if (!standin) {
+            fprintf(stderr, "%s: cannot serve %s on port %hu\n", argv[0],
+                    kinds[types[i]], ports[i]);
+            return 1;
+        }
+        printf("%s 127.0.0.1:%hu\n", kinds[types[i]], standin_port(standin));
+        fflush(stdout);
+    }
+
+    while (1) {
+        xsleep(60);
+    }
+}
+
+static int parse_kind(const char *arg, uint16_t *port) {
+    size_t i, len;
+
+    for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        len = strlen(kinds[i]);
+        if (strncmp(arg, kinds[i], len) != 0) {
+            continue;
+        }
+        if (arg[len] == '\0') {
+            *port = 0;
+            return (int)i;
+        }
+        if (arg[len] == ':') {
+            *port = (uint16_t)atoi(arg + len + 1);
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static int parse_option(struct standin_config *config, const char *arg) {
+    const char *value = strchr(arg, '=');
+    size_t len;
+
+    if (!value) {
+        return -1;
+    }
+    len = value++ - arg;
+
+    if (strncmp(arg, "answer", len) == 0 && len == 6) {
+        config->answer = value;
+    } else if (strncmp(arg, "latency", len) == 0 && len == 7) {
+        config->latency = atoi(value);
+    } else if (strncmp(arg, "jitter", len) == 0 && len == 6) {
+        config->jitter = atoi(value);
+    } else if (strncmp(arg, "loss", len) == 0 && len == 4) {
+        config->loss = atoi(value);
+    } else if (strncmp(arg, "refuse", len) == 0 && len == 6) {
+        config->refuse = atoi(value);
+    } else if (strncmp(arg, "truncate", len) == 0 && len == 8) {
+        config->truncate = atoi(value);
+    } else if (strncmp(arg, "drip", len) == 0 && len == 4) {
+        config->drip = atoi(value);
+    } else if (strncmp(arg, "tunnel", len) == 0 && len == 6) {
+        config->tunnel = atoi(value);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s <dns|socks5|http>[:port] [key=value...] ...\n"
+            "  latency=ms jitter=ms loss=%% refuse=%% truncate=bytes "
+            "drip=ms tunnel=0|1 answer=text\n",
+            program);
+}
@@ -0,0 +1,26 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+
+/*
+ * Unit tests are programs run by ctest, main returns TEST_RESULT: non-zero
+ * once any CHECK failed. A failed CHECK reports its line and carries on so
+ * one run shows every failure.
+ */
+static int test_failures = 0;
+
+#define CHECK(expr)                                                       \
+    do {                                                                  \
+        if (!(expr)) {                                                    \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,        \
+                    __LINE__, #expr);                                     \
+            test_failures++;                                              \
+        }                                                                 \
+    } while (0)
+
+#define TEST_RESULT (test_failures > 0)
+
+#endif /* test.h */
@@ -0,0 +1,141 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+/* Submission, order, work stealing and completion of the worker pool */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "test.h"
+
+#define TASKS 1000
+#define CHILDREN 64
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t loop; /* thread of the event loop */
+static int worked;     /* work callbacks run */
+static int completed;  /* done callbacks run */
+
+static struct pool *pool;
+static pool_task children[CHILDREN];
+
+static void work(void *arg) {
+    (void)arg;
+
+    CHECK(!pthread_equal(pthread_self(), loop));
+    pthread_mutex_lock(&lock);
+    worked++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void done(void *arg) {
+    (void)arg;
+
+    /* completions run on the thread calling pool_complete only */
+    CHECK(pthread_equal(pthread_self(), loop));
+    completed++;
+}
+
+/*
+ * Tasks submitted from a worker stay on its own deque, the parent blocks
+ * until they have run: they can only have been stolen by other workers.
+ */
+static void parent(void *arg) {
+    int i;
+
+    (void)arg;
+
+    for (i = 0; i < CHILDREN; i++) {
+        pool_submit(pool, &children[i], work, done, NULL);
+    }
+
+    pthread_mutex_lock(&lock);
+    while (worked < CHILDREN) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void test_submit(void) {
+    static pool_task tasks[TASKS];
+    int i, n = 0;
+
+    worked = completed = 0;
+    pool = pool_new(4);
+    CHECK(pool != NULL);
+    CHECK(pool_size(pool) == 4);
+
+    for (i = 0; i < TASKS; i++) {
+        pool_submit(pool, &tasks[i], work, done, NULL);
+    }
+    while (n < TASKS) {
+        if (pool_wait(pool, 1000) == 0) {
+            CHECK(!"no completion within a second");
+            break;
+        }
+        n += pool_complete(pool);
+    }
+
+    CHECK(n == TASKS);
+    CHECK(worked == TASKS);
+    CHECK(completed == TASKS);
+    CHECK(pool_complete(pool) == 0);
+
+    pool_free(pool);
+}
+
+static int order[TASKS];
+
+static void record(void *arg) {
+    /* a single worker, no lock needed */
+    order[worked++] = *(int *)arg;
+}
+
+static void test_order(void) {
+    static pool_task tasks[TASKS];
+    static int index[TASKS];
+    int i;
+
+    worked = completed = 0;
+    pool = pool_new(1);
+    CHECK(pool != NULL);
+
+    for (i = 0; i < TASKS; i++) {
+        index[i] = i;
+        pool_submit(pool, &tasks[i], record, done, &index[i]);
+    }
+    pool_free(pool);
+
+    CHECK(worked == TASKS);
+    CHECK(completed == TASKS);
+    for (i = 0; i < TASKS; i++) {
+        CHECK(order[i] == i);
+    }
+}
+
+static void test_steal(void) {
+    pool_task task;
+
+    worked = completed = 0;
+    pool = pool_new(2);
+    CHECK(pool != NULL);
+
+    pool_submit(pool, &task, parent, done, NULL);
+
+    /* pool_free waits for the tasks and runs the pending completions */
+    pool_free(pool);
+    CHECK(worked == CHILDREN);
+    CHECK(completed == CHILDREN + 1);
+}
+
+int main(void) {
+    loop = pthread_self();
+
+    test_submit();
+    test_order();
+    test_steal();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,154 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+/* Round trip, tampering, ordering and buffer limits of the record layer */
+
+#include <string.h>
+
+#include "record.h"
+#include "test.h"
+
+static const unsigned char key[RECORD_KEY_SIZE] = {1};
+static const unsigned char salt[RECORD_SALT_SIZE] = {2};
+
+static unsigned char buf[64 * 1024];
+static unsigned char data[40000];
+
+static void test_roundtrip(void) {
+    record_context sender, receiver;
+    unsigned char *payload, *ptr;
+    size_t len, off = 0;
+    record_buffer rb;
+    int i, n;
+
+    CHECK(record_init(&sender, key, salt) == 0);
+    CHECK(record_init(&receiver, key, salt) == 0);
+    record_buffer_init(&rb, buf, sizeof(buf));
+
+    /* in place, then split in records, then empty */
+    ptr = record_reserve(&rb, 5);
+    CHECK(ptr != NULL);
+    memcpy(ptr, "hello", 5);
+    CHECK(record_seal(&sender, &rb, 5) == 0);
+    CHECK(record_append(&sender, &rb, data, sizeof(data)) == 0);
+    CHECK(record_append(&sender, &rb, data, 0) == 0);
+    CHECK(rb.len == 5 + sizeof(data) + 5 * RECORD_OVERHEAD);
+
+    /* a partial record is not opened yet */
+    CHECK(record_open(&receiver, buf, RECORD_HEADER_SIZE - 1, &payload,
+                      &len) == 0);
+    CHECK(record_open(&receiver, buf, 5 + RECORD_OVERHEAD - 1, &payload,
+                      &len) == 0);
+
+    n = record_open(&receiver, buf, rb.len, &payload, &len);
+    CHECK(n == 5 + RECORD_OVERHEAD);
+    CHECK(len == 5 && memcmp(payload, "hello", 5) == 0);
+    off += n;
+
+    for (i = 0; i * RECORD_MAX_PAYLOAD < (int)sizeof(data); i++) {
+        n = record_open(&receiver, buf + off, rb.len - off, &payload, &len);
+        CHECK(n > 0);
+        if (n <= 0) {
+            break;
+        }
+        CHECK(memcmp(payload, data + i * RECORD_MAX_PAYLOAD, len) == 0);
+        off += n;
+    }
+
+    n = record_open(&receiver, buf + off, rb.len - off, &payload, &len);
+    CHECK(n == RECORD_OVERHEAD && len == 0);
+    off += n;
+    CHECK(off == rb.len);
+
+    record_free(&sender);
+    record_free(&receiver);
+}
+
+static void test_tamper(void) {
+    record_context sender, receiver;
+    unsigned char *payload;
+    record_buffer rb;
+    size_t len;
+
+    CHECK(record_init(&sender, key, salt) == 0);
+    CHECK(record_init(&receiver, key, salt) == 0);
+    record_buffer_init(&rb, buf, sizeof(buf));
+
+    CHECK(record_append(&sender, &rb, "x", 1) == 0);
+    buf[RECORD_HEADER_SIZE] ^= 1;
+    CHECK(record_open(&receiver, buf, rb.len, &payload, &len) == -1);
+
+    record_free(&receiver);
+
+    /* the header is authenticated too: SEQ 1 turned into the expected 0 */
+    CHECK(record_init(&receiver, key, salt) == 0);
+    record_buffer_init(&rb, buf, sizeof(buf));
+    CHECK(record_append(&sender, &rb, "y", 1) == 0);
+    buf[RECORD_HEADER_SIZE - 1] ^= 1;
+    CHECK(record_open(&receiver, buf, rb.len, &payload, &len) == -1);
+
+    record_free(&sender);
+    record_free(&receiver);
+}
+
+static void test_order(void) {
+    record_context sender, receiver;
+    unsigned char *payload;
+    record_buffer rb;
+    size_t len;
+
+    CHECK(record_init(&sender, key, salt) == 0);
+    CHECK(record_init(&receiver, key, salt) == 0);
+    record_buffer_init(&rb, buf, sizeof(buf));
+
+    CHECK(record_append(&sender, &rb, "x", 1) == 0);
+    CHECK(record_append(&sender, &rb, "y", 1) == 0);
+
+    /* the second record first */
+    CHECK(record_open(&receiver, buf + 1 + RECORD_OVERHEAD,
+                      rb.len - 1 - RECORD_OVERHEAD, &payload, &len) == -1);
+    record_free(&receiver);
+
+    /* a replay of the first, the stream is dead after a failure */
+    CHECK(record_init(&receiver, key, salt) == 0);
+    CHECK(record_open(&receiver, buf, rb.len, &payload, &len) > 0);
+    CHECK(len == 1 && *payload == 'x');
+    CHECK(record_open(&receiver, buf, rb.len, &payload, &len) == -1);
+
+    record_free(&sender);
+    record_free(&receiver);
+}
+
+static void test_full(void) {
+    record_context sender;
+    record_buffer rb;
+
+    CHECK(record_init(&sender, key, salt) == 0);
+    record_buffer_init(&rb, buf, 100);
+
+    /* all or nothing */
+    CHECK(record_append(&sender, &rb, data, 100 - RECORD_OVERHEAD + 1) ==
+          -1);
+    CHECK(rb.len == 0);
+    CHECK(record_reserve(&rb, 100 - RECORD_OVERHEAD + 1) == NULL);
+    CHECK(record_reserve(&rb, 100 - RECORD_OVERHEAD) != NULL);
+    CHECK(record_append(&sender, &rb, data, 100 - RECORD_OVERHEAD) == 0);
+    CHECK(rb.len == 100);
+    CHECK(record_append(&sender, &rb, data, 0) == -1);
+
+    record_free(&sender);
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (unsigned char)i;
+    }
+
+    test_roundtrip();
+    test_tamper();
+    test_order();
+    test_full();
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,164 @@
+/* MIT License Copyright (c) 2022, h1zzz */
+
+/* Heap order, failure backoff and retry-after of the check-in scheduler */
+
+#include <stdlib.h>
+
+#include "sched.h"
+#include "test.h"
+
+#define TIMERS 16
+
+struct job {
+    sched_timer timer;
+    int ret;  /* returned by the job */
+    int runs; /* number of runs */
+};
+
+static uint64_t last; /* due time of the last job run */
+static sched_context *kicked; /* scheduler of the job kicking itself */
+
+static int job_run(void *arg) {
+    struct job *job = arg;
+
+    /* due jobs run earliest first, and never before they are due */
+    CHECK(job->timer.when >= last);
+    CHECK(job->timer.when <= sched_now());
+    last = job->timer.when;
+
+    job->runs++;
+    if (kicked) {
+        /* work queued while the job runs */
+        sched_kick(kicked, &job->timer, 0);
+        kicked = NULL;
+    }
+    return job->ret;
+}
+
+static void test_order(void) {
+    struct job jobs[TIMERS];
+    sched_context sched;
+    int i, done;
+
+    sched_init(&sched);
+    for (i = 0; i < TIMERS; i++) {
+        jobs[i].ret = SCHED_DONE;
+        jobs[i].runs = 0;
+        CHECK(sched_add(&sched, &jobs[i].timer, 1 + rand() % 100, job_run,
+                        &jobs[i]) == 0);
+    }
+
+    /* a timer removed from the middle of the heap never runs */
+    sched_remove(&sched, &jobs[TIMERS / 2].timer);
+    CHECK(jobs[TIMERS / 2].timer.index == -1);
+    CHECK(sched.count == TIMERS - 1);
+
+    for (done = 0; !done;) {
+        last = 0;
+        CHECK(sched_run(&sched) > 0);
+        for (done = 1, i = 0; i < TIMERS; i++) {
+            if (i != TIMERS / 2 && jobs[i].runs < 2) {
+                done = 0;
+            }
+        }
+    }
+    CHECK(jobs[TIMERS / 2].runs == 0);
+
+    for (i = 0; i < TIMERS; i++) {
+        sched_remove(&sched, &jobs[i].timer);
+    }
+    CHECK(sched.count == 0);
+    CHECK(sched_run(&sched) == -1);
+}
+
+static void test_backoff(void) {
+    int i, n, delay, base = SCHED_BACKOFF_MIN;
+
+    for (i = 1; i < 40; i++) {
+        for (n = 0; n < 100; n++) {
+            delay = sched_backoff(i);
+            CHECK(delay >= base / 2);
+            CHECK(delay <= base);
+        }
+        base = base * 2 > SCHED_BACKOFF_MAX ? SCHED_BACKOFF_MAX : base * 2;
+    }
+}
+
+static void test_retry_after(void) {
+    sched_context sched;
+    struct job job;
+
+    sched_init(&sched);
+    job.ret = 2; /* the cc asks to come back in 2 seconds */
+    job.runs = 0;
+    CHECK(sched_add(&sched, &job.timer, 1, job_run, &job) == 0);
+
+    last = 0;
+    CHECK(sched_run(&sched) == 1);
+    CHECK(job.timer.failures == 0);
+    CHECK(sched_next(&sched) > 1900);
+
+    /* work queued meanwhile waits for the retry-after */
+    sched_kick(&sched, &job.timer, 0);
+    CHECK(job.timer.pending);
+    CHECK(sched_next(&sched) > 1900);
+    CHECK(job.timer.when >= job.timer.deferred);
+
+    /* a success clears the retry-after, a kick brings the job forward */
+    job.timer.when = sched_now();
+    job.ret = SCHED_DONE;
+    last = 0;
+    CHECK(sched_run(&sched) == 1);
+    CHECK(job.timer.deferred == 0);
+    sched_kick(&sched, &job.timer, 0);
+    CHECK(sched_next(&sched) == 0);
+
+    /* a failing job keeps its backoff whatever work is queued */
+    job.ret = SCHED_FAIL;
+    last = 0;
+    CHECK(sched_run(&sched) == 1);
+    CHECK(job.timer.failures == 1);
+    sched_kick(&sched, &job.timer, 0);
+    CHECK(sched_next(&sched) >= SCHED_BACKOFF_MIN / 2 - 100);
+
+    sched_remove(&sched, &job.timer);
+}
+
+static void test_kick(void) {
+    sched_context sched;
+    struct job job;
+
+    sched_init(&sched);
+    job.ret = SCHED_DONE;
+    job.runs = 0;
+    CHECK(sched_add(&sched, &job.timer, 60 * 1000, job_run, &job) == 0);
+
+    /* a second kick joins the run queued by the first */
+    job.timer.when = sched_now() + 60 * 1000;
+    sched_kick(&sched, &job.timer, 1000);
+    CHECK(job.timer.pending);
+    sched_kick(&sched, &job.timer, 0);
+    CHECK(sched_next(&sched) > 900);
+
+    /* the run takes the work, a kick meanwhile gets a run right after */
+    job.timer.when = sched_now();
+    kicked = &sched;
+    last = 0;
+    CHECK(sched_run(&sched) == 2);
+    CHECK(job.runs == 2);
+    CHECK(!job.timer.pending);
+    CHECK(sched_next(&sched) > 59 * 1000);
+
+    sched_remove(&sched, &job.timer);
+}
+
+int main(void) {
+    srand(1);
+
+    test_order();
+    test_backoff();
+    test_retry_after();
+    test_kick();
+
+    return TEST_RESULT;
+}
@@ -2,8 +2,89 @@
 
 package api
 
-import "github.com/gin-gonic/gin"
+import (
+	"errors"
+	"log"
+	"net/http"
+	"strconv"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/h1zzz/purewater/cc/database"
+	"github.com/h1zzz/purewater/cc/server"
+)
 
 // RegisterAgent ...
 func RegisterAgent(r *gin.RouterGroup) {
+	r.POST("/task", AgentTask)
+	r.GET("/history", AgentHistory)
+}
+
+type AgentTaskParam struct {
+	ID   string `json:"id"`
+	Data []byte `json:"data"`
+}
+
+func AgentTask(c *gin.Context) {
+	var params AgentTaskParam
+	if err := c.ShouldBindJSON(&params); err != nil {
+		log.Print(err)
+		APIReply(c, http.StatusBadRequest, -1, err.Error(), nil)
+		return
+	}
+
+	if !server.ValidAgentID(params.ID) {
+		APIReply(c, http.StatusBadRequest, -1, "Invalid agent id", nil)
+		return
+	}
+
+	id, err := Server.Enqueue(params.ID, params.Data)
+	switch {
+	case err == nil:
+	case errors.Is(err, server.ErrTaskTooLarge):
+		APIReply(c, http.StatusRequestEntityTooLarge, -1, err.Error(), nil)
+		return
+	case errors.Is(err, server.ErrQueueFull):
+		// Backpressure: the agent has not picked up its pending tasks yet.
+		APIReply(c, http.StatusTooManyRequests, -1, err.Error(), nil)
+		return
+	default:
+		// The cluster node owning the agent could not queue the task.
+		log.Print(err)
+		APIReply(c, http.StatusBadGateway, -1, err.Error(), nil)
+		return
+	}
+
+	APIReply(c, http.StatusOK, 0, "", gin.H{"task": id})
+}
+
+// AgentHistory returns the last n (default 50, at most 1000) events of an
+// agent within the last days (default 7).
+func AgentHistory(c *gin.Context) {
+	id := c.Query("id")
+	if !server.ValidAgentID(id) {
+		APIReply(c, http.StatusBadRequest, -1, "Invalid agent id", nil)
+		return
+	}
+
+	n, err := strconv.Atoi(c.DefaultQuery("n", "50"))
+	if err != nil || n <= 0 || n > 1000 {
+		APIReply(c, http.StatusBadRequest, -1, "Invalid n", nil)
+		return
+	}
+
+	days, err := strconv.Atoi(c.DefaultQuery("days", "7"))
+	if err != nil || days <= 0 {
+		APIReply(c, http.StatusBadRequest, -1, "Invalid days", nil)
+		return
+	}
+
+	events, err := database.AgentHistory(id, time.Now().AddDate(0, 0, -days), n)
+	if err != nil {
+		log.Print(err)
+		APIReply(c, http.StatusInternalServerError, -1, err.Error(), nil)
+		return
+	}
+
+	APIReply(c, http.StatusOK, 0, "", events)
 }
@@ -7,6 +7,9 @@ import "github.com/gin-gonic/gin"
 // Register ...
 func Register(r *gin.RouterGroup) {
 	RegisterServer(r.Group("/server"))
+	RegisterAgent(r.Group("/agent"))
+	r.GET("/events", Events)
+	r.GET("/rates", Rates)
 }
 
 func APIReply(c *gin.Context, httpStatus, ret int, err string, content interface{}) {
@@ -0,0 +1,80 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package api
+
+import (
+	"encoding/json"
+	"fmt"
+	"net/http"
+	"strconv"
+	"time"
+
+	"github.com/gin-gonic/gin"
+)
+
+// Events streams state changes as server-sent events:
+//
+//	id: <seq>
+//	event: listener | listener_removed | agent
+//	data: <json>
+//
+// A new client first receives a "snapshot" event with the full state, then
+// deltas. A client that reconnects with Last-Event-ID (or ?since=<seq>)
+// resumes after that sequence number, falling back to a new snapshot when the
+// missed events are no longer buffered.
+func Events(c *gin.Context) {
+	since := c.GetHeader("Last-Event-ID")
+	if since == "" {
+		since = c.Query("since")
+	}
+	seq, _ := strconv.ParseUint(since, 10, 64)
+
+	sub, replay, snapshot := Server.Subscribe(seq)
+	defer sub.Close()
+
+	w := c.Writer
+	w.Header().Set("Content-Type", "text/event-stream")
+	w.Header().Set("Cache-Control", "no-cache")
+	w.Header().Set("X-Accel-Buffering", "no")
+	w.WriteHeader(http.StatusOK)
+
+	if snapshot != nil {
+		data, err := json.Marshal(snapshot)
+		if err != nil {
+			return
+		}
+		fmt.Fprintf(w, "id: %d\nevent: snapshot\ndata: %s\n\n", snapshot.Seq, data)
+	}
+	for _, event := range replay {
+		fmt.Fprintf(w, "id: %d\nevent: %s\ndata: %s\n\n", event.Seq, event.Type, event.Data)
+	}
+	w.Flush()
+
+	keepalive := time.NewTicker(15 * time.Second)
+	defer keepalive.Stop()
+
+	for {
+		select {
+		case event, ok := <-sub.C:
+			if !ok {
+				// Dropped for falling behind, the client resumes.
+				return
+			}
+			fmt.Fprintf(w, "id: %d\nevent: %s\ndata: %s\n\n", event.Seq, event.Type, event.Data)
+			// Batch whatever else is already queued into the same flush.
+			for n := len(sub.C); n > 0; n-- {
+				event, ok = <-sub.C
+				if !ok {
+					break
+				}
+				fmt.Fprintf(w, "id: %d\nevent: %s\ndata: %s\n\n", event.Seq, event.Type, event.Data)
+			}
+			w.Flush()
+		case <-keepalive.C:
+			fmt.Fprint(w, ": keepalive\n\n")
+			w.Flush()
+		case <-c.Request.Context().Done():
+			return
+		}
+	}
+}
@@ -0,0 +1,156 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package api
+
+import (
+	"bufio"
+	"context"
+	"fmt"
+	"net"
+	"net/http"
+	"net/http/httptest"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+type sseEvent struct {
+	id    uint64
+	event string
+	data  string
+}
+
+// stream reads the server-sent events of GET /api/events, resuming after
+// lastEventID unless it is empty.
+type stream struct {
+	cancel context.CancelFunc
+	resp   *http.Response
+	r      *bufio.Reader
+}
+
+func openStream(t *testing.T, url, lastEventID string) *stream {
+	ctx, cancel := context.WithCancel(context.Background())
+	req, err := http.NewRequestWithContext(ctx, http.MethodGet, url+"/api/events", nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if lastEventID != "" {
+		req.Header.Set("Last-Event-ID", lastEventID)
+	}
+	resp, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if ct := resp.Header.Get("Content-Type"); ct != "text/event-stream" {
+		t.Fatalf("content type %q", ct)
+	}
+	return &stream{cancel: cancel, resp: resp, r: bufio.NewReader(resp.Body)}
+}
+
+func (s *stream) close() {
+	s.cancel()
+	s.resp.Body.Close()
+}
+
+func (s *stream) next(t *testing.T) sseEvent {
+	var e sseEvent
+	for {
+		line, err := s.r.ReadString('\n')
+		if err != nil {
+			t.Fatal(err)
+		}
+		line = strings.TrimSuffix(line, "\n")
+		switch {
+		case line == "":
+			if e.event != "" {
+				return e
+			}
+		case strings.HasPrefix(line, "id: "):
+			e.id, _ = strconv.ParseUint(line[4:], 10, 64)
+		case strings.HasPrefix(line, "event: "):
+			e.event = line[7:]
+		case strings.HasPrefix(line, "data: "):
+			e.data = line[6:]
+		}
+	}
+}
+
+func freePort(t *testing.T) int {
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer ln.Close()
+	return ln.Addr().(*net.TCPAddr).Port
+}
+
+// TestEvents checks that a client resuming within the buffered events gets
+// only those it missed, a snapshot otherwise, and that a client that does
+// not read does not hold back the check-ins.
+func TestEvents(t *testing.T) {
+	gin.SetMode(gin.TestMode)
+	r := gin.New()
+	r.GET("/api/events", Events)
+	ts := httptest.NewServer(r)
+	defer ts.Close()
+
+	port := freePort(t)
+	if err := Server.Start(server.ListenerTCP, port); err != nil {
+		t.Fatal(err)
+	}
+	defer Server.Stop(port)
+	v, _ := Server.Listeners().Load(port)
+	l := v.(server.Listener)
+
+	checkin := func(id string) { Server.Checkin(l, id, "127.0.0.1:1234") }
+
+	s := openStream(t, ts.URL, "")
+	if e := s.next(t); e.event != "snapshot" {
+		t.Fatalf("first event %q, want a snapshot", e.event)
+	}
+	checkin("events-1")
+	first := s.next(t)
+	if first.event != server.EventAgent || !strings.Contains(first.data, `"id":"events-1"`) {
+		t.Fatalf("got %q %s, want agent events-1", first.event, first.data)
+	}
+	s.close()
+
+	// Resuming after events-1 gets the two check-ins missed only.
+	checkin("events-2")
+	checkin("events-3")
+	s = openStream(t, ts.URL, strconv.FormatUint(first.id, 10))
+	for _, id := range []string{"events-2", "events-3"} {
+		e := s.next(t)
+		if e.event != server.EventAgent || !strings.Contains(e.data, `"id":"`+id+`"`) {
+			t.Fatalf("got %q %s, want agent %s", e.event, e.data, id)
+		}
+	}
+	s.close()
+
+	// An id no longer buffered gets a snapshot.
+	s = openStream(t, ts.URL, "1")
+	if e := s.next(t); e.event != "snapshot" || !strings.Contains(e.data, `"id":"events-3"`) {
+		t.Fatalf("got %q %s, want a snapshot", e.event, e.data)
+	}
+	s.close()
+
+	// A client that stops reading is dropped, check-ins go on.
+	s = openStream(t, ts.URL, "")
+	defer s.close()
+	done := make(chan struct{})
+	go func() {
+		for i := 0; i < 4*1024; i++ {
+			checkin(fmt.Sprintf("events-slow-%d", i))
+		}
+		close(done)
+	}()
+	select {
+	case <-done:
+	case <-time.After(10 * time.Second):
+		t.Fatal("check-ins blocked by a slow client")
+	}
+}
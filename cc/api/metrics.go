@@ -0,0 +1,54 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package api
+
+import (
+	"bytes"
+	"net/http"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/h1zzz/purewater/cc/metrics"
+)
+
+var (
+	apiRequests = metrics.NewCounter()
+	apiErrors   = metrics.NewCounter()
+	apiActive   metrics.Gauge
+	apiLatency  = metrics.NewHistogram()
+)
+
+// MetricsMiddleware counts the API requests and their latency. Long-lived
+// event and rate streams are counted as active only.
+func MetricsMiddleware(c *gin.Context) {
+	start := time.Now()
+	apiActive.Inc()
+	c.Next()
+	apiActive.Dec()
+
+	apiRequests.Inc()
+	if c.Writer.Status() >= http.StatusBadRequest {
+		apiErrors.Inc()
+	}
+	if path := c.FullPath(); path != "/api/events" && path != "/api/rates" {
+		apiLatency.Since(start)
+	}
+}
+
+// Metrics serves the listener and API metrics in the Prometheus text format.
+func Metrics(c *gin.Context) {
+	var buf bytes.Buffer
+
+	Server.WriteMetrics(&buf)
+
+	metrics.WriteHelp(&buf, "purewater_api_requests_total", "counter", "API requests.")
+	metrics.WriteCounter(&buf, "purewater_api_requests_total", "", apiRequests.Value())
+	metrics.WriteHelp(&buf, "purewater_api_errors_total", "counter", "API requests answered with an error status.")
+	metrics.WriteCounter(&buf, "purewater_api_errors_total", "", apiErrors.Value())
+	metrics.WriteHelp(&buf, "purewater_api_active_requests", "gauge", "API requests in progress.")
+	metrics.WriteGauge(&buf, "purewater_api_active_requests", "", apiActive.Value())
+	metrics.WriteHelp(&buf, "purewater_api_request_seconds", "histogram", "API request latency.")
+	metrics.WriteHistogram(&buf, "purewater_api_request_seconds", "", apiLatency.Snapshot())
+
+	c.Data(http.StatusOK, "text/plain; version=0.0.4", buf.Bytes())
+}
@@ -0,0 +1,71 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package api
+
+import (
+	"net/http"
+	"net/http/httptest"
+	"strconv"
+	"strings"
+	"testing"
+
+	"github.com/gin-gonic/gin"
+)
+
+// TestMetrics checks that the middleware counts requests, errors and
+// latency, and that they come out in the Prometheus text format.
+func TestMetrics(t *testing.T) {
+	gin.SetMode(gin.TestMode)
+	r := gin.New()
+	r.Use(MetricsMiddleware)
+	r.GET("/api/ok", func(c *gin.Context) { c.Status(http.StatusOK) })
+	r.GET("/api/missing", func(c *gin.Context) { c.Status(http.StatusNotFound) })
+	r.GET("/api/metrics", Metrics)
+
+	requests, errors := apiRequests.Value(), apiErrors.Value()
+	observed := apiLatency.Snapshot().Count
+
+	for _, path := range []string{"/api/ok", "/api/ok", "/api/missing"} {
+		r.ServeHTTP(httptest.NewRecorder(), httptest.NewRequest(http.MethodGet, path, nil))
+	}
+
+	if n := apiRequests.Value() - requests; n != 3 {
+		t.Errorf("%d requests counted, want 3", n)
+	}
+	if n := apiErrors.Value() - errors; n != 1 {
+		t.Errorf("%d errors counted, want 1", n)
+	}
+	if n := apiLatency.Snapshot().Count - observed; n != 3 {
+		t.Errorf("%d latencies observed, want 3", n)
+	}
+	if n := apiActive.Value(); n != 0 {
+		t.Errorf("%d requests active, want 0", n)
+	}
+
+	w := httptest.NewRecorder()
+	r.ServeHTTP(w, httptest.NewRequest(http.MethodGet, "/api/metrics", nil))
+	if w.Code != http.StatusOK {
+		t.Fatalf("status %d", w.Code)
+	}
+	if ct := w.Header().Get("Content-Type"); ct != "text/plain; version=0.0.4" {
+		t.Errorf("content type %q", ct)
+	}
+
+	out := w.Body.String()
+	for _, line := range []string{
+		"# HELP purewater_api_requests_total API requests.\n",
+		"# TYPE purewater_api_requests_total counter\n",
+		"purewater_api_requests_total " + strconv.FormatUint(requests+3, 10) + "\n",
+		"purewater_api_errors_total " + strconv.FormatUint(errors+1, 10) + "\n",
+		"# TYPE purewater_api_active_requests gauge\n",
+		"purewater_api_active_requests 1\n", // the metrics request itself
+		"# TYPE purewater_api_request_seconds histogram\n",
+		`purewater_api_request_seconds_bucket{le="+Inf"} ` + strconv.FormatUint(observed+3, 10) + "\n",
+		"purewater_api_request_seconds_sum ",
+		"purewater_api_request_seconds_count " + strconv.FormatUint(observed+3, 10) + "\n",
+	} {
+		if !strings.Contains(out, line) {
+			t.Errorf("no %q in:\n%s", line, out)
+		}
+	}
+}
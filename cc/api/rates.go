@@ -0,0 +1,102 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package api
+
+import (
+	"encoding/json"
+	"fmt"
+	"net/http"
+	"strconv"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// maxRatePoints bounds the history sent per listener when the client does
+// not ask for fewer.
+const maxRatePoints = 2000
+
+type ratesEvent struct {
+	Port       int                `json:"port"`
+	Resolution string             `json:"resolution"`
+	Points     []server.RatePoint `json:"points"`
+}
+
+// Rates streams the check-in, byte and error rates of the listeners as
+// server-sent events:
+//
+//	event: rates
+//	data: {"port": <port>, "resolution": "1s", "points": [...]}
+//
+// Query parameters: resolution is 1s (default), 1m or 1h, points bounds the
+// history first sent per listener, which is downsampled to fit, and port
+// selects a single listener. New points follow as they are completed.
+func Rates(c *gin.Context) {
+	res, ok := server.ParseRateResolution(c.DefaultQuery("resolution", "1s"))
+	if !ok {
+		APIReply(c, http.StatusBadRequest, -1, "resolution must be 1s, 1m or 1h", nil)
+		return
+	}
+	max, err := strconv.Atoi(c.DefaultQuery("points", strconv.Itoa(maxRatePoints)))
+	if err != nil || max <= 0 || max > maxRatePoints {
+		max = maxRatePoints
+	}
+	port, _ := strconv.Atoi(c.Query("port"))
+
+	w := c.Writer
+	w.Header().Set("Content-Type", "text/event-stream")
+	w.Header().Set("Cache-Control", "no-cache")
+	w.Header().Set("X-Accel-Buffering", "no")
+	w.WriteHeader(http.StatusOK)
+
+	// Time of the newest point sent for each listener.
+	sent := make(map[int]int64)
+
+	send := func() {
+		n := 0
+		Server.Listeners().Range(func(k, v interface{}) bool {
+			l := v.(server.Listener)
+			if port != 0 && l.Port() != port {
+				return true
+			}
+
+			since, ok := sent[l.Port()]
+			points, newest := l.Metrics().Rates.Points(res, since, max)
+			if len(points) == 0 && ok {
+				return true
+			}
+			sent[l.Port()] = newest
+
+			data, err := json.Marshal(ratesEvent{Port: l.Port(), Resolution: res.String(), Points: points})
+			if err == nil {
+				fmt.Fprintf(w, "event: rates\ndata: %s\n\n", data)
+				n++
+			}
+			return true
+		})
+		if n == 0 {
+			fmt.Fprint(w, ": keepalive\n\n")
+		}
+		w.Flush()
+	}
+	send()
+
+	// New 1m and 1h points are completed on the minute and the hour, a
+	// finer check keeps their delay short.
+	tick := res.Step()
+	if tick > time.Minute {
+		tick = time.Minute
+	}
+	ticker := time.NewTicker(tick)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ticker.C:
+			send()
+		case <-c.Request.Context().Done():
+			return
+		}
+	}
+}
@@ -21,6 +21,7 @@ var (
 func RegisterServer(r *gin.RouterGroup) {
 	r.POST("/start", ServerStart)
 	r.POST("/stop", ServerStop)
+	r.POST("/restart", ServerRestart)
 	r.GET("/info", ServerInfo)
 	r.GET("/list", ServerList)
 }
@@ -76,6 +77,31 @@ func ServerStop(c *gin.Context) {
 	APIReply(c, http.StatusOK, 0, "", nil)
 }
 
+// ServerRestart replaces a listener without closing its port, see
+// server.Server.Restart.
+func ServerRestart(c *gin.Context) {
+	var params ServerParam
+	if err := c.ShouldBindJSON(&params); err != nil {
+		log.Print(err)
+		APIReply(c, http.StatusBadRequest, -1, err.Error(), nil)
+		return
+	}
+
+	if !util.ValidPort(params.Port) {
+		APIReply(c, http.StatusBadRequest, -1, "Invalid port", nil)
+		return
+	}
+
+	err := Server.Restart(params.Port)
+	if err != nil {
+		log.Print(err)
+		APIReply(c, http.StatusBadRequest, -1, err.Error(), nil)
+		return
+	}
+
+	APIReply(c, http.StatusOK, 0, "", nil)
+}
+
 func ServerInfo(c *gin.Context) {
 	port, err := strconv.Atoi(c.Query("port"))
 	if err != nil {
@@ -91,12 +117,10 @@ func ServerInfo(c *gin.Context) {
 
 	if v, ok := Server.Listeners().Load(port); ok {
 		l := v.(server.Listener)
-		APIReply(c, http.StatusOK, 0, "", gin.H{
-			"protocol": l.Protocol(),
-			"port":     l.Port(),
-			"comment":  l.Comment(),
-			"status":   l.Status(),
-		})
+		APIReply(c, http.StatusOK, 0, "", struct {
+			server.ListenerInfo
+			Metrics server.ListenerMetricsSnapshot `json:"metrics"`
+		}{server.NewListenerInfo(l), l.Metrics().Snapshot()})
 		return
 	}
 
@@ -104,15 +128,9 @@ func ServerInfo(c *gin.Context) {
 }
 
 func ServerList(c *gin.Context) {
-	var list []gin.H
+	var list []server.ListenerInfo
 	Server.Listeners().Range(func(k, v interface{}) bool {
-		l := v.(server.Listener)
-		list = append(list, gin.H{
-			"protocol": l.Protocol(),
-			"port":     l.Port(),
-			"comment":  l.Comment(),
-			"status":   l.Status(),
-		})
+		list = append(list, server.NewListenerInfo(v.(server.Listener)))
 		return true
 	})
 	APIReply(c, http.StatusOK, 0, "", list)
@@ -2,8 +2,14 @@
 
 package database
 
+import "time"
+
 type Agent struct {
-	ID      string `json:"id" gorm:"id"`
-	Host    string `json:"host" gorm:"host"`
-	Address string `json:"address" gorm:"address"`
+	ID        string    `json:"id" gorm:"id"`
+	Host      string    `json:"host" gorm:"host"`
+	Address   string    `json:"address" gorm:"address"`
+	Protocol  string    `json:"protocol" gorm:"protocol"`
+	FirstSeen time.Time `json:"first_seen" gorm:"first_seen"`
+	LastSeen  time.Time `json:"last_seen" gorm:"last_seen"`
+	Checkins  uint64    `json:"checkins" gorm:"checkins"`
 }
@@ -0,0 +1,315 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package database
+
+import (
+	stdsql "database/sql"
+	"fmt"
+	"sort"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
+)
+
+type EventType uint8
+
+const (
+	EventCheckin       = EventType(1)
+	EventTaskQueued    = EventType(2)
+	EventTaskDelivered = EventType(3)
+)
+
+// Event is a row of the agent_event history table.
+type Event struct {
+	AgentID  string    `json:"agent_id" gorm:"agent_id"`
+	Time     time.Time `json:"time" gorm:"time"`
+	Seq      uint64    `json:"seq" gorm:"seq"`
+	Type     EventType `json:"type" gorm:"type"`
+	TaskID   uint64    `json:"task_id" gorm:"task_id"`
+	Address  string    `json:"address" gorm:"address"`
+	Protocol string    `json:"protocol" gorm:"protocol"`
+}
+
+const eventInsert = "INSERT INTO `agent_event` (`agent_id`, `time`, `seq`, `type`, `task_id`, `address`, `protocol`) VALUES %s"
+
+// maxPendingEvents bounds the memory held while the database is unreachable,
+// newer events are dropped beyond it.
+const maxPendingEvents = 1 << 20
+
+// eventWriterRetries is the number of flushes an event is tried in before it
+// is dropped.
+const eventWriterRetries = 3
+
+// pendingEvent is an event waiting to be inserted.
+type pendingEvent struct {
+	Event
+	failures int // inserts that failed
+}
+
+// EventWriter appends agent events to the day-partitioned agent_event table
+// in multi-row inserts, and keeps the partitions rolling: partitions are
+// created ahead of time and expired by dropping them whole instead of with
+// DELETE.
+type EventWriter struct {
+	db        *stdsql.DB
+	interval  time.Duration
+	size      int
+	retention int
+	seq       uint64
+	mu        sync.Mutex
+	pending   []pendingEvent
+	dropped   int
+	stmts     *stmtCache
+	kick      chan struct{}
+	done      chan struct{}
+	wg        sync.WaitGroup
+}
+
+// NewEventWriter starts a writer on the database opened by InitDatabase,
+// history older than retention days is dropped.
+func NewEventWriter(interval time.Duration, size, retention int) (*EventWriter, error) {
+	db, err := sql.DB()
+	if err != nil {
+		return nil, err
+	}
+
+	w := newEventWriter(db, interval, size, retention)
+	if err := w.rotate(time.Now()); err != nil {
+		w.Close()
+		return nil, err
+	}
+
+	return w, nil
+}
+
+func newEventWriter(db *stdsql.DB, interval time.Duration, size, retention int) *EventWriter {
+	w := &EventWriter{
+		db:        db,
+		interval:  interval,
+		size:      size,
+		retention: retention,
+		seq:       uint64(time.Now().UnixNano()),
+		stmts:     newStmtCache(db, eventInsert, 7, size),
+		kick:      make(chan struct{}, 1),
+		done:      make(chan struct{}),
+	}
+
+	w.wg.Add(1)
+	go w.run()
+
+	return w
+}
+
+// Record queues an event, Seq is assigned by the writer.
+func (w *EventWriter) Record(event Event) {
+	event.Seq = atomic.AddUint64(&w.seq, 1)
+
+	w.mu.Lock()
+	if len(w.pending) >= maxPendingEvents {
+		w.dropped++
+		w.mu.Unlock()
+		return
+	}
+	w.pending = append(w.pending, pendingEvent{Event: event})
+	n := len(w.pending)
+	w.mu.Unlock()
+
+	if n >= w.size {
+		select {
+		case w.kick <- struct{}{}:
+		default:
+		}
+	}
+}
+
+// Close flushes the pending events and stops the writer.
+func (w *EventWriter) Close() error {
+	close(w.done)
+	w.wg.Wait()
+	w.stmts.close()
+	return nil
+}
+
+func (w *EventWriter) run() {
+	defer w.wg.Done()
+
+	ticker := time.NewTicker(w.interval)
+	defer ticker.Stop()
+
+	day := time.Now().YearDay()
+
+	for {
+		select {
+		case <-ticker.C:
+		case <-w.kick:
+		case <-w.done:
+			w.flush()
+			return
+		}
+
+		w.flush()
+
+		if now := time.Now(); now.YearDay() != day {
+			if err := w.rotate(now); err != nil {
+				logger.Warn("agent_event rotate", "err", err)
+			} else {
+				day = now.YearDay()
+			}
+		}
+	}
+}
+
+// flush inserts the pending events in batches of size events. A batch that
+// fails is requeued and the next ones are still inserted, events that failed
+// eventWriterRetries flushes are dropped.
+func (w *EventWriter) flush() {
+	w.mu.Lock()
+	events, dropped := w.pending, w.dropped
+	w.pending, w.dropped = nil, 0
+	w.mu.Unlock()
+
+	if dropped != 0 {
+		logger.Error("agent_event queue full, events dropped", "events", dropped)
+	}
+
+	for len(events) != 0 {
+		n := len(events)
+		if n > w.size {
+			n = w.size
+		}
+		if err := w.insert(events[:n]); err != nil {
+			logger.Warn("agent_event insert", "events", n, "err", err)
+			w.requeue(events[:n])
+		}
+		events = events[n:]
+	}
+}
+
+func (w *EventWriter) insert(events []pendingEvent) error {
+	stmt, err := w.stmts.get(len(events))
+	if err != nil {
+		return err
+	}
+
+	args := make([]interface{}, 0, len(events)*7)
+	for i := range events {
+		e := &events[i]
+		args = append(args, e.AgentID, e.Time, e.Seq, e.Type, e.TaskID, e.Address, e.Protocol)
+	}
+
+	_, err = stmt.Exec(args...)
+	return err
+}
+
+// requeue puts a batch that failed back ahead of the pending events, or drops
+// the events that failed too many times.
+func (w *EventWriter) requeue(batch []pendingEvent) {
+	events := make([]pendingEvent, 0, len(batch))
+	failed := 0
+	for _, e := range batch {
+		e.failures++
+		if e.failures >= eventWriterRetries {
+			failed++
+			continue
+		}
+		events = append(events, e)
+	}
+	if failed != 0 {
+		logger.Error("agent_event insert failed, events dropped", "events", failed, "retries", eventWriterRetries)
+	}
+
+	w.mu.Lock()
+	defer w.mu.Unlock()
+
+	if len(events)+len(w.pending) > maxPendingEvents {
+		n := len(events) + len(w.pending) - maxPendingEvents
+		if n > len(events) {
+			n = len(events)
+		}
+		w.dropped += n
+		events = events[:len(events)-n]
+	}
+	w.pending = append(events, w.pending...)
+}
+
+// partitionName returns the name of the partition holding the day of t.
+func partitionName(t time.Time) string { return t.Format("p20060102") }
+
+// rotate creates the partitions for the next days and drops those past the
+// retention.
+func (w *EventWriter) rotate(now time.Time) error {
+	rows, err := w.db.Query("SELECT `PARTITION_NAME` FROM `information_schema`.`PARTITIONS` " +
+		"WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'agent_event' AND `PARTITION_NAME` IS NOT NULL")
+	if err != nil {
+		return err
+	}
+
+	exists := make(map[string]bool)
+	var names []string
+	for rows.Next() {
+		var name string
+		if err := rows.Scan(&name); err != nil {
+			rows.Close()
+			return err
+		}
+		exists[name] = true
+		names = append(names, name)
+	}
+	rows.Close()
+	if err := rows.Err(); err != nil {
+		return err
+	}
+
+	today := time.Date(now.Year(), now.Month(), now.Day(), 0, 0, 0, 0, time.Local)
+
+	// Split the catch-all p_future partition into the missing days.
+	var add string
+	for i := 0; i < 7; i++ {
+		day := today.AddDate(0, 0, i)
+		if exists[partitionName(day)] {
+			continue
+		}
+		add += fmt.Sprintf("PARTITION %s VALUES LESS THAN (TO_DAYS('%s')), ",
+			partitionName(day), day.AddDate(0, 0, 1).Format("2006-01-02"))
+	}
+	if add != "" {
+		_, err := w.db.Exec("ALTER TABLE `agent_event` REORGANIZE PARTITION p_future INTO (" +
+			add + "PARTITION p_future VALUES LESS THAN MAXVALUE)")
+		if err != nil {
+			return err
+		}
+	}
+
+	// Expire old history by dropping whole partitions.
+	oldest := partitionName(today.AddDate(0, 0, -w.retention))
+	var drop []string
+	for _, name := range names {
+		if name != "p_future" && name < oldest {
+			drop = append(drop, name)
+		}
+	}
+	if len(drop) != 0 {
+		sort.Strings(drop)
+		list := drop[0]
+		for _, name := range drop[1:] {
+			list += ", " + name
+		}
+		if _, err := w.db.Exec("ALTER TABLE `agent_event` DROP PARTITION " + list); err != nil {
+			return err
+		}
+	}
+
+	return nil
+}
+
+// AgentHistory returns the last n events of the agent since the given time,
+// newest first. The lookup is a backward range scan of the primary key
+// (agent_id, time, seq), restricted to the partitions after since.
+func AgentHistory(id string, since time.Time, n int) ([]Event, error) {
+	var events []Event
+	err := sql.Raw("SELECT `agent_id`, `time`, `seq`, `type`, `task_id`, `address`, `protocol` FROM `agent_event` "+
+		"WHERE `agent_id` = ? AND `time` >= ? ORDER BY `time` DESC, `seq` DESC LIMIT ?", id, since, n).Scan(&events).Error
+	return events, err
+}
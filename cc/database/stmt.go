@@ -0,0 +1,60 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package database
+
+import (
+	stdsql "database/sql"
+	"strings"
+)
+
+// stmtCache prepares multi-row statements by row count. Full batches always
+// use the same statement, so only the sizes of partial batches are prepared
+// again, and at most a few of those are kept around.
+type stmtCache struct {
+	db    *stdsql.DB
+	query string // "... VALUES %s ..."
+	row   string // "(?, ?, ...)"
+	size  int
+	stmts map[int]*stdsql.Stmt
+}
+
+func newStmtCache(db *stdsql.DB, query string, cols, size int) *stmtCache {
+	return &stmtCache{
+		db:    db,
+		query: query,
+		row:   "(" + strings.TrimSuffix(strings.Repeat("?, ", cols), ", ") + ")",
+		size:  size,
+		stmts: make(map[int]*stdsql.Stmt),
+	}
+}
+
+func (c *stmtCache) get(n int) (*stdsql.Stmt, error) {
+	if stmt, ok := c.stmts[n]; ok {
+		return stmt, nil
+	}
+
+	rows := strings.TrimSuffix(strings.Repeat(c.row+", ", n), ", ")
+	stmt, err := c.db.Prepare(strings.Replace(c.query, "%s", rows, 1))
+	if err != nil {
+		return nil, err
+	}
+
+	if n != c.size && len(c.stmts) >= 16 {
+		for k, v := range c.stmts {
+			if k != c.size {
+				v.Close()
+				delete(c.stmts, k)
+			}
+		}
+	}
+	c.stmts[n] = stmt
+
+	return stmt, nil
+}
+
+func (c *stmtCache) close() {
+	for n, stmt := range c.stmts {
+		stmt.Close()
+		delete(c.stmts, n)
+	}
+}
@@ -0,0 +1,215 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package database
+
+import (
+	stdsql "database/sql"
+	"sync"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
+)
+
+const agentWriterShards = 16
+
+// agentWriterRetries is the number of flushes an agent's check-ins are
+// retried for before they are dropped.
+const agentWriterRetries = 3
+
+const agentUpsert = "INSERT INTO `agent` (`id`, `address`, `protocol`, `first_seen`, `last_seen`, `checkins`) VALUES %s " +
+	"ON DUPLICATE KEY UPDATE `address` = VALUES(`address`), `protocol` = VALUES(`protocol`), " +
+	"`last_seen` = GREATEST(`last_seen`, VALUES(`last_seen`)), `checkins` = `checkins` + VALUES(`checkins`)"
+
+// pendingAgent is the coalesced check-ins of an agent, failures counts the
+// flushes that failed to write them.
+type pendingAgent struct {
+	Agent
+	failures int
+}
+
+type agentShard struct {
+	mu      sync.Mutex
+	pending map[string]*pendingAgent
+}
+
+// AgentWriter persists agent check-ins write-behind. Check-ins are coalesced
+// per agent in memory and flushed as multi-row upserts every interval, or
+// sooner once size agents are pending, so the check-in path never waits for
+// the database.
+type AgentWriter struct {
+	db       *stdsql.DB
+	interval time.Duration
+	size     int
+	shards   [agentWriterShards]agentShard
+	stmts    *stmtCache
+	kick     chan struct{}
+	done     chan struct{}
+	wg       sync.WaitGroup
+}
+
+// NewAgentWriter starts a writer on the database opened by InitDatabase.
+func NewAgentWriter(interval time.Duration, size int) (*AgentWriter, error) {
+	db, err := sql.DB()
+	if err != nil {
+		return nil, err
+	}
+	return newAgentWriter(db, interval, size), nil
+}
+
+func newAgentWriter(db *stdsql.DB, interval time.Duration, size int) *AgentWriter {
+	w := &AgentWriter{
+		db:       db,
+		interval: interval,
+		size:     size,
+		stmts:    newStmtCache(db, agentUpsert, 6, size),
+		kick:     make(chan struct{}, 1),
+		done:     make(chan struct{}),
+	}
+	for i := range w.shards {
+		w.shards[i].pending = make(map[string]*pendingAgent)
+	}
+
+	w.wg.Add(1)
+	go w.run()
+
+	return w
+}
+
+// Record queues a check-in of the agent.
+func (w *AgentWriter) Record(id, address, protocol string, t time.Time) {
+	shard := w.shard(id)
+
+	shard.mu.Lock()
+	agent, ok := shard.pending[id]
+	if !ok {
+		agent = &pendingAgent{Agent: Agent{ID: id, FirstSeen: t}}
+		shard.pending[id] = agent
+	}
+	agent.Address = address
+	agent.Protocol = protocol
+	agent.LastSeen = t
+	agent.Checkins++
+	n := len(shard.pending)
+	shard.mu.Unlock()
+
+	if n*agentWriterShards >= w.size {
+		select {
+		case w.kick <- struct{}{}:
+		default:
+		}
+	}
+}
+
+// shard hashes id with FNV-1a to pick its shard.
+func (w *AgentWriter) shard(id string) *agentShard {
+	h := uint32(2166136261)
+	for i := 0; i < len(id); i++ {
+		h ^= uint32(id[i])
+		h *= 16777619
+	}
+	return &w.shards[h%agentWriterShards]
+}
+
+// Close flushes the pending check-ins and stops the writer.
+func (w *AgentWriter) Close() error {
+	close(w.done)
+	w.wg.Wait()
+
+	w.stmts.close()
+	return nil
+}
+
+func (w *AgentWriter) run() {
+	defer w.wg.Done()
+
+	ticker := time.NewTicker(w.interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ticker.C:
+		case <-w.kick:
+		case <-w.done:
+			w.flush()
+			return
+		}
+		w.flush()
+	}
+}
+
+// flush writes the pending check-ins in batches of size agents. A batch
+// that fails is requeued and the next ones are still written, agents whose
+// check-ins failed agentWriterRetries flushes in a row are dropped so that
+// a batch the database keeps refusing does not pile up.
+func (w *AgentWriter) flush() {
+	var agents []*pendingAgent
+
+	for i := range w.shards {
+		shard := &w.shards[i]
+		shard.mu.Lock()
+		if len(shard.pending) != 0 {
+			for _, agent := range shard.pending {
+				agents = append(agents, agent)
+			}
+			shard.pending = make(map[string]*pendingAgent, len(shard.pending))
+		}
+		shard.mu.Unlock()
+	}
+
+	for len(agents) != 0 {
+		n := len(agents)
+		if n > w.size {
+			n = w.size
+		}
+		if err := w.upsert(agents[:n]); err != nil {
+			logger.Warn("agent upsert", "agents", n, "err", err)
+			w.requeue(agents[:n])
+		}
+		agents = agents[n:]
+	}
+}
+
+func (w *AgentWriter) upsert(agents []*pendingAgent) error {
+	stmt, err := w.stmts.get(len(agents))
+	if err != nil {
+		return err
+	}
+
+	args := make([]interface{}, 0, len(agents)*6)
+	for _, agent := range agents {
+		args = append(args, agent.ID, agent.Address, agent.Protocol, agent.FirstSeen, agent.LastSeen, agent.Checkins)
+	}
+
+	_, err = stmt.Exec(args...)
+	return err
+}
+
+// requeue merges check-ins that failed to flush back into the pending set so
+// they are retried on the next flush, or drops them after too many failures.
+func (w *AgentWriter) requeue(agents []*pendingAgent) {
+	dropped := 0
+
+	for _, a := range agents {
+		a.failures++
+		if a.failures >= agentWriterRetries {
+			dropped++
+			continue
+		}
+
+		shard := w.shard(a.ID)
+
+		shard.mu.Lock()
+		if agent, ok := shard.pending[a.ID]; ok {
+			agent.FirstSeen = a.FirstSeen
+			agent.Checkins += a.Checkins
+			agent.failures = a.failures
+		} else {
+			shard.pending[a.ID] = a
+		}
+		shard.mu.Unlock()
+	}
+
+	if dropped != 0 {
+		logger.Error("agent upsert failed, check-ins dropped", "agents", dropped, "retries", agentWriterRetries)
+	}
+}
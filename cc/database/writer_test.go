@@ -0,0 +1,222 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package database
+
+import (
+	stdsql "database/sql"
+	"database/sql/driver"
+	"errors"
+	"fmt"
+	"os"
+	"sync"
+	"testing"
+	"time"
+)
+
+// The tests run against the MySQL container of docker-compose.yml:
+//
+//	$ docker-compose up -d mysql
+//	$ MYSQL_TEST_ADDR=127.0.0.1:3306 go test ./database/
+func initTestDatabase(t testing.TB) {
+	addr := os.Getenv("MYSQL_TEST_ADDR")
+	if addr == "" {
+		t.Skip("MYSQL_TEST_ADDR is not set")
+	}
+
+	err := InitDatabase(os.Getenv("MYSQL_USER"), os.Getenv("MYSQL_PASSWORD"), addr, os.Getenv("MYSQL_DATABASE"))
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	sql.Exec("DELETE FROM `agent` WHERE `id` LIKE 'test-%'")
+	sql.Exec("DELETE FROM `agent_event` WHERE `agent_id` LIKE 'test-%'")
+}
+
+func TestAgentWriter(t *testing.T) {
+	initTestDatabase(t)
+
+	w, err := NewAgentWriter(50*time.Millisecond, 8)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	now := time.Now().Truncate(time.Second)
+	for i := 0; i < 1000; i++ {
+		w.Record(fmt.Sprintf("test-%d", i%20), "127.0.0.1:1234", "tcp", now.Add(time.Duration(i)*time.Second))
+	}
+	w.Close()
+
+	var agents []Agent
+	if err := sql.Raw("SELECT * FROM `agent` WHERE `id` LIKE 'test-%'").Scan(&agents).Error; err != nil {
+		t.Fatal(err)
+	}
+
+	if len(agents) != 20 {
+		t.Fatalf("got %d agents, want 20", len(agents))
+	}
+	for _, agent := range agents {
+		if agent.Checkins != 50 {
+			t.Errorf("%s: got %d check-ins, want 50", agent.ID, agent.Checkins)
+		}
+		if !agent.LastSeen.After(agent.FirstSeen) {
+			t.Errorf("%s: last_seen %v is not after first_seen %v", agent.ID, agent.LastSeen, agent.FirstSeen)
+		}
+	}
+}
+
+// failingDriver accepts every statement and refuses to execute those with a
+// "bad" argument, like rows the database rejects. Executed rows are counted
+// by their first column.
+type failingDriver struct {
+	mu   sync.Mutex
+	rows map[string]int
+	cols int
+}
+
+type failingConn struct{ d *failingDriver }
+type failingStmt struct{ d *failingDriver }
+
+func (d *failingDriver) Open(name string) (driver.Conn, error) { return failingConn{d}, nil }
+
+func (c failingConn) Prepare(query string) (driver.Stmt, error) { return failingStmt(c), nil }
+func (c failingConn) Close() error                              { return nil }
+func (c failingConn) Begin() (driver.Tx, error)                 { return nil, errors.New("no transactions") }
+
+func (s failingStmt) Close() error  { return nil }
+func (s failingStmt) NumInput() int { return -1 }
+func (s failingStmt) Query(args []driver.Value) (driver.Rows, error) {
+	return nil, errors.New("no queries")
+}
+
+func (s failingStmt) Exec(args []driver.Value) (driver.Result, error) {
+	for _, arg := range args {
+		if arg == "bad" {
+			return nil, errors.New("data too long")
+		}
+	}
+	s.d.mu.Lock()
+	defer s.d.mu.Unlock()
+	for i := 0; i < len(args); i += s.d.cols {
+		s.d.rows[args[i].(string)]++
+	}
+	return driver.RowsAffected(len(args) / s.d.cols), nil
+}
+
+// TestAgentWriterFailingBatch checks that a batch the database refuses does
+// not hold back the others and is dropped after agentWriterRetries flushes.
+func TestAgentWriterFailingBatch(t *testing.T) {
+	d := &failingDriver{rows: make(map[string]int), cols: 6}
+	stdsql.Register("agentwriter-failing", d)
+	db, err := stdsql.Open("agentwriter-failing", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Close()
+
+	// One agent per batch, flushed by hand.
+	w := newAgentWriter(db, time.Hour, 1)
+	defer w.Close()
+
+	now := time.Now()
+	w.Record("test-bad", "127.0.0.1:1234", "bad", now)
+	for i := 0; i < 10; i++ {
+		w.Record(fmt.Sprintf("test-%d", i), "127.0.0.1:1234", "tcp", now)
+	}
+
+	for i := 0; i < agentWriterRetries; i++ {
+		w.flush()
+	}
+
+	if len(d.rows) != 10 {
+		t.Fatalf("%d agents written, want 10", len(d.rows))
+	}
+	for i := range w.shards {
+		if n := len(w.shards[i].pending); n != 0 {
+			t.Fatalf("shard %d: %d agents still pending", i, n)
+		}
+	}
+}
+
+// TestEventWriterFailingBatch checks that a batch the database refuses does
+// not hold back the others and is dropped after eventWriterRetries flushes.
+func TestEventWriterFailingBatch(t *testing.T) {
+	d := &failingDriver{rows: make(map[string]int), cols: 7}
+	stdsql.Register("eventwriter-failing", d)
+	db, err := stdsql.Open("eventwriter-failing", "")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Close()
+
+	// One event per batch, flushed by hand.
+	w := newEventWriter(db, time.Hour, 1, 30)
+
+	now := time.Now()
+	w.Record(Event{AgentID: "test-bad", Time: now, Type: EventCheckin, Protocol: "bad"})
+	for i := 0; i < 10; i++ {
+		w.Record(Event{AgentID: fmt.Sprintf("test-%d", i), Time: now, Type: EventCheckin, Protocol: "tcp"})
+	}
+
+	for i := 0; i < eventWriterRetries; i++ {
+		w.flush()
+	}
+	w.Close()
+
+	if len(d.rows) != 10 {
+		t.Fatalf("%d events written, want 10", len(d.rows))
+	}
+	if n := len(w.pending); n != 0 {
+		t.Fatalf("%d events still pending", n)
+	}
+}
+
+func TestEventWriter(t *testing.T) {
+	initTestDatabase(t)
+
+	w, err := NewEventWriter(50*time.Millisecond, 8, 30)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	now := time.Now().Truncate(time.Second)
+	for i := 0; i < 100; i++ {
+		w.Record(Event{AgentID: "test-event", Time: now.Add(time.Duration(i-100) * time.Second), Type: EventCheckin})
+	}
+	w.Close()
+
+	events, err := AgentHistory("test-event", now.Add(-time.Hour), 10)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if len(events) != 10 {
+		t.Fatalf("got %d events, want 10", len(events))
+	}
+	if !events[0].Time.Equal(now.Add(-time.Second)) || !events[0].Time.After(events[9].Time) {
+		t.Errorf("events are not newest first: %v ... %v", events[0].Time, events[9].Time)
+	}
+}
+
+func BenchmarkAgentWriterRecord(b *testing.B) {
+	initTestDatabase(b)
+
+	w, err := NewAgentWriter(time.Second, 500)
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer w.Close()
+
+	ids := make([]string, 10000)
+	for i := range ids {
+		ids[i] = fmt.Sprintf("test-%d", i)
+	}
+
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			w.Record(ids[i%len(ids)], "127.0.0.1:1234", "tcp", time.Now())
+			i++
+		}
+	})
+}
@@ -1,2 +1,33 @@
 -- MIT License Copyright (c) 2021, h1zzz
 
+-- Current state of every agent, written in batches by database.AgentWriter.
+CREATE TABLE IF NOT EXISTS `agent` (
+  `id` VARCHAR(64) NOT NULL,
+  `host` VARCHAR(255) NOT NULL DEFAULT '',
+  `address` VARCHAR(64) NOT NULL DEFAULT '',
+  `protocol` VARCHAR(8) NOT NULL DEFAULT '',
+  `first_seen` DATETIME NOT NULL,
+  `last_seen` DATETIME NOT NULL,
+  `checkins` BIGINT UNSIGNED NOT NULL DEFAULT 0,
+  PRIMARY KEY (`id`),
+  KEY `idx_last_seen` (`last_seen`),
+  KEY `idx_protocol_last_seen` (`protocol`, `last_seen`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
+
+-- Check-in and task history, written in batches by database.EventWriter.
+-- Rows are partitioned by day, the writer creates partitions ahead of time
+-- and expires history by dropping partitions. The primary key doubles as
+-- the covering index of "last N events of agent X".
+CREATE TABLE IF NOT EXISTS `agent_event` (
+  `agent_id` VARCHAR(64) NOT NULL,
+  `time` DATETIME NOT NULL,
+  `seq` BIGINT UNSIGNED NOT NULL,
+  `type` TINYINT UNSIGNED NOT NULL,
+  `task_id` BIGINT UNSIGNED NOT NULL DEFAULT 0,
+  `address` VARCHAR(64) NOT NULL DEFAULT '',
+  `protocol` VARCHAR(8) NOT NULL DEFAULT '',
+  PRIMARY KEY (`agent_id`, `time`, `seq`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci
+PARTITION BY RANGE (TO_DAYS(`time`)) (
+  PARTITION p_future VALUES LESS THAN MAXVALUE
+);
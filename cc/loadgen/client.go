@@ -0,0 +1,290 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package main
+
+import (
+	"bytes"
+	"crypto/tls"
+	"encoding/base64"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math/rand"
+	"net"
+	"net/http"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// client checks in as one agent. Like the agent, it keeps its connection or
+// socket between check-ins.
+type client interface {
+	// checkin returns the task frame of the response, a busy frame when the
+	// agent is deferred.
+	checkin() ([]byte, error)
+	close()
+}
+
+var (
+	errRcode   = errors.New("dns error response")
+	emptyFrame = server.AppendTaskFrame(nil, nil)
+)
+
+func newClient(protocol server.ListenerProtocol, addr, id string, timeout time.Duration) client {
+	switch protocol {
+	case server.ListenerTCP:
+		msg := make([]byte, 2+len(id))
+		binary.BigEndian.PutUint16(msg, uint16(len(id)))
+		copy(msg[2:], id)
+		return &tcpClient{addr: addr, msg: msg, timeout: timeout}
+	case server.ListenerUDP:
+		return &udpClient{addr: addr, msg: []byte(id), timeout: timeout}
+	case server.ListenerHTTP, server.ListenerHTTPS:
+		return &httpClient{
+			url: fmt.Sprintf("%s://%s/?id=%s", protocol, addr, id),
+			client: &http.Client{
+				Timeout: timeout,
+				// One connection, and TLS session, per agent.
+				Transport: &http.Transport{
+					MaxIdleConnsPerHost: 1,
+					TLSClientConfig:     &tls.Config{InsecureSkipVerify: true},
+				},
+			},
+		}
+	case server.ListenerDNS:
+		return &dnsClient{addr: addr, query: dnsQuery(id), timeout: timeout}
+	}
+	panic("unsupported protocol " + string(protocol))
+}
+
+type tcpClient struct {
+	addr    string
+	msg     []byte
+	timeout time.Duration
+	conn    net.Conn
+	frame   []byte
+}
+
+// checkin sends the agent id prefixed with its 16-bit length and reads the
+// frame prefixed with its 32-bit length.
+func (c *tcpClient) checkin() ([]byte, error) {
+	if c.conn == nil {
+		conn, err := net.DialTimeout("tcp", c.addr, c.timeout)
+		if err != nil {
+			return nil, err
+		}
+		c.conn = conn
+	}
+
+	frame, err := c.exchange()
+	if err != nil {
+		c.close()
+		return nil, err
+	}
+	if _, busy := server.FrameRetryAfter(frame); busy {
+		// The listener closes the connection after a busy frame.
+		c.close()
+	}
+	return frame, nil
+}
+
+func (c *tcpClient) exchange() ([]byte, error) {
+	var hdr [4]byte
+
+	c.conn.SetDeadline(time.Now().Add(c.timeout))
+	if _, err := c.conn.Write(c.msg); err != nil {
+		return nil, err
+	}
+	if _, err := io.ReadFull(c.conn, hdr[:]); err != nil {
+		return nil, err
+	}
+
+	n := int(binary.BigEndian.Uint32(hdr[:]))
+	if cap(c.frame) < n {
+		c.frame = make([]byte, n)
+	}
+	c.frame = c.frame[:n]
+	if _, err := io.ReadFull(c.conn, c.frame); err != nil {
+		return nil, err
+	}
+	return c.frame, nil
+}
+
+func (c *tcpClient) close() {
+	if c.conn != nil {
+		c.conn.Close()
+		c.conn = nil
+	}
+}
+
+type udpClient struct {
+	addr    string
+	msg     []byte
+	timeout time.Duration
+	conn    net.Conn
+	buf     []byte
+}
+
+// checkin sends the agent id in a datagram answered with the frame. A
+// response arriving after the timeout may be taken for the next one, the
+// protocol has nothing to match them.
+func (c *udpClient) checkin() ([]byte, error) {
+	if c.conn == nil {
+		conn, err := net.Dial("udp", c.addr)
+		if err != nil {
+			return nil, err
+		}
+		c.conn = conn
+		c.buf = make([]byte, 64<<10)
+	}
+
+	c.conn.SetDeadline(time.Now().Add(c.timeout))
+	if _, err := c.conn.Write(c.msg); err != nil {
+		return nil, err
+	}
+	n, err := c.conn.Read(c.buf)
+	if err != nil {
+		return nil, err
+	}
+	return c.buf[:n], nil
+}
+
+func (c *udpClient) close() {
+	if c.conn != nil {
+		c.conn.Close()
+		c.conn = nil
+	}
+}
+
+type httpClient struct {
+	url    string
+	client *http.Client
+	body   bytes.Buffer
+}
+
+// checkin gets the frame, an empty one for 204. Deferred agents get a busy
+// frame with 429 or 503.
+func (c *httpClient) checkin() ([]byte, error) {
+	resp, err := c.client.Get(c.url)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+
+	switch resp.StatusCode {
+	case http.StatusNoContent:
+		return emptyFrame, nil
+	case http.StatusOK, http.StatusTooManyRequests, http.StatusServiceUnavailable:
+	default:
+		io.Copy(io.Discard, resp.Body)
+		return nil, fmt.Errorf("http status %d", resp.StatusCode)
+	}
+
+	c.body.Reset()
+	if _, err := c.body.ReadFrom(resp.Body); err != nil {
+		return nil, err
+	}
+	return c.body.Bytes(), nil
+}
+
+func (c *httpClient) close() { c.client.CloseIdleConnections() }
+
+type dnsClient struct {
+	addr    string
+	query   []byte
+	timeout time.Duration
+	conn    net.Conn
+	buf     []byte
+	frame   []byte
+}
+
+// dnsQuery builds a TXT query for "<id>.load.test", the query ID is set per
+// check-in.
+func dnsQuery(id string) []byte {
+	b := make([]byte, 12, 32+len(id))
+	b[2] = 0x01 // RD
+	b[5] = 1    // QDCOUNT
+	for _, label := range []string{id, "load", "test"} {
+		b = append(b, byte(len(label)))
+		b = append(b, label...)
+	}
+	return append(b, 0, 0, 16, 0, 1) // TXT, IN
+}
+
+// checkin queries the TXT record of the agent, the base64 encoded frame.
+func (c *dnsClient) checkin() ([]byte, error) {
+	if c.conn == nil {
+		conn, err := net.Dial("udp", c.addr)
+		if err != nil {
+			return nil, err
+		}
+		c.conn = conn
+		c.buf = make([]byte, 64<<10)
+	}
+
+	qid := uint16(rand.Intn(1 << 16))
+	binary.BigEndian.PutUint16(c.query, qid)
+
+	c.conn.SetDeadline(time.Now().Add(c.timeout))
+	if _, err := c.conn.Write(c.query); err != nil {
+		return nil, err
+	}
+
+	for {
+		n, err := c.conn.Read(c.buf)
+		if err != nil {
+			return nil, err
+		}
+		// Late responses to timed out queries are skipped.
+		if n >= len(c.query) && binary.BigEndian.Uint16(c.buf) == qid {
+			return c.parse(c.buf[:n])
+		}
+	}
+}
+
+// parse returns the frame of a response holding the question and a single
+// TXT answer pointing back to it.
+func (c *dnsClient) parse(resp []byte) ([]byte, error) {
+	if resp[3]&0x0f != 0 || binary.BigEndian.Uint16(resp[6:]) != 1 {
+		return nil, errRcode
+	}
+
+	// Name pointer, type, class and TTL, then RDLENGTH.
+	off := len(c.query) + 10
+	if off+2 > len(resp) {
+		return nil, errRcode
+	}
+	end := off + 2 + int(binary.BigEndian.Uint16(resp[off:]))
+	if end > len(resp) {
+		return nil, errRcode
+	}
+
+	var text []byte
+	for b := resp[off+2 : end]; len(b) > 0; {
+		n := 1 + int(b[0])
+		if n > len(b) {
+			return nil, errRcode
+		}
+		text = append(text, b[1:n]...)
+		b = b[n:]
+	}
+
+	n := base64.StdEncoding.DecodedLen(len(text))
+	if cap(c.frame) < n {
+		c.frame = make([]byte, n)
+	}
+	n, err := base64.StdEncoding.Decode(c.frame[:n], text)
+	if err != nil {
+		return nil, err
+	}
+	return c.frame[:n], nil
+}
+
+func (c *dnsClient) close() {
+	if c.conn != nil {
+		c.conn.Close()
+		c.conn = nil
+	}
+}
@@ -0,0 +1,307 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package main
+
+import (
+	"bufio"
+	"crypto/ecdsa"
+	"crypto/elliptic"
+	"crypto/rand"
+	"crypto/x509"
+	"encoding/pem"
+	"fmt"
+	"io"
+	"math/big"
+	mrand "math/rand"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// report is the outcome of one protocol, counted over the measured time
+// after the warmup.
+type report struct {
+	Protocol     string  `json:"protocol"`
+	Agents       int     `json:"agents"`
+	Seconds      float64 `json:"seconds"`
+	Checkins     uint64  `json:"checkins"`
+	Rate         float64 `json:"checkins_per_sec"`
+	Errors       uint64  `json:"errors"`
+	Busy         uint64  `json:"busy"`
+	Tasks        uint64  `json:"tasks"`
+	BytesIn      uint64  `json:"bytes_in"` // task frames received by the agents
+	P50          float64 `json:"p50_us"`
+	P99          float64 `json:"p99_us"`
+	P999         float64 `json:"p999_us"`
+	CPU          float64 `json:"cpu_percent"` // of one core, by the cc process
+	PerCPUSecond float64 `json:"checkins_per_cpu_sec"`
+	RSS          uint64  `json:"rss_bytes"` // peak sampled
+}
+
+// procStat is the CPU time and resident set size of a process.
+type procStat struct {
+	cpu time.Duration
+	rss uint64
+}
+
+// agentStats are kept by each agent and summed once the phase is over.
+type agentStats struct {
+	checkins  uint64
+	errors    uint64
+	busy      uint64
+	tasks     uint64
+	bytes     uint64
+	latencies []time.Duration
+}
+
+// runPhase starts a cc process serving protocol and runs the fleet against
+// it for the warmup and the measured duration.
+func runPhase(protocol server.ListenerProtocol, cfg *config) (report, error) {
+	dir, err := os.MkdirTemp("", "loadgen")
+	if err != nil {
+		return report{}, err
+	}
+	defer os.RemoveAll(dir)
+	if err := writeCert(dir); err != nil {
+		return report{}, err
+	}
+
+	exe, err := os.Executable()
+	if err != nil {
+		return report{}, err
+	}
+	args := []string{"-serve", string(protocol)}
+	if cfg.admission {
+		args = append(args, "-admission")
+	}
+	cmd := exec.Command(exe, args...)
+	cmd.Dir = dir // the HTTPS listener loads cert.pem and key.pem from there
+	cmd.Stderr = os.Stderr
+	tasks, err := cmd.StdinPipe()
+	if err != nil {
+		return report{}, err
+	}
+	stdout, err := cmd.StdoutPipe()
+	if err != nil {
+		return report{}, err
+	}
+	if err := cmd.Start(); err != nil {
+		return report{}, err
+	}
+	defer cmd.Wait()
+	defer tasks.Close()
+
+	line, err := bufio.NewReader(stdout).ReadString('\n')
+	if err != nil {
+		cmd.Process.Kill()
+		return report{}, fmt.Errorf("cc process: %v", err)
+	}
+	port, _ := strconv.Atoi(strings.TrimSpace(line))
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+
+	start := time.Now()
+	measure := start.Add(cfg.warmup)
+	end := measure.Add(cfg.duration)
+
+	stats := make([]agentStats, cfg.agents)
+	var wg sync.WaitGroup
+	for i := range stats {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			c := newClient(protocol, addr, agentID(i), cfg.timeout)
+			defer c.close()
+			runAgent(c, cfg, &stats[i], start, measure, end)
+		}(i)
+	}
+
+	done := make(chan struct{})
+	go queueTasks(tasks, cfg, done)
+
+	cpu, rss := sampleProcess(cmd.Process.Pid, measure, end)
+
+	wg.Wait()
+	close(done)
+
+	r := report{Protocol: string(protocol), Agents: cfg.agents, Seconds: cfg.duration.Seconds(), RSS: rss}
+	var latencies []time.Duration
+	for i := range stats {
+		s := &stats[i]
+		r.Checkins += s.checkins
+		r.Errors += s.errors
+		r.Busy += s.busy
+		r.Tasks += s.tasks
+		r.BytesIn += s.bytes
+		latencies = append(latencies, s.latencies...)
+	}
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+	r.P50 = quantile(latencies, 0.5)
+	r.P99 = quantile(latencies, 0.99)
+	r.P999 = quantile(latencies, 0.999)
+	r.Rate = float64(r.Checkins) / r.Seconds
+	r.CPU = cpu.Seconds() / r.Seconds * 100
+	if cpu > 0 {
+		r.PerCPUSecond = float64(r.Checkins) / cpu.Seconds()
+	}
+	return r, nil
+}
+
+func agentID(i int) string { return fmt.Sprintf("agent-%d", i) }
+
+// runAgent checks in every interval, give or take the jitter, like the
+// agent does: the interval starts when the previous check-in is answered, a
+// deferred agent waits the retry-after instead. Agents start spread over the
+// first interval.
+func runAgent(c client, cfg *config, s *agentStats, start, measure, end time.Time) {
+	rnd := mrand.New(mrand.NewSource(mrand.Int63()))
+	next := start.Add(time.Duration(rnd.Int63n(int64(cfg.interval))))
+
+	for next.Before(end) {
+		time.Sleep(time.Until(next))
+
+		sent := time.Now()
+		frame, err := c.checkin()
+		now := time.Now()
+		measured := !sent.Before(measure) && now.Before(end)
+
+		jitter := (2*rnd.Float64() - 1) * cfg.jitter
+		next = now.Add(time.Duration(float64(cfg.interval) * (1 + jitter)))
+		retryAfter, busy := server.FrameRetryAfter(frame)
+		if busy {
+			next = now.Add(time.Duration(retryAfter) * time.Second)
+		}
+
+		if !measured {
+			continue
+		}
+		if err != nil {
+			s.errors++
+			continue
+		}
+
+		s.checkins++
+		s.bytes += uint64(len(frame))
+		s.latencies = append(s.latencies, now.Sub(sent))
+
+		if busy {
+			s.busy++
+			continue
+		}
+		if tasks, err := server.ParseTaskFrame(frame); err == nil {
+			s.tasks += uint64(len(tasks))
+		} else {
+			s.errors++
+		}
+	}
+}
+
+// queueTasks writes the tasks to queue to the cc process, spread evenly so
+// that cfg.tasks are queued per check-in on average. Agents and sizes are
+// drawn at random, sizes by their weight in the mix.
+func queueTasks(w io.Writer, cfg *config, done chan struct{}) {
+	const tick = 10 * time.Millisecond
+
+	perTick := cfg.tasks * float64(cfg.agents) * float64(tick) / float64(cfg.interval)
+	total := 0
+	for _, s := range cfg.sizes {
+		total += s.weight
+	}
+
+	bw := bufio.NewWriter(w)
+	ticker := time.NewTicker(tick)
+	defer ticker.Stop()
+
+	owed := 0.0
+	for {
+		select {
+		case <-done:
+			return
+		case <-ticker.C:
+		}
+
+		for owed += perTick; owed >= 1; owed-- {
+			n := mrand.Intn(total)
+			size := 0
+			for _, s := range cfg.sizes {
+				if n -= s.weight; n < 0 {
+					size = s.size
+					break
+				}
+			}
+			fmt.Fprintf(bw, "%s %d\n", agentID(mrand.Intn(cfg.agents)), size)
+		}
+		if bw.Flush() != nil {
+			return
+		}
+	}
+}
+
+// sampleProcess returns the CPU time process pid used between measure and
+// end, and the peak of its RSS sampled in between.
+func sampleProcess(pid int, measure, end time.Time) (time.Duration, uint64) {
+	time.Sleep(time.Until(measure))
+	first, ok := readProcStat(pid)
+	if !ok {
+		time.Sleep(time.Until(end))
+		return 0, 0
+	}
+
+	last := first
+	peak := first.rss
+	for d := time.Until(end); d > 0; d = time.Until(end) {
+		if d > 250*time.Millisecond {
+			d = 250 * time.Millisecond
+		}
+		time.Sleep(d)
+		if st, ok := readProcStat(pid); ok {
+			last = st
+			if st.rss > peak {
+				peak = st.rss
+			}
+		}
+	}
+	return last.cpu - first.cpu, peak
+}
+
+func quantile(sorted []time.Duration, q float64) float64 {
+	if len(sorted) == 0 {
+		return 0
+	}
+	return float64(sorted[int(q*float64(len(sorted)-1))]) / float64(time.Microsecond)
+}
+
+// writeCert writes a self-signed cert.pem and key.pem to dir for the HTTPS
+// listener.
+func writeCert(dir string) error {
+	key, err := ecdsa.GenerateKey(elliptic.P256(), rand.Reader)
+	if err != nil {
+		return err
+	}
+	template := &x509.Certificate{
+		SerialNumber: big.NewInt(1),
+		NotBefore:    time.Now().Add(-time.Hour),
+		NotAfter:     time.Now().Add(24 * time.Hour),
+		DNSNames:     []string{"localhost"},
+	}
+	der, err := x509.CreateCertificate(rand.Reader, template, template, &key.PublicKey, key)
+	if err != nil {
+		return err
+	}
+	keyDER, err := x509.MarshalECPrivateKey(key)
+	if err != nil {
+		return err
+	}
+
+	err = os.WriteFile(filepath.Join(dir, "cert.pem"), pem.EncodeToMemory(&pem.Block{Type: "CERTIFICATE", Bytes: der}), 0600)
+	if err != nil {
+		return err
+	}
+	return os.WriteFile(filepath.Join(dir, "key.pem"), pem.EncodeToMemory(&pem.Block{Type: "EC PRIVATE KEY", Bytes: keyDER}), 0600)
+}
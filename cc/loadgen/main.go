@@ -0,0 +1,144 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+// Command loadgen simulates a fleet of agents checking in with the cc
+// listeners on localhost and reports what one listener sustains: check-ins
+// per second, latency percentiles, and the CPU time and RSS of the cc
+// process. Each protocol runs in turn against a fresh cc process.
+//
+//	go run ./loadgen -agents 5000 -interval 5s -duration 1m -protocols tcp,dns
+package main
+
+import (
+	"encoding/json"
+	"flag"
+	"fmt"
+	"log"
+	"math/rand"
+	"os"
+	"strconv"
+	"strings"
+	"text/tabwriter"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// maxTaskSize keeps a task frame in a single datagram, base64 encoded for
+// DNS.
+const maxTaskSize = 32 << 10
+
+type config struct {
+	agents    int
+	interval  time.Duration
+	jitter    float64
+	duration  time.Duration
+	warmup    time.Duration
+	timeout   time.Duration
+	tasks     float64 // tasks queued per check-in
+	sizes     []taskSize
+	admission bool
+}
+
+// taskSize is a task payload size and its weight in the task mix.
+type taskSize struct {
+	size   int
+	weight int
+}
+
+func main() {
+	log.SetFlags(0)
+
+	var cfg config
+	var protocols, sizes, serveProtocol string
+	var jsonOutput bool
+
+	flag.IntVar(&cfg.agents, "agents", 2000, "simulated agents per protocol")
+	flag.DurationVar(&cfg.interval, "interval", 5*time.Second, "check-in interval of each agent")
+	flag.Float64Var(&cfg.jitter, "jitter", 0.2, "random fraction added to or taken from the interval")
+	flag.DurationVar(&cfg.duration, "duration", 30*time.Second, "measured time per protocol")
+	flag.DurationVar(&cfg.warmup, "warmup", 0, "time before measuring, every agent has checked in once after an interval (default interval)")
+	flag.DurationVar(&cfg.timeout, "timeout", 5*time.Second, "check-in timeout")
+	flag.Float64Var(&cfg.tasks, "tasks", 0.1, "tasks queued per check-in, on average")
+	flag.StringVar(&sizes, "sizes", "64:70,1024:25,16384:5", "task mix, size:weight,...")
+	flag.StringVar(&protocols, "protocols", "tcp,udp,http,https,dns", "listeners to load, in turn")
+	flag.BoolVar(&cfg.admission, "admission", false, "keep the default admission control, which defers most agents of a single address")
+	flag.BoolVar(&jsonOutput, "json", false, "print the results as JSON")
+	flag.StringVar(&serveProtocol, "serve", "", "run the cc listener of a protocol, used by loadgen itself")
+	flag.Parse()
+
+	if serveProtocol != "" {
+		if err := serve(server.ListenerProtocol(serveProtocol), cfg.admission); err != nil {
+			log.Fatal(err)
+		}
+		return
+	}
+
+	if cfg.warmup == 0 {
+		cfg.warmup = cfg.interval
+	}
+	var err error
+	if cfg.sizes, err = parseSizes(sizes); err != nil {
+		log.Fatal(err)
+	}
+	if cfg.agents <= 0 || cfg.interval <= 0 || cfg.duration <= 0 {
+		log.Fatal("agents, interval and duration must be positive")
+	}
+
+	raiseFileLimit()
+	rand.Seed(time.Now().UnixNano())
+
+	var reports []report
+	for _, p := range strings.Split(protocols, ",") {
+		r, err := runPhase(server.ListenerProtocol(p), &cfg)
+		if err != nil {
+			log.Fatalf("%s: %v", p, err)
+		}
+		reports = append(reports, r)
+		if !jsonOutput {
+			log.Printf("%s done", p)
+		}
+	}
+
+	if jsonOutput {
+		enc := json.NewEncoder(os.Stdout)
+		enc.SetIndent("", "  ")
+		enc.Encode(reports)
+		return
+	}
+	printReports(reports)
+}
+
+func parseSizes(s string) ([]taskSize, error) {
+	var sizes []taskSize
+	for _, item := range strings.Split(s, ",") {
+		parts := strings.SplitN(item, ":", 2)
+		size, err := strconv.Atoi(parts[0])
+		if err != nil || size < 0 || size > maxTaskSize {
+			return nil, fmt.Errorf("bad task size %q, at most %d", item, maxTaskSize)
+		}
+		weight := 1
+		if len(parts) == 2 {
+			if weight, err = strconv.Atoi(parts[1]); err != nil || weight <= 0 {
+				return nil, fmt.Errorf("bad task weight %q", item)
+			}
+		}
+		sizes = append(sizes, taskSize{size, weight})
+	}
+	return sizes, nil
+}
+
+func printReports(reports []report) {
+	w := tabwriter.NewWriter(os.Stdout, 0, 0, 2, ' ', tabwriter.AlignRight)
+	fmt.Fprintln(w, "protocol\tagents\tcheckins/s\terrors\tbusy\ttasks\tp50\tp99\tp999\tcpu\tcheckins/cpu-s\trss\t")
+	for _, r := range reports {
+		fmt.Fprintf(w, "%s\t%d\t%.1f\t%d\t%d\t%d\t%v\t%v\t%v\t%.1f%%\t%.0f\t%.1fM\t\n",
+			r.Protocol, r.Agents, r.Rate, r.Errors, r.Busy, r.Tasks,
+			usDuration(r.P50), usDuration(r.P99), usDuration(r.P999),
+			r.CPU, r.PerCPUSecond, float64(r.RSS)/(1<<20))
+	}
+	w.Flush()
+}
+
+func usDuration(us float64) time.Duration {
+	return (time.Duration(us*1e3) * time.Nanosecond).Round(time.Microsecond)
+}
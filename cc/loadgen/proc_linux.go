@@ -0,0 +1,54 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"os"
+	"strconv"
+	"syscall"
+	"time"
+)
+
+// clockTicks is USER_HZ, the unit of the CPU times in /proc, 100 on every
+// Linux architecture Go supports.
+const clockTicks = 100
+
+// readProcStat reads the CPU time and RSS of process pid from /proc.
+func readProcStat(pid int) (procStat, bool) {
+	b, err := os.ReadFile(fmt.Sprintf("/proc/%d/stat", pid))
+	if err != nil {
+		return procStat{}, false
+	}
+
+	// The command name may hold spaces, the fields start after it.
+	i := bytes.LastIndexByte(b, ')')
+	if i < 0 {
+		return procStat{}, false
+	}
+	fields := bytes.Fields(b[i+1:])
+	if len(fields) < 22 {
+		return procStat{}, false
+	}
+
+	// utime, stime and rss are fields 14, 15 and 24 of stat(5).
+	utime, _ := strconv.ParseUint(string(fields[11]), 10, 64)
+	stime, _ := strconv.ParseUint(string(fields[12]), 10, 64)
+	rss, _ := strconv.ParseUint(string(fields[21]), 10, 64)
+
+	return procStat{
+		cpu: time.Duration(utime+stime) * time.Second / clockTicks,
+		rss: rss * uint64(os.Getpagesize()),
+	}, true
+}
+
+// raiseFileLimit lifts the soft limit on open files to the hard one, every
+// simulated agent holds a socket.
+func raiseFileLimit() {
+	var rlim syscall.Rlimit
+	if syscall.Getrlimit(syscall.RLIMIT_NOFILE, &rlim) == nil && rlim.Cur < rlim.Max {
+		rlim.Cur = rlim.Max
+		syscall.Setrlimit(syscall.RLIMIT_NOFILE, &rlim)
+	}
+}
@@ -0,0 +1,12 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+//go:build !linux
+// +build !linux
+
+package main
+
+// CPU time and RSS are only sampled on Linux, they are reported as zero
+// elsewhere.
+func readProcStat(pid int) (procStat, bool) { return procStat{}, false }
+
+func raiseFileLimit() {}
@@ -0,0 +1,79 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"net"
+	"os"
+	"strconv"
+	"strings"
+
+	"github.com/h1zzz/purewater/cc/logger"
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// serve runs the listener of a phase in its own process, so its CPU time and
+// RSS are not mixed with those of the fleet. It prints the port the listener
+// is on, then queues the tasks read from stdin, one "<agent id> <size>" per
+// line, until stdin is closed.
+func serve(protocol server.ListenerProtocol, admission bool) error {
+	logger.SetLevel(logger.LevelWarn)
+	raiseFileLimit()
+
+	s := &server.Server{}
+	if !admission {
+		// Every agent comes from 127.0.0.1, the per-source limit would
+		// defer nearly all of them.
+		s.SetAdmission(server.AdmissionConfig{})
+	}
+
+	var port int
+	var err error
+	for retry := 0; retry < 10; retry++ {
+		// The DNS listener also needs the UDP port of the same number, which
+		// may be taken.
+		if port, err = freePort(); err == nil {
+			if err = s.Start(protocol, port); err == nil {
+				break
+			}
+		}
+	}
+	if err != nil {
+		return err
+	}
+	fmt.Printf("%d\n", port)
+
+	payload := make([]byte, maxTaskSize)
+	dropped := 0
+
+	r := bufio.NewScanner(os.Stdin)
+	for r.Scan() {
+		fields := strings.Fields(r.Text())
+		if len(fields) != 2 {
+			return fmt.Errorf("bad task line: %q", r.Text())
+		}
+		size, err := strconv.Atoi(fields[1])
+		if err != nil || size < 0 || size > maxTaskSize {
+			return fmt.Errorf("bad task size: %q", r.Text())
+		}
+		if _, err := s.Enqueue(fields[0], payload[:size]); err != nil {
+			dropped++
+		}
+	}
+
+	if dropped != 0 {
+		fmt.Fprintf(os.Stderr, "%s: %d tasks dropped, queue full\n", protocol, dropped)
+	}
+	return r.Err()
+}
+
+func freePort() (int, error) {
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		return 0, err
+	}
+	defer ln.Close()
+	return ln.Addr().(*net.TCPAddr).Port, nil
+}
@@ -0,0 +1,286 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package logger
+
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+type Level int32
+
+const (
+	LevelDebug = Level(0)
+	LevelInfo  = Level(1)
+	LevelWarn  = Level(2)
+	LevelError = Level(3)
+)
+
+var levelNames = [...]string{"DEBUG", "INFO", "WARN", "ERROR"}
+
+func (lv Level) String() string {
+	if lv < LevelDebug || lv > LevelError {
+		return "LEVEL(" + strconv.Itoa(int(lv)) + ")"
+	}
+	return levelNames[lv]
+}
+
+// ParseLevel parses "debug", "info", "warn" or "error".
+func ParseLevel(s string) (Level, error) {
+	for i, name := range levelNames {
+		if strings.EqualFold(s, name) {
+			return Level(i), nil
+		}
+	}
+	return LevelInfo, fmt.Errorf("unknown log level: %s", s)
+}
+
+// ringSize is the number of formatted lines waiting for the writer, lines
+// are dropped rather than blocking the caller when it is full.
+const ringSize = 8192
+
+// Logger formats structured lines on the calling goroutine into a pooled
+// buffer and hands them to a background writer over a bounded ring, so
+// logging never waits for the output. Lines below the level cost a single
+// atomic load.
+type Logger struct {
+	level   int32
+	ring    chan *[]byte
+	dropped uint64
+	flush   chan chan struct{}
+}
+
+var bufPool = sync.Pool{New: func() interface{} {
+	b := make([]byte, 0, 256)
+	return &b
+}}
+
+func New(w io.Writer, level Level) *Logger {
+	l := &Logger{
+		level: int32(level),
+		ring:  make(chan *[]byte, ringSize),
+		flush: make(chan chan struct{}),
+	}
+	go l.run(bufio.NewWriterSize(w, 64<<10))
+	return l
+}
+
+func (l *Logger) SetLevel(level Level) { atomic.StoreInt32(&l.level, int32(level)) }
+func (l *Logger) Level() Level         { return Level(atomic.LoadInt32(&l.level)) }
+
+func (l *Logger) Enabled(level Level) bool { return level >= l.Level() }
+
+// Dropped returns the number of lines lost because the ring was full.
+func (l *Logger) Dropped() uint64 { return atomic.LoadUint64(&l.dropped) }
+
+// Log writes "time LEVEL msg key=value ..." if level is enabled, kv holds
+// alternating keys and values.
+func (l *Logger) Log(level Level, msg string, kv ...interface{}) {
+	if !l.Enabled(level) {
+		return
+	}
+
+	bp := bufPool.Get().(*[]byte)
+	b := (*bp)[:0]
+
+	b = time.Now().AppendFormat(b, "2006/01/02 15:04:05.000000")
+	b = append(b, ' ')
+	b = append(b, level.String()...)
+	b = append(b, ' ')
+	b = append(b, msg...)
+	for i := 0; i+1 < len(kv); i += 2 {
+		b = append(b, ' ')
+		b = appendValue(b, kv[i])
+		b = append(b, '=')
+		b = appendValue(b, kv[i+1])
+	}
+	b = append(b, '\n')
+
+	*bp = b
+	l.enqueue(bp)
+}
+
+func (l *Logger) enqueue(bp *[]byte) {
+	select {
+	case l.ring <- bp:
+	default:
+		atomic.AddUint64(&l.dropped, 1)
+		bufPool.Put(bp)
+	}
+}
+
+func appendValue(b []byte, v interface{}) []byte {
+	switch v := v.(type) {
+	case string:
+		if strings.ContainsAny(v, " =\"\n") {
+			return strconv.AppendQuote(b, v)
+		}
+		return append(b, v...)
+	case int:
+		return strconv.AppendInt(b, int64(v), 10)
+	case int64:
+		return strconv.AppendInt(b, v, 10)
+	case uint64:
+		return strconv.AppendUint(b, v, 10)
+	case bool:
+		return strconv.AppendBool(b, v)
+	case time.Duration:
+		return append(b, v.String()...)
+	case error:
+		return strconv.AppendQuote(b, v.Error())
+	case fmt.Stringer:
+		return appendValue(b, v.String())
+	default:
+		return appendValue(b, fmt.Sprint(v))
+	}
+}
+
+func (l *Logger) Debug(msg string, kv ...interface{}) { l.Log(LevelDebug, msg, kv...) }
+func (l *Logger) Info(msg string, kv ...interface{})  { l.Log(LevelInfo, msg, kv...) }
+func (l *Logger) Warn(msg string, kv ...interface{})  { l.Log(LevelWarn, msg, kv...) }
+func (l *Logger) Error(msg string, kv ...interface{}) { l.Log(LevelError, msg, kv...) }
+
+// Write lets the standard log package and gin write through the logger, p
+// is copied and queued as is.
+func (l *Logger) Write(p []byte) (int, error) {
+	bp := bufPool.Get().(*[]byte)
+	*bp = append((*bp)[:0], p...)
+	l.enqueue(bp)
+	return len(p), nil
+}
+
+// Flush waits until every queued line has been written.
+func (l *Logger) Flush() {
+	c := make(chan struct{})
+	l.flush <- c
+	<-c
+}
+
+func (l *Logger) run(w *bufio.Writer) {
+	var reported uint64
+
+	for {
+		select {
+		case bp := <-l.ring:
+			w.Write(*bp)
+			bufPool.Put(bp)
+			// Batch the lines already queued into one write.
+			for n := len(l.ring); n > 0; n-- {
+				bp = <-l.ring
+				w.Write(*bp)
+				bufPool.Put(bp)
+			}
+		case c := <-l.flush:
+			for n := len(l.ring); n > 0; n-- {
+				bp := <-l.ring
+				w.Write(*bp)
+				bufPool.Put(bp)
+			}
+			w.Flush()
+			close(c)
+			continue
+		}
+
+		if dropped := l.Dropped(); dropped != reported {
+			fmt.Fprintf(w, "%s WARN log ring full dropped=%d\n", time.Now().Format("2006/01/02 15:04:05.000000"), dropped-reported)
+			reported = dropped
+		}
+		w.Flush()
+	}
+}
+
+// Limiter bounds the rate of a log call site, such as a per-packet
+// message, to a number of lines per second. It is lock-free so a refused
+// line costs a few atomic operations.
+type Limiter struct {
+	perSecond  int64
+	window     int64 // current second
+	count      int64 // lines in the current second
+	suppressed uint64
+}
+
+func NewLimiter(perSecond int) *Limiter { return &Limiter{perSecond: int64(perSecond)} }
+
+// seconds is a coarse clock for the limiters, reading the time on every
+// refused line would cost more than the rest of Allow.
+var seconds = func() *int64 {
+	now := time.Now().Unix()
+	go func() {
+		for t := range time.Tick(100 * time.Millisecond) {
+			atomic.StoreInt64(&now, t.Unix())
+		}
+	}()
+	return &now
+}()
+
+// Allow reports whether a line may be written now.
+func (r *Limiter) Allow() bool {
+	now := atomic.LoadInt64(seconds)
+	if window := atomic.LoadInt64(&r.window); window != now {
+		if atomic.CompareAndSwapInt64(&r.window, window, now) {
+			atomic.StoreInt64(&r.count, 0)
+		}
+	}
+	if atomic.AddInt64(&r.count, 1) > r.perSecond {
+		atomic.AddUint64(&r.suppressed, 1)
+		return false
+	}
+	return true
+}
+
+// Suppressed returns and resets the number of lines refused since the last
+// call.
+func (r *Limiter) Suppressed() uint64 { return atomic.SwapUint64(&r.suppressed, 0) }
+
+// Log writes a line through l if both the level and the limiter allow it,
+// the number of lines suppressed before it is appended as "suppressed=N".
+func (r *Limiter) Log(l *Logger, level Level, msg string, kv ...interface{}) {
+	if !l.Enabled(level) || !r.Allow() {
+		return
+	}
+	if n := r.Suppressed(); n != 0 {
+		kv = append(kv, "suppressed", n)
+	}
+	l.Log(level, msg, kv...)
+}
+
+// StdLogger returns a standard logger writing through the limiter at level,
+// for packages such as net/http that take a *log.Logger.
+func (r *Limiter) StdLogger(level Level) *log.Logger {
+	return log.New(limiterWriter{r, level}, "", 0)
+}
+
+type limiterWriter struct {
+	r     *Limiter
+	level Level
+}
+
+func (w limiterWriter) Write(p []byte) (int, error) {
+	w.r.Log(std, w.level, strings.TrimSuffix(string(p), "\n"))
+	return len(p), nil
+}
+
+func (r *Limiter) Debug(msg string, kv ...interface{}) { r.Log(std, LevelDebug, msg, kv...) }
+func (r *Limiter) Info(msg string, kv ...interface{})  { r.Log(std, LevelInfo, msg, kv...) }
+func (r *Limiter) Warn(msg string, kv ...interface{})  { r.Log(std, LevelWarn, msg, kv...) }
+
+var std = New(os.Stderr, LevelInfo)
+
+// Default returns the process wide logger.
+func Default() *Logger { return std }
+
+func SetLevel(level Level) { std.SetLevel(level) }
+func Flush()               { std.Flush() }
+
+func Debug(msg string, kv ...interface{}) { std.Log(LevelDebug, msg, kv...) }
+func Info(msg string, kv ...interface{})  { std.Log(LevelInfo, msg, kv...) }
+func Warn(msg string, kv ...interface{})  { std.Log(LevelWarn, msg, kv...) }
+func Error(msg string, kv ...interface{}) { std.Log(LevelError, msg, kv...) }
@@ -0,0 +1,229 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package logger
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"net"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+var addr = &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 53}
+
+// syncBuffer collects the output of the writer goroutine.
+type syncBuffer struct {
+	mu  sync.Mutex
+	buf bytes.Buffer
+}
+
+func (b *syncBuffer) Write(p []byte) (int, error) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.Write(p)
+}
+
+func (b *syncBuffer) String() string {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.String()
+}
+
+// slowWriter lets the lines pile up in the ring.
+type slowWriter struct{ syncBuffer }
+
+func (w *slowWriter) Write(p []byte) (int, error) {
+	time.Sleep(time.Millisecond)
+	return w.syncBuffer.Write(p)
+}
+
+// stuckWriter blocks the writer goroutine in its first Write until release
+// is closed.
+type stuckWriter struct {
+	syncBuffer
+	once    sync.Once
+	stuck   chan struct{}
+	release chan struct{}
+}
+
+func (w *stuckWriter) Write(p []byte) (int, error) {
+	w.once.Do(func() {
+		close(w.stuck)
+		<-w.release
+	})
+	return w.syncBuffer.Write(p)
+}
+
+// TestRingFull checks that lines beyond the ring are dropped without
+// blocking the caller, counted, and reported once the writer catches up.
+func TestRingFull(t *testing.T) {
+	w := &stuckWriter{stuck: make(chan struct{}), release: make(chan struct{})}
+	l := New(w, LevelInfo)
+
+	l.Info("first")
+	<-w.stuck
+
+	for i := 0; i < ringSize+5; i++ {
+		l.Info("line", "i", i)
+	}
+	if n := l.Dropped(); n != 5 {
+		t.Fatalf("%d lines dropped, want 5", n)
+	}
+
+	close(w.release)
+	l.Flush()
+	l.Info("last")
+	l.Flush()
+
+	out := w.String()
+	if n := strings.Count(out, " INFO line "); n != ringSize {
+		t.Errorf("%d lines written, want %d", n, ringSize)
+	}
+	if !strings.Contains(out, "WARN log ring full dropped=5\n") {
+		t.Errorf("drops not reported")
+	}
+}
+
+// TestBufferReuse checks that a pooled buffer is not handed out again while
+// its line is being written: every line of concurrent callers comes out
+// whole.
+func TestBufferReuse(t *testing.T) {
+	w := &slowWriter{}
+	l := New(w, LevelInfo)
+
+	var wg sync.WaitGroup
+	for g := 0; g < 8; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			for i := 0; i < 500; i++ {
+				l.Info("line", "g", g, "i", i, "pad", strings.Repeat(fmt.Sprint(g), 1+i%300))
+				if i%50 == 0 {
+					// Lines copied in by Write must not share the caller's slice.
+					p := []byte(fmt.Sprintf("raw g=%d i=%d\n", g, i))
+					l.Write(p)
+					copy(p, "XXXXXXXX")
+				}
+			}
+		}(g)
+	}
+	wg.Wait()
+	l.Flush()
+
+	if n := l.Dropped(); n != 0 {
+		t.Skipf("%d lines dropped, the writer fell behind", n)
+	}
+
+	lines := strings.Split(strings.TrimSuffix(w.String(), "\n"), "\n")
+	if len(lines) != 8*500+8*10 {
+		t.Fatalf("%d lines, want %d", len(lines), 8*500+8*10)
+	}
+	for _, line := range lines {
+		var g, i int
+		if strings.HasPrefix(line, "raw ") {
+			if _, err := fmt.Sscanf(line, "raw g=%d i=%d", &g, &i); err != nil {
+				t.Fatalf("corrupted line %q", line)
+			}
+			continue
+		}
+		var pad string
+		k := strings.Index(line, " INFO line ")
+		if k < 0 {
+			t.Fatalf("corrupted line %q", line)
+		}
+		if _, err := fmt.Sscanf(line[k:], " INFO line g=%d i=%d pad=%s", &g, &i, &pad); err != nil {
+			t.Fatalf("corrupted line %q: %v", line, err)
+		}
+		if pad != strings.Repeat(fmt.Sprint(g), 1+i%300) {
+			t.Fatalf("corrupted line %q", line)
+		}
+	}
+}
+
+// nextSecond waits for the coarse clock of the limiters to tick into a new
+// second.
+func nextSecond(t *testing.T) {
+	now := atomic.LoadInt64(seconds)
+	deadline := time.Now().Add(2 * time.Second)
+	for atomic.LoadInt64(seconds) == now {
+		if time.Now().After(deadline) {
+			t.Fatal("limiter clock stuck")
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+}
+
+// TestLimiter checks that a limiter refuses lines past its rate, counts
+// them, and lets lines through again in the next second.
+func TestLimiter(t *testing.T) {
+	w := &syncBuffer{}
+	l := New(w, LevelInfo)
+	r := NewLimiter(3)
+
+	nextSecond(t)
+	for i := 0; i < 10; i++ {
+		r.Log(l, LevelInfo, "line", "i", i)
+	}
+	r.Log(l, LevelDebug, "below the level")
+	l.Flush()
+	if n := strings.Count(w.String(), " INFO line "); n != 3 {
+		t.Fatalf("%d lines written, want 3", n)
+	}
+
+	nextSecond(t)
+	r.Log(l, LevelInfo, "again")
+	l.Flush()
+	if !strings.Contains(w.String(), " INFO again suppressed=7\n") {
+		t.Errorf("suppressed lines not reported: %q", w.String())
+	}
+	if n := r.Suppressed(); n != 0 {
+		t.Errorf("%d lines suppressed after the report, want 0", n)
+	}
+	for i := 0; i < 2; i++ {
+		if !r.Allow() {
+			t.Fatalf("line %d of the second refused", i+2)
+		}
+	}
+	if r.Allow() {
+		t.Error("line 4 of the second allowed")
+	}
+}
+
+// BenchmarkDisabled is the cost of a per-packet debug line at info level.
+func BenchmarkDisabled(b *testing.B) {
+	l := New(io.Discard, LevelInfo)
+	r := NewLimiter(100)
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			r.Log(l, LevelDebug, "udp recv", "port", 53, "addr", addr)
+		}
+	})
+}
+
+// BenchmarkLimited is the cost of a per-packet line whose rate limit is
+// exhausted, the common case under load.
+func BenchmarkLimited(b *testing.B) {
+	l := New(io.Discard, LevelDebug)
+	r := NewLimiter(100)
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			r.Log(l, LevelDebug, "udp recv", "port", 53, "addr", addr)
+		}
+	})
+}
+
+// BenchmarkLog is the cost of formatting and queueing a line.
+func BenchmarkLog(b *testing.B) {
+	l := New(io.Discard, LevelDebug)
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			l.Log(LevelInfo, "udp recv", "port", 53, "addr", addr)
+		}
+	})
+}
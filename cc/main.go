@@ -5,10 +5,18 @@ package main
 import (
 	"fmt"
 	"log"
+	"net"
+	"net/http"
 	"os"
+	"strconv"
+	"strings"
+	"time"
 
 	"github.com/gin-gonic/gin"
 	"github.com/h1zzz/purewater/cc/api"
+	"github.com/h1zzz/purewater/cc/database"
+	"github.com/h1zzz/purewater/cc/logger"
+	"github.com/h1zzz/purewater/cc/server"
 	"github.com/joho/godotenv"
 )
 
@@ -31,19 +39,203 @@ func init() {
 	if err := godotenv.Load(); err != nil && !os.IsNotExist(err) {
 		log.Fatal(err)
 	}
+
+	if level, err := logger.ParseLevel(os.Getenv("LOG_LEVEL")); err == nil {
+		logger.SetLevel(level)
+	}
+
+	// Route the standard logger and gin through the asynchronous writer.
+	log.SetOutput(logger.Default())
+	gin.DefaultWriter = logger.Default()
+	gin.DefaultErrorWriter = logger.Default()
+}
+
+// fatal logs v and exits once the log has been written out.
+func fatal(v ...interface{}) {
+	log.Print(v...)
+	logger.Flush()
+	os.Exit(1)
 }
 
 func main() {
 	log.Print(welcomeText)
 
-	// err := database.InitDatabase(os.Getenv("MYSQL_USER"), os.Getenv("MYSQL_PASSWORD"), os.Getenv("MYSQL_ADDR"),
-	//     os.Getenv("MYSQL_DATABASE"))
-	// if err != nil {
-	//     log.Fatal(err)
-	// }
+	err := database.InitDatabase(os.Getenv("MYSQL_USER"), os.Getenv("MYSQL_PASSWORD"), os.Getenv("MYSQL_ADDR"),
+		os.Getenv("MYSQL_DATABASE"))
+	if err != nil {
+		fatal(err)
+	}
+
+	agents, err := database.NewAgentWriter(time.Second, 500)
+	if err != nil {
+		fatal(err)
+	}
+
+	retention, err := strconv.Atoi(os.Getenv("HISTORY_RETENTION_DAYS"))
+	if err != nil {
+		retention = 30
+	}
+
+	events, err := database.NewEventWriter(time.Second, 1000, retention)
+	if err != nil {
+		fatal(err)
+	}
+
+	admission := server.DefaultAdmissionConfig
+	if rate, err := strconv.ParseFloat(os.Getenv("ADMISSION_SOURCE_RATE"), 64); err == nil {
+		admission.SourceRate, admission.SourceBurst = rate, 5*rate
+	}
+	if rate, err := strconv.ParseFloat(os.Getenv("ADMISSION_LISTENER_RATE"), 64); err == nil {
+		admission.ListenerRate, admission.ListenerBurst = rate, 2*rate
+	}
+	if n, err := strconv.ParseInt(os.Getenv("ADMISSION_MAX_SESSIONS"), 10, 64); err == nil {
+		admission.MaxSessions = n
+	}
+	api.Server.SetAdmission(admission)
+
+	if secret := os.Getenv("TLS_TICKET_SECRET"); secret != "" {
+		server.SetTicketSecret([]byte(secret))
+	}
+
+	api.Server.AddCheckinHook(func(l server.Listener, agent *server.Agent) {
+		agents.Record(agent.ID(), agent.Address(), string(agent.Protocol()), agent.LastSeen())
+		events.Record(database.Event{
+			AgentID:  agent.ID(),
+			Time:     agent.LastSeen(),
+			Type:     database.EventCheckin,
+			Address:  agent.Address(),
+			Protocol: string(agent.Protocol()),
+		})
+	})
+
+	api.Server.AddTaskHook(func(agent *server.Agent, tasks []server.Task, state server.TaskState) {
+		event := database.Event{AgentID: agent.ID(), Time: time.Now(), Type: database.EventTaskQueued}
+		if state == server.TaskDelivered {
+			event.Type = database.EventTaskDelivered
+			event.Address = agent.Address()
+			event.Protocol = string(agent.Protocol())
+		}
+		for _, task := range tasks {
+			event.TaskID = task.ID
+			events.Record(event)
+		}
+	})
 
 	router := gin.Default()
+	router.Use(api.MetricsMiddleware)
+	router.GET("/metrics", api.Metrics)
 	api.Register(router.Group("/api"))
 
-	log.Fatal(router.RunTLS(fmt.Sprintf("0.0.0.0:%s", os.Getenv("API_LISTEN_PORT")), "cert.pem", "key.pem"))
+	port, err := strconv.Atoi(os.Getenv("API_LISTEN_PORT"))
+	if err != nil {
+		fatal(err)
+	}
+
+	// The API socket may be inherited from the process being upgraded, like
+	// those of the listeners.
+	ln, err := server.ListenTCP(port)
+	if err != nil {
+		fatal(err)
+	}
+
+	srv := &http.Server{Addr: fmt.Sprintf("0.0.0.0:%d", port), Handler: router}
+	servers := map[*http.Server]*net.TCPListener{srv: ln}
+
+	if os.Getenv("CLUSTER_NODES") != "" {
+		clusterSrv, clusterLn, err := startCluster()
+		if err != nil {
+			fatal(err)
+		}
+		servers[clusterSrv] = clusterLn
+	}
+
+	restoreListeners()
+	api.Server.RestoreTasks()
+
+	go handleUpgrade(servers, func() {
+		agents.Close()
+		events.Close()
+	})
+
+	err = srv.ServeTLS(ln, "cert.pem", "key.pem")
+	if err == http.ErrServerClosed {
+		// Upgraded, handleUpgrade exits once the process has drained.
+		select {}
+	}
+	agents.Close()
+	events.Close()
+	fatal(err)
+}
+
+// startCluster joins the cluster described by CLUSTER_NODE, CLUSTER_NODES
+// and CLUSTER_SECRET, and serves requests forwarded by the other nodes on
+// CLUSTER_LISTEN_PORT.
+func startCluster() (*http.Server, *net.TCPListener, error) {
+	nodes, err := server.ParseClusterNodes(os.Getenv("CLUSTER_NODES"))
+	if err != nil {
+		return nil, nil, err
+	}
+	cluster, err := server.NewCluster(os.Getenv("CLUSTER_NODE"), os.Getenv("CLUSTER_SECRET"), nodes)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	port, err := strconv.Atoi(os.Getenv("CLUSTER_LISTEN_PORT"))
+	if err != nil {
+		return nil, nil, err
+	}
+	ln, err := server.ListenTCP(port)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	api.Server.SetCluster(cluster)
+
+	srv := &http.Server{Addr: fmt.Sprintf("0.0.0.0:%d", port), Handler: api.Server.ClusterHandler()}
+	go func() {
+		if err := srv.Serve(ln); err != nil && err != http.ErrServerClosed {
+			log.Print(err)
+		}
+	}()
+
+	log.Printf("cluster node %s of %d", cluster.Self(), len(nodes))
+	return srv, ln, nil
+}
+
+// listenersEnv lists the listeners to start in a new cc process, as
+// "<protocol>/<port>" separated by commas. Their sockets are inherited
+// through server.SocketsEnv.
+const listenersEnv = "PUREWATER_LISTENERS"
+
+func restoreListeners() {
+	env := os.Getenv(listenersEnv)
+	if env == "" {
+		return
+	}
+	os.Unsetenv(listenersEnv)
+
+	for _, item := range strings.Split(env, ",") {
+		i := strings.LastIndexByte(item, '/')
+		if i == -1 {
+			continue
+		}
+		port, err := strconv.Atoi(item[i+1:])
+		if err != nil {
+			continue
+		}
+		if err := api.Server.Start(server.ListenerProtocol(item[:i]), port); err != nil {
+			log.Print(err)
+		}
+	}
+}
+
+// listenersEnvironment describes the running listeners for restoreListeners.
+func listenersEnvironment() string {
+	var items []string
+	api.Server.Listeners().Range(func(k, v interface{}) bool {
+		l := v.(server.Listener)
+		items = append(items, fmt.Sprintf("%s/%d", l.Protocol(), l.Port()))
+		return true
+	})
+	return listenersEnv + "=" + strings.Join(items, ",")
 }
@@ -0,0 +1,106 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+//go:build !windows
+// +build !windows
+
+package main
+
+import (
+	"context"
+	"fmt"
+	"log"
+	"net"
+	"net/http"
+	"os"
+	"os/exec"
+	"os/signal"
+	"syscall"
+
+	"github.com/h1zzz/purewater/cc/api"
+	"github.com/h1zzz/purewater/cc/logger"
+	"github.com/h1zzz/purewater/cc/server"
+)
+
+// handleUpgrade replaces the process on SIGUSR2: a new cc process inherits
+// the sockets of servers and of every listener, then this one stops
+// accepting, drains the check-ins in flight, hands the tasks still queued
+// over to the new process and exits. No port is closed during the upgrade,
+// connections queue on the shared sockets until the new process accepts
+// them.
+func handleUpgrade(servers map[*http.Server]*net.TCPListener, closeWriters func()) {
+	c := make(chan os.Signal, 1)
+	signal.Notify(c, syscall.SIGUSR2)
+
+	for range c {
+		tasks, err := upgrade(servers)
+		if err != nil {
+			log.Printf("upgrade: %v", err)
+			continue
+		}
+
+		signal.Stop(c)
+		log.Print("upgrade: draining")
+
+		ctx, cancel := context.WithTimeout(context.Background(), server.RestartDrain)
+		for srv := range servers {
+			srv.Shutdown(ctx)
+		}
+		api.Server.Shutdown(ctx)
+		cancel()
+
+		// Nothing is queued or delivered here any more.
+		if err := api.Server.HandOverTasks(tasks); err != nil {
+			log.Printf("upgrade: tasks: %v", err)
+		}
+		tasks.Close()
+
+		closeWriters()
+		logger.Flush()
+		os.Exit(0)
+	}
+}
+
+// upgrade starts the new process, it returns the pipe to hand the pending
+// tasks over to it.
+func upgrade(servers map[*http.Server]*net.TCPListener) (*os.File, error) {
+	files, err := api.Server.Files()
+	if err != nil {
+		return nil, err
+	}
+
+	// The child holds its own copies once started.
+	defer func() {
+		for _, f := range files {
+			f.Close()
+		}
+	}()
+
+	for _, ln := range servers {
+		f, err := ln.File()
+		if err != nil {
+			return nil, err
+		}
+		files[fmt.Sprintf("tcp/%d", ln.Addr().(*net.TCPAddr).Port)] = f
+	}
+
+	r, w, err := os.Pipe()
+	if err != nil {
+		return nil, err
+	}
+	defer r.Close()
+
+	env, extra := server.SocketsEnvironment(files)
+
+	cmd := exec.Command(os.Args[0], os.Args[1:]...)
+	cmd.Env = append(os.Environ(), env, listenersEnvironment(), api.Server.TasksEnvironment(len(extra)))
+	cmd.ExtraFiles = append(extra, r)
+	cmd.Stdout = os.Stdout
+	cmd.Stderr = os.Stderr
+	if err := cmd.Start(); err != nil {
+		w.Close()
+		return nil, err
+	}
+
+	log.Printf("upgrade: started pid %d", cmd.Process.Pid)
+	return w, nil
+}
@@ -0,0 +1,11 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package main
+
+import (
+	"net"
+	"net/http"
+)
+
+// handleUpgrade does nothing, sockets cannot be inherited on Windows.
+func handleUpgrade(servers map[*http.Server]*net.TCPListener, closeWriters func()) {}
@@ -0,0 +1,183 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package metrics
+
+import (
+	"fmt"
+	"io"
+	"runtime"
+	"sync/atomic"
+	"time"
+	"unsafe"
+)
+
+// stripes is the number of cache lines a Counter is spread over.
+var stripes = func() int {
+	n := 1
+	for n < runtime.GOMAXPROCS(0) && n < 64 {
+		n <<= 1
+	}
+	return n
+}()
+
+// stripe picks the stripe of the calling goroutine. Go has no per-CPU data,
+// goroutine stacks are distinct though, so the address of a local variable
+// spreads concurrent callers over the stripes without shared state.
+func stripe() int {
+	var x byte
+	p := uintptr(unsafe.Pointer(&x))
+	return int((p>>10)^(p>>16)) & (stripes - 1)
+}
+
+type paddedUint64 struct {
+	v uint64
+	_ [56]byte
+}
+
+// Counter is a monotonically increasing counter whose increments from
+// different goroutines mostly land on different cache lines.
+type Counter struct {
+	cells []paddedUint64
+}
+
+func NewCounter() *Counter { return &Counter{cells: make([]paddedUint64, stripes)} }
+
+func (c *Counter) Add(n uint64) { atomic.AddUint64(&c.cells[stripe()].v, n) }
+func (c *Counter) Inc()         { c.Add(1) }
+
+func (c *Counter) Value() uint64 {
+	var sum uint64
+	for i := range c.cells {
+		sum += atomic.LoadUint64(&c.cells[i].v)
+	}
+	return sum
+}
+
+// Gauge is a value that goes up and down, such as active connections.
+type Gauge struct {
+	v int64
+}
+
+func (g *Gauge) Add(n int64)  { atomic.AddInt64(&g.v, n) }
+func (g *Gauge) Inc()         { g.Add(1) }
+func (g *Gauge) Dec()         { g.Add(-1) }
+func (g *Gauge) Value() int64 { return atomic.LoadInt64(&g.v) }
+
+// Buckets are the upper bounds of the latency histogram buckets.
+var Buckets = []time.Duration{
+	50 * time.Microsecond, 100 * time.Microsecond, 250 * time.Microsecond, 500 * time.Microsecond,
+	time.Millisecond, 2500 * time.Microsecond, 5 * time.Millisecond, 10 * time.Millisecond,
+	25 * time.Millisecond, 50 * time.Millisecond, 100 * time.Millisecond, 250 * time.Millisecond,
+	500 * time.Millisecond, time.Second, 2500 * time.Millisecond,
+}
+
+type histogramStripe struct {
+	counts [16]uint64 // len(Buckets) + the +Inf bucket
+	sum    uint64     // nanoseconds
+	_      [56]byte
+}
+
+// Histogram is a striped latency histogram with the fixed Buckets.
+type Histogram struct {
+	stripes []histogramStripe
+}
+
+func NewHistogram() *Histogram { return &Histogram{stripes: make([]histogramStripe, stripes)} }
+
+func (h *Histogram) Observe(d time.Duration) {
+	i := 0
+	for i < len(Buckets) && d > Buckets[i] {
+		i++
+	}
+	s := &h.stripes[stripe()]
+	atomic.AddUint64(&s.counts[i], 1)
+	atomic.AddUint64(&s.sum, uint64(d))
+}
+
+// Since observes the time elapsed since start.
+func (h *Histogram) Since(start time.Time) { h.Observe(time.Since(start)) }
+
+type HistogramSnapshot struct {
+	Counts []uint64      `json:"counts"` // per bucket, not cumulative
+	Count  uint64        `json:"count"`
+	Sum    time.Duration `json:"sum"`
+}
+
+func (h *Histogram) Snapshot() HistogramSnapshot {
+	snap := HistogramSnapshot{Counts: make([]uint64, len(Buckets)+1)}
+	for i := range h.stripes {
+		s := &h.stripes[i]
+		for j := range snap.Counts {
+			n := atomic.LoadUint64(&s.counts[j])
+			snap.Counts[j] += n
+			snap.Count += n
+		}
+		snap.Sum += time.Duration(atomic.LoadUint64(&s.sum))
+	}
+	return snap
+}
+
+// Quantile estimates the q-quantile from the bucket upper bounds.
+func (s HistogramSnapshot) Quantile(q float64) time.Duration {
+	if s.Count == 0 {
+		return 0
+	}
+	rank := uint64(q * float64(s.Count))
+	var n uint64
+	for i, c := range s.Counts {
+		n += c
+		if n > rank {
+			if i == len(Buckets) {
+				return Buckets[len(Buckets)-1]
+			}
+			return Buckets[i]
+		}
+	}
+	return Buckets[len(Buckets)-1]
+}
+
+// WriteCounter writes a sample in the Prometheus text format, labels is
+// either empty or `name="value",...`.
+func WriteCounter(w io.Writer, name, labels string, v uint64) {
+	if labels != "" {
+		labels = "{" + labels + "}"
+	}
+	fmt.Fprintf(w, "%s%s %d\n", name, labels, v)
+}
+
+func WriteGauge(w io.Writer, name, labels string, v int64) {
+	if labels != "" {
+		labels = "{" + labels + "}"
+	}
+	fmt.Fprintf(w, "%s%s %d\n", name, labels, v)
+}
+
+// WriteHistogram writes the cumulative buckets, sum and count of a histogram
+// in seconds.
+func WriteHistogram(w io.Writer, name, labels string, s HistogramSnapshot) {
+	sep := ""
+	if labels != "" {
+		sep = ","
+	}
+
+	var n uint64
+	for i, c := range s.Counts {
+		n += c
+		le := "+Inf"
+		if i < len(Buckets) {
+			le = fmt.Sprint(Buckets[i].Seconds())
+		}
+		fmt.Fprintf(w, "%s_bucket{%s%sle=\"%s\"} %d\n", name, labels, sep, le, n)
+	}
+
+	if labels != "" {
+		labels = "{" + labels + "}"
+	}
+	fmt.Fprintf(w, "%s_sum%s %g\n", name, labels, s.Sum.Seconds())
+	fmt.Fprintf(w, "%s_count%s %d\n", name, labels, s.Count)
+}
+
+// WriteHelp writes the HELP and TYPE lines of a metric family.
+func WriteHelp(w io.Writer, name, typ, help string) {
+	fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, typ)
+}
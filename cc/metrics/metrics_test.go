@@ -0,0 +1,150 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package metrics
+
+import (
+	"bytes"
+	"strings"
+	"sync"
+	"testing"
+	"time"
+)
+
+// TestCounter checks that the stripes of a counter add up to every
+// increment of concurrent goroutines.
+func TestCounter(t *testing.T) {
+	c := NewCounter()
+
+	var wg sync.WaitGroup
+	for g := 0; g < 32; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			for i := 0; i < 1000; i++ {
+				c.Add(uint64(g))
+				c.Inc()
+			}
+		}(g)
+	}
+	wg.Wait()
+
+	// 1000 * (0 + 1 + ... + 31) + 32 * 1000
+	if v, want := c.Value(), uint64(1000*31*32/2+32*1000); v != want {
+		t.Fatalf("got %d, want %d", v, want)
+	}
+}
+
+// TestHistogramBuckets checks that a bucket holds the durations up to its
+// bound included, and the last one those past every bound.
+func TestHistogramBuckets(t *testing.T) {
+	h := NewHistogram()
+
+	for _, b := range Buckets {
+		h.Observe(b)            // in the bucket of b
+		h.Observe(b + 1)        // in the next one
+		h.Observe(b - b/10 + 1) // in the bucket of b too
+	}
+	h.Observe(0)
+
+	s := h.Snapshot()
+	if len(s.Counts) != len(Buckets)+1 {
+		t.Fatalf("%d buckets, want %d", len(s.Counts), len(Buckets)+1)
+	}
+	if s.Counts[0] != 3 {
+		t.Errorf("bucket 0: got %d, want 3", s.Counts[0])
+	}
+	for i := 1; i < len(Buckets); i++ {
+		if s.Counts[i] != 3 {
+			t.Errorf("bucket %v: got %d, want 3", Buckets[i], s.Counts[i])
+		}
+	}
+	if n := s.Counts[len(Buckets)]; n != 1 {
+		t.Errorf("bucket +Inf: got %d, want 1", n)
+	}
+	if s.Count != uint64(3*len(Buckets)+1) {
+		t.Errorf("count: got %d, want %d", s.Count, 3*len(Buckets)+1)
+	}
+
+	var sum time.Duration
+	for _, b := range Buckets {
+		sum += 3*b + 1 - b/10 + 1
+	}
+	if s.Sum != sum {
+		t.Errorf("sum: got %v, want %v", s.Sum, sum)
+	}
+}
+
+func TestHistogramQuantile(t *testing.T) {
+	h := NewHistogram()
+	if q := h.Snapshot().Quantile(0.5); q != 0 {
+		t.Errorf("empty histogram: got %v, want 0", q)
+	}
+
+	for i := 0; i < 90; i++ {
+		h.Observe(time.Millisecond)
+	}
+	for i := 0; i < 10; i++ {
+		h.Observe(time.Minute)
+	}
+
+	s := h.Snapshot()
+	if q := s.Quantile(0.5); q != time.Millisecond {
+		t.Errorf("p50: got %v, want 1ms", q)
+	}
+	if q := s.Quantile(0.99); q != Buckets[len(Buckets)-1] {
+		t.Errorf("p99: got %v, want %v", q, Buckets[len(Buckets)-1])
+	}
+}
+
+// TestWriteHistogram checks the Prometheus text format of a histogram
+// family: cumulative buckets in seconds ending with +Inf, then sum and
+// count.
+func TestWriteHistogram(t *testing.T) {
+	h := NewHistogram()
+	h.Observe(time.Millisecond)
+	h.Observe(2 * time.Millisecond)
+	h.Observe(time.Minute)
+
+	var buf bytes.Buffer
+	WriteHelp(&buf, "test_seconds", "histogram", "Test latency.")
+	WriteHistogram(&buf, "test_seconds", `port="80"`, h.Snapshot())
+	WriteHelp(&buf, "test_total", "counter", "Test counter.")
+	WriteCounter(&buf, "test_total", "", 7)
+	WriteGauge(&buf, "test_active", `port="80"`, -1)
+
+	lines := strings.Split(strings.TrimSuffix(buf.String(), "\n"), "\n")
+	want := []string{
+		"# HELP test_seconds Test latency.",
+		"# TYPE test_seconds histogram",
+		`test_seconds_bucket{port="80",le="5e-05"} 0`,
+		`test_seconds_bucket{port="80",le="0.0001"} 0`,
+		`test_seconds_bucket{port="80",le="0.00025"} 0`,
+		`test_seconds_bucket{port="80",le="0.0005"} 0`,
+		`test_seconds_bucket{port="80",le="0.001"} 1`,
+		`test_seconds_bucket{port="80",le="0.0025"} 2`,
+		`test_seconds_bucket{port="80",le="0.005"} 2`,
+		`test_seconds_bucket{port="80",le="0.01"} 2`,
+		`test_seconds_bucket{port="80",le="0.025"} 2`,
+		`test_seconds_bucket{port="80",le="0.05"} 2`,
+		`test_seconds_bucket{port="80",le="0.1"} 2`,
+		`test_seconds_bucket{port="80",le="0.25"} 2`,
+		`test_seconds_bucket{port="80",le="0.5"} 2`,
+		`test_seconds_bucket{port="80",le="1"} 2`,
+		`test_seconds_bucket{port="80",le="2.5"} 2`,
+		`test_seconds_bucket{port="80",le="+Inf"} 3`,
+		`test_seconds_sum{port="80"} 60.003`,
+		`test_seconds_count{port="80"} 3`,
+		"# HELP test_total Test counter.",
+		"# TYPE test_total counter",
+		"test_total 7",
+		`test_active{port="80"} -1`,
+	}
+	if len(lines) != len(want) {
+		t.Fatalf("got %d lines, want %d:\n%s", len(lines), len(want), buf.String())
+	}
+	for i := range want {
+		if lines[i] != want[i] {
+			t.Errorf("line %d: got %q, want %q", i+1, lines[i], want[i])
+		}
+	}
+}
@@ -0,0 +1,237 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"math"
+	"math/rand"
+	"net"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// AdmissionConfig bounds the load the listeners take on. Rates are check-ins
+// per second and bursts the number of check-ins above the rate absorbed at
+// once, a zero rate or cap disables the limit.
+type AdmissionConfig struct {
+	SourceRate     float64 // per source IP address
+	SourceBurst    float64
+	ListenerRate   float64 // per listener
+	ListenerBurst  float64
+	MaxSessions    int64         // connections and HTTP requests open at once
+	MaxRetryAfter  time.Duration // longest deferral handed out
+	SourceIdleTime time.Duration // forget sources idle that long
+}
+
+var DefaultAdmissionConfig = AdmissionConfig{
+	SourceRate:     10,
+	SourceBurst:    50,
+	ListenerRate:   10000,
+	ListenerBurst:  20000,
+	MaxSessions:    50000,
+	MaxRetryAfter:  time.Minute,
+	SourceIdleTime: 5 * time.Minute,
+}
+
+// tokenBucket admits check-ins at a rate. Once empty it spreads the check-ins
+// it refuses: each is told to come back when its turn comes after the
+// check-ins deferred before it, which spreads a reconnect storm over time
+// instead of synchronizing it on the next second. A deferral costs no token,
+// so an agent coming back is admitted as soon as the bucket has refilled.
+type tokenBucket struct {
+	mu     sync.Mutex
+	tokens float64
+	// deferred estimates the check-ins told to come back and not yet due,
+	// it drains at the rate as their turns come.
+	deferred float64
+	last     int64 // unix nanoseconds of the last refill
+}
+
+func newTokenBucket(burst float64, now int64) *tokenBucket {
+	return &tokenBucket{tokens: burst, last: now}
+}
+
+// take returns zero if a check-in is admitted now, otherwise how long it
+// should be deferred.
+func (b *tokenBucket) take(now int64, rate, burst float64, max time.Duration) time.Duration {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+
+	if now > b.last {
+		refill := float64(now-b.last) / 1e9 * rate
+		b.tokens = math.Min(burst, b.tokens+refill)
+		b.deferred = math.Max(0, b.deferred-refill)
+		b.last = now
+	}
+	if b.tokens >= 1 {
+		b.tokens--
+		return 0
+	}
+
+	wait := time.Duration((b.deferred + 1 - b.tokens) / rate * 1e9)
+	if wait > max {
+		// Deferring that far out would only grow the backlog.
+		return max
+	}
+	b.deferred++
+	return wait
+}
+
+// idle reports whether the bucket was not used for d and refilled to burst,
+// it can then be dropped.
+func (b *tokenBucket) idle(now int64, rate, burst float64, d time.Duration) bool {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return now-b.last > int64(d) && b.tokens+float64(now-b.last)/1e9*rate >= burst
+}
+
+const admissionShards = 64
+
+// admission holds the admission state of a Server.
+type admission struct {
+	config    atomic.Value // *AdmissionConfig
+	sessions  int64
+	listeners sync.Map // port -> *tokenBucket
+	sources   [admissionShards]struct {
+		sync.Mutex
+		buckets map[[16]byte]*tokenBucket
+	}
+	once sync.Once
+}
+
+func (a *admission) init() {
+	a.once.Do(func() {
+		if a.config.Load() == nil {
+			config := DefaultAdmissionConfig
+			a.config.Store(&config)
+		}
+		for i := range a.sources {
+			a.sources[i].buckets = make(map[[16]byte]*tokenBucket)
+		}
+		go a.sweep()
+	})
+}
+
+func (a *admission) Config() *AdmissionConfig {
+	a.init()
+	return a.config.Load().(*AdmissionConfig)
+}
+
+// sweep forgets idle sources so the table stays the size of the active
+// agent population.
+func (a *admission) sweep() {
+	for range time.Tick(time.Minute) {
+		config := a.Config()
+		now := time.Now().UnixNano()
+		for i := range a.sources {
+			shard := &a.sources[i]
+			shard.Lock()
+			for ip, b := range shard.buckets {
+				if b.idle(now, config.SourceRate, config.SourceBurst, config.SourceIdleTime) {
+					delete(shard.buckets, ip)
+				}
+			}
+			shard.Unlock()
+		}
+	}
+}
+
+func sourceIP(addr net.Addr) (ip [16]byte) {
+	switch addr := addr.(type) {
+	case *net.TCPAddr:
+		copy(ip[:], addr.IP.To16())
+	case *net.UDPAddr:
+		copy(ip[:], addr.IP.To16())
+	default:
+		if host, _, err := net.SplitHostPort(addr.String()); err == nil {
+			copy(ip[:], net.ParseIP(host).To16())
+		}
+	}
+	return ip
+}
+
+func (a *admission) source(ip [16]byte, config *AdmissionConfig, now int64) *tokenBucket {
+	var h byte
+	for _, c := range ip {
+		h = h*31 + c
+	}
+	shard := &a.sources[h%admissionShards]
+
+	shard.Lock()
+	defer shard.Unlock()
+
+	b, ok := shard.buckets[ip]
+	if !ok {
+		b = newTokenBucket(config.SourceBurst, now)
+		shard.buckets[ip] = b
+	}
+	return b
+}
+
+func (a *admission) listener(port int, config *AdmissionConfig, now int64) *tokenBucket {
+	if v, ok := a.listeners.Load(port); ok {
+		return v.(*tokenBucket)
+	}
+	v, _ := a.listeners.LoadOrStore(port, newTokenBucket(config.ListenerBurst, now))
+	return v.(*tokenBucket)
+}
+
+// sessionRetryAfter is the deferral of a session refused by the cap, spread
+// over a few seconds as nothing tells when sessions will close.
+func sessionRetryAfter() int { return 1 + rand.Intn(10) }
+
+// retryAfter rounds a deferral up to the whole seconds of a busy frame or a
+// Retry-After header.
+func retryAfter(wait time.Duration) int {
+	return int((wait + time.Second - 1) / time.Second)
+}
+
+// SetAdmission replaces the admission limits of the listeners.
+func (s *Server) SetAdmission(config AdmissionConfig) {
+	s.admission.config.Store(&config)
+	s.admission.init()
+}
+
+// Admit decides whether a check-in from addr on listener l is served now.
+// It returns zero, or the number of seconds the agent should wait before
+// checking in again. The source is checked first so that a single address
+// cannot drain the listener's budget.
+func (s *Server) Admit(l Listener, addr net.Addr) int {
+	config := s.admission.Config()
+	now := time.Now().UnixNano()
+
+	if config.SourceRate > 0 {
+		b := s.admission.source(sourceIP(addr), config, now)
+		if wait := b.take(now, config.SourceRate, config.SourceBurst, config.MaxRetryAfter); wait > 0 {
+			l.Metrics().Rejected.Inc()
+			return retryAfter(wait)
+		}
+	}
+	if config.ListenerRate > 0 {
+		b := s.admission.listener(l.Port(), config, now)
+		if wait := b.take(now, config.ListenerRate, config.ListenerBurst, config.MaxRetryAfter); wait > 0 {
+			l.Metrics().Rejected.Inc()
+			return retryAfter(wait)
+		}
+	}
+	return 0
+}
+
+// AcquireSession counts a connection or request against the session cap,
+// it reports false if the cap is reached. A successful call must be paired
+// with ReleaseSession.
+func (s *Server) AcquireSession(l Listener) bool {
+	config := s.admission.Config()
+	if n := atomic.AddInt64(&s.admission.sessions, 1); config.MaxSessions > 0 && n > config.MaxSessions {
+		atomic.AddInt64(&s.admission.sessions, -1)
+		l.Metrics().Rejected.Inc()
+		return false
+	}
+	return true
+}
+
+func (s *Server) ReleaseSession() { atomic.AddInt64(&s.admission.sessions, -1) }
+
+// Sessions returns the number of sessions open.
+func (s *Server) Sessions() int64 { return atomic.LoadInt64(&s.admission.sessions) }
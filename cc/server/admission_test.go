@@ -0,0 +1,141 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io"
+	"net"
+	"testing"
+	"time"
+)
+
+// TestTokenBucketDeferral checks that check-ins refused by an empty bucket
+// are spread over the following seconds rather than all deferred to the
+// next one.
+func TestTokenBucketDeferral(t *testing.T) {
+	now := time.Now().UnixNano()
+	b := newTokenBucket(10, now)
+
+	admitted := 0
+	deferred := make(map[int]int)
+	for i := 0; i < 100; i++ {
+		if wait := b.take(now, 10, 10, time.Minute); wait == 0 {
+			admitted++
+		} else {
+			deferred[retryAfter(wait)]++
+		}
+	}
+	if admitted != 10 {
+		t.Fatalf("admitted %d, want the burst of 10", admitted)
+	}
+	for s := 1; s <= 9; s++ {
+		if deferred[s] != 10 {
+			t.Fatalf("deferred %v, want 10 per second", deferred)
+		}
+	}
+
+	if wait := b.take(now, 10, 10, 5*time.Second); wait != 5*time.Second {
+		t.Fatalf("wait %v, want the 5s cap", wait)
+	}
+}
+
+// TestTokenBucketReturning checks that deferred agents coming back when told
+// are all admitted at about the rate, a deferral must not cost a token.
+func TestTokenBucketReturning(t *testing.T) {
+	const agents, rate, burst = 40, 2, 5
+	start := time.Now().UnixNano()
+	b := newTokenBucket(burst, start)
+
+	// Every agent checks in at start, then after each retry-after.
+	due := make([]int64, agents)
+	for i := range due {
+		due[i] = start
+	}
+	admitted, last := 0, start
+	for admitted < agents {
+		next := -1
+		for i, t := range due {
+			if t != 0 && (next == -1 || t < due[next]) {
+				next = i
+			}
+		}
+		now := due[next]
+		if now-start > int64(time.Minute) {
+			t.Fatalf("%d of %d agents admitted in a minute", admitted, agents)
+		}
+		if wait := b.take(now, rate, burst, time.Minute); wait == 0 {
+			admitted++
+			due[next] = 0
+			last = now
+		} else {
+			due[next] = now + int64(retryAfter(wait))*int64(time.Second)
+		}
+	}
+
+	// The burst goes at once, the rest at the rate, plus the rounding of
+	// the retry-after to whole seconds.
+	want := time.Duration((agents-burst)/rate+2) * time.Second
+	if d := time.Duration(last - start); d > want {
+		t.Fatalf("all admitted after %v, want within %v", d, want)
+	}
+}
+
+func TestAdmissionTCP(t *testing.T) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{SourceRate: 1, SourceBurst: 2, MaxSessions: 1, MaxRetryAfter: time.Minute})
+	port := freePort(t)
+	if err := s.Start(ListenerTCP, port); err != nil {
+		t.Fatal(err)
+	}
+	defer s.Stop(port)
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+
+	readFrame := func(conn net.Conn) []byte {
+		conn.SetDeadline(time.Now().Add(5 * time.Second))
+		var hdr [4]byte
+		if _, err := io.ReadFull(conn, hdr[:]); err != nil {
+			t.Fatal(err)
+		}
+		frame := make([]byte, binary.BigEndian.Uint32(hdr[:]))
+		if _, err := io.ReadFull(conn, frame); err != nil {
+			t.Fatal(err)
+		}
+		return frame
+	}
+
+	conn, err := net.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+
+	// The session cap refuses a second connection.
+	second, err := net.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if retryAfter, ok := FrameRetryAfter(readFrame(second)); !ok || retryAfter < 1 {
+		t.Fatalf("second session: retry after %d, %v", retryAfter, ok)
+	}
+	second.Close()
+
+	// The source may burst two check-ins, the third is deferred.
+	checkin := []byte{0, 5, 'a', 'g', 'e', 'n', 't'}
+	for i := 0; i < 3; i++ {
+		conn.Write(checkin)
+		frame := readFrame(conn)
+		retryAfter, busy := FrameRetryAfter(frame)
+		if busy != (i == 2) {
+			t.Fatalf("check-in %d: busy %v", i, busy)
+		}
+		if busy && retryAfter != 1 {
+			t.Fatalf("retry after %d, want 1", retryAfter)
+		}
+	}
+
+	if n := s.Sessions(); n > 1 {
+		t.Fatalf("%d sessions", n)
+	}
+}
@@ -0,0 +1,121 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"context"
+	"sync/atomic"
+	"time"
+)
+
+// Agent is the check-in session of an agent, shared by all listeners.
+type Agent struct {
+	id       string
+	address  atomic.Value
+	protocol atomic.Value
+	lastSeen int64
+	wakeup   chan struct{}
+	queue    *taskQueue
+}
+
+func newAgent(id string) *Agent {
+	return &Agent{id: id, wakeup: make(chan struct{}, 1), queue: newTaskQueue(DefaultQueueSize)}
+}
+
+// Push queues a task for the agent and releases a held check-in. It returns
+// ErrQueueFull when the agent has too many pending tasks.
+func (a *Agent) Push(task Task) error {
+	if err := a.queue.Push(task); err != nil {
+		return err
+	}
+	a.Notify()
+	return nil
+}
+
+// Drain pops the pending tasks whose frame fits in budget bytes, see
+// taskQueue.Drain.
+func (a *Agent) Drain(budget int) []Task { return a.queue.Drain(budget) }
+
+// Pending returns the approximate number of queued tasks.
+func (a *Agent) Pending() int { return a.queue.Len() }
+
+// Notify releases a check-in held open by the agent. If the agent is not
+// waiting, the next Wait returns immediately.
+func (a *Agent) Notify() {
+	select {
+	case a.wakeup <- struct{}{}:
+	default:
+	}
+}
+
+// Wait blocks until the agent is notified, the timeout expires or ctx is done.
+// It reports whether the agent was notified.
+func (a *Agent) Wait(ctx context.Context, timeout time.Duration) bool {
+	if timeout <= 0 {
+		select {
+		case <-a.wakeup:
+			return true
+		default:
+			return false
+		}
+	}
+
+	timer := time.NewTimer(timeout)
+	defer timer.Stop()
+
+	select {
+	case <-a.wakeup:
+		return true
+	case <-timer.C:
+		return false
+	case <-ctx.Done():
+		return false
+	}
+}
+
+// touch records a check-in, it reports whether the agent's address or
+// protocol changed or the check-in is the first one within a second, which
+// bounds the rate of agent events.
+func (a *Agent) touch(address string, protocol ListenerProtocol) bool {
+	changed := false
+	if a.Address() != address {
+		a.address.Store(address)
+		changed = true
+	}
+	if a.Protocol() != protocol {
+		a.protocol.Store(protocol)
+		changed = true
+	}
+	now := time.Now().Unix()
+	if atomic.SwapInt64(&a.lastSeen, now) != now {
+		changed = true
+	}
+	return changed
+}
+
+func (a *Agent) ID() string { return a.id }
+
+func (a *Agent) Address() string {
+	v, _ := a.address.Load().(string)
+	return v
+}
+
+func (a *Agent) Protocol() ListenerProtocol {
+	v, _ := a.protocol.Load().(ListenerProtocol)
+	return v
+}
+
+func (a *Agent) LastSeen() time.Time { return time.Unix(atomic.LoadInt64(&a.lastSeen), 0) }
+
+// ValidAgentID reports whether id can be used to identify an agent.
+func ValidAgentID(id string) bool {
+	if id == "" || len(id) > 64 {
+		return false
+	}
+	for _, c := range id {
+		if !('0' <= c && c <= '9' || 'a' <= c && c <= 'z' || 'A' <= c && c <= 'Z' || c == '-' || c == '_') {
+			return false
+		}
+	}
+	return true
+}
@@ -0,0 +1,376 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bytes"
+	"context"
+	"crypto/hmac"
+	"crypto/sha256"
+	"encoding/binary"
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"net/url"
+	"sort"
+	"strconv"
+	"sync/atomic"
+	"time"
+)
+
+// ClusterNode is a cc node, Addr is the base URL of its cluster handler such
+// as "http://10.0.0.2:9090".
+type ClusterNode struct {
+	ID   string
+	Addr string
+}
+
+// Cluster shares agents between cc nodes. Every node runs listeners and each
+// agent session is owned by one node chosen by consistent hashing on the
+// agent id: check-ins and tasks for an agent arriving at another node are
+// forwarded to its owner over the nodes' cluster handlers.
+type Cluster struct {
+	self     string
+	index    int // of self in the sorted node ids
+	secret   []byte
+	ring     *Ring
+	nodes    map[string]ClusterNode
+	client   *http.Client
+	forwards chan struct{} // check-ins forwarded by datagram listeners
+}
+
+// clusterSlack is added to the wait of a forwarded check-in for the request
+// timeout.
+const clusterSlack = 10 * time.Second
+
+// clusterMaxForwards bounds the check-ins a datagram listener forwards at
+// once, see Server.goForward.
+const clusterMaxForwards = 4096
+
+// clusterMaxNodes is the number of node indexes the top 16 bits of the task
+// ids hold.
+const clusterMaxNodes = 1 << 16
+
+// Requests between nodes carry the time they were made and an HMAC-SHA256
+// of it, the request URI and the body keyed with the cluster secret, so the
+// secret never goes over the wire. A request older than clusterMaxSkew is
+// refused.
+const (
+	clusterTimeHeader      = "X-Cluster-Time"
+	clusterSignatureHeader = "X-Cluster-Signature"
+	clusterMaxSkew         = 30 * time.Second
+)
+
+// clusterHeldHeader returns how long a forwarded check-in was held.
+const clusterHeldHeader = "X-Cluster-Held"
+
+// NewCluster describes the cluster as seen from node self, nodes lists every
+// node including self. The secret authenticates the nodes to each other, it
+// must not be empty.
+func NewCluster(self, secret string, nodes []ClusterNode) (*Cluster, error) {
+	if secret == "" {
+		return nil, errors.New("cluster secret is empty")
+	}
+
+	if len(nodes) > clusterMaxNodes {
+		return nil, fmt.Errorf("more than %d cluster nodes", clusterMaxNodes)
+	}
+
+	c := &Cluster{
+		self:     self,
+		secret:   []byte(secret),
+		nodes:    make(map[string]ClusterNode),
+		forwards: make(chan struct{}, clusterMaxForwards),
+		client: &http.Client{Transport: &http.Transport{
+			MaxIdleConns:        1024,
+			MaxIdleConnsPerHost: 256,
+			IdleConnTimeout:     90 * time.Second,
+		}},
+	}
+
+	ids := make([]string, 0, len(nodes))
+	for _, node := range nodes {
+		if _, ok := c.nodes[node.ID]; ok {
+			return nil, fmt.Errorf("duplicate cluster node: %s", node.ID)
+		}
+		c.nodes[node.ID] = node
+		ids = append(ids, node.ID)
+	}
+	if _, ok := c.nodes[self]; !ok {
+		return nil, fmt.Errorf("cluster node %s is not in the node list", self)
+	}
+	c.ring = NewRing(ids)
+
+	// Every node sorts the same list, whatever the order it was given in.
+	sort.Strings(ids)
+	c.index = sort.SearchStrings(ids, self)
+
+	return c, nil
+}
+
+// ParseClusterNodes parses "<id>=<addr>,...".
+func ParseClusterNodes(s string) ([]ClusterNode, error) {
+	var nodes []ClusterNode
+	for _, item := range bytes.Split([]byte(s), []byte(",")) {
+		item = bytes.TrimSpace(item)
+		if len(item) == 0 {
+			continue
+		}
+		i := bytes.IndexByte(item, '=')
+		if i <= 0 {
+			return nil, fmt.Errorf("invalid cluster node: %s", item)
+		}
+		nodes = append(nodes, ClusterNode{ID: string(item[:i]), Addr: string(item[i+1:])})
+	}
+	return nodes, nil
+}
+
+func (c *Cluster) Self() string { return c.self }
+
+// Owner returns the node owning the agent.
+func (c *Cluster) Owner(id string) ClusterNode { return c.nodes[c.ring.Owner(id)] }
+
+// remote returns the owner of the agent if it is another node.
+func (c *Cluster) remote(id string) (ClusterNode, bool) {
+	node := c.Owner(id)
+	return node, node.ID != c.self
+}
+
+// sign returns the hex HMAC of a request made at t, uri is its path and
+// query.
+func (c *Cluster) sign(t, uri string, body []byte) string {
+	mac := hmac.New(sha256.New, c.secret)
+	mac.Write([]byte(t))
+	mac.Write([]byte{'\n'})
+	mac.Write([]byte(uri))
+	mac.Write([]byte{'\n'})
+	mac.Write(body)
+	return hex.EncodeToString(mac.Sum(nil))
+}
+
+// verify checks the time and signature of a request from another node,
+// body is its content.
+func (c *Cluster) verify(r *http.Request, body []byte) bool {
+	t := r.Header.Get(clusterTimeHeader)
+	nsec, err := strconv.ParseInt(t, 10, 64)
+	if err != nil {
+		return false
+	}
+	if skew := time.Since(time.Unix(0, nsec)); skew > clusterMaxSkew || skew < -clusterMaxSkew {
+		return false
+	}
+
+	signature, err := hex.DecodeString(r.Header.Get(clusterSignatureHeader))
+	if err != nil {
+		return false
+	}
+	expected, _ := hex.DecodeString(c.sign(t, r.URL.RequestURI(), body))
+	return hmac.Equal(signature, expected)
+}
+
+func (c *Cluster) do(ctx context.Context, node ClusterNode, path string, query url.Values, body []byte) (*http.Response, error) {
+	uri := path + "?" + query.Encode()
+	req, err := http.NewRequestWithContext(ctx, http.MethodPost, node.Addr+uri, bytes.NewReader(body))
+	if err != nil {
+		return nil, err
+	}
+	t := strconv.FormatInt(time.Now().UnixNano(), 10)
+	req.Header.Set(clusterTimeHeader, t)
+	req.Header.Set(clusterSignatureHeader, c.sign(t, uri, body))
+
+	resp, err := c.client.Do(req)
+	if err != nil {
+		return nil, err
+	}
+	if resp.StatusCode != http.StatusOK {
+		io.Copy(ioutil.Discard, resp.Body)
+		resp.Body.Close()
+		switch resp.StatusCode {
+		case http.StatusTooManyRequests:
+			return nil, ErrQueueFull
+		case http.StatusRequestEntityTooLarge:
+			return nil, ErrTaskTooLarge
+		}
+		return nil, fmt.Errorf("cluster node %s: %s", node.ID, resp.Status)
+	}
+	return resp, nil
+}
+
+// poll forwards a check-in to the agent's owner, see Server.Poll.
+func (c *Cluster) poll(ctx context.Context, node ClusterNode, id, address string, protocol ListenerProtocol,
+	budget int, wait time.Duration) ([]Task, time.Duration, error) {
+	ctx, cancel := context.WithTimeout(ctx, wait+clusterSlack)
+	defer cancel()
+
+	query := url.Values{
+		"id":       {id},
+		"address":  {address},
+		"protocol": {string(protocol)},
+		"budget":   {strconv.Itoa(budget)},
+		"wait":     {strconv.FormatInt(int64(wait), 10)},
+	}
+	resp, err := c.do(ctx, node, "/cluster/poll", query, nil)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer resp.Body.Close()
+
+	held, _ := strconv.ParseInt(resp.Header.Get(clusterHeldHeader), 10, 64)
+	frame, err := ioutil.ReadAll(resp.Body)
+	if err != nil {
+		return nil, time.Duration(held), err
+	}
+	tasks, err := ParseTaskFrame(frame)
+	return tasks, time.Duration(held), err
+}
+
+// enqueue forwards a new task to the agent's owner and returns its id.
+func (c *Cluster) enqueue(ctx context.Context, node ClusterNode, id string, data []byte) (uint64, error) {
+	ctx, cancel := context.WithTimeout(ctx, clusterSlack)
+	defer cancel()
+
+	resp, err := c.do(ctx, node, "/cluster/enqueue", url.Values{"id": {id}}, data)
+	if err != nil {
+		return 0, err
+	}
+	defer resp.Body.Close()
+
+	var b [8]byte
+	if _, err := io.ReadFull(resp.Body, b[:]); err != nil {
+		return 0, err
+	}
+	return binary.BigEndian.Uint64(b[:]), nil
+}
+
+// ClusterHandler serves the requests forwarded by other cluster nodes, signed
+// with the cluster secret. It should only be reachable by them.
+func (s *Server) ClusterHandler() http.Handler {
+	mux := http.NewServeMux()
+	mux.HandleFunc("/cluster/poll", s.clusterPoll)
+	mux.HandleFunc("/cluster/enqueue", s.clusterEnqueue)
+
+	return http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		c := s.Cluster()
+		if c == nil || r.Method != http.MethodPost {
+			http.Error(w, "forbidden", http.StatusForbidden)
+			return
+		}
+
+		// Nodes send no body past the largest task.
+		body, err := ioutil.ReadAll(io.LimitReader(r.Body, MaxTaskSize+1))
+		if err != nil || !c.verify(r, body) {
+			http.Error(w, "forbidden", http.StatusForbidden)
+			return
+		}
+		r.Body = ioutil.NopCloser(bytes.NewReader(body))
+
+		mux.ServeHTTP(w, r)
+	})
+}
+
+// clusterPoll serves a forwarded check-in. It is handled here even if the
+// ring of this node disagrees, forwarding again could loop while nodes are
+// being reconfigured.
+func (s *Server) clusterPoll(w http.ResponseWriter, r *http.Request) {
+	q := r.URL.Query()
+	id := q.Get("id")
+	if !ValidAgentID(id) {
+		http.Error(w, "invalid agent id", http.StatusBadRequest)
+		return
+	}
+	budget, _ := strconv.Atoi(q.Get("budget"))
+	wait, _ := strconv.ParseInt(q.Get("wait"), 10, 64)
+	if time.Duration(wait) > maxPollWait {
+		wait = int64(maxPollWait)
+	}
+
+	agent := s.checkin(nil, id, q.Get("address"), ListenerProtocol(q.Get("protocol")))
+	tasks, held := s.poll(r.Context(), agent, budget, time.Duration(wait))
+
+	frame := AppendTaskFrame(nil, tasks)
+	w.Header().Set("Content-Type", "application/octet-stream")
+	w.Header().Set(clusterHeldHeader, strconv.FormatInt(int64(held), 10))
+	w.Write(frame)
+}
+
+func (s *Server) clusterEnqueue(w http.ResponseWriter, r *http.Request) {
+	id := r.URL.Query().Get("id")
+	data, err := ioutil.ReadAll(http.MaxBytesReader(w, r.Body, MaxTaskSize+1))
+	if err != nil || !ValidAgentID(id) {
+		http.Error(w, "bad request", http.StatusBadRequest)
+		return
+	}
+
+	if len(data) > MaxTaskSize {
+		http.Error(w, ErrTaskTooLarge.Error(), http.StatusRequestEntityTooLarge)
+		return
+	}
+	taskID, err := s.enqueue(s.Agent(id), data)
+	if errors.Is(err, ErrQueueFull) {
+		http.Error(w, err.Error(), http.StatusTooManyRequests)
+		return
+	}
+
+	var b [8]byte
+	binary.BigEndian.PutUint64(b[:], taskID)
+	w.Write(b[:])
+}
+
+// SetCluster makes the server a node of c, or a single node if c is nil. It
+// is set once at startup: membership is static, so no agent changes owner
+// and no queued task has to move.
+func (s *Server) SetCluster(c *Cluster) {
+	s.cluster.Store(&c)
+	if c == nil {
+		return
+	}
+
+	// Task ids stay unique across nodes, the top 16 bits hold the index of
+	// the node that queued the task.
+	base := uint64(c.index) << 48
+	for {
+		id := atomic.LoadUint64(&s.taskID)
+		if id>>48 == base>>48 || atomic.CompareAndSwapUint64(&s.taskID, id, base) {
+			break
+		}
+	}
+}
+
+// Cluster returns the cluster of the server, nil for a single node.
+func (s *Server) Cluster() *Cluster {
+	if c, ok := s.cluster.Load().(**Cluster); ok {
+		return *c
+	}
+	return nil
+}
+
+// Forwarded reports whether check-ins of agent id are forwarded to another
+// cluster node.
+func (s *Server) Forwarded(id string) bool {
+	if c := s.Cluster(); c != nil {
+		_, ok := c.remote(id)
+		return ok
+	}
+	return false
+}
+
+// goForward runs f, serving a forwarded check-in, on its own goroutine so
+// that a slow node does not hold up the read loop of a datagram listener.
+// With clusterMaxForwards already in flight the check-in is dropped, as a
+// lost datagram, and goForward returns false.
+func (s *Server) goForward(f func()) bool {
+	c := s.Cluster()
+	select {
+	case c.forwards <- struct{}{}:
+	default:
+		return false
+	}
+	go func() {
+		defer func() { <-c.forwards }()
+		f()
+	}()
+	return true
+}
@@ -0,0 +1,268 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bytes"
+	"context"
+	"fmt"
+	"net"
+	"net/http"
+	"net/http/httptest"
+	"strconv"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+func TestRingBalance(t *testing.T) {
+	r3 := NewRing([]string{"a", "b", "c"})
+	r4 := NewRing([]string{"a", "b", "c", "d"})
+
+	const n = 30000
+	counts := make(map[string]int)
+	moved := 0
+	for i := 0; i < n; i++ {
+		id := fmt.Sprintf("agent-%d", i)
+		owner := r4.Owner(id)
+		counts[owner]++
+		if old := r3.Owner(id); old != owner && owner != "d" {
+			t.Fatalf("%s moved from %s to %s", id, old, owner)
+		}
+		if r3.Owner(id) != owner {
+			moved++
+		}
+	}
+	for node, count := range counts {
+		if count < n/4*8/10 || count > n/4*12/10 {
+			t.Errorf("node %s owns %d of %d agents", node, count, n)
+		}
+	}
+	t.Logf("%v, %d moved", counts, moved)
+}
+
+// newTestCluster starts nodes sharing agents over loopback.
+func newTestCluster(t *testing.T, n int) []*Server {
+	servers := make([]*Server, n)
+	nodes := make([]ClusterNode, n)
+	for i := range servers {
+		s := &Server{}
+		ts := httptest.NewServer(s.ClusterHandler())
+		t.Cleanup(ts.Close)
+		servers[i] = s
+		nodes[i] = ClusterNode{ID: fmt.Sprintf("cc%d", i), Addr: ts.URL}
+	}
+	for i, s := range servers {
+		c, err := NewCluster(nodes[i].ID, "secret", nodes)
+		if err != nil {
+			t.Fatal(err)
+		}
+		s.SetCluster(c)
+	}
+	return servers
+}
+
+func TestClusterForwarding(t *testing.T) {
+	servers := newTestCluster(t, 3)
+	listeners := make([]*TCPListener, len(servers))
+	for i, s := range servers {
+		listeners[i] = &TCPListener{srv: s, protocol: ListenerTCP, metrics: newListenerMetrics()}
+	}
+
+	for i := 0; i < 30; i++ {
+		id := fmt.Sprintf("agent-%d", i)
+		taskID, err := servers[i%3].Enqueue(id, []byte(id))
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		// Check in on another node than the one the task was queued on.
+		l := listeners[(i+1)%3]
+		tasks, _ := l.srv.Poll(context.Background(), l, id, "127.0.0.1:1", 0, 0)
+		if len(tasks) != 1 || tasks[0].ID != taskID || string(tasks[0].Data) != id {
+			t.Fatalf("%s: got %v, want task %d", id, tasks, taskID)
+		}
+	}
+
+	owned := 0
+	for _, s := range servers {
+		s.Agents().Range(func(k, v interface{}) bool {
+			owned++
+			return true
+		})
+	}
+	if owned != 30 {
+		t.Fatalf("%d agent sessions, want 30", owned)
+	}
+}
+
+func TestClusterLongPoll(t *testing.T) {
+	servers := newTestCluster(t, 3)
+	id := "agent-poll"
+	owner := servers[0].Cluster().Owner(id).ID
+
+	// Hold the check-in on a node that does not own the agent.
+	var s *Server
+	for _, s = range servers {
+		if s.Cluster().Self() != owner {
+			break
+		}
+	}
+	l := &HTTPListener{srv: s, protocol: ListenerHTTP, metrics: newListenerMetrics()}
+
+	done := make(chan []Task)
+	go func() {
+		tasks, _ := s.Poll(context.Background(), l, id, "127.0.0.1:1", 0, 10*time.Second)
+		done <- tasks
+	}()
+
+	time.Sleep(100 * time.Millisecond)
+	if _, err := servers[2].Enqueue(id, []byte("wake")); err != nil {
+		t.Fatal(err)
+	}
+
+	select {
+	case tasks := <-done:
+		if len(tasks) != 1 || string(tasks[0].Data) != "wake" {
+			t.Fatalf("got %v", tasks)
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatal("held check-in was not released")
+	}
+}
+
+// TestClusterAuth checks that the cluster handler only serves requests
+// signed with the cluster secret, recently, for the URI and body sent.
+func TestClusterAuth(t *testing.T) {
+	s := &Server{}
+	c, err := NewCluster("cc0", "secret", []ClusterNode{{ID: "cc0"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	s.SetCluster(c)
+	ts := httptest.NewServer(s.ClusterHandler())
+	defer ts.Close()
+
+	other, err := NewCluster("cc0", "other", []ClusterNode{{ID: "cc0"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	const uri = "/cluster/enqueue?id=agent"
+	now := time.Now()
+	for _, tc := range []struct {
+		name    string
+		signer  *Cluster
+		t       time.Time
+		signed  string // URI signed
+		body    string // body signed
+		noSig   bool
+		allowed bool
+	}{
+		{name: "signed", signer: c, t: now, signed: uri, body: "task", allowed: true},
+		{name: "unsigned", signer: c, t: now, signed: uri, body: "task", noSig: true},
+		{name: "other secret", signer: other, t: now, signed: uri, body: "task"},
+		{name: "stale", signer: c, t: now.Add(-time.Minute), signed: uri, body: "task"},
+		{name: "future", signer: c, t: now.Add(time.Minute), signed: uri, body: "task"},
+		{name: "other agent", signer: c, t: now, signed: "/cluster/enqueue?id=other", body: "task"},
+		{name: "other body", signer: c, t: now, signed: uri, body: "other"},
+	} {
+		req, err := http.NewRequest(http.MethodPost, ts.URL+uri, bytes.NewReader([]byte("task")))
+		if err != nil {
+			t.Fatal(err)
+		}
+		nsec := strconv.FormatInt(tc.t.UnixNano(), 10)
+		req.Header.Set(clusterTimeHeader, nsec)
+		if !tc.noSig {
+			req.Header.Set(clusterSignatureHeader, tc.signer.sign(nsec, tc.signed, []byte(tc.body)))
+		}
+
+		resp, err := http.DefaultClient.Do(req)
+		if err != nil {
+			t.Fatal(err)
+		}
+		resp.Body.Close()
+		if allowed := resp.StatusCode == http.StatusOK; allowed != tc.allowed {
+			t.Errorf("%s: status %s", tc.name, resp.Status)
+		}
+	}
+}
+
+// TestClusterTaskIDs checks that the nodes number their tasks apart, by
+// their index in the sorted node list.
+func TestClusterTaskIDs(t *testing.T) {
+	servers := newTestCluster(t, 3)
+	for i, s := range servers {
+		if base := atomic.LoadUint64(&s.taskID) >> 48; base != uint64(i) {
+			t.Errorf("node cc%d numbers tasks from %d<<48", i, base)
+		}
+	}
+
+	// The order of the list does not matter.
+	nodes := []ClusterNode{{ID: "cc2"}, {ID: "cc0"}, {ID: "cc1"}}
+	for i, id := range []string{"cc0", "cc1", "cc2"} {
+		c, err := NewCluster(id, "secret", nodes)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if c.index != i {
+			t.Errorf("node %s has index %d, want %d", id, c.index, i)
+		}
+	}
+}
+
+func TestClusterEmptySecret(t *testing.T) {
+	nodes := []ClusterNode{{ID: "cc0", Addr: "http://127.0.0.1:1"}}
+	if _, err := NewCluster("cc0", "", nodes); err == nil {
+		t.Fatal("cluster started without a secret")
+	}
+}
+
+// TestClusterSlowNode checks that a check-in forwarded to a slow node does not
+// hold up the other check-ins of a UDP listener.
+func TestClusterSlowNode(t *testing.T) {
+	slow := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		time.Sleep(2 * time.Second)
+		w.Write(AppendTaskFrame(nil, nil))
+	}))
+	defer slow.Close()
+
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{})
+	c, err := NewCluster("cc0", "secret", []ClusterNode{{ID: "cc0"}, {ID: "cc1", Addr: slow.URL}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	s.SetCluster(c)
+
+	var local, remote string
+	for i := 0; local == "" || remote == ""; i++ {
+		id := fmt.Sprintf("agent-%d", i)
+		if s.Forwarded(id) {
+			remote = id
+		} else {
+			local = id
+		}
+	}
+
+	port := freeUDPPort(t)
+	if err := s.Start(ListenerUDP, port); err != nil {
+		t.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	conn, err := net.Dial("udp", fmt.Sprintf("127.0.0.1:%d", port))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+
+	conn.Write([]byte(remote))
+	conn.Write([]byte(local))
+
+	conn.SetReadDeadline(time.Now().Add(time.Second))
+	var resp [udpFrameBudget]byte
+	if _, err := conn.Read(resp[:]); err != nil {
+		t.Fatalf("local check-in held up by the slow node: %v", err)
+	}
+}
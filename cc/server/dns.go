@@ -3,11 +3,55 @@
 package server
 
 import (
-	"fmt"
-	"log"
+	"context"
+	"encoding/base64"
+	"encoding/binary"
+	"io"
+	"net"
+	"os"
+	"runtime"
 	"sync"
+	"time"
 
-	"github.com/miekg/dns"
+	"github.com/h1zzz/purewater/cc/logger"
+)
+
+const (
+	// dnsFrameBudget keeps TXT answers within a 512 byte DNS message.
+	dnsFrameBudget = 256
+	// dnsTCPFrameBudget bounds TXT answers over TCP, where messages are not
+	// limited to a datagram.
+	dnsTCPFrameBudget = 16 << 10
+	// dnsUDPSize and dnsTCPSize are the largest messages over UDP without
+	// EDNS and over TCP, with its 16-bit length prefix.
+	dnsUDPSize = 512
+	dnsTCPSize = 65535
+	// dnsTCPIdle closes idle TCP connections.
+	dnsTCPIdle = 10 * time.Second
+	// dnsMaxShards caps the number of UDP sockets of a listener.
+	dnsMaxShards = 16
+)
+
+const (
+	dnsHeaderSize = 12
+	dnsTypeTXT    = 16
+	dnsClassINET  = 1
+)
+
+// Response templates. Only the query ID, the RD and CD bits and, for an
+// answer, the question and TXT data are patched in; nothing else of a
+// response depends on the query.
+var (
+	dnsHeaderAnswer   = [dnsHeaderSize]byte{2: 0x80, 5: 1, 7: 1}
+	dnsHeaderRefused  = [dnsHeaderSize]byte{2: 0x80, 3: 5, 5: 1}
+	dnsHeaderNXDomain = [dnsHeaderSize]byte{2: 0x80, 3: 3, 5: 1}
+	dnsHeaderFormErr  = [dnsHeaderSize]byte{2: 0x80, 3: 1}
+	// dnsHeaderTruncated sets TC, the resolver retries over TCP.
+	dnsHeaderTruncated = [dnsHeaderSize]byte{2: 0x82, 5: 1}
+
+	// dnsTXTAnswer points back to the question name, TTL 0. The RDATA
+	// length and the strings follow.
+	dnsTXTAnswer = [...]byte{0xc0, dnsHeaderSize, 0, dnsTypeTXT, 0, dnsClassINET, 0, 0, 0, 0}
 )
 
 type DNSListener struct {
@@ -16,43 +60,386 @@ type DNSListener struct {
 	status   ListenerStatus
 	agents   sync.Map
 	comment  string
-	server   *dns.Server
+	conns    []*net.UDPConn
+	listener *net.TCPListener
+	tcpConns sync.Map // net.Conn -> struct{}
+	closing  chan struct{}
+	once     sync.Once
+	wg       sync.WaitGroup
+	srv      *Server
+	metrics  *ListenerMetrics
+}
+
+// dnsBuffers are the per-goroutine buffers of a DNS server loop.
+type dnsBuffers struct {
+	frame []byte
+	text  []byte
+	resp  []byte
+}
+
+// parseDNSQuery returns the first label of the question name, the offset of
+// the end of the question and its type. ok is false for a malformed query.
+func parseDNSQuery(msg []byte) (label []byte, end int, qtype uint16, ok bool) {
+	if binary.BigEndian.Uint16(msg[4:]) != 1 || msg[2]&0x78 != 0 {
+		// One question of a standard query.
+		return nil, 0, 0, false
+	}
+
+	off := dnsHeaderSize
+	for {
+		if off >= len(msg) || off-dnsHeaderSize > 255 {
+			return nil, 0, 0, false
+		}
+		n := int(msg[off])
+		if n == 0 {
+			off++
+			break
+		}
+		if n&0xc0 != 0 || off+1+n > len(msg) {
+			// Questions are never compressed.
+			return nil, 0, 0, false
+		}
+		if label == nil {
+			label = msg[off+1 : off+1+n]
+		}
+		off += 1 + n
+	}
+
+	if off+4 > len(msg) {
+		return nil, 0, 0, false
+	}
+	return label, off + 4, binary.BigEndian.Uint16(msg[off:]), true
+}
+
+func appendDNSHeader(b []byte, tmpl *[dnsHeaderSize]byte, query []byte) []byte {
+	b = append(b, tmpl[:]...)
+	h := b[len(b)-dnsHeaderSize:]
+	h[0], h[1] = query[0], query[1]
+	h[2] |= query[2] & 0x01 // RD
+	h[3] |= query[3] & 0x10 // CD
+	return b
+}
+
+// dnsFrameRoom returns the size of the largest frame that fits in n bytes
+// of TXT RDATA once base64 encoded, in character strings of up to 255 bytes
+// each preceded by its length.
+func dnsFrameRoom(n int) int {
+	if n <= 0 {
+		return 0
+	}
+	text := n / 256 * 255
+	if r := n % 256; r > 1 {
+		text += r - 1
+	}
+	return text / 4 * 3
 }
 
-func (l *DNSListener) handle(w dns.ResponseWriter, m *dns.Msg) {
-	log.Printf("DNS Handle Recvfrom: %s", w.RemoteAddr().String())
+// answer serves a check-in as a TXT query for "<agent id>.<any domain>",
+// the task frame is returned base64 encoded in a TXT record. The frame is
+// cut to budget bytes and to what fits in a response of size bytes. It
+// returns the response to query, or nil if the query is not worth a
+// response.
+func (l *DNSListener) answer(buf *dnsBuffers, query []byte, addr net.Addr, budget, size int) []byte {
+	start := time.Now()
+	l.metrics.Datagrams.Inc()
+	l.metrics.BytesIn.Add(uint64(len(query)))
+	defer l.metrics.Latency.Since(start)
+
+	if len(query) < dnsHeaderSize || query[2]&0x80 != 0 {
+		l.metrics.DecodeErrors.Inc()
+		return nil
+	}
+
+	label, end, qtype, ok := parseDNSQuery(query)
+	if !ok {
+		l.metrics.DecodeErrors.Inc()
+		return appendDNSHeader(buf.resp[:0], &dnsHeaderFormErr, query)
+	}
+	if qtype != dnsTypeTXT {
+		l.metrics.DecodeErrors.Inc()
+		return append(appendDNSHeader(buf.resp[:0], &dnsHeaderRefused, query), query[dnsHeaderSize:end]...)
+	}
+
+	id := string(label)
+	if !ValidAgentID(id) {
+		l.metrics.DecodeErrors.Inc()
+		return append(appendDNSHeader(buf.resp[:0], &dnsHeaderNXDomain, query), query[dnsHeaderSize:end]...)
+	}
+
+	if retryAfter := l.srv.Admit(l, addr); retryAfter != 0 {
+		buf.frame = AppendBusyFrame(buf.frame[:0], retryAfter)
+	} else {
+		// The response repeats the question, then the answer record.
+		if room := dnsFrameRoom(size - end - len(dnsTXTAnswer) - 2); budget > room {
+			budget = room
+		}
+		tasks, _ := l.srv.Poll(context.Background(), l, id, addr.String(), budget, 0)
+		buf.frame = AppendTaskFrame(buf.frame[:0], tasks)
+	}
+
+	n := base64.StdEncoding.EncodedLen(len(buf.frame))
+	if cap(buf.text) < n {
+		buf.text = make([]byte, n)
+	}
+	text := buf.text[:n]
+	base64.StdEncoding.Encode(text, buf.frame)
+
+	b := appendDNSHeader(buf.resp[:0], &dnsHeaderAnswer, query)
+	b = append(b, query[dnsHeaderSize:end]...)
+	b = append(b, dnsTXTAnswer[:]...)
+	rdata := len(b)
+	b = append(b, 0, 0)
+	for {
+		// Character strings hold at most 255 bytes.
+		chunk := text
+		if len(chunk) > 255 {
+			chunk = chunk[:255]
+		}
+		b = append(b, byte(len(chunk)))
+		b = append(b, chunk...)
+		text = text[len(chunk):]
+		if len(text) == 0 {
+			break
+		}
+	}
+	binary.BigEndian.PutUint16(b[rdata:], uint16(len(b)-rdata-2))
+
+	if len(b) > size {
+		// Not with the budget above, but never send an answer the resolver
+		// would cut or whose lengths wrapped.
+		errorLog.Warn("dns answer too large", "port", l.port, "size", len(b))
+		b = append(appendDNSHeader(buf.resp[:0], &dnsHeaderTruncated, query), query[dnsHeaderSize:end]...)
+	}
+
+	buf.resp = b
+	return b
+}
+
+func (l *DNSListener) draining() bool {
+	select {
+	case <-l.closing:
+		return true
+	default:
+		return false
+	}
+}
+
+func (l *DNSListener) serveUDP(conn *net.UDPConn) {
+	defer l.wg.Done()
+	defer conn.Close()
+
+	query := make([]byte, 4096)
+	buf := &dnsBuffers{resp: make([]byte, 0, 512)}
+
+	for {
+		n, addr, err := conn.ReadFromUDP(query)
+		if err != nil {
+			if !l.draining() {
+				logger.Error("dns read", "port", l.port, "err", err)
+				l.SetOffline()
+			}
+			return
+		}
+		recvLog.Debug("dns query", "port", l.port, "addr", addr)
+
+		if l.forwarded(query[:n]) {
+			q := append([]byte(nil), query[:n]...)
+			l.srv.goForward(func() {
+				buf := &dnsBuffers{}
+				l.reply(conn, l.answer(buf, q, addr, dnsFrameBudget, dnsUDPSize), addr)
+			})
+			continue
+		}
+		l.reply(conn, l.answer(buf, query[:n], addr, dnsFrameBudget, dnsUDPSize), addr)
+	}
+}
+
+// forwarded reports whether query is a check-in forwarded to another cluster
+// node, which serveUDP answers on its own goroutine.
+func (l *DNSListener) forwarded(query []byte) bool {
+	if l.srv.Cluster() == nil || len(query) < dnsHeaderSize || query[2]&0x80 != 0 {
+		return false
+	}
+	label, _, qtype, ok := parseDNSQuery(query)
+	return ok && qtype == dnsTypeTXT && l.srv.Forwarded(string(label))
+}
+
+func (l *DNSListener) reply(conn *net.UDPConn, resp []byte, addr *net.UDPAddr) {
+	if resp == nil {
+		return
+	}
+	if n, err := conn.WriteToUDP(resp, addr); err != nil {
+		errorLog.Warn("dns write", "port", l.port, "err", err)
+	} else {
+		l.metrics.BytesOut.Add(uint64(n))
+	}
+}
+
+// serveTCP serves queries on a connection, each prefixed with its 16-bit
+// length as in RFC 1035 4.2.2.
+func (l *DNSListener) serveTCP(conn net.Conn) {
+	defer l.wg.Done()
+	defer l.srv.ReleaseSession()
+	defer conn.Close()
+	acceptLog.Debug("dns accept", "port", l.port, "addr", conn.RemoteAddr())
+
+	l.metrics.Active.Inc()
+	defer l.metrics.Active.Dec()
+
+	l.tcpConns.Store(conn, struct{}{})
+	defer l.tcpConns.Delete(conn)
+
+	var hdr [2]byte
+	query := make([]byte, 0, 512)
+	buf := &dnsBuffers{resp: make([]byte, 0, 512)}
+
+	for !l.draining() {
+		conn.SetReadDeadline(time.Now().Add(dnsTCPIdle))
+		if _, err := io.ReadFull(conn, hdr[:]); err != nil {
+			return
+		}
+		n := int(binary.BigEndian.Uint16(hdr[:]))
+		if cap(query) < n {
+			query = make([]byte, n)
+		}
+		query = query[:n]
+		if _, err := io.ReadFull(conn, query); err != nil {
+			return
+		}
+
+		resp := l.answer(buf, query, conn.RemoteAddr(), dnsTCPFrameBudget, dnsTCPSize)
+		if resp == nil {
+			return
+		}
+		binary.BigEndian.PutUint16(hdr[:], uint16(len(resp)))
+		bufs := net.Buffers{hdr[:], resp}
+		n64, err := bufs.WriteTo(conn)
+		l.metrics.BytesOut.Add(uint64(n64))
+		if err != nil {
+			errorLog.Warn("dns write", "port", l.port, "err", err)
+			return
+		}
+	}
 }
 
 func (l *DNSListener) Start(protocol ListenerProtocol, port int) (err error) {
-	mux := dns.NewServeMux()
-	mux.HandleFunc(".", l.handle)
+	shards := runtime.GOMAXPROCS(0)
+	if shards > dnsMaxShards {
+		shards = dnsMaxShards
+	}
 
-	l.server = &dns.Server{
-		Addr:    fmt.Sprintf("0.0.0.0:%d", port),
-		Net:     "udp",
-		Handler: mux,
+	l.conns, err = ListenUDPShards(port, shards)
+	if err != nil {
+		logger.Error("dns listen", "port", port, "err", err)
+		return
+	}
+	l.listener, err = ListenTCP(port)
+	if err != nil {
+		logger.Error("dns listen", "port", port, "err", err)
+		for _, conn := range l.conns {
+			conn.Close()
+		}
+		return
 	}
 
 	l.protocol = protocol
 	l.port = port
+	l.closing = make(chan struct{})
 	l.SetOnline()
 
+	for _, conn := range l.conns {
+		l.wg.Add(1)
+		go l.serveUDP(conn)
+	}
+
 	go func(l *DNSListener) {
-		if err := l.server.ListenAndServe(); err != nil {
-			log.Print(err)
-			l.SetOffline()
+		defer l.listener.Close()
+		for {
+			conn, err := l.listener.Accept()
+			if err != nil {
+				if !l.draining() {
+					logger.Error("dns accept", "port", l.port, "err", err)
+				}
+				break
+			}
+			l.metrics.Accepts.Inc()
+			if !l.srv.AcquireSession(l) {
+				// The resolver falls back to another server or to UDP.
+				conn.Close()
+				continue
+			}
+			l.wg.Add(1)
+			go l.serveTCP(conn)
 		}
 	}(l)
 
 	return
 }
 
-func (l *DNSListener) Stop() error                { return l.server.Shutdown() }
+// Shutdown stops reading and waits for the queries in flight.
+func (l *DNSListener) Shutdown(ctx context.Context) error {
+	l.once.Do(func() { close(l.closing) })
+	err := l.listener.Close()
+
+	now := time.Now()
+	for _, conn := range l.conns {
+		conn.SetReadDeadline(now)
+	}
+	l.tcpConns.Range(func(k, v interface{}) bool {
+		k.(net.Conn).SetReadDeadline(now.Add(time.Second))
+		return true
+	})
+
+	if !waitContext(ctx, &l.wg) {
+		l.Stop()
+	}
+	return err
+}
+
+func (l *DNSListener) Files() (map[string]*os.File, error) {
+	files := make(map[string]*os.File)
+	fail := func(err error) (map[string]*os.File, error) {
+		for _, f := range files {
+			f.Close()
+		}
+		return nil, err
+	}
+
+	for i, conn := range l.conns {
+		f, err := conn.File()
+		if err != nil {
+			return fail(err)
+		}
+		files[shardKey("udp", l.port, i)] = f
+	}
+	f, err := l.listener.File()
+	if err != nil {
+		return fail(err)
+	}
+	files[socketKey("tcp", l.port)] = f
+
+	return files, nil
+}
+
+func (l *DNSListener) Stop() error {
+	l.once.Do(func() { close(l.closing) })
+	err := l.listener.Close()
+	for _, conn := range l.conns {
+		conn.Close()
+	}
+	l.tcpConns.Range(func(k, v interface{}) bool {
+		k.(net.Conn).Close()
+		return true
+	})
+	return err
+}
+
 func (l *DNSListener) Agents() *sync.Map          { return &l.agents }
 func (l *DNSListener) Status() ListenerStatus     { return l.status }
-func (l *DNSListener) SetOffline()                { l.status = ListenerOffline }
-func (l *DNSListener) SetOnline()                 { l.status = ListenerOnline }
+func (l *DNSListener) SetOffline()                { l.status = ListenerOffline; l.srv.listenerChanged(l) }
+func (l *DNSListener) SetOnline()                 { l.status = ListenerOnline; l.srv.listenerChanged(l) }
 func (l *DNSListener) Comment() string            { return l.comment }
 func (l *DNSListener) SetComment(comment string)  { l.comment = comment }
 func (l *DNSListener) Protocol() ListenerProtocol { return l.protocol }
 func (l *DNSListener) Port() int                  { return l.port }
+func (l *DNSListener) Metrics() *ListenerMetrics  { return l.metrics }
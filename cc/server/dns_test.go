@@ -0,0 +1,265 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/base64"
+	"encoding/binary"
+	"fmt"
+	"io"
+	"net"
+	"runtime"
+	"strings"
+	"testing"
+	"time"
+)
+
+func freeUDPPort(t testing.TB) int {
+	conn, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	return conn.LocalAddr().(*net.UDPAddr).Port
+}
+
+func dnsQuery(id uint16, name string, qtype uint16) []byte {
+	b := make([]byte, dnsHeaderSize, 64)
+	binary.BigEndian.PutUint16(b, id)
+	b[2] = 0x01 // RD
+	b[5] = 1
+	for _, label := range []string{name, "example", "com"} {
+		b = append(b, byte(len(label)))
+		b = append(b, label...)
+	}
+	return append(b, 0, byte(qtype>>8), byte(qtype), 0, dnsClassINET)
+}
+
+// dnsTXT returns the rcode and the concatenated TXT strings of a response
+// built by DNSListener.answer.
+func dnsTXT(t *testing.T, query, resp []byte) (int, string) {
+	if len(resp) < len(query) || resp[0] != query[0] || resp[1] != query[1] || resp[2]&0x81 != 0x81 {
+		t.Fatalf("bad response header %x", resp)
+	}
+	rcode := int(resp[3] & 0x0f)
+	if binary.BigEndian.Uint16(resp[6:]) == 0 {
+		return rcode, ""
+	}
+	b := resp[len(query)+len(dnsTXTAnswer)+2:]
+	var text []byte
+	for len(b) > 0 {
+		n := 1 + int(b[0])
+		text = append(text, b[1:n]...)
+		b = b[n:]
+	}
+	return rcode, string(text)
+}
+
+func TestDNSListener(t *testing.T) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freeUDPPort(t)
+	if err := s.Start(ListenerDNS, port); err != nil {
+		t.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	taskID, _ := s.Enqueue("agent-udp", []byte("hello"))
+	s.Enqueue("agent-tcp", make([]byte, 1000))
+
+	conn, err := net.Dial("udp", fmt.Sprintf("127.0.0.1:%d", port))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	conn.SetDeadline(time.Now().Add(5 * time.Second))
+
+	resp := make([]byte, 512)
+	exchange := func(query []byte) []byte {
+		conn.Write(query)
+		n, err := conn.Read(resp)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return resp[:n]
+	}
+
+	query := dnsQuery(0x1234, "agent-udp", dnsTypeTXT)
+	rcode, text := dnsTXT(t, query, exchange(query))
+	frame, err := base64.StdEncoding.DecodeString(text)
+	if err != nil || rcode != 0 {
+		t.Fatalf("rcode %d, %v", rcode, err)
+	}
+	tasks, err := ParseTaskFrame(frame)
+	if err != nil || len(tasks) != 1 || tasks[0].ID != taskID || string(tasks[0].Data) != "hello" {
+		t.Fatalf("got %v, %v", tasks, err)
+	}
+
+	query = dnsQuery(1, "agent-udp", 1)
+	if rcode, _ := dnsTXT(t, query, exchange(query)); rcode != 5 {
+		t.Fatalf("A query: rcode %d, want refused", rcode)
+	}
+	query = dnsQuery(2, "bad.id", dnsTypeTXT)
+	query[dnsHeaderSize+4] = '!'
+	if rcode, _ := dnsTXT(t, query, exchange(query)); rcode != 3 {
+		t.Fatalf("invalid id: rcode %d, want nxdomain", rcode)
+	}
+
+	// A task too large for a datagram is delivered over TCP.
+	tcp, err := net.Dial("tcp", fmt.Sprintf("127.0.0.1:%d", port))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer tcp.Close()
+	tcp.SetDeadline(time.Now().Add(5 * time.Second))
+
+	query = dnsQuery(3, "agent-tcp", dnsTypeTXT)
+	tcp.Write(append([]byte{0, byte(len(query))}, query...))
+	var hdr [2]byte
+	io.ReadFull(tcp, hdr[:])
+	resp = make([]byte, binary.BigEndian.Uint16(hdr[:]))
+	if _, err := io.ReadFull(tcp, resp); err != nil {
+		t.Fatal(err)
+	}
+	_, text = dnsTXT(t, query, resp)
+	frame, _ = base64.StdEncoding.DecodeString(text)
+	if tasks, err := ParseTaskFrame(frame); err != nil || len(tasks) != 1 || len(tasks[0].Data) != 1000 {
+		t.Fatalf("got %v, %v", tasks, err)
+	}
+
+	// A task too large for a TCP message is not drained, the length prefix
+	// matches the answer.
+	s.Enqueue("agent-tcp", make([]byte, 80000))
+	query = dnsQuery(4, "agent-tcp", dnsTypeTXT)
+	tcp.Write(append([]byte{0, byte(len(query))}, query...))
+	io.ReadFull(tcp, hdr[:])
+	resp = make([]byte, binary.BigEndian.Uint16(hdr[:]))
+	if _, err := io.ReadFull(tcp, resp); err != nil {
+		t.Fatal(err)
+	}
+	_, text = dnsTXT(t, query, resp)
+	frame, _ = base64.StdEncoding.DecodeString(text)
+	if tasks, err := ParseTaskFrame(frame); err != nil || len(tasks) != 0 {
+		t.Fatalf("got %v, %v", tasks, err)
+	}
+	if n := s.Agent("agent-tcp").Pending(); n != 1 {
+		t.Fatalf("%d tasks pending, want 1", n)
+	}
+}
+
+// TestDNSAnswerSize checks that answers fit in a datagram whatever the
+// length of the question.
+func TestDNSAnswerSize(t *testing.T) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{})
+	l := &DNSListener{srv: s, metrics: newListenerMetrics(), protocol: ListenerDNS}
+	buf := &dnsBuffers{resp: make([]byte, 0, 512)}
+	addr := &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 53}
+
+	for _, pad := range []int{0, 60, 120, 180} {
+		id := fmt.Sprintf("agent-%d", pad)
+		for i := 0; i < 10; i++ {
+			s.Enqueue(id, make([]byte, 50))
+		}
+
+		// Lengthen the name with labels after the agent id.
+		labels := []string{id}
+		for n := 0; n < pad; n += 60 {
+			labels = append(labels, strings.Repeat("a", 60))
+		}
+		query := []byte{0, 1, 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0}
+		for _, label := range append(labels, "example", "com") {
+			query = append(append(query, byte(len(label))), label...)
+		}
+		query = append(query, 0, 0, dnsTypeTXT, 0, dnsClassINET)
+
+		resp := l.answer(buf, query, addr, dnsFrameBudget, dnsUDPSize)
+		if len(resp) > dnsUDPSize || resp[2]&0x02 != 0 {
+			t.Fatalf("pad %d: %d bytes, TC %v", pad, len(resp), resp[2]&0x02 != 0)
+		}
+		_, text := dnsTXT(t, query, resp)
+		frame, _ := base64.StdEncoding.DecodeString(text)
+		tasks, err := ParseTaskFrame(frame)
+		if err != nil || len(tasks) == 0 {
+			t.Fatalf("pad %d: got %v, %v", pad, tasks, err)
+		}
+		if n := s.Agent(id).Pending(); n != 10-len(tasks) {
+			t.Fatalf("pad %d: %d tasks pending, want %d", pad, n, 10-len(tasks))
+		}
+	}
+}
+
+func TestDNSFrameRoom(t *testing.T) {
+	for n := 0; n < 2000; n++ {
+		frame := dnsFrameRoom(n)
+		text := base64.StdEncoding.EncodedLen(frame)
+		if size := text + (text+254)/255; frame > 0 && size > n {
+			t.Fatalf("room %d: a %d byte frame takes %d bytes", n, frame, size)
+		}
+		text = base64.StdEncoding.EncodedLen(frame + 3)
+		if size := text + (text+254)/255; size <= n {
+			t.Fatalf("room %d: a %d byte frame would fit too", n, frame+3)
+		}
+	}
+}
+
+// BenchmarkDNSListener sends TXT check-ins over loopback, see
+// benchmarkCheckins.
+func BenchmarkDNSListener(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freeUDPPort(b)
+	if err := s.Start(ListenerDNS, port); err != nil {
+		b.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	clients := 4 * runtime.GOMAXPROCS(0)
+	conns := make([]net.Conn, clients)
+	queries := make([][]byte, clients)
+	resps := make([][]byte, clients)
+	for c := range conns {
+		conn, err := net.Dial("udp", fmt.Sprintf("127.0.0.1:%d", port))
+		if err != nil {
+			b.Fatal(err)
+		}
+		defer conn.Close()
+		conns[c] = conn
+		queries[c] = dnsQuery(0, fmt.Sprintf("agent-%d", c), dnsTypeTXT)
+		resps[c] = make([]byte, 512)
+	}
+
+	benchmarkCheckins(b, clients, func(c, i int) {
+		conn, query, resp := conns[c], queries[c], resps[c]
+		binary.BigEndian.PutUint16(query, uint16(i))
+		conn.SetReadDeadline(time.Now().Add(time.Second))
+		conn.Write(query)
+		for {
+			n, err := conn.Read(resp)
+			if err != nil {
+				// Lost, counted at the timeout.
+				return
+			}
+			if n >= 2 && binary.BigEndian.Uint16(resp) == uint16(i) {
+				return
+			}
+		}
+	})
+}
+
+// BenchmarkDNSAnswer measures the handler alone, without the sockets.
+func BenchmarkDNSAnswer(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{})
+	l := &DNSListener{srv: s, metrics: newListenerMetrics(), protocol: ListenerDNS}
+	buf := &dnsBuffers{resp: make([]byte, 0, 512)}
+	query := dnsQuery(1, "agent", dnsTypeTXT)
+	addr := &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1), Port: 53}
+
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if l.answer(buf, query, addr, dnsFrameBudget, dnsUDPSize) == nil {
+			b.Fatal("no answer")
+		}
+	}
+}
@@ -0,0 +1,146 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/json"
+	"sync"
+	"time"
+)
+
+const (
+	EventListener        = "listener"
+	EventListenerRemoved = "listener_removed"
+	EventAgent           = "agent"
+)
+
+// eventRingSize is the number of recent events kept for resuming streams.
+const eventRingSize = 4096
+
+// subscriptionSize is the number of events a subscriber may lag behind
+// before it is dropped and has to resume.
+const subscriptionSize = 1024
+
+// Event is a state change delta, Data holds its JSON encoding.
+type Event struct {
+	Seq  uint64
+	Type string
+	Data []byte
+}
+
+type ListenerInfo struct {
+	Protocol ListenerProtocol `json:"protocol"`
+	Port     int              `json:"port"`
+	Comment  string           `json:"comment"`
+	Status   ListenerStatus   `json:"status"`
+}
+
+type AgentInfo struct {
+	ID       string           `json:"id"`
+	Address  string           `json:"address"`
+	Protocol ListenerProtocol `json:"protocol"`
+	LastSeen int64            `json:"last_seen"`
+	Pending  int              `json:"pending"`
+}
+
+// Snapshot is the full state as of sequence number Seq.
+type Snapshot struct {
+	Seq       uint64         `json:"seq"`
+	Listeners []ListenerInfo `json:"listeners"`
+	Agents    []AgentInfo    `json:"agents"`
+}
+
+func NewListenerInfo(l Listener) ListenerInfo {
+	return ListenerInfo{Protocol: l.Protocol(), Port: l.Port(), Comment: l.Comment(), Status: l.Status()}
+}
+
+func NewAgentInfo(a *Agent) AgentInfo {
+	return AgentInfo{ID: a.ID(), Address: a.Address(), Protocol: a.Protocol(), LastSeen: a.LastSeen().Unix(), Pending: a.Pending()}
+}
+
+type Subscription struct {
+	C   <-chan Event
+	c   chan Event
+	bus *eventBus
+}
+
+// Close stops the delivery of events to the subscription.
+func (sub *Subscription) Close() {
+	sub.bus.mu.Lock()
+	defer sub.bus.mu.Unlock()
+
+	if _, ok := sub.bus.subs[sub]; ok {
+		delete(sub.bus.subs, sub)
+		close(sub.c)
+	}
+}
+
+// eventBus numbers events, keeps the most recent ones for resuming and fans
+// them out to subscribers. A subscriber that falls behind is dropped rather
+// than slowing down the publishers.
+type eventBus struct {
+	mu   sync.Mutex
+	seq  uint64
+	ring [eventRingSize]Event
+	subs map[*Subscription]struct{}
+}
+
+// start numbers the events of this process after those of any previous one,
+// so a client resuming with a sequence number kept across a cc restart, such
+// as the desktop cache, gets a snapshot rather than unrelated events.
+func (b *eventBus) start() {
+	if b.seq == 0 {
+		b.seq = uint64(time.Now().UnixNano())
+	}
+}
+
+func (b *eventBus) publish(typ string, v interface{}) {
+	data, err := json.Marshal(v)
+	if err != nil {
+		return
+	}
+
+	b.mu.Lock()
+	defer b.mu.Unlock()
+
+	b.start()
+	b.seq++
+	event := Event{Seq: b.seq, Type: typ, Data: data}
+	b.ring[b.seq%eventRingSize] = event
+
+	for sub := range b.subs {
+		select {
+		case sub.c <- event:
+		default:
+			delete(b.subs, sub)
+			close(sub.c)
+		}
+	}
+}
+
+// subscribe registers a subscriber and returns the events after since that
+// are still buffered. If they are not, or since is 0, ok is false and the
+// subscriber should start from a snapshot instead. Events newer than seq are
+// delivered on the subscription either way.
+func (b *eventBus) subscribe(since uint64) (sub *Subscription, replay []Event, seq uint64, ok bool) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+
+	b.start()
+	c := make(chan Event, subscriptionSize)
+	sub = &Subscription{C: c, c: c, bus: b}
+	if b.subs == nil {
+		b.subs = make(map[*Subscription]struct{})
+	}
+	b.subs[sub] = struct{}{}
+
+	if since == 0 || since > b.seq || b.seq-since >= eventRingSize {
+		return sub, nil, b.seq, false
+	}
+
+	for i := since + 1; i <= b.seq; i++ {
+		replay = append(replay, b.ring[i%eventRingSize])
+	}
+
+	return sub, replay, b.seq, true
+}
@@ -0,0 +1,131 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/json"
+	"fmt"
+	"testing"
+	"time"
+)
+
+// checkins publishes an agent event for each of n new agents.
+func checkins(s *Server, prefix string, n int) {
+	for i := 0; i < n; i++ {
+		s.checkin(nil, fmt.Sprintf("%s-%d", prefix, i), "127.0.0.1:1234", ListenerTCP)
+	}
+}
+
+func receive(t *testing.T, sub *Subscription, n int) []Event {
+	var events []Event
+	for len(events) < n {
+		select {
+		case event, ok := <-sub.C:
+			if !ok {
+				t.Fatalf("subscription closed after %d events", len(events))
+			}
+			events = append(events, event)
+		case <-time.After(5 * time.Second):
+			t.Fatalf("%d events received, want %d", len(events), n)
+		}
+	}
+	return events
+}
+
+// TestSubscribeResume checks that a client resuming within the buffered
+// events gets only those it missed, and a snapshot otherwise.
+func TestSubscribeResume(t *testing.T) {
+	s := &Server{}
+	checkins(s, "before", 2)
+
+	// A new client starts from a snapshot.
+	sub, replay, snapshot := s.Subscribe(0)
+	if snapshot == nil || replay != nil {
+		t.Fatal("no snapshot for a new client")
+	}
+	if len(snapshot.Agents) != 2 {
+		t.Fatalf("snapshot of %d agents, want 2", len(snapshot.Agents))
+	}
+
+	checkins(s, "after", 3)
+	events := receive(t, sub, 3)
+	sub.Close()
+	if events[0].Seq != snapshot.Seq+1 {
+		t.Fatalf("first event %d after snapshot %d", events[0].Seq, snapshot.Seq)
+	}
+
+	// Resuming after the first event replays the other two only.
+	sub, replay, snapshot = s.Subscribe(events[0].Seq)
+	sub.Close()
+	if snapshot != nil {
+		t.Fatal("snapshot for a client within the buffered events")
+	}
+	if len(replay) != 2 || replay[0].Seq != events[1].Seq || replay[1].Seq != events[2].Seq {
+		t.Fatalf("replay %v, want events %d and %d", replay, events[1].Seq, events[2].Seq)
+	}
+	var agent AgentInfo
+	if err := json.Unmarshal(replay[1].Data, &agent); err != nil || agent.ID != "after-2" {
+		t.Fatalf("replayed %s, want agent after-2", replay[1].Data)
+	}
+
+	// Up to date, nothing to replay.
+	sub, replay, snapshot = s.Subscribe(events[2].Seq)
+	sub.Close()
+	if snapshot != nil || len(replay) != 0 {
+		t.Fatalf("%d events replayed to an up to date client", len(replay))
+	}
+
+	// Past the buffered events, or from another process, a snapshot again.
+	checkins(s, "overflow", eventRingSize)
+	for _, since := range []uint64{events[0].Seq, events[2].Seq + 1<<40} {
+		sub, replay, snapshot = s.Subscribe(since)
+		sub.Close()
+		if snapshot == nil || replay != nil {
+			t.Fatalf("resume after %d: no snapshot", since)
+		}
+		if n := len(snapshot.Agents); n != 5+eventRingSize {
+			t.Fatalf("snapshot of %d agents, want %d", n, 5+eventRingSize)
+		}
+	}
+}
+
+// TestSlowSubscriber checks that a subscriber that does not read does not
+// hold back the publishers nor the other subscribers, it is dropped.
+func TestSlowSubscriber(t *testing.T) {
+	s := &Server{}
+	slow, _, _ := s.Subscribe(0)
+	fast, _, _ := s.Subscribe(0)
+	defer fast.Close()
+
+	// The fast subscriber reads each event before the next is published.
+	n := subscriptionSize + 10
+	read := make(chan struct{})
+	done := make(chan struct{})
+	go func() {
+		for i := 0; i < n; i++ {
+			s.checkin(nil, fmt.Sprintf("agent-%d", i), "127.0.0.1:1234", ListenerTCP)
+			<-read
+		}
+		close(done)
+	}()
+
+	for i := 0; i < n; i++ {
+		receive(t, fast, 1)
+		read <- struct{}{}
+	}
+	select {
+	case <-done:
+	case <-time.After(5 * time.Second):
+		t.Fatal("publish blocked by a slow subscriber")
+	}
+
+	// The slow subscriber got what fitted, then was dropped.
+	got := 0
+	for range slow.C {
+		got++
+	}
+	if got != subscriptionSize {
+		t.Fatalf("slow subscriber got %d events, want %d", got, subscriptionSize)
+	}
+	slow.Close()
+}
@@ -0,0 +1,104 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/binary"
+	"errors"
+)
+
+const (
+	taskFrameHeaderSize = 4
+	taskHeaderSize      = 12
+	// taskFrameBusy in COUNT marks a busy frame, see AppendBusyFrame.
+	taskFrameBusy = 0xffffffff
+	// MaxFrameSize bounds the frames of the TCP and HTTP listeners. A task
+	// of MaxTaskSize always fits, agents receive frames into a buffer of this
+	// size and the tasks left over go with the next check-in.
+	MaxFrameSize = taskFrameHeaderSize + taskHeaderSize + MaxTaskSize
+)
+
+var (
+	ErrShortFrame = errors.New("short task frame")
+	ErrBusyFrame  = errors.New("busy frame")
+)
+
+// The pending tasks of an agent are delivered in a single frame, within the
+// frame budget of the listener, big-endian:
+//
+// +-------+----+-----+------+----+-----+------+-----+
+// | COUNT | ID | LEN | DATA | ID | LEN | DATA | ... |
+// +-------+----+-----+------+----+-----+------+-----+
+// |   4   | 8  |  4  | LEN  | 8  |  4  | LEN  |     |
+// +-------+----+-----+------+----+-----+------+-----+
+
+// AppendTaskFrame appends the frame carrying tasks to dst.
+func AppendTaskFrame(dst []byte, tasks []Task) []byte {
+	var hdr [taskHeaderSize]byte
+
+	binary.BigEndian.PutUint32(hdr[:4], uint32(len(tasks)))
+	dst = append(dst, hdr[:4]...)
+
+	for _, task := range tasks {
+		binary.BigEndian.PutUint64(hdr[:8], task.ID)
+		binary.BigEndian.PutUint32(hdr[8:], uint32(len(task.Data)))
+		dst = append(dst, hdr[:]...)
+		dst = append(dst, task.Data...)
+	}
+
+	return dst
+}
+
+// AppendBusyFrame appends a frame deferring the check-in, the agent should
+// check in again after retryAfter seconds. COUNT is 0xffffffff and followed
+// by the 32-bit number of seconds.
+func AppendBusyFrame(dst []byte, retryAfter int) []byte {
+	var hdr [8]byte
+	binary.BigEndian.PutUint32(hdr[:4], taskFrameBusy)
+	binary.BigEndian.PutUint32(hdr[4:], uint32(retryAfter))
+	return append(dst, hdr[:]...)
+}
+
+// FrameRetryAfter returns the retry-after of a busy frame, ok is false for
+// any other frame.
+func FrameRetryAfter(buf []byte) (retryAfter int, ok bool) {
+	if len(buf) < 8 || binary.BigEndian.Uint32(buf) != taskFrameBusy {
+		return 0, false
+	}
+	return int(binary.BigEndian.Uint32(buf[4:])), true
+}
+
+// ParseTaskFrame decodes a frame built by AppendTaskFrame, it returns
+// ErrBusyFrame for a busy frame. Task data aliases buf.
+func ParseTaskFrame(buf []byte) ([]Task, error) {
+	if len(buf) < taskFrameHeaderSize {
+		return nil, ErrShortFrame
+	}
+
+	count := binary.BigEndian.Uint32(buf)
+	if count == taskFrameBusy {
+		return nil, ErrBusyFrame
+	}
+	buf = buf[taskFrameHeaderSize:]
+
+	if uint64(count)*taskHeaderSize > uint64(len(buf)) {
+		return nil, ErrShortFrame
+	}
+
+	tasks := make([]Task, 0, count)
+	for i := uint32(0); i < count; i++ {
+		if len(buf) < taskHeaderSize {
+			return nil, ErrShortFrame
+		}
+		id := binary.BigEndian.Uint64(buf)
+		n := binary.BigEndian.Uint32(buf[8:])
+		buf = buf[taskHeaderSize:]
+		if uint64(n) > uint64(len(buf)) {
+			return nil, ErrShortFrame
+		}
+		tasks = append(tasks, Task{ID: id, Data: buf[:n]})
+		buf = buf[n:]
+	}
+
+	return tasks, nil
+}
@@ -0,0 +1,67 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bytes"
+	"testing"
+)
+
+func TestTaskFrameRoundTrip(t *testing.T) {
+	tasks := []Task{
+		{ID: 1, Data: []byte("hello")},
+		{ID: 1 << 40, Data: nil},
+		{ID: 3, Data: bytes.Repeat([]byte{0xff}, 70000)},
+	}
+
+	frame := AppendTaskFrame([]byte("prefix"), tasks)
+	got, err := ParseTaskFrame(frame[len("prefix"):])
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(got) != len(tasks) {
+		t.Fatalf("parsed %d tasks, want %d", len(got), len(tasks))
+	}
+	for i := range tasks {
+		if got[i].ID != tasks[i].ID || !bytes.Equal(got[i].Data, tasks[i].Data) {
+			t.Fatalf("task %d: got %d/%d bytes, want %d/%d bytes",
+				i, got[i].ID, len(got[i].Data), tasks[i].ID, len(tasks[i].Data))
+		}
+	}
+
+	if got, err := ParseTaskFrame(AppendTaskFrame(nil, nil)); err != nil || len(got) != 0 {
+		t.Fatalf("empty frame: %v %v", got, err)
+	}
+}
+
+func TestTaskFrameMalformed(t *testing.T) {
+	frame := AppendTaskFrame(nil, []Task{{ID: 1, Data: []byte("hello")}, {ID: 2, Data: []byte("world")}})
+
+	// Every truncation of a valid frame is short.
+	for n := 0; n < len(frame); n++ {
+		if _, err := ParseTaskFrame(frame[:n]); err != ErrShortFrame {
+			t.Fatalf("frame cut at %d: %v, want ErrShortFrame", n, err)
+		}
+	}
+
+	for name, frame := range map[string][]byte{
+		"count too large":  {0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0},
+		"length too large": {0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0xff, 0xff, 0xff, 0xff, 'x'},
+		"huge count":       {0x7f, 0xff, 0xff, 0xff},
+	} {
+		if _, err := ParseTaskFrame(frame); err != ErrShortFrame {
+			t.Fatalf("%s: %v, want ErrShortFrame", name, err)
+		}
+	}
+
+	busy := AppendBusyFrame(nil, 7)
+	if _, err := ParseTaskFrame(busy); err != ErrBusyFrame {
+		t.Fatalf("busy frame: %v, want ErrBusyFrame", err)
+	}
+	if retryAfter, ok := FrameRetryAfter(busy); !ok || retryAfter != 7 {
+		t.Fatalf("retry-after %d %v, want 7", retryAfter, ok)
+	}
+	if _, ok := FrameRetryAfter(frame); ok {
+		t.Fatal("task frame taken for a busy frame")
+	}
+}
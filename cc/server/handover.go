@@ -0,0 +1,155 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bufio"
+	"encoding/binary"
+	"fmt"
+	"io"
+	"os"
+	"strings"
+	"sync/atomic"
+
+	"github.com/h1zzz/purewater/cc/logger"
+)
+
+// TasksEnv passes the pending tasks of a cc process being upgraded to the
+// new one, as "<fd>,<task id>": the read end of a pipe among the ExtraFiles
+// of the child, and the first task id the child may use.
+const TasksEnv = "PUREWATER_TASKS"
+
+// taskIDGap is left between the task ids of the parent at the upgrade and
+// those of the child, for the tasks the parent still queues while draining.
+const taskIDGap = 1 << 20
+
+// TasksEnvironment returns the TasksEnv variable of a child whose
+// ExtraFiles[i] is the read end of the pipe given to HandOverTasks.
+func (s *Server) TasksEnvironment(i int) string {
+	// ExtraFiles[i] becomes descriptor 3+i in the child.
+	return fmt.Sprintf("%s=%d,%d", TasksEnv, 3+i, atomic.LoadUint64(&s.taskID)+taskIDGap)
+}
+
+// HandOverTasks drains the queue of every agent to w, once the listeners
+// stopped serving check-ins, for RestoreTasks in the new process. Each agent
+// is written as its id, prefixed with its 8-bit length, followed by the
+// frame of its tasks, prefixed with its 32-bit length.
+func (s *Server) HandOverTasks(w io.Writer) error {
+	bw := bufio.NewWriter(w)
+	var hdr [4]byte
+	var err error
+
+	s.agents.Range(func(k, v interface{}) bool {
+		agent := v.(*Agent)
+		tasks := agent.Drain(0)
+		if len(tasks) == 0 {
+			return true
+		}
+		frame := AppendTaskFrame(nil, tasks)
+
+		bw.WriteByte(byte(len(agent.id)))
+		bw.WriteString(agent.id)
+		binary.BigEndian.PutUint32(hdr[:], uint32(len(frame)))
+		bw.Write(hdr[:])
+		_, err = bw.Write(frame)
+		return err == nil
+	})
+	if err != nil {
+		return err
+	}
+	return bw.Flush()
+}
+
+// RestoreTasks takes over the tasks handed over by the parent process, see
+// TasksEnv. Task ids continue after those of the parent. The tasks arrive
+// once the parent has drained, they are queued after those queued here in
+// the meantime.
+func (s *Server) RestoreTasks() {
+	env := os.Getenv(TasksEnv)
+	if env == "" {
+		return
+	}
+	os.Unsetenv(TasksEnv)
+
+	var fd uintptr
+	var id uint64
+	if _, err := fmt.Sscanf(strings.Replace(env, ",", " ", 1), "%d %d", &fd, &id); err != nil {
+		logger.Warn("restore tasks", "env", env, "err", err)
+		return
+	}
+
+	s.raiseTaskID(id)
+	go s.restoreTasks(os.NewFile(fd, "tasks"))
+}
+
+// raiseTaskID makes the next task ids greater than id.
+func (s *Server) raiseTaskID(id uint64) {
+	for {
+		old := atomic.LoadUint64(&s.taskID)
+		if old >= id || atomic.CompareAndSwapUint64(&s.taskID, old, id) {
+			return
+		}
+	}
+}
+
+// restoreTasks reads what HandOverTasks wrote to r and queues it.
+func (s *Server) restoreTasks(r io.ReadCloser) {
+	defer r.Close()
+
+	br := bufio.NewReader(r)
+	restored, dropped := 0, 0
+
+	for {
+		id, tasks, err := readHandOver(br)
+		if err == io.EOF {
+			break
+		}
+		if err != nil {
+			logger.Error("restore tasks", "err", err)
+			break
+		}
+
+		agent := s.Agent(id)
+		for _, task := range tasks {
+			if agent.Push(task) != nil {
+				dropped++
+			} else {
+				restored++
+			}
+		}
+	}
+
+	logger.Info("tasks restored", "tasks", restored, "dropped", dropped)
+}
+
+// readHandOver reads the tasks of an agent written by HandOverTasks, err is
+// io.EOF after the last agent.
+func readHandOver(br *bufio.Reader) (string, []Task, error) {
+	n, err := br.ReadByte()
+	if err != nil {
+		return "", nil, err
+	}
+
+	id := make([]byte, n)
+	var hdr [4]byte
+	if _, err := io.ReadFull(br, id); err != nil {
+		return "", nil, io.ErrUnexpectedEOF
+	}
+	if _, err := io.ReadFull(br, hdr[:]); err != nil {
+		return "", nil, io.ErrUnexpectedEOF
+	}
+	if !ValidAgentID(string(id)) {
+		return "", nil, fmt.Errorf("invalid agent id %q", id)
+	}
+
+	size := binary.BigEndian.Uint32(hdr[:])
+	if size > taskFrameHeaderSize+DefaultQueueSize*(taskHeaderSize+MaxTaskSize) {
+		return "", nil, fmt.Errorf("%s: frame too large", id)
+	}
+	frame := make([]byte, size)
+	if _, err := io.ReadFull(br, frame); err != nil {
+		return "", nil, io.ErrUnexpectedEOF
+	}
+	tasks, err := ParseTaskFrame(frame)
+	return string(id), tasks, err
+}
@@ -0,0 +1,82 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"strings"
+	"testing"
+)
+
+func TestHandOverTasks(t *testing.T) {
+	parent := &Server{}
+	var ids []uint64
+	for i := 0; i < 10; i++ {
+		id, err := parent.Enqueue(fmt.Sprintf("agent-%d", i%3), []byte{byte(i)})
+		if err != nil {
+			t.Fatal(err)
+		}
+		ids = append(ids, id)
+	}
+
+	env := parent.TasksEnvironment(2)
+	if want := fmt.Sprintf("%s=5,%d", TasksEnv, 10+taskIDGap); env != want {
+		t.Fatalf("environment %q, want %q", env, want)
+	}
+
+	var pipe bytes.Buffer
+	if err := parent.HandOverTasks(&pipe); err != nil {
+		t.Fatal(err)
+	}
+	if n := parent.Agent("agent-0").Pending(); n != 0 {
+		t.Fatalf("%d tasks left in the parent", n)
+	}
+
+	child := &Server{}
+	child.raiseTaskID(10 + taskIDGap)
+	child.Enqueue("agent-0", []byte("child"))
+	child.restoreTasks(ioutil.NopCloser(&pipe))
+
+	// The child's own task comes first, then those of the parent in order.
+	tasks := child.Agent("agent-0").Drain(0)
+	if len(tasks) != 5 || tasks[0].ID != 11+taskIDGap {
+		t.Fatalf("got %v", tasks)
+	}
+	for i, task := range tasks[1:] {
+		if task.ID != ids[3*i] || task.Data[0] != byte(3*i) {
+			t.Fatalf("task %d: got %d %v, want %d", i, task.ID, task.Data, ids[3*i])
+		}
+	}
+	if n := child.Agent("agent-2").Pending(); n != 3 {
+		t.Fatalf("agent-2: %d tasks, want 3", n)
+	}
+}
+
+func TestRestoreTasksTruncated(t *testing.T) {
+	parent := &Server{}
+	parent.Enqueue("agent-0", []byte("a"))
+	parent.Enqueue("agent-1", []byte("b"))
+
+	var pipe bytes.Buffer
+	parent.HandOverTasks(&pipe)
+	b := pipe.Bytes()
+
+	// The first agent is complete, the second is cut.
+	child := &Server{}
+	first := 1 + len("agent-0") + 4 + taskFrameHeaderSize + taskHeaderSize + 1
+	child.restoreTasks(ioutil.NopCloser(bytes.NewReader(b[:first+3])))
+
+	restored := 0
+	child.agents.Range(func(k, v interface{}) bool {
+		if !strings.HasPrefix(k.(string), "agent-") {
+			t.Fatalf("unexpected agent %q", k)
+		}
+		restored += v.(*Agent).Pending()
+		return true
+	})
+	if restored != 1 {
+		t.Fatalf("%d tasks restored, want 1", restored)
+	}
+}
@@ -3,12 +3,46 @@
 package server
 
 import (
+	"context"
+	"crypto/tls"
 	"fmt"
-	"log"
+	"net"
 	"net/http"
+	"os"
+	"strconv"
 	"sync"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
 )
 
+// maxPollWait caps how long a check-in may be held open by the listener.
+const maxPollWait = 120 * time.Second
+
+const (
+	// httpReadHeaderTimeout bounds a client sending its request headers.
+	httpReadHeaderTimeout = 10 * time.Second
+	// httpReadTimeout bounds reading a whole request, check-ins have no
+	// body.
+	httpReadTimeout = 30 * time.Second
+	// httpWriteTimeout must cover a long-polled check-in held for
+	// maxPollWait.
+	httpWriteTimeout = maxPollWait + 30*time.Second
+	// httpIdleTimeout closes keep-alive connections between check-ins, it
+	// is longer than a typical check-in interval so agents keep their
+	// connection, and TLS session, between check-ins.
+	httpIdleTimeout = 5 * time.Minute
+	// httpMaxHeaderBytes is far more than a check-in needs.
+	httpMaxHeaderBytes = 8 << 10
+)
+
+// framePool recycles response frames, most check-ins answer an empty or
+// small frame.
+var framePool = sync.Pool{New: func() interface{} {
+	b := make([]byte, 0, 512)
+	return &b
+}}
+
 type HTTPListener struct {
 	protocol ListenerProtocol
 	port     int
@@ -16,32 +50,172 @@ type HTTPListener struct {
 	agents   sync.Map
 	comment  string
 	server   *http.Server
+	tls      *tls.Config // registered for ticket key rotation
+	listener *net.TCPListener
+	srv      *Server
+	metrics  *ListenerMetrics
+	closing  chan struct{}
+	once     sync.Once
 }
 
+// handle serves agent check-ins, "GET /?id=<agent>&wait=<seconds>", replying
+// with a frame of every pending task. With a non-zero wait the request is
+// long-polled: it is held open until work is queued for the agent or the wait
+// expires, in which case 204 is returned.
 func (l *HTTPListener) handle(w http.ResponseWriter, r *http.Request) {
-	log.Printf("HTTP Handle Recvfrom: %s", r.RemoteAddr)
+	recvLog.Debug("http request", "port", l.port, "addr", r.RemoteAddr)
+
+	start := time.Now()
+	l.metrics.BytesIn.Add(uint64(len(r.RequestURI)))
+
+	if !l.srv.AcquireSession(l) {
+		l.writeBusy(w, http.StatusServiceUnavailable, sessionRetryAfter())
+		return
+	}
+	defer l.srv.ReleaseSession()
+
+	id := r.URL.Query().Get("id")
+	if !ValidAgentID(id) {
+		l.metrics.DecodeErrors.Inc()
+		http.Error(w, "invalid agent id", http.StatusBadRequest)
+		return
+	}
+
+	var wait time.Duration
+	if s := r.URL.Query().Get("wait"); s != "" {
+		n, err := strconv.Atoi(s)
+		if err != nil || n < 0 {
+			l.metrics.DecodeErrors.Inc()
+			http.Error(w, "invalid wait", http.StatusBadRequest)
+			return
+		}
+		wait = time.Duration(n) * time.Second
+		if wait > maxPollWait {
+			wait = maxPollWait
+		}
+	}
+
+	if retryAfter := l.srv.Admit(l, remoteAddr(r)); retryAfter != 0 {
+		l.writeBusy(w, http.StatusTooManyRequests, retryAfter)
+		return
+	}
+
+	// A held check-in is released when the listener shuts down, the agent
+	// polls again on the new listener.
+	ctx, cancel := context.WithCancel(r.Context())
+	defer cancel()
+	if wait > 0 {
+		go func() {
+			select {
+			case <-l.closing:
+				cancel()
+			case <-ctx.Done():
+			}
+		}()
+	}
+
+	tasks, held := l.srv.Poll(ctx, l, id, r.RemoteAddr, MaxFrameSize, wait)
+	start = start.Add(held)
+	if len(tasks) == 0 {
+		w.WriteHeader(http.StatusNoContent)
+		l.metrics.Latency.Since(start)
+		return
+	}
+
+	bp := framePool.Get().(*[]byte)
+	frame := AppendTaskFrame((*bp)[:0], tasks)
+	w.Header().Set("Content-Type", "application/octet-stream")
+	w.Header().Set("Content-Length", strconv.Itoa(len(frame)))
+	n, _ := w.Write(frame)
+	l.metrics.BytesOut.Add(uint64(n))
+	l.metrics.Latency.Since(start)
+
+	if cap(frame) <= 64<<10 {
+		*bp = frame
+		framePool.Put(bp)
+	}
+}
+
+// writeBusy defers the agent with a Retry-After header and a busy frame.
+func (l *HTTPListener) writeBusy(w http.ResponseWriter, status, retryAfter int) {
+	frame := AppendBusyFrame(nil, retryAfter)
+	w.Header().Set("Content-Type", "application/octet-stream")
+	w.Header().Set("Retry-After", strconv.Itoa(retryAfter))
+	w.WriteHeader(status)
+	n, _ := w.Write(frame)
+	l.metrics.BytesOut.Add(uint64(n))
+}
+
+// remoteAddr returns the address of the connection a request came on.
+func remoteAddr(r *http.Request) net.Addr {
+	host, _, _ := net.SplitHostPort(r.RemoteAddr)
+	return &net.TCPAddr{IP: net.ParseIP(host)}
+}
+
+func (l *HTTPListener) connState(conn net.Conn, state http.ConnState) {
+	switch state {
+	case http.StateNew:
+		l.metrics.Accepts.Inc()
+		l.metrics.Active.Inc()
+	case http.StateHijacked, http.StateClosed:
+		l.metrics.Active.Dec()
+	}
 }
 
 func (l *HTTPListener) Start(protocol ListenerProtocol, port int) (err error) {
 	mux := &http.ServeMux{}
 	mux.HandleFunc("/", l.handle)
 
-	l.server = &http.Server{Addr: fmt.Sprintf("0.0.0.0:%d", port), Handler: mux}
+	if protocol != ListenerHTTP && protocol != ListenerHTTPS {
+		return fmt.Errorf("unsupported protocol: %s", protocol)
+	}
+
+	l.listener, err = ListenTCP(port)
+	if err != nil {
+		logger.Error("http listen", "port", port, "err", err)
+		return
+	}
+
+	l.server = &http.Server{
+		Addr:              fmt.Sprintf("0.0.0.0:%d", port),
+		Handler:           mux,
+		ConnState:         l.connState,
+		ReadHeaderTimeout: httpReadHeaderTimeout,
+		ReadTimeout:       httpReadTimeout,
+		WriteTimeout:      httpWriteTimeout,
+		IdleTimeout:       httpIdleTimeout,
+		MaxHeaderBytes:    httpMaxHeaderBytes,
+		ErrorLog:          errorLog.StdLogger(logger.LevelWarn),
+	}
+
+	if protocol == ListenerHTTPS {
+		// The certificate is loaded on every start, a restart picks up a
+		// renewed one.
+		cert, err := tls.LoadX509KeyPair("cert.pem", "key.pem")
+		if err != nil {
+			l.listener.Close()
+			logger.Error("https certificate", "port", port, "err", err)
+			return err
+		}
+		l.tls = newTLSConfig(cert)
+		l.server.TLSConfig = l.tls
+	}
+
 	l.protocol = protocol
 	l.port = port
+	l.closing = make(chan struct{})
 	l.SetOnline()
 
 	go func() {
-		switch protocol {
-		case ListenerHTTP:
-			err = l.server.ListenAndServe()
-		case ListenerHTTPS:
-			err = l.server.ListenAndServeTLS("cert.pem", "key.pem")
-		default:
-			log.Fatal("no support protocol")
+		var err error
+		if protocol == ListenerHTTPS {
+			// ServeTLS enables HTTP/2 on the configuration.
+			err = l.server.ServeTLS(l.listener, "", "")
+		} else {
+			err = l.server.Serve(l.listener)
 		}
-		if err != nil {
-			log.Print(err)
+		if err != nil && err != http.ErrServerClosed {
+			logger.Error("http serve", "port", l.port, "err", err)
 			l.SetOffline()
 		}
 	}()
@@ -49,12 +223,44 @@ func (l *HTTPListener) Start(protocol ListenerProtocol, port int) (err error) {
 	return
 }
 
-func (l *HTTPListener) Stop() error                { return l.server.Close() }
+// Shutdown stops accepting, releases held check-ins and waits for the
+// requests in flight.
+func (l *HTTPListener) Shutdown(ctx context.Context) error {
+	l.once.Do(func() { close(l.closing) })
+	l.release()
+	err := l.server.Shutdown(ctx)
+	if err == context.DeadlineExceeded || err == context.Canceled {
+		return l.server.Close()
+	}
+	return err
+}
+
+func (l *HTTPListener) Files() (map[string]*os.File, error) {
+	f, err := l.listener.File()
+	if err != nil {
+		return nil, err
+	}
+	return map[string]*os.File{socketKey("tcp", l.port): f}, nil
+}
+
+// release stops rotating the session ticket keys of the listener.
+func (l *HTTPListener) release() {
+	if l.tls != nil {
+		tickets.unregister(l.tls)
+	}
+}
+
+func (l *HTTPListener) Stop() error {
+	l.release()
+	return l.server.Close()
+}
+
 func (l *HTTPListener) Agents() *sync.Map          { return &l.agents }
 func (l *HTTPListener) Status() ListenerStatus     { return l.status }
-func (l *HTTPListener) SetOffline()                { l.status = ListenerOffline }
-func (l *HTTPListener) SetOnline()                 { l.status = ListenerOnline }
+func (l *HTTPListener) SetOffline()                { l.status = ListenerOffline; l.srv.listenerChanged(l) }
+func (l *HTTPListener) SetOnline()                 { l.status = ListenerOnline; l.srv.listenerChanged(l) }
 func (l *HTTPListener) Comment() string            { return l.comment }
 func (l *HTTPListener) SetComment(comment string)  { l.comment = comment }
 func (l *HTTPListener) Protocol() ListenerProtocol { return l.protocol }
 func (l *HTTPListener) Port() int                  { return l.port }
+func (l *HTTPListener) Metrics() *ListenerMetrics  { return l.metrics }
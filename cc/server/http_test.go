@@ -0,0 +1,159 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"context"
+	"crypto/ecdsa"
+	"crypto/elliptic"
+	"crypto/rand"
+	"crypto/tls"
+	"crypto/x509"
+	"encoding/pem"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"math/big"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"runtime"
+	"testing"
+	"time"
+)
+
+// chdirCert changes to a directory holding a self-signed cert.pem and
+// key.pem, as the HTTPS listener loads them from the working directory.
+func chdirCert(tb testing.TB) {
+	key, _ := ecdsa.GenerateKey(elliptic.P256(), rand.Reader)
+	template := &x509.Certificate{
+		SerialNumber: big.NewInt(1),
+		NotBefore:    time.Now().Add(-time.Hour),
+		NotAfter:     time.Now().Add(time.Hour),
+		DNSNames:     []string{"localhost"},
+	}
+	der, err := x509.CreateCertificate(rand.Reader, template, template, &key.PublicKey, key)
+	if err != nil {
+		tb.Fatal(err)
+	}
+	keyDER, _ := x509.MarshalECPrivateKey(key)
+
+	dir := tb.TempDir()
+	ioutil.WriteFile(dir+"/cert.pem", pem.EncodeToMemory(&pem.Block{Type: "CERTIFICATE", Bytes: der}), 0600)
+	ioutil.WriteFile(dir+"/key.pem", pem.EncodeToMemory(&pem.Block{Type: "EC PRIVATE KEY", Bytes: keyDER}), 0600)
+
+	wd, _ := os.Getwd()
+	os.Chdir(dir)
+	tb.Cleanup(func() { os.Chdir(wd) })
+}
+
+// TestHTTPListenerShutdownTwice drains a listener twice, as a signal and an
+// upgrade may both do.
+func TestHTTPListenerShutdownTwice(t *testing.T) {
+	s := &Server{}
+	port := freePort(t)
+	if err := s.Start(ListenerHTTP, port); err != nil {
+		t.Fatal(err)
+	}
+
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second)
+	defer cancel()
+	s.Shutdown(ctx)
+	s.Shutdown(ctx)
+	s.Stop(port)
+}
+
+// BenchmarkHTTPSCheckin compares check-ins over new connections with full
+// handshakes, over new connections resuming a TLS session, and over a
+// kept-alive connection.
+func BenchmarkHTTPSCheckin(b *testing.B) {
+	chdirCert(b)
+
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freePort(b)
+	if err := s.Start(ListenerHTTPS, port); err != nil {
+		b.Fatal(err)
+	}
+	defer s.Stop(port)
+	url := fmt.Sprintf("https://127.0.0.1:%d/?id=agent", port)
+
+	cases := []struct {
+		name      string
+		keepAlive bool
+		cache     tls.ClientSessionCache
+	}{
+		{"full-handshake", false, nil},
+		{"resumed", false, tls.NewLRUClientSessionCache(1)},
+		{"keep-alive", true, nil},
+	}
+	for _, c := range cases {
+		b.Run(c.name, func(b *testing.B) {
+			client := &http.Client{Transport: &http.Transport{
+				DisableKeepAlives: !c.keepAlive,
+				TLSClientConfig:   &tls.Config{InsecureSkipVerify: true, ClientSessionCache: c.cache},
+			}}
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				resp, err := client.Get(url)
+				if err != nil {
+					b.Fatal(err)
+				}
+				io.Copy(ioutil.Discard, resp.Body)
+				resp.Body.Close()
+			}
+		})
+	}
+}
+
+// BenchmarkHTTPListener checks in over kept-alive loopback connections, see
+// benchmarkCheckins.
+func BenchmarkHTTPListener(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freePort(b)
+	if err := s.Start(ListenerHTTP, port); err != nil {
+		b.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	clients := 4 * runtime.GOMAXPROCS(0)
+	client := &http.Client{Transport: &http.Transport{MaxIdleConnsPerHost: clients}}
+	defer client.CloseIdleConnections()
+
+	benchmarkCheckins(b, clients, func(c, i int) {
+		resp, err := client.Get(fmt.Sprintf("http://127.0.0.1:%d/?id=agent-%d", port, c))
+		if err != nil {
+			b.Error(err)
+			return
+		}
+		io.Copy(ioutil.Discard, resp.Body)
+		resp.Body.Close()
+	})
+}
+
+// BenchmarkHTTPHandle measures the handler alone, without the connection,
+// for a check-in with no task and one with a task to deliver.
+func BenchmarkHTTPHandle(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{})
+	l := &HTTPListener{srv: s, metrics: newListenerMetrics(), protocol: ListenerHTTP}
+	req := httptest.NewRequest(http.MethodGet, "/?id=agent", nil)
+	data := make([]byte, 256)
+
+	for _, tasks := range []int{0, 1} {
+		b.Run(fmt.Sprintf("tasks=%d", tasks), func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				if tasks != 0 {
+					s.Enqueue("agent", data)
+				}
+				w := httptest.NewRecorder()
+				l.handle(w, req)
+				if w.Code != http.StatusOK && w.Code != http.StatusNoContent {
+					b.Fatalf("status %d", w.Code)
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,109 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"fmt"
+	"io"
+
+	"github.com/h1zzz/purewater/cc/metrics"
+)
+
+// ListenerMetrics are the counters kept by every listener. Connection based
+// listeners count Accepts and Active, packet based ones Datagrams.
+type ListenerMetrics struct {
+	Accepts      *metrics.Counter
+	Active       metrics.Gauge
+	Datagrams    *metrics.Counter
+	BytesIn      *metrics.Counter
+	BytesOut     *metrics.Counter
+	DecodeErrors *metrics.Counter
+	Checkins     *metrics.Counter
+	Rejected     *metrics.Counter   // check-ins and sessions deferred by admission control
+	Latency      *metrics.Histogram // check-in handling, long-poll holds excluded
+	Rates        *RateSeries        // history of the counters, see sampleRates
+}
+
+func newListenerMetrics() *ListenerMetrics {
+	return &ListenerMetrics{
+		Accepts:      metrics.NewCounter(),
+		Datagrams:    metrics.NewCounter(),
+		BytesIn:      metrics.NewCounter(),
+		BytesOut:     metrics.NewCounter(),
+		DecodeErrors: metrics.NewCounter(),
+		Checkins:     metrics.NewCounter(),
+		Rejected:     metrics.NewCounter(),
+		Latency:      metrics.NewHistogram(),
+		Rates:        newRateSeries(),
+	}
+}
+
+type ListenerMetricsSnapshot struct {
+	Accepts      uint64                    `json:"accepts"`
+	Active       int64                     `json:"active"`
+	Datagrams    uint64                    `json:"datagrams"`
+	BytesIn      uint64                    `json:"bytes_in"`
+	BytesOut     uint64                    `json:"bytes_out"`
+	DecodeErrors uint64                    `json:"decode_errors"`
+	Checkins     uint64                    `json:"checkins"`
+	Rejected     uint64                    `json:"rejected"`
+	Latency      metrics.HistogramSnapshot `json:"latency"`
+}
+
+func (m *ListenerMetrics) Snapshot() ListenerMetricsSnapshot {
+	return ListenerMetricsSnapshot{
+		Accepts:      m.Accepts.Value(),
+		Active:       m.Active.Value(),
+		Datagrams:    m.Datagrams.Value(),
+		BytesIn:      m.BytesIn.Value(),
+		BytesOut:     m.BytesOut.Value(),
+		DecodeErrors: m.DecodeErrors.Value(),
+		Checkins:     m.Checkins.Value(),
+		Rejected:     m.Rejected.Value(),
+		Latency:      m.Latency.Snapshot(),
+	}
+}
+
+// WriteMetrics writes the metrics of every listener in the Prometheus text
+// format.
+func (s *Server) WriteMetrics(w io.Writer) {
+	var snaps []ListenerMetricsSnapshot
+	var labels []string
+
+	s.listeners.Range(func(k, v interface{}) bool {
+		l := v.(Listener)
+		snaps = append(snaps, l.Metrics().Snapshot())
+		labels = append(labels, fmt.Sprintf(`protocol="%s",port="%d"`, l.Protocol(), l.Port()))
+		return true
+	})
+
+	counters := []struct {
+		name, help string
+		value      func(s *ListenerMetricsSnapshot) uint64
+	}{
+		{"purewater_listener_accepts_total", "Accepted connections.", func(s *ListenerMetricsSnapshot) uint64 { return s.Accepts }},
+		{"purewater_listener_datagrams_total", "Received datagrams.", func(s *ListenerMetricsSnapshot) uint64 { return s.Datagrams }},
+		{"purewater_listener_bytes_in_total", "Bytes received from agents.", func(s *ListenerMetricsSnapshot) uint64 { return s.BytesIn }},
+		{"purewater_listener_bytes_out_total", "Bytes sent to agents.", func(s *ListenerMetricsSnapshot) uint64 { return s.BytesOut }},
+		{"purewater_listener_decode_errors_total", "Malformed check-ins.", func(s *ListenerMetricsSnapshot) uint64 { return s.DecodeErrors }},
+		{"purewater_listener_checkins_total", "Agent check-ins.", func(s *ListenerMetricsSnapshot) uint64 { return s.Checkins }},
+		{"purewater_listener_rejected_total", "Check-ins and sessions deferred by admission control.", func(s *ListenerMetricsSnapshot) uint64 { return s.Rejected }},
+	}
+
+	for _, c := range counters {
+		metrics.WriteHelp(w, c.name, "counter", c.help)
+		for i := range snaps {
+			metrics.WriteCounter(w, c.name, labels[i], c.value(&snaps[i]))
+		}
+	}
+
+	metrics.WriteHelp(w, "purewater_listener_active_connections", "gauge", "Open connections.")
+	for i := range snaps {
+		metrics.WriteGauge(w, "purewater_listener_active_connections", labels[i], snaps[i].Active)
+	}
+
+	metrics.WriteHelp(w, "purewater_listener_checkin_seconds", "histogram", "Check-in handling latency.")
+	for i := range snaps {
+		metrics.WriteHistogram(w, "purewater_listener_checkin_seconds", labels[i], snaps[i].Latency)
+	}
+}
@@ -0,0 +1,77 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"bytes"
+	"fmt"
+	"net"
+	"strings"
+	"testing"
+	"time"
+)
+
+// TestWriteMetrics checks the Prometheus text output of a listener after a
+// few check-ins: a HELP and TYPE line per family, then its samples labeled
+// with the listener.
+func TestWriteMetrics(t *testing.T) {
+	s := &Server{}
+	port := freePort(t)
+	if err := s.Start(ListenerTCP, port); err != nil {
+		t.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	var conn net.Conn
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+	for i := 0; i < 3; i++ {
+		if err := tcpCheckin(&conn, addr, "agent"); err != nil {
+			t.Fatal(err)
+		}
+	}
+	defer conn.Close()
+
+	labels := fmt.Sprintf(`protocol="tcp",port="%d"`, port)
+
+	// The latency is observed once the frame is written.
+	var out string
+	for deadline := time.Now().Add(5 * time.Second); ; {
+		var buf bytes.Buffer
+		s.WriteMetrics(&buf)
+		out = buf.String()
+		if strings.Contains(out, "purewater_listener_checkin_seconds_count{"+labels+"} 3\n") {
+			break
+		}
+		if time.Now().After(deadline) {
+			t.Fatalf("3 check-ins not counted:\n%s", out)
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+
+	for _, family := range []struct{ name, typ string }{
+		{"purewater_listener_accepts_total", "counter"},
+		{"purewater_listener_checkins_total", "counter"},
+		{"purewater_listener_rejected_total", "counter"},
+		{"purewater_listener_active_connections", "gauge"},
+		{"purewater_listener_checkin_seconds", "histogram"},
+	} {
+		if !strings.Contains(out, "# HELP "+family.name+" ") {
+			t.Errorf("no HELP line for %s", family.name)
+		}
+		if !strings.Contains(out, "# TYPE "+family.name+" "+family.typ+"\n") {
+			t.Errorf("no TYPE line for %s", family.name)
+		}
+	}
+
+	for _, sample := range []string{
+		"purewater_listener_accepts_total{" + labels + "} 1\n",
+		"purewater_listener_checkins_total{" + labels + "} 3\n",
+		"purewater_listener_active_connections{" + labels + "} 1\n",
+		"purewater_listener_checkin_seconds_bucket{" + labels + `,le="+Inf"} 3` + "\n",
+		"purewater_listener_checkin_seconds_sum{" + labels + "} ",
+	} {
+		if !strings.Contains(out, sample) {
+			t.Errorf("no sample %q in:\n%s", sample, out)
+		}
+	}
+}
@@ -0,0 +1,126 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"errors"
+	"runtime"
+	"sync"
+	"sync/atomic"
+)
+
+const (
+	// DefaultQueueSize is the number of tasks that can be pending for an
+	// agent.
+	DefaultQueueSize = 256
+	// MaxTaskSize bounds the data of a task.
+	MaxTaskSize = 1 << 20
+)
+
+var (
+	ErrQueueFull    = errors.New("task queue is full")
+	ErrTaskTooLarge = errors.New("task is too large")
+)
+
+type Task struct {
+	ID   uint64
+	Data []byte
+}
+
+type taskSlot struct {
+	seq  uint64
+	task Task
+}
+
+// taskQueue is a bounded multi-producer single-consumer ring. Producers
+// claim slots with a CAS on tail and never block, a full queue is reported to
+// the caller as backpressure. The consumer side is serialized by a mutex that
+// producers never touch, since an agent may check in on several listeners at
+// once.
+type taskQueue struct {
+	mask  uint64
+	slots []taskSlot
+	_     [56]byte // keep tail off the cache line of head
+	tail  uint64
+	_     [56]byte
+	mu    sync.Mutex
+	head  uint64
+}
+
+// newTaskQueue returns a queue holding at least size tasks, size is rounded
+// up to a power of two.
+func newTaskQueue(size int) *taskQueue {
+	n := 2
+	for n < size {
+		n <<= 1
+	}
+
+	q := &taskQueue{mask: uint64(n - 1), slots: make([]taskSlot, n)}
+	for i := range q.slots {
+		q.slots[i].seq = uint64(i)
+	}
+	return q
+}
+
+func (q *taskQueue) Push(task Task) error {
+	for {
+		tail := atomic.LoadUint64(&q.tail)
+		slot := &q.slots[tail&q.mask]
+		seq := atomic.LoadUint64(&slot.seq)
+
+		switch {
+		case seq == tail:
+			if atomic.CompareAndSwapUint64(&q.tail, tail, tail+1) {
+				slot.task = task
+				atomic.StoreUint64(&slot.seq, tail+1)
+				return nil
+			}
+		case seq < tail:
+			// The consumer has not released this slot yet.
+			return ErrQueueFull
+		default:
+			// Another producer claimed the slot, reload tail.
+		}
+		runtime.Gosched()
+	}
+}
+
+// Drain pops pending tasks in order until the encoded size of the popped
+// tasks would exceed budget bytes, a budget <= 0 drains everything. A task
+// whose frame alone exceeds budget is not popped either: it stays queued,
+// with the tasks behind it, for a transport with a larger budget. Tasks
+// still being written by a producer are left for the next call.
+func (q *taskQueue) Drain(budget int) []Task {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+
+	var tasks []Task
+	size := taskFrameHeaderSize
+
+	for {
+		slot := &q.slots[q.head&q.mask]
+		if atomic.LoadUint64(&slot.seq) != q.head+1 {
+			break
+		}
+
+		size += taskHeaderSize + len(slot.task.Data)
+		if budget > 0 && size > budget {
+			break
+		}
+
+		tasks = append(tasks, slot.task)
+		slot.task = Task{}
+		atomic.StoreUint64(&slot.seq, q.head+q.mask+1)
+		q.head++
+	}
+
+	return tasks
+}
+
+// Len returns the approximate number of pending tasks.
+func (q *taskQueue) Len() int {
+	q.mu.Lock()
+	head := q.head
+	q.mu.Unlock()
+	return int(atomic.LoadUint64(&q.tail) - head)
+}
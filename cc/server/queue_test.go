@@ -0,0 +1,168 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"fmt"
+	"sync"
+	"testing"
+)
+
+func pushTasks(t *testing.T, q *taskQueue, sizes ...int) {
+	for i, size := range sizes {
+		if err := q.Push(Task{ID: uint64(i + 1), Data: make([]byte, size)}); err != nil {
+			t.Fatal(err)
+		}
+	}
+}
+
+func taskIDs(tasks []Task) []uint64 {
+	ids := make([]uint64, len(tasks))
+	for i, task := range tasks {
+		ids[i] = task.ID
+	}
+	return ids
+}
+
+func TestTaskQueueDrainBudget(t *testing.T) {
+	q := newTaskQueue(8)
+	pushTasks(t, q, 100, 100, 100, 2000, 100)
+
+	// Three 100 byte tasks fit in a datagram, the fourth is left queued.
+	budget := taskFrameHeaderSize + 3*(taskHeaderSize+100)
+	if ids := taskIDs(q.Drain(budget)); fmt.Sprint(ids) != "[1 2 3]" {
+		t.Fatalf("drained %v, want [1 2 3]", ids)
+	}
+
+	// A task larger than the budget on its own is not popped, nor are the
+	// tasks behind it.
+	if tasks := q.Drain(udpFrameBudget); len(tasks) != 0 {
+		t.Fatalf("drained %v over budget", taskIDs(tasks))
+	}
+	if q.Len() != 2 {
+		t.Fatalf("%d tasks left, want 2", q.Len())
+	}
+
+	// A stream transport takes them, in order.
+	if ids := taskIDs(q.Drain(0)); fmt.Sprint(ids) != "[4 5]" {
+		t.Fatalf("drained %v, want [4 5]", ids)
+	}
+	if tasks := q.Drain(0); len(tasks) != 0 {
+		t.Fatalf("drained %v from an empty queue", taskIDs(tasks))
+	}
+}
+
+func TestTaskQueueFull(t *testing.T) {
+	q := newTaskQueue(4)
+	pushTasks(t, q, 1, 1, 1, 1)
+	if err := q.Push(Task{}); err != ErrQueueFull {
+		t.Fatalf("push to a full queue: %v", err)
+	}
+	q.Drain(taskFrameHeaderSize + taskHeaderSize + 1)
+	if err := q.Push(Task{ID: 5}); err != nil {
+		t.Fatalf("push after drain: %v", err)
+	}
+	if ids := taskIDs(q.Drain(0)); fmt.Sprint(ids) != "[2 3 4 5]" {
+		t.Fatalf("drained %v, want [2 3 4 5]", ids)
+	}
+}
+
+// TestTaskQueueConcurrent pushes from several producers while consumers
+// drain, every task must be delivered once and in the order of its producer.
+func TestTaskQueueConcurrent(t *testing.T) {
+	const producers, perProducer = 8, 2000
+
+	q := newTaskQueue(64)
+	var wg sync.WaitGroup
+	for p := 0; p < producers; p++ {
+		wg.Add(1)
+		go func(p int) {
+			defer wg.Done()
+			for i := 0; i < perProducer; {
+				if q.Push(Task{ID: uint64(p)<<32 | uint64(i)}) == nil {
+					i++
+				}
+			}
+		}(p)
+	}
+
+	var mu sync.Mutex
+	next := make([]uint64, producers)
+	received := 0
+	done := make(chan struct{})
+	var consumers sync.WaitGroup
+	for c := 0; c < 2; c++ {
+		consumers.Add(1)
+		go func() {
+			defer consumers.Done()
+			for {
+				select {
+				case <-done:
+					return
+				default:
+				}
+				// Check the order under the lock so that two consumers
+				// cannot interleave their batches.
+				mu.Lock()
+				for _, task := range q.Drain(udpFrameBudget) {
+					p, i := task.ID>>32, task.ID&0xffffffff
+					if i != next[p] {
+						t.Errorf("producer %d: task %d, want %d", p, i, next[p])
+					}
+					next[p] = i + 1
+					received++
+				}
+				mu.Unlock()
+			}
+		}()
+	}
+
+	wg.Wait()
+	for {
+		mu.Lock()
+		n := received
+		mu.Unlock()
+		if n == producers*perProducer {
+			break
+		}
+	}
+	close(done)
+	consumers.Wait()
+
+	if q.Len() != 0 {
+		t.Fatalf("%d tasks left", q.Len())
+	}
+}
+
+func TestEnqueueTooLarge(t *testing.T) {
+	s := &Server{}
+	if _, err := s.Enqueue("agent", make([]byte, MaxTaskSize+1)); err != ErrTaskTooLarge {
+		t.Fatalf("enqueue: %v, want ErrTaskTooLarge", err)
+	}
+	if _, err := s.Enqueue("agent", make([]byte, MaxTaskSize)); err != nil {
+		t.Fatal(err)
+	}
+}
+
+// BenchmarkTaskQueuePush measures enqueue contention with many API writers
+// pushing to one agent. A writer that finds the queue full drains it, the
+// way a check-in would.
+func BenchmarkTaskQueuePush(b *testing.B) {
+	for _, writers := range []int{1, 4, 16, 64} {
+		b.Run(fmt.Sprintf("writers=%d", writers), func(b *testing.B) {
+			q := newTaskQueue(DefaultQueueSize)
+			data := make([]byte, 64)
+
+			b.SetParallelism(writers)
+			b.ReportAllocs()
+			b.ResetTimer()
+			b.RunParallel(func(pb *testing.PB) {
+				for pb.Next() {
+					for q.Push(Task{Data: data}) == ErrQueueFull {
+						q.Drain(0)
+					}
+				}
+			})
+		})
+	}
+}
@@ -0,0 +1,234 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"sync"
+	"time"
+)
+
+// RateResolution selects one of the rate histories of a listener.
+type RateResolution int
+
+const (
+	RateSecond RateResolution = iota // 1 hour of 1s points
+	RateMinute                       // 1 day of 1m points
+	RateHour                         // 30 days of 1h points
+	rateResolutions
+)
+
+var rateSteps = [rateResolutions]time.Duration{time.Second, time.Minute, time.Hour}
+var rateSizes = [rateResolutions]int{3600, 1440, 720}
+
+// ParseRateResolution parses "1s", "1m" or "1h".
+func ParseRateResolution(s string) (RateResolution, bool) {
+	for i, step := range rateSteps {
+		if s == shortDuration(step) {
+			return RateResolution(i), true
+		}
+	}
+	return 0, false
+}
+
+func (r RateResolution) Step() time.Duration { return rateSteps[r] }
+func (r RateResolution) String() string      { return shortDuration(rateSteps[r]) }
+
+func shortDuration(d time.Duration) string {
+	switch d {
+	case time.Second:
+		return "1s"
+	case time.Minute:
+		return "1m"
+	default:
+		return "1h"
+	}
+}
+
+// RatePoint holds the per-second averages of a listener over a step
+// starting at Time, in unix seconds.
+type RatePoint struct {
+	Time     int64   `json:"t"`
+	Checkins float64 `json:"checkins"`
+	BytesIn  float64 `json:"bytes_in"`
+	BytesOut float64 `json:"bytes_out"`
+	Errors   float64 `json:"errors"`
+	Rejected float64 `json:"rejected"`
+}
+
+func (p *RatePoint) add(q *RatePoint) {
+	p.Checkins += q.Checkins
+	p.BytesIn += q.BytesIn
+	p.BytesOut += q.BytesOut
+	p.Errors += q.Errors
+	p.Rejected += q.Rejected
+}
+
+func (p *RatePoint) scale(f float64) {
+	p.Checkins *= f
+	p.BytesIn *= f
+	p.BytesOut *= f
+	p.Errors *= f
+	p.Rejected *= f
+}
+
+// rateRing is a fixed-size history, the oldest point is overwritten.
+type rateRing struct {
+	points []RatePoint
+	next   int
+	full   bool
+}
+
+func (r *rateRing) push(p RatePoint) {
+	r.points[r.next] = p
+	r.next++
+	if r.next == len(r.points) {
+		r.next, r.full = 0, true
+	}
+}
+
+// since appends the points newer than t, oldest first.
+func (r *rateRing) since(dst []RatePoint, t int64) []RatePoint {
+	if r.full {
+		dst = appendSince(dst, r.points[r.next:], t)
+	}
+	return appendSince(dst, r.points[:r.next], t)
+}
+
+func appendSince(dst, points []RatePoint, t int64) []RatePoint {
+	for i := range points {
+		if points[i].Time > t {
+			dst = append(dst, points[i])
+		}
+	}
+	return dst
+}
+
+// rateAccumulator averages the points of a finer resolution into one point
+// of a coarser one.
+type rateAccumulator struct {
+	sum   RatePoint
+	count int
+}
+
+// RateSeries keeps the rates of a listener at every resolution. Each
+// second's point is folded into the current minute, each minute into the
+// current hour, so the memory used is fixed whatever the uptime.
+type RateSeries struct {
+	mu    sync.Mutex
+	rings [rateResolutions]rateRing
+	acc   [rateResolutions]rateAccumulator // current minute and hour
+	prev  RatePoint                        // totals at the previous sample
+	last  time.Time
+}
+
+func newRateSeries() *RateSeries {
+	s := &RateSeries{}
+	for i := range s.rings {
+		s.rings[i].points = make([]RatePoint, rateSizes[i])
+	}
+	return s
+}
+
+// sample records the counter totals of m at now, the first sample only sets
+// the reference.
+func (s *RateSeries) sample(now time.Time, m *ListenerMetrics) {
+	totals := RatePoint{
+		Checkins: float64(m.Checkins.Value()),
+		BytesIn:  float64(m.BytesIn.Value()),
+		BytesOut: float64(m.BytesOut.Value()),
+		Errors:   float64(m.DecodeErrors.Value()),
+		Rejected: float64(m.Rejected.Value()),
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	prev, last := s.prev, s.last
+	s.prev, s.last = totals, now
+	if last.IsZero() {
+		return
+	}
+
+	// The ticker may drift, rates are over the time actually elapsed.
+	p := totals
+	prev.scale(-1)
+	p.add(&prev)
+	p.scale(1 / now.Sub(last).Seconds())
+	p.Time = now.Truncate(time.Second).Unix()
+
+	s.push(RateSecond, p)
+}
+
+func (s *RateSeries) push(r RateResolution, p RatePoint) {
+	s.rings[r].push(p)
+	if r+1 == rateResolutions {
+		return
+	}
+
+	// Close the coarser point when p starts a new one.
+	next := r + 1
+	step := int64(rateSteps[next] / time.Second)
+	acc := &s.acc[next]
+	if acc.count > 0 && p.Time/step != acc.sum.Time/step {
+		avg := acc.sum
+		avg.scale(1 / float64(acc.count))
+		avg.Time = acc.sum.Time / step * step
+		*acc = rateAccumulator{}
+		s.push(next, avg)
+	}
+	if acc.count == 0 {
+		acc.sum.Time = p.Time
+	}
+	acc.sum.add(&p)
+	acc.count++
+}
+
+// Points returns the points of resolution r newer than since, at most max
+// of them when max > 0: longer histories are downsampled by averaging runs
+// of adjacent points, each stamped with the time of its first point. newest
+// is the time of the newest point before downsampling, to pass as since the
+// next time, or since if there is no newer point.
+func (s *RateSeries) Points(r RateResolution, since int64, max int) (points []RatePoint, newest int64) {
+	s.mu.Lock()
+	points = s.rings[r].since(nil, since)
+	s.mu.Unlock()
+
+	if len(points) == 0 {
+		return nil, since
+	}
+	newest = points[len(points)-1].Time
+	return downsample(points, max), newest
+}
+
+func downsample(points []RatePoint, max int) []RatePoint {
+	if max <= 0 || len(points) <= max {
+		return points
+	}
+
+	n := (len(points) + max - 1) / max
+	out := points[:0]
+	for i := 0; i < len(points); i += n {
+		end := i + n
+		if end > len(points) {
+			end = len(points)
+		}
+		avg := points[i]
+		for j := i + 1; j < end; j++ {
+			avg.add(&points[j])
+		}
+		avg.scale(1 / float64(end-i))
+		out = append(out, avg)
+	}
+	return out
+}
+
+// sampleRates feeds the rate series of every listener once a second.
+func (s *Server) sampleRates() {
+	for now := range time.Tick(time.Second) {
+		s.listeners.Range(func(k, v interface{}) bool {
+			m := v.(Listener).Metrics()
+			m.Rates.sample(now, m)
+			return true
+		})
+	}
+}
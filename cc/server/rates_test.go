@@ -0,0 +1,48 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"math"
+	"testing"
+	"time"
+)
+
+func TestRateSeries(t *testing.T) {
+	m := newListenerMetrics()
+	s := m.Rates
+
+	// Two hours of 10 check-ins/s, starting on the hour.
+	start := time.Unix(1700000000/3600*3600, 0)
+	for i := 0; i <= 2*3600; i++ {
+		s.sample(start.Add(time.Duration(i)*time.Second), m)
+		m.Checkins.Add(10)
+	}
+
+	seconds, _ := s.Points(RateSecond, 0, 0)
+	if len(seconds) != rateSizes[RateSecond] {
+		t.Fatalf("1s points: %d", len(seconds))
+	}
+	minutes, newest := s.Points(RateMinute, 0, 0)
+	if len(minutes) != 120 || newest != start.Unix()+119*60 {
+		t.Fatalf("1m points: %d, newest %d", len(minutes), newest-start.Unix())
+	}
+	hours, _ := s.Points(RateHour, 0, 0)
+	if len(hours) != 1 || hours[0].Time != start.Unix() {
+		t.Fatalf("1h points: %+v", hours)
+	}
+
+	for _, p := range append(append(seconds, minutes...), hours...) {
+		if math.Abs(p.Checkins-10) > 1e-9 {
+			t.Fatalf("rate at %d: %f", p.Time, p.Checkins)
+		}
+	}
+
+	down, newest := s.Points(RateSecond, 0, 100)
+	if len(down) != 100 || newest != seconds[len(seconds)-1].Time {
+		t.Fatalf("downsampled: %d points, newest %d", len(down), newest)
+	}
+	if more, _ := s.Points(RateSecond, newest, 100); len(more) != 0 {
+		t.Fatalf("points after the newest: %d", len(more))
+	}
+}
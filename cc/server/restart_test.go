@@ -0,0 +1,143 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io"
+	"net"
+	"net/http"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+func freePort(t testing.TB) int {
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer ln.Close()
+	return ln.Addr().(*net.TCPAddr).Port
+}
+
+// tcpCheckin checks in on conn, reconnecting once if the listener closed it
+// while draining.
+func tcpCheckin(conn *net.Conn, addr, id string) error {
+	msg := make([]byte, 2+len(id))
+	binary.BigEndian.PutUint16(msg, uint16(len(id)))
+	copy(msg[2:], id)
+
+	for retry := 0; ; retry++ {
+		if *conn == nil {
+			c, err := net.Dial("tcp", addr)
+			if err != nil {
+				return err
+			}
+			*conn = c
+		}
+
+		var hdr [4]byte
+		_, err := (*conn).Write(msg)
+		if err == nil {
+			_, err = io.ReadFull(*conn, hdr[:])
+		}
+		if err == nil {
+			_, err = io.CopyN(io.Discard, *conn, int64(binary.BigEndian.Uint32(hdr[:])))
+			return err
+		}
+
+		(*conn).Close()
+		*conn = nil
+		if retry == 1 {
+			return err
+		}
+	}
+}
+
+// TestRestartUnderLoad restarts listeners while agents check in, no
+// check-in may fail.
+func TestRestartUnderLoad(t *testing.T) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	tcpPort, httpPort := freePort(t), freePort(t)
+	if err := s.Start(ListenerTCP, tcpPort); err != nil {
+		t.Fatal(err)
+	}
+	if err := s.Start(ListenerHTTP, httpPort); err != nil {
+		t.Fatal(err)
+	}
+
+	var checkins, failures uint64
+	stop := make(chan struct{})
+	var wg sync.WaitGroup
+
+	for i := 0; i < 8; i++ {
+		wg.Add(2)
+		go func(i int) {
+			defer wg.Done()
+			var conn net.Conn
+			addr := fmt.Sprintf("127.0.0.1:%d", tcpPort)
+			for {
+				select {
+				case <-stop:
+					if conn != nil {
+						conn.Close()
+					}
+					return
+				default:
+				}
+				if err := tcpCheckin(&conn, addr, fmt.Sprintf("tcp-%d", i)); err != nil {
+					t.Log(err)
+					atomic.AddUint64(&failures, 1)
+				}
+				atomic.AddUint64(&checkins, 1)
+			}
+		}(i)
+		go func(i int) {
+			defer wg.Done()
+			client := &http.Client{Transport: &http.Transport{}}
+			url := fmt.Sprintf("http://127.0.0.1:%d/?id=http-%d&wait=1", httpPort, i)
+			for {
+				select {
+				case <-stop:
+					return
+				default:
+				}
+				resp, err := client.Get(url)
+				if err == nil {
+					io.Copy(io.Discard, resp.Body)
+					resp.Body.Close()
+					if resp.StatusCode != http.StatusOK && resp.StatusCode != http.StatusNoContent {
+						err = fmt.Errorf("status %d", resp.StatusCode)
+					}
+				}
+				if err != nil {
+					t.Log(err)
+					atomic.AddUint64(&failures, 1)
+				}
+				atomic.AddUint64(&checkins, 1)
+			}
+		}(i)
+	}
+
+	for i := 0; i < 5; i++ {
+		time.Sleep(100 * time.Millisecond)
+		if err := s.Restart(tcpPort); err != nil {
+			t.Fatal(err)
+		}
+		if err := s.Restart(httpPort); err != nil {
+			t.Fatal(err)
+		}
+	}
+	time.Sleep(100 * time.Millisecond)
+	close(stop)
+	wg.Wait()
+
+	if failures != 0 {
+		t.Fatalf("%d of %d check-ins failed", failures, checkins)
+	}
+	t.Logf("%d check-ins", checkins)
+}
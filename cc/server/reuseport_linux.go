@@ -0,0 +1,20 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import "syscall"
+
+// soReusePort is SO_REUSEPORT, missing from package syscall on Linux.
+const soReusePort = 0xf
+
+const reusePortSupported = true
+
+func reusePort(network, address string, c syscall.RawConn) error {
+	var err error
+	if cerr := c.Control(func(fd uintptr) {
+		err = syscall.SetsockoptInt(int(fd), syscall.SOL_SOCKET, soReusePort, 1)
+	}); cerr != nil {
+		return cerr
+	}
+	return err
+}
@@ -0,0 +1,14 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+//go:build !linux
+// +build !linux
+
+package server
+
+import "syscall"
+
+// reusePortSupported is false where SO_REUSEPORT does not balance datagrams
+// between sockets, listeners then use a single socket.
+const reusePortSupported = false
+
+func reusePort(network, address string, c syscall.RawConn) error { return nil }
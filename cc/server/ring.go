@@ -0,0 +1,68 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"hash/fnv"
+	"sort"
+	"strconv"
+)
+
+// ringReplicas is the number of points of each node on the ring, enough to
+// keep the share of every node within a few percent of even.
+const ringReplicas = 160
+
+// Ring assigns keys to nodes by consistent hashing, adding or removing a
+// node only moves the keys it gains or loses. A Ring is immutable.
+type Ring struct {
+	points []uint64
+	nodes  []string // owner of points[i]
+}
+
+func NewRing(nodes []string) *Ring {
+	r := &Ring{}
+	type point struct {
+		hash uint64
+		node string
+	}
+	var points []point
+	for _, node := range nodes {
+		for i := 0; i < ringReplicas; i++ {
+			points = append(points, point{ringHash(node + "#" + strconv.Itoa(i)), node})
+		}
+	}
+	sort.Slice(points, func(i, j int) bool { return points[i].hash < points[j].hash })
+
+	for _, p := range points {
+		r.points = append(r.points, p.hash)
+		r.nodes = append(r.nodes, p.node)
+	}
+	return r
+}
+
+// Owner returns the node owning key, or "" if the ring is empty.
+func (r *Ring) Owner(key string) string {
+	if len(r.points) == 0 {
+		return ""
+	}
+	h := ringHash(key)
+	i := sort.Search(len(r.points), func(i int) bool { return r.points[i] >= h })
+	if i == len(r.points) {
+		i = 0
+	}
+	return r.nodes[i]
+}
+
+// ringHash is FNV-1a followed by a 64-bit finalizer, FNV alone clusters the
+// short similar strings used as agent ids and point names.
+func ringHash(s string) uint64 {
+	h := fnv.New64a()
+	h.Write([]byte(s))
+	x := h.Sum64()
+	x ^= x >> 33
+	x *= 0xff51afd7ed558ccd
+	x ^= x >> 33
+	x *= 0xc4ceb9fe1a85ec53
+	x ^= x >> 33
+	return x
+}
@@ -3,9 +3,14 @@
 package server
 
 import (
+	"context"
 	"fmt"
-	"log"
+	"os"
 	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
 )
 
 type ListenerStatus int
@@ -24,9 +29,21 @@ const (
 	ListenerDNS   = ListenerProtocol("dns")
 )
 
+// Per-packet and per-connection messages are rate limited, so a flood of
+// agents cannot turn logging into the bottleneck of the listeners.
+var (
+	acceptLog = logger.NewLimiter(100)
+	recvLog   = logger.NewLimiter(100)
+	errorLog  = logger.NewLimiter(20)
+)
+
 type Listener interface {
 	Start(protocol ListenerProtocol, port int) (err error)
-	// Restart() error
+	// Shutdown stops serving new check-ins and waits for those in flight
+	// until ctx is done.
+	Shutdown(ctx context.Context) error
+	// Files duplicates the listening sockets, keyed by "<network>/<port>".
+	Files() (map[string]*os.File, error)
 	Stop() error
 	Agents() *sync.Map
 	Status() ListenerStatus
@@ -36,10 +53,40 @@ type Listener interface {
 	SetComment(comment string)
 	Protocol() ListenerProtocol
 	Port() int
+	Metrics() *ListenerMetrics
+}
+
+type TaskState int
+
+const (
+	TaskQueued    = TaskState(1)
+	TaskDelivered = TaskState(2)
+)
+
+// CheckinHook is called after every check-in, it runs on the listener's
+// goroutine and must not block. l is nil for check-ins forwarded by another
+// cluster node.
+type CheckinHook func(l Listener, agent *Agent)
+
+// TaskHook is called when tasks are queued for or delivered to an agent, it
+// must not block either.
+type TaskHook func(agent *Agent, tasks []Task, state TaskState)
+
+type serverHooks struct {
+	checkin []CheckinHook
+	task    []TaskHook
 }
 
 type Server struct {
 	listeners sync.Map
+	agents    sync.Map
+	taskID    uint64
+	hooks     atomic.Value // *serverHooks
+	mu        sync.Mutex
+	events    eventBus
+	cluster   atomic.Value // **Cluster
+	admission admission
+	rates     sync.Once
 }
 
 func (s *Server) Start(protocol ListenerProtocol, port int) error {
@@ -48,39 +95,326 @@ func (s *Server) Start(protocol ListenerProtocol, port int) error {
 		return fmt.Errorf("The port is already in use by the listener, %s, %d, %s", l.Protocol(), l.Port(), l.Comment())
 	}
 
-	var listener Listener
+	listener, err := s.newListener(protocol, newListenerMetrics())
+	if err != nil {
+		return err
+	}
+
+	err = listener.Start(protocol, port)
+	if err != nil {
+		return err
+	}
+
+	s.listeners.Store(port, listener)
+	s.listenerChanged(listener)
+
+	return nil
+}
+
+func (s *Server) newListener(protocol ListenerProtocol, metrics *ListenerMetrics) (Listener, error) {
+	s.rates.Do(func() { go s.sampleRates() })
 
 	switch protocol {
 	case ListenerTCP:
-		listener = &TCPListener{}
+		return &TCPListener{srv: s, metrics: metrics}, nil
 	case ListenerUDP:
-		listener = &UDPListener{}
+		return &UDPListener{srv: s, metrics: metrics}, nil
 	case ListenerHTTP, ListenerHTTPS:
-		listener = &HTTPListener{}
+		return &HTTPListener{srv: s, metrics: metrics}, nil
 	case ListenerDNS:
-		listener = &DNSListener{}
+		return &DNSListener{srv: s, metrics: metrics}, nil
 	default:
-		return fmt.Errorf("unsupported protocol")
+		return nil, fmt.Errorf("unsupported protocol")
 	}
+}
+
+// RestartDrain bounds how long a replaced listener serves the check-ins it
+// already accepted.
+const RestartDrain = 30 * time.Second
+
+// Restart replaces the listener on port with a new instance that takes over
+// its socket, so the port is never closed and no check-in is refused. The
+// old instance drains in the background.
+func (s *Server) Restart(port int) error {
+	v, ok := s.listeners.Load(port)
+	if !ok {
+		return fmt.Errorf("Listener does not exist")
+	}
+	old := v.(Listener)
+
+	files, err := old.Files()
+	if err != nil {
+		return err
+	}
+	handOver(files)
 
-	err := listener.Start(protocol, port)
+	listener, err := s.newListener(old.Protocol(), old.Metrics())
 	if err != nil {
-		log.Print(err)
+		discard(files)
+		return err
+	}
+	listener.SetComment(old.Comment())
+	old.Agents().Range(func(k, v interface{}) bool {
+		listener.Agents().Store(k, v)
+		return true
+	})
+
+	if err := listener.Start(old.Protocol(), port); err != nil {
+		discard(files)
 		return err
 	}
 
 	s.listeners.Store(port, listener)
+	s.listenerChanged(listener)
+
+	go func() {
+		ctx, cancel := context.WithTimeout(context.Background(), RestartDrain)
+		defer cancel()
+		if err := old.Shutdown(ctx); err != nil {
+			logger.Warn("listener drain", "port", port, "err", err)
+		}
+	}()
 
 	return nil
 }
 
+// Shutdown drains every listener in parallel until ctx is done.
+func (s *Server) Shutdown(ctx context.Context) {
+	var wg sync.WaitGroup
+	s.listeners.Range(func(k, v interface{}) bool {
+		wg.Add(1)
+		go func(l Listener) {
+			defer wg.Done()
+			if err := l.Shutdown(ctx); err != nil {
+				logger.Warn("listener drain", "port", l.Port(), "err", err)
+			}
+		}(v.(Listener))
+		return true
+	})
+	wg.Wait()
+}
+
+// Files duplicates the sockets of every listener, for a new process to take
+// over with SocketsEnvironment.
+func (s *Server) Files() (map[string]*os.File, error) {
+	files := make(map[string]*os.File)
+	var err error
+	s.listeners.Range(func(k, v interface{}) bool {
+		var f map[string]*os.File
+		if f, err = v.(Listener).Files(); err != nil {
+			return false
+		}
+		for key, file := range f {
+			files[key] = file
+		}
+		return true
+	})
+	if err != nil {
+		for _, f := range files {
+			f.Close()
+		}
+		return nil, err
+	}
+	return files, nil
+}
+
+// waitContext waits for wg until ctx is done, it reports whether wg finished.
+func waitContext(ctx context.Context, wg *sync.WaitGroup) bool {
+	done := make(chan struct{})
+	go func() {
+		wg.Wait()
+		close(done)
+	}()
+
+	select {
+	case <-done:
+		return true
+	case <-ctx.Done():
+		return false
+	}
+}
+
 func (s *Server) Stop(port int) error {
 	if v, ok := s.listeners.Load(port); ok {
 		l := v.(Listener)
 		s.listeners.Delete(port)
+		s.events.publish(EventListenerRemoved, struct {
+			Port int `json:"port"`
+		}{port})
 		return l.Stop()
 	}
 	return fmt.Errorf("Listener does not exist")
 }
 
+// Agent returns the session of the agent with the given id, creating it on
+// first use.
+func (s *Server) Agent(id string) *Agent {
+	if v, ok := s.agents.Load(id); ok {
+		return v.(*Agent)
+	}
+	v, _ := s.agents.LoadOrStore(id, newAgent(id))
+	return v.(*Agent)
+}
+
+// Checkin records a check-in of the agent through listener l.
+func (s *Server) Checkin(l Listener, id, address string) *Agent {
+	l.Metrics().Checkins.Inc()
+	return s.checkin(l, id, address, l.Protocol())
+}
+
+func (s *Server) checkin(l Listener, id, address string, protocol ListenerProtocol) *Agent {
+	agent := s.Agent(id)
+	if agent.touch(address, protocol) {
+		s.events.publish(EventAgent, NewAgentInfo(agent))
+	}
+	if l != nil {
+		l.Agents().Store(id, agent)
+	}
+
+	if hooks, ok := s.hooks.Load().(*serverHooks); ok {
+		for _, hook := range hooks.checkin {
+			hook(l, agent)
+		}
+	}
+
+	return agent
+}
+
+// Poll serves a check-in of agent id through l. It returns the pending tasks
+// whose frame fits in budget bytes, see taskQueue.Drain. With a non-zero wait
+// the check-in is held until a task is queued, the wait expires or ctx is
+// done, held is the time spent waiting. Check-ins of agents owned by another
+// cluster node are forwarded to it.
+func (s *Server) Poll(ctx context.Context, l Listener, id, address string, budget int,
+	wait time.Duration) (tasks []Task, held time.Duration) {
+	if c := s.Cluster(); c != nil {
+		if node, ok := c.remote(id); ok {
+			l.Metrics().Checkins.Inc()
+			tasks, held, err := c.poll(ctx, node, id, address, l.Protocol(), budget, wait)
+			if err != nil {
+				errorLog.Warn("cluster poll", "node", node.ID, "agent", id, "err", err)
+			}
+			return tasks, held
+		}
+	}
+	return s.poll(ctx, s.Checkin(l, id, address), budget, wait)
+}
+
+func (s *Server) poll(ctx context.Context, agent *Agent, budget int, wait time.Duration) ([]Task, time.Duration) {
+	var held time.Duration
+
+	tasks := s.Deliver(agent, budget)
+	for len(tasks) == 0 && wait > held {
+		// A notification may race with the drain above, so keep waiting
+		// until the deadline if the queue turns out to be empty.
+		start := time.Now()
+		ok := agent.Wait(ctx, wait-held)
+		held += time.Since(start)
+		if !ok {
+			break
+		}
+		tasks = s.Deliver(agent, budget)
+	}
+	return tasks, held
+}
+
+// Deliver pops the agent's pending tasks for a check-in response, see
+// taskQueue.Drain for budget.
+func (s *Server) Deliver(agent *Agent, budget int) []Task {
+	tasks := agent.Drain(budget)
+	if len(tasks) != 0 {
+		s.taskHooks(agent, tasks, TaskDelivered)
+	}
+	return tasks
+}
+
+func (s *Server) taskHooks(agent *Agent, tasks []Task, state TaskState) {
+	if hooks, ok := s.hooks.Load().(*serverHooks); ok {
+		for _, hook := range hooks.task {
+			hook(agent, tasks, state)
+		}
+	}
+}
+
+// updateHooks replaces the hooks with a modified copy, readers never lock.
+func (s *Server) updateHooks(update func(hooks *serverHooks)) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	hooks := &serverHooks{}
+	if old, ok := s.hooks.Load().(*serverHooks); ok {
+		hooks.checkin = append(hooks.checkin, old.checkin...)
+		hooks.task = append(hooks.task, old.task...)
+	}
+	update(hooks)
+	s.hooks.Store(hooks)
+}
+
+// AddCheckinHook registers hook to be called on every check-in.
+func (s *Server) AddCheckinHook(hook CheckinHook) {
+	s.updateHooks(func(hooks *serverHooks) { hooks.checkin = append(hooks.checkin, hook) })
+}
+
+// AddTaskHook registers hook to be called when tasks are queued or delivered.
+func (s *Server) AddTaskHook(hook TaskHook) {
+	s.updateHooks(func(hooks *serverHooks) { hooks.task = append(hooks.task, hook) })
+}
+
+// Enqueue queues data as a task for the agent, it is delivered with every
+// other pending task on the agent's next check-in on any listener. Tasks of
+// agents owned by another cluster node are queued there. Data larger than
+// MaxTaskSize is refused with ErrTaskTooLarge.
+func (s *Server) Enqueue(id string, data []byte) (uint64, error) {
+	if len(data) > MaxTaskSize {
+		return 0, ErrTaskTooLarge
+	}
+	if c := s.Cluster(); c != nil {
+		if node, ok := c.remote(id); ok {
+			return c.enqueue(context.Background(), node, id, data)
+		}
+	}
+	return s.enqueue(s.Agent(id), data)
+}
+
+func (s *Server) enqueue(agent *Agent, data []byte) (uint64, error) {
+	task := Task{ID: atomic.AddUint64(&s.taskID, 1), Data: data}
+	if err := agent.Push(task); err != nil {
+		return 0, err
+	}
+	s.taskHooks(agent, []Task{task}, TaskQueued)
+	return task.ID, nil
+}
+
+// listenerChanged publishes the state of a listener that started or changed
+// its status.
+func (s *Server) listenerChanged(l Listener) {
+	if v, ok := s.listeners.Load(l.Port()); ok && v == l {
+		s.events.publish(EventListener, NewListenerInfo(l))
+	}
+}
+
+// Subscribe streams state change events, resuming after sequence number
+// since when the events are still buffered. Otherwise replay is nil and the
+// caller should start from the returned Snapshot, whose Seq matches the
+// first event delivered on the subscription.
+func (s *Server) Subscribe(since uint64) (*Subscription, []Event, *Snapshot) {
+	sub, replay, seq, ok := s.events.subscribe(since)
+	if ok {
+		return sub, replay, nil
+	}
+
+	snapshot := &Snapshot{Seq: seq, Listeners: []ListenerInfo{}, Agents: []AgentInfo{}}
+	s.listeners.Range(func(k, v interface{}) bool {
+		snapshot.Listeners = append(snapshot.Listeners, NewListenerInfo(v.(Listener)))
+		return true
+	})
+	s.agents.Range(func(k, v interface{}) bool {
+		snapshot.Agents = append(snapshot.Agents, NewAgentInfo(v.(*Agent)))
+		return true
+	})
+
+	return sub, nil, snapshot
+}
+
 func (s *Server) Listeners() *sync.Map { return &s.listeners }
+func (s *Server) Agents() *sync.Map    { return &s.agents }
@@ -0,0 +1,69 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"runtime"
+	"sort"
+	"sync"
+	"testing"
+	"time"
+)
+
+// BenchmarkServerStart measures bringing a listener up and down, which
+// bounds how fast listeners can be restored or restarted.
+func BenchmarkServerStart(b *testing.B) {
+	chdirCert(b)
+
+	for _, protocol := range []ListenerProtocol{ListenerTCP, ListenerUDP, ListenerHTTP, ListenerHTTPS, ListenerDNS} {
+		b.Run(string(protocol), func(b *testing.B) {
+			s := &Server{}
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				port := freePort(b)
+				if err := s.Start(protocol, port); err != nil {
+					b.Fatal(err)
+				}
+				if err := s.Stop(port); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+// benchmarkCheckins is a local load test: b.N check-ins are spread over
+// clients sending one at a time, and the throughput per core and the 99th
+// percentile latency are reported. checkin is called with the client number
+// and the check-in number, a failed check-in counts with its latency.
+func benchmarkCheckins(b *testing.B, clients int, checkin func(c, i int)) {
+	latencies := make([][]time.Duration, clients)
+	var wg sync.WaitGroup
+
+	b.ResetTimer()
+	start := time.Now()
+	for c := 0; c < clients; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			for i := c; i < b.N; i += clients {
+				sent := time.Now()
+				checkin(c, i)
+				latencies[c] = append(latencies[c], time.Since(sent))
+			}
+		}(c)
+	}
+	wg.Wait()
+	elapsed := time.Since(start)
+	b.StopTimer()
+
+	var all []time.Duration
+	for _, l := range latencies {
+		all = append(all, l...)
+	}
+	sort.Slice(all, func(i, j int) bool { return all[i] < all[j] })
+	if len(all) > 0 {
+		b.ReportMetric(float64(all[len(all)*99/100].Microseconds()), "p99-µs")
+	}
+	b.ReportMetric(float64(b.N)/elapsed.Seconds()/float64(runtime.GOMAXPROCS(0)), "qps/core")
+}
@@ -0,0 +1,204 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"context"
+	"fmt"
+	"net"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+)
+
+// SocketsEnv passes listening sockets to a new cc process, as a list of
+// "<network>/<port>=<fd>" separated by commas. The descriptors are the
+// ExtraFiles of the child.
+const SocketsEnv = "PUREWATER_SOCKETS"
+
+// sockets holds listening sockets handed over by a restarted listener or
+// inherited from the parent process, keyed by "<network>/<port>". The next
+// listener bound to the same key takes them over instead of binding again,
+// so the port is never closed.
+var sockets = struct {
+	sync.Mutex
+	files map[string]*os.File
+}{files: make(map[string]*os.File)}
+
+func init() {
+	env := os.Getenv(SocketsEnv)
+	if env == "" {
+		return
+	}
+	os.Unsetenv(SocketsEnv)
+
+	for _, item := range strings.Split(env, ",") {
+		i := strings.LastIndexByte(item, '=')
+		if i == -1 {
+			continue
+		}
+		fd, err := strconv.Atoi(item[i+1:])
+		if err != nil {
+			continue
+		}
+		sockets.files[item[:i]] = os.NewFile(uintptr(fd), item[:i])
+	}
+}
+
+func socketKey(network string, port int) string { return network + "/" + strconv.Itoa(port) }
+
+// shardKey names the i-th of the sockets sharing a port.
+func shardKey(network string, port, i int) string {
+	if i == 0 {
+		return socketKey(network, port)
+	}
+	return socketKey(network, port) + "#" + strconv.Itoa(i)
+}
+
+// handOver stores sockets for the next listener bound to their keys.
+func handOver(files map[string]*os.File) {
+	sockets.Lock()
+	defer sockets.Unlock()
+
+	for key, f := range files {
+		if old, ok := sockets.files[key]; ok {
+			old.Close()
+		}
+		sockets.files[key] = f
+	}
+}
+
+// discard closes handed over sockets that were not taken.
+func discard(files map[string]*os.File) {
+	sockets.Lock()
+	defer sockets.Unlock()
+
+	for key, f := range files {
+		if sockets.files[key] == f {
+			delete(sockets.files, key)
+		}
+		f.Close()
+	}
+}
+
+func takeSocket(key string) *os.File {
+	sockets.Lock()
+	defer sockets.Unlock()
+
+	f := sockets.files[key]
+	delete(sockets.files, key)
+	return f
+}
+
+// ListenTCP binds a TCP port on all addresses, or takes over the socket
+// handed over for it.
+func ListenTCP(port int) (*net.TCPListener, error) {
+	f := takeSocket(socketKey("tcp", port))
+	if f == nil {
+		return net.ListenTCP("tcp", &net.TCPAddr{IP: net.IPv4(0, 0, 0, 0), Port: port})
+	}
+	defer f.Close()
+
+	ln, err := net.FileListener(f)
+	if err != nil {
+		return nil, err
+	}
+	tcp, ok := ln.(*net.TCPListener)
+	if !ok {
+		ln.Close()
+		return nil, fmt.Errorf("inherited socket %s is not a TCP listener", f.Name())
+	}
+	return tcp, nil
+}
+
+// ListenUDP binds a UDP port on all addresses, or takes over the socket
+// handed over for it.
+func ListenUDP(port int) (*net.UDPConn, error) {
+	f := takeSocket(socketKey("udp", port))
+	if f == nil {
+		return net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(0, 0, 0, 0), Port: port})
+	}
+	return fileUDP(f)
+}
+
+// ListenUDPShards binds n UDP sockets sharing port with SO_REUSEPORT, the
+// kernel spreads datagrams over them by flow. Every socket handed over for
+// the port is taken over, there may be more than n of them: a socket left
+// without a reader would silently drop its share of the datagrams.
+func ListenUDPShards(port, n int) ([]*net.UDPConn, error) {
+	if !reusePortSupported {
+		conn, err := ListenUDP(port)
+		if err != nil {
+			return nil, err
+		}
+		return []*net.UDPConn{conn}, nil
+	}
+
+	var conns []*net.UDPConn
+	fail := func(err error) ([]*net.UDPConn, error) {
+		for _, conn := range conns {
+			conn.Close()
+		}
+		return nil, err
+	}
+
+	for i := 0; ; i++ {
+		f := takeSocket(shardKey("udp", port, i))
+		if f == nil {
+			break
+		}
+		conn, err := fileUDP(f)
+		if err != nil {
+			return fail(err)
+		}
+		conns = append(conns, conn)
+	}
+
+	lc := net.ListenConfig{Control: reusePort}
+	for len(conns) < n {
+		conn, err := lc.ListenPacket(context.Background(), "udp", fmt.Sprintf("0.0.0.0:%d", port))
+		if err != nil {
+			return fail(err)
+		}
+		conns = append(conns, conn.(*net.UDPConn))
+	}
+
+	return conns, nil
+}
+
+func fileUDP(f *os.File) (*net.UDPConn, error) {
+	defer f.Close()
+
+	conn, err := net.FilePacketConn(f)
+	if err != nil {
+		return nil, err
+	}
+	udp, ok := conn.(*net.UDPConn)
+	if !ok {
+		conn.Close()
+		return nil, fmt.Errorf("inherited socket %s is not a UDP socket", f.Name())
+	}
+	return udp, nil
+}
+
+// SocketsEnvironment describes files for a child process, it returns the
+// SocketsEnv variable and the matching ExtraFiles.
+func SocketsEnvironment(files map[string]*os.File) (string, []*os.File) {
+	keys := make([]string, 0, len(files))
+	for key := range files {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+
+	var items []string
+	var extra []*os.File
+	for _, key := range keys {
+		// ExtraFiles[i] becomes descriptor 3+i in the child.
+		items = append(items, fmt.Sprintf("%s=%d", key, 3+len(extra)))
+		extra = append(extra, files[key])
+	}
+
+	return SocketsEnv + "=" + strings.Join(items, ","), extra
+}
@@ -3,9 +3,16 @@
 package server
 
 import (
-	"log"
+	"bufio"
+	"context"
+	"encoding/binary"
+	"io"
 	"net"
+	"os"
 	"sync"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
 )
 
 type TCPListener struct {
@@ -15,22 +22,100 @@ type TCPListener struct {
 	agents   sync.Map
 	comment  string
 	listener *net.TCPListener
+	srv      *Server
+	metrics  *ListenerMetrics
+	closing  chan struct{}
+	once     sync.Once
+	conns    sync.Map // net.Conn -> struct{}
+	wg       sync.WaitGroup
 }
 
+// handle serves check-ins on a connection. Each check-in is the agent id
+// prefixed with its 16-bit big-endian length, answered with the 32-bit
+// big-endian length of the task frame followed by the frame.
 func (l *TCPListener) handle(conn net.Conn) {
+	defer l.wg.Done()
+	defer l.srv.ReleaseSession()
 	defer conn.Close()
-	log.Printf("TCP Handle Recvfrom: %s", conn.RemoteAddr().String())
+	acceptLog.Debug("tcp accept", "port", l.port, "addr", conn.RemoteAddr())
+
+	l.metrics.Active.Inc()
+	defer l.metrics.Active.Dec()
+
+	l.conns.Store(conn, struct{}{})
+	defer l.conns.Delete(conn)
+
+	r := bufio.NewReader(conn)
+	var hdr [4]byte
+	var frame []byte
+
+	for {
+		if _, err := io.ReadFull(r, hdr[:2]); err != nil {
+			if err != io.EOF && !l.draining() {
+				errorLog.Warn("tcp read", "port", l.port, "err", err)
+			}
+			return
+		}
+
+		id := make([]byte, binary.BigEndian.Uint16(hdr[:2]))
+		if _, err := io.ReadFull(r, id); err != nil {
+			errorLog.Warn("tcp read", "port", l.port, "err", err)
+			return
+		}
+
+		start := time.Now()
+		l.metrics.BytesIn.Add(uint64(2 + len(id)))
+
+		if !ValidAgentID(string(id)) {
+			l.metrics.DecodeErrors.Inc()
+			errorLog.Warn("tcp invalid agent id", "port", l.port, "addr", conn.RemoteAddr())
+			return
+		}
+
+		if retryAfter := l.srv.Admit(l, conn.RemoteAddr()); retryAfter != 0 {
+			l.writeBusy(conn, retryAfter)
+			return
+		}
+
+		tasks, _ := l.srv.Poll(context.Background(), l, string(id), conn.RemoteAddr().String(), MaxFrameSize, 0)
+
+		frame = AppendTaskFrame(frame[:0], tasks)
+		binary.BigEndian.PutUint32(hdr[:], uint32(len(frame)))
+		n, err := conn.Write(append(hdr[:], frame...))
+		l.metrics.BytesOut.Add(uint64(n))
+		if err != nil {
+			errorLog.Warn("tcp write", "port", l.port, "err", err)
+			return
+		}
+		l.metrics.Latency.Since(start)
+
+		if l.draining() {
+			// The agent reconnects to the new listener.
+			return
+		}
+	}
+}
+
+// writeBusy defers the agent, the connection is closed after the busy frame.
+func (l *TCPListener) writeBusy(conn net.Conn, retryAfter int) {
+	var b [16]byte
+	frame := AppendBusyFrame(b[4:4], retryAfter)
+	binary.BigEndian.PutUint32(b[:4], uint32(len(frame)))
+	conn.SetWriteDeadline(time.Now().Add(time.Second))
+	n, _ := conn.Write(b[:4+len(frame)])
+	l.metrics.BytesOut.Add(uint64(n))
 }
 
 func (l *TCPListener) Start(protocol ListenerProtocol, port int) (err error) {
-	l.listener, err = net.ListenTCP("tcp", &net.TCPAddr{IP: net.IPv4(0, 0, 0, 0), Port: port})
+	l.listener, err = ListenTCP(port)
 	if err != nil {
-		log.Print(err)
+		logger.Error("tcp listen", "port", port, "err", err)
 		return
 	}
 
 	l.protocol = protocol
 	l.port = port
+	l.closing = make(chan struct{})
 	l.SetOnline()
 
 	go func(l *TCPListener) {
@@ -38,22 +123,77 @@ func (l *TCPListener) Start(protocol ListenerProtocol, port int) (err error) {
 		for {
 			conn, err := l.listener.Accept()
 			if err != nil {
-				log.Print(err)
-				l.SetOffline()
+				select {
+				case <-l.closing:
+				default:
+					logger.Error("tcp accept", "port", l.port, "err", err)
+					l.SetOffline()
+				}
 				break
 			}
+			l.metrics.Accepts.Inc()
+			if !l.srv.AcquireSession(l) {
+				// Refused before a goroutine is spent on the connection.
+				l.writeBusy(conn, sessionRetryAfter())
+				conn.Close()
+				continue
+			}
+			l.wg.Add(1)
 			go l.handle(conn)
 		}
 	}(l)
 	return nil
 }
 
-func (l *TCPListener) Stop() error                { return l.listener.Close() }
+// Shutdown stops accepting and lets every connection finish its current
+// check-in. Idle connections get a second to send one more before they are
+// closed, connections left when ctx is done are closed.
+func (l *TCPListener) Shutdown(ctx context.Context) error {
+	l.once.Do(func() { close(l.closing) })
+	err := l.listener.Close()
+
+	l.conns.Range(func(k, v interface{}) bool {
+		k.(net.Conn).SetReadDeadline(time.Now().Add(time.Second))
+		return true
+	})
+
+	if !waitContext(ctx, &l.wg) {
+		l.conns.Range(func(k, v interface{}) bool {
+			k.(net.Conn).Close()
+			return true
+		})
+	}
+	return err
+}
+
+func (l *TCPListener) draining() bool {
+	select {
+	case <-l.closing:
+		return true
+	default:
+		return false
+	}
+}
+
+func (l *TCPListener) Files() (map[string]*os.File, error) {
+	f, err := l.listener.File()
+	if err != nil {
+		return nil, err
+	}
+	return map[string]*os.File{socketKey("tcp", l.port): f}, nil
+}
+
+func (l *TCPListener) Stop() error {
+	l.once.Do(func() { close(l.closing) })
+	return l.listener.Close()
+}
+
 func (l *TCPListener) Agents() *sync.Map          { return &l.agents }
 func (l *TCPListener) Status() ListenerStatus     { return l.status }
-func (l *TCPListener) SetOffline()                { l.status = ListenerOffline }
-func (l *TCPListener) SetOnline()                 { l.status = ListenerOnline }
+func (l *TCPListener) SetOffline()                { l.status = ListenerOffline; l.srv.listenerChanged(l) }
+func (l *TCPListener) SetOnline()                 { l.status = ListenerOnline; l.srv.listenerChanged(l) }
 func (l *TCPListener) Comment() string            { return l.comment }
 func (l *TCPListener) SetComment(comment string)  { l.comment = comment }
 func (l *TCPListener) Protocol() ListenerProtocol { return l.protocol }
 func (l *TCPListener) Port() int                  { return l.port }
+func (l *TCPListener) Metrics() *ListenerMetrics  { return l.metrics }
@@ -0,0 +1,95 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io"
+	"net"
+	"runtime"
+	"testing"
+)
+
+// TestTCPFrameBudget checks the frames of a backlog of large tasks stay
+// within MaxFrameSize, and no task is lost over the check-ins.
+func TestTCPFrameBudget(t *testing.T) {
+	s := &Server{}
+	port := freePort(t)
+	if err := s.Start(ListenerTCP, port); err != nil {
+		t.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	for _, size := range []int{MaxTaskSize, MaxTaskSize, 100} {
+		if _, err := s.Enqueue("agent", make([]byte, size)); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	conn, err := net.Dial("tcp", fmt.Sprintf("127.0.0.1:%d", port))
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+
+	msg := append([]byte{0, 5}, "agent"...)
+	var counts []int
+	for len(counts) < 3 {
+		var hdr [4]byte
+		if _, err := conn.Write(msg); err != nil {
+			t.Fatal(err)
+		}
+		if _, err := io.ReadFull(conn, hdr[:]); err != nil {
+			t.Fatal(err)
+		}
+		size := binary.BigEndian.Uint32(hdr[:])
+		if size > MaxFrameSize {
+			t.Fatalf("frame of %d bytes over %d", size, MaxFrameSize)
+		}
+		frame := make([]byte, size)
+		if _, err := io.ReadFull(conn, frame); err != nil {
+			t.Fatal(err)
+		}
+		tasks, err := ParseTaskFrame(frame)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(tasks) == 0 {
+			break
+		}
+		counts = append(counts, len(tasks))
+	}
+	if fmt.Sprint(counts) != "[1 1 1]" {
+		t.Fatalf("tasks per frame %v", counts)
+	}
+}
+
+// BenchmarkTCPListener checks in over kept-alive loopback connections, see
+// benchmarkCheckins.
+func BenchmarkTCPListener(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freePort(b)
+	if err := s.Start(ListenerTCP, port); err != nil {
+		b.Fatal(err)
+	}
+	defer s.Stop(port)
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+
+	clients := 4 * runtime.GOMAXPROCS(0)
+	conns := make([]net.Conn, clients)
+	defer func() {
+		for _, conn := range conns {
+			if conn != nil {
+				conn.Close()
+			}
+		}
+	}()
+
+	benchmarkCheckins(b, clients, func(c, i int) {
+		if err := tcpCheckin(&conns[c], addr, fmt.Sprintf("agent-%d", c)); err != nil {
+			b.Error(err)
+		}
+	})
+}
@@ -0,0 +1,112 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"crypto/hmac"
+	"crypto/rand"
+	"crypto/sha256"
+	"crypto/tls"
+	"encoding/binary"
+	"sync"
+	"time"
+)
+
+// ticketRotation is how long a session ticket key encrypts new tickets, a
+// key keeps decrypting for two more periods.
+const ticketRotation = time.Hour
+
+// sessionTickets derives the session ticket keys of every TLS listener from
+// a secret and the current period, so that nodes and processes sharing the
+// secret resume each other's sessions, across listener restarts and
+// upgrades. Keys rotate every ticketRotation.
+type sessionTickets struct {
+	mu      sync.Mutex
+	secret  []byte
+	configs map[*tls.Config]struct{}
+	once    sync.Once
+}
+
+var tickets = func() *sessionTickets {
+	secret := make([]byte, 32)
+	rand.Read(secret)
+	return &sessionTickets{secret: secret, configs: make(map[*tls.Config]struct{})}
+}()
+
+// SetTicketSecret sets the secret shared by the cluster nodes. Without it
+// each process uses a random secret.
+func SetTicketSecret(secret []byte) {
+	tickets.mu.Lock()
+	defer tickets.mu.Unlock()
+
+	tickets.secret = append([]byte(nil), secret...)
+	tickets.update()
+}
+
+// keys returns the keys of the current period first, as it encrypts, then
+// the next one to tolerate clock skew between nodes and the previous ones.
+func (t *sessionTickets) keys(now time.Time) [][32]byte {
+	period := now.Unix() / int64(ticketRotation/time.Second)
+
+	var keys [][32]byte
+	for _, p := range []int64{period, period + 1, period - 1, period - 2} {
+		mac := hmac.New(sha256.New, t.secret)
+		var b [8]byte
+		binary.BigEndian.PutUint64(b[:], uint64(p))
+		mac.Write([]byte("purewater session ticket"))
+		mac.Write(b[:])
+
+		var key [32]byte
+		copy(key[:], mac.Sum(nil))
+		keys = append(keys, key)
+	}
+	return keys
+}
+
+func (t *sessionTickets) update() {
+	keys := t.keys(time.Now())
+	for config := range t.configs {
+		config.SetSessionTicketKeys(keys)
+	}
+}
+
+func (t *sessionTickets) register(config *tls.Config) {
+	t.once.Do(func() { go t.rotate() })
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	t.configs[config] = struct{}{}
+	config.SetSessionTicketKeys(t.keys(time.Now()))
+}
+
+func (t *sessionTickets) unregister(config *tls.Config) {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	delete(t.configs, config)
+}
+
+func (t *sessionTickets) rotate() {
+	for {
+		now := time.Now()
+		next := now.Truncate(ticketRotation).Add(ticketRotation)
+		time.Sleep(next.Sub(now))
+
+		t.mu.Lock()
+		t.update()
+		t.mu.Unlock()
+	}
+}
+
+// newTLSConfig returns the configuration of a TLS listener, serving HTTP/2
+// and HTTP/1.1 with resumable sessions.
+func newTLSConfig(cert tls.Certificate) *tls.Config {
+	config := &tls.Config{
+		Certificates: []tls.Certificate{cert},
+		MinVersion:   tls.VersionTLS12,
+		NextProtos:   []string{"h2", "http/1.1"},
+	}
+	tickets.register(config)
+	return config
+}
@@ -3,9 +3,13 @@
 package server
 
 import (
-	"log"
+	"context"
 	"net"
+	"os"
 	"sync"
+	"time"
+
+	"github.com/h1zzz/purewater/cc/logger"
 )
 
 type UDPListener struct {
@@ -15,48 +19,126 @@ type UDPListener struct {
 	agents   sync.Map
 	comment  string
 	conn     *net.UDPConn
+	srv      *Server
+	metrics  *ListenerMetrics
+	closing  chan struct{}
+	once     sync.Once
+	done     chan struct{}
 }
 
+// udpFrameBudget keeps task frames within a single unfragmented datagram.
+const udpFrameBudget = 1400
+
+// handle serves check-ins, each datagram carries an agent id and is answered
+// with a datagram holding the task frame.
 func (l *UDPListener) handle() error {
 	defer l.conn.Close()
+
+	buf := make([]byte, 2048)
+	frame := make([]byte, 0, udpFrameBudget)
+
 	for {
-		buf := make([]byte, 2048)
-		_, err := l.conn.Read(buf)
+		n, addr, err := l.conn.ReadFromUDP(buf)
 		if err != nil {
-			log.Print(err)
 			return err
 		}
-		log.Printf("UDP Handle Recvfrom: %s", l.conn.RemoteAddr().String())
+		recvLog.Debug("udp recv", "port", l.port, "addr", addr)
+
+		start := time.Now()
+		l.metrics.Datagrams.Inc()
+		l.metrics.BytesIn.Add(uint64(n))
+
+		id := string(buf[:n])
+		if !ValidAgentID(id) {
+			l.metrics.DecodeErrors.Inc()
+			continue
+		}
+
+		if retryAfter := l.srv.Admit(l, addr); retryAfter != 0 {
+			frame = AppendBusyFrame(frame[:0], retryAfter)
+		} else if l.srv.Forwarded(id) {
+			l.srv.goForward(func() {
+				tasks, _ := l.srv.Poll(context.Background(), l, id, addr.String(), udpFrameBudget, 0)
+				l.reply(AppendTaskFrame(nil, tasks), addr, start)
+			})
+			continue
+		} else {
+			tasks, _ := l.srv.Poll(context.Background(), l, id, addr.String(), udpFrameBudget, 0)
+			frame = AppendTaskFrame(frame[:0], tasks)
+		}
+		l.reply(frame, addr, start)
+	}
+}
+
+func (l *UDPListener) reply(frame []byte, addr *net.UDPAddr, start time.Time) {
+	if n, err := l.conn.WriteToUDP(frame, addr); err != nil {
+		errorLog.Warn("udp write", "port", l.port, "err", err)
+	} else {
+		l.metrics.BytesOut.Add(uint64(n))
 	}
+	l.metrics.Latency.Since(start)
 }
 
 func (l *UDPListener) Start(protocol ListenerProtocol, port int) (err error) {
-	l.conn, err = net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(0, 0, 0, 0), Port: port})
+	l.conn, err = ListenUDP(port)
 	if err != nil {
-		log.Print(err)
+		logger.Error("udp listen", "port", port, "err", err)
 		return
 	}
 
 	l.protocol = protocol
 	l.port = port
+	l.closing = make(chan struct{})
+	l.done = make(chan struct{})
 	l.SetOnline()
 
 	go func(l *UDPListener) {
+		defer close(l.done)
 		if err := l.handle(); err != nil {
-			log.Print(err)
-			l.SetOffline()
+			select {
+			case <-l.closing:
+			default:
+				logger.Error("udp read", "port", l.port, "err", err)
+				l.SetOffline()
+			}
 		}
 	}(l)
 
 	return nil
 }
 
-func (l *UDPListener) Stop() error                { return l.conn.Close() }
+// Shutdown stops reading once the datagram in hand has been answered.
+func (l *UDPListener) Shutdown(ctx context.Context) error {
+	l.once.Do(func() { close(l.closing) })
+	l.conn.SetReadDeadline(time.Now())
+
+	select {
+	case <-l.done:
+		return nil
+	case <-ctx.Done():
+		return l.conn.Close()
+	}
+}
+
+func (l *UDPListener) Files() (map[string]*os.File, error) {
+	f, err := l.conn.File()
+	if err != nil {
+		return nil, err
+	}
+	return map[string]*os.File{socketKey("udp", l.port): f}, nil
+}
+
+func (l *UDPListener) Stop() error {
+	l.once.Do(func() { close(l.closing) })
+	return l.conn.Close()
+}
+
 func (l *UDPListener) Agents() *sync.Map          { return &l.agents }
 func (l *UDPListener) Status() ListenerStatus     { return l.status }
-func (l *UDPListener) SetOffline()                { l.status = ListenerOffline }
-func (l *UDPListener) SetOnline()                 { l.status = ListenerOnline }
+func (l *UDPListener) SetOffline()                { l.status = ListenerOffline; l.srv.listenerChanged(l) }
+func (l *UDPListener) SetOnline()                 { l.status = ListenerOnline; l.srv.listenerChanged(l) }
 func (l *UDPListener) Comment() string            { return l.comment }
 func (l *UDPListener) SetComment(comment string)  { l.comment = comment }
 func (l *UDPListener) Protocol() ListenerProtocol { return l.protocol }
 func (l *UDPListener) Port() int                  { return l.port }
+func (l *UDPListener) Metrics() *ListenerMetrics  { return l.metrics }
@@ -0,0 +1,45 @@
+// MIT License Copyright (c) 2022, h1zzz
+
+package server
+
+import (
+	"fmt"
+	"net"
+	"runtime"
+	"testing"
+	"time"
+)
+
+// BenchmarkUDPListener sends check-in datagrams over loopback, see
+// benchmarkCheckins.
+func BenchmarkUDPListener(b *testing.B) {
+	s := &Server{}
+	s.SetAdmission(AdmissionConfig{}) // load from a single address
+	port := freeUDPPort(b)
+	if err := s.Start(ListenerUDP, port); err != nil {
+		b.Fatal(err)
+	}
+	defer s.Stop(port)
+
+	clients := 4 * runtime.GOMAXPROCS(0)
+	conns := make([]net.Conn, clients)
+	ids := make([][]byte, clients)
+	for c := range conns {
+		conn, err := net.Dial("udp", fmt.Sprintf("127.0.0.1:%d", port))
+		if err != nil {
+			b.Fatal(err)
+		}
+		defer conn.Close()
+		conns[c] = conn
+		ids[c] = []byte(fmt.Sprintf("agent-%d", c))
+	}
+
+	benchmarkCheckins(b, clients, func(c, i int) {
+		conn := conns[c]
+		var resp [udpFrameBudget]byte
+		conn.SetReadDeadline(time.Now().Add(time.Second))
+		conn.Write(ids[c])
+		// Lost datagrams are counted at the timeout.
+		conn.Read(resp[:])
+	})
+}
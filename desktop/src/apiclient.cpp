@@ -0,0 +1,279 @@
+#include "apiclient.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSslCertificate>
+#include <QUrlQuery>
+
+#include "eventsource.h"
+
+namespace {
+
+// forEachEvent calls fn with the id, type and data of every server-sent
+// event in data, comments such as keepalives are skipped.
+template <typename Fn>
+void forEachEvent(const QByteArray &data, Fn fn) {
+    int from = 0;
+    while (from < data.size()) {
+        int end = data.indexOf("\n\n", from);
+        if (end == -1) {
+            end = data.size();
+        }
+
+        quint64 id = 0;
+        QByteArray type, payload;
+        for (const QByteArray &line : data.mid(from, end - from).split('\n')) {
+            if (line.startsWith("id: ")) {
+                id = line.mid(4).toULongLong();
+            } else if (line.startsWith("event: ")) {
+                type = line.mid(7);
+            } else if (line.startsWith("data: ")) {
+                payload = line.mid(6);
+            }
+        }
+        from = end + 2;
+
+        if (!type.isEmpty()) {
+            fn(id, type, QJsonDocument::fromJson(payload).object());
+        }
+    }
+}
+
+// decodeEvents parses the events of api.Events. A snapshot is a batch of
+// its own, the deltas between snapshots are gathered into one batch.
+QVector<StateBatch> decodeEvents(const QByteArray &data) {
+    QVector<StateBatch> batches;
+    StateBatch batch;
+    bool empty = true;
+
+    forEachEvent(data, [&](quint64 id, const QByteArray &type,
+                           const QJsonObject &obj) {
+        if (type == "snapshot") {
+            if (!empty) {
+                batches.append(std::move(batch));
+            }
+            StateBatch snapshot;
+            snapshot.snapshot = true;
+            snapshot.seq = id;
+            for (const QJsonValue &v :
+                 obj.value(QLatin1String("agents")).toArray()) {
+                snapshot.agents.append(AgentInfo::fromJson(v.toObject()));
+            }
+            for (const QJsonValue &v :
+                 obj.value(QLatin1String("listeners")).toArray()) {
+                snapshot.listeners.append(
+                    ListenerInfo::fromJson(v.toObject()));
+            }
+            batches.append(std::move(snapshot));
+            batch = StateBatch();
+            empty = true;
+            return;
+        }
+
+        if (type == "agent") {
+            batch.agents.append(AgentInfo::fromJson(obj));
+        } else if (type == "listener") {
+            batch.listeners.append(ListenerInfo::fromJson(obj));
+        } else if (type == "listener_removed") {
+            batch.removedListeners.append(ListenerInfo::fromJson(obj).key());
+        }
+        batch.seq = id;
+        empty = false;
+    });
+
+    if (!empty) {
+        batches.append(std::move(batch));
+    }
+    return batches;
+}
+
+// decodeRateEvents parses the events of api.Rates.
+QVector<RateBatch> decodeRateEvents(const QByteArray &data) {
+    QVector<RateBatch> rates;
+
+    forEachEvent(data, [&](quint64, const QByteArray &type,
+                           const QJsonObject &obj) {
+        if (type != "rates") {
+            return;
+        }
+        RateBatch batch;
+        batch.port = obj.value(QLatin1String("port")).toInt();
+        batch.resolution = obj.value(QLatin1String("resolution")).toString();
+        const QJsonArray points = obj.value(QLatin1String("points")).toArray();
+        batch.points.reserve(points.size());
+        for (const QJsonValue &v : points) {
+            batch.points.append(RatePoint::fromJson(v.toObject()));
+        }
+        rates.append(std::move(batch));
+    });
+
+    return rates;
+}
+
+}  // namespace
+
+ApiClient::ApiClient(const QUrl &base, QObject *parent)
+    : QObject(parent),
+      base_(base),
+      ssl_(QSslConfiguration::defaultConfiguration()) {
+    decoder_.setMaxThreadCount(1);
+
+    events_ = new EventSource(
+        &manager_,
+        [this] {
+            QNetworkRequest req = request(QStringLiteral("/api/events"));
+            if (seq_ != 0) {
+                req.setRawHeader("Last-Event-ID", QByteArray::number(seq_));
+            }
+            return req;
+        },
+        this);
+    connect(events_, &EventSource::received, this, &ApiClient::decodeState);
+    connect(events_, &EventSource::errorOccurred, this,
+            &ApiClient::errorOccurred);
+
+    rates_ = new EventSource(
+        &manager_,
+        [this] {
+            QNetworkRequest req = request(QStringLiteral("/api/rates"));
+            QUrl url = req.url();
+            url.setQuery(rateQuery_);
+            req.setUrl(url);
+            return req;
+        },
+        this);
+    connect(rates_, &EventSource::received, this, &ApiClient::decodeRates);
+}
+
+ApiClient::~ApiClient() {
+    // Nothing may be delivered to this object once it is gone.
+    decoder_.clear();
+    decoder_.waitForDone();
+    events_->close();
+    rates_->close();
+}
+
+void ApiClient::addCaCertificates(const QString &path) {
+    QList<QSslCertificate> certs = ssl_.caCertificates();
+    certs.append(QSslCertificate::fromPath(path));
+    ssl_.setCaCertificates(certs);
+}
+
+QNetworkRequest ApiClient::request(const QString &path) const {
+    QUrl url = base_;
+    url.setPath(path);
+
+    QNetworkRequest req(url);
+    req.setSslConfiguration(ssl_);
+    req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    return req;
+}
+
+void ApiClient::get(const QString &path, Callback callback) {
+    auto it = inflight_.find(path);
+    if (it != inflight_.end()) {
+        it->append(std::move(callback));
+        return;
+    }
+    inflight_.insert(path, QVector<Callback>{std::move(callback)});
+
+    QNetworkReply *reply = manager_.get(request(path));
+    connect(reply, &QNetworkReply::finished, this, [this, reply, path] {
+        finish(reply, inflight_.take(path));
+    });
+}
+
+void ApiClient::post(const QString &path, const QJsonObject &body,
+                     Callback callback) {
+    QNetworkRequest req = request(path);
+    req.setHeader(QNetworkRequest::ContentTypeHeader,
+                  QStringLiteral("application/json"));
+
+    QNetworkReply *reply =
+        manager_.post(req, QJsonDocument(body).toJson(QJsonDocument::Compact));
+    connect(reply, &QNetworkReply::finished, this, [this, reply, callback] {
+        finish(reply, QVector<Callback>{callback});
+    });
+}
+
+// finish decodes the APIReply of reply on the decoder thread and runs the
+// callbacks with it on the UI thread.
+void ApiClient::finish(QNetworkReply *reply, QVector<Callback> callbacks) {
+    QByteArray data = reply->readAll();
+    QString error;
+    if (reply->error() != QNetworkReply::NoError) {
+        error = reply->errorString();
+    }
+    reply->deleteLater();
+
+    decoder_.start([this, data, error, callbacks] {
+        QJsonParseError parseError;
+        QJsonObject obj = QJsonDocument::fromJson(data, &parseError).object();
+
+        QString message = error;
+        if (parseError.error == QJsonParseError::NoError &&
+            obj.value(QLatin1String("code")).toInt() != 0) {
+            // the cc explains the failure better than the HTTP status
+            message = obj.value(QLatin1String("msg")).toString();
+        } else if (message.isEmpty() &&
+                   parseError.error != QJsonParseError::NoError) {
+            message = parseError.errorString();
+        }
+        QJsonValue content = obj.value(QLatin1String("content"));
+
+        QMetaObject::invokeMethod(
+            this,
+            [callbacks, content, message] {
+                for (const Callback &callback : callbacks) {
+                    callback(content, message);
+                }
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void ApiClient::subscribe(quint64 seq) {
+    seq_ = seq;
+    events_->open();
+}
+
+void ApiClient::subscribeRates(const QString &resolution, int points) {
+    QUrlQuery query;
+    query.addQueryItem(QStringLiteral("resolution"), resolution);
+    query.addQueryItem(QStringLiteral("points"), QString::number(points));
+    rateQuery_ = query.toString();
+    rates_->open();
+}
+
+void ApiClient::decodeState(const QByteArray &events) {
+    decoder_.start([this, events] {
+        QVector<StateBatch> batches = decodeEvents(events);
+        if (batches.isEmpty()) {
+            return;
+        }
+        QMetaObject::invokeMethod(
+            this,
+            [this, batches] {
+                for (const StateBatch &batch : batches) {
+                    seq_ = batch.seq;
+                    emit batchReceived(batch);
+                }
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void ApiClient::decodeRates(const QByteArray &events) {
+    decoder_.start([this, events] {
+        QVector<RateBatch> rates = decodeRateEvents(events);
+        if (rates.isEmpty()) {
+            return;
+        }
+        QMetaObject::invokeMethod(
+            this, [this, rates] { emit ratesReceived(rates); },
+            Qt::QueuedConnection);
+    });
+}
@@ -0,0 +1,79 @@
+#ifndef APICLIENT_H
+#define APICLIENT_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QNetworkAccessManager>
+#include <QObject>
+#include <QSslConfiguration>
+#include <QThreadPool>
+#include <QUrl>
+#include <QVector>
+
+#include <functional>
+
+#include "state.h"
+
+class EventSource;
+class QNetworkReply;
+
+// ApiClient talks to the cc /api over a persistent HTTP/2 connection. The
+// bodies are decoded on a worker thread and the results delivered on the
+// UI thread, so a large response never blocks the event loop.
+class ApiClient : public QObject {
+    Q_OBJECT
+
+public:
+    // Receives the "content" of the APIReply, or an error message.
+    using Callback =
+        std::function<void(const QJsonValue &content, const QString &error)>;
+
+    explicit ApiClient(const QUrl &base, QObject *parent = nullptr);
+    ~ApiClient();
+
+    // Trust the PEM certificates in path, for a cc using its own CA.
+    void addCaCertificates(const QString &path);
+
+    // GET path. Identical requests still in flight share a single request
+    // and every callback gets its result.
+    void get(const QString &path, Callback callback);
+    void post(const QString &path, const QJsonObject &body, Callback callback);
+
+    // Follow the event stream, resuming after sequence number seq when it
+    // is not 0. The stream is reopened after errors.
+    void subscribe(quint64 seq = 0);
+    quint64 sequence() const { return seq_; }
+
+    // Follow the listener rates at resolution "1s", "1m" or "1h", with a
+    // history of at most points points per listener.
+    void subscribeRates(const QString &resolution, int points);
+
+signals:
+    // A run of events decoded from the stream, in stream order.
+    void batchReceived(const StateBatch &batch);
+    void ratesReceived(const QVector<RateBatch> &rates);
+    void errorOccurred(const QString &error);
+
+private:
+    QNetworkRequest request(const QString &path) const;
+    void finish(QNetworkReply *reply, QVector<Callback> callbacks);
+    void decodeState(const QByteArray &events);
+    void decodeRates(const QByteArray &events);
+
+    QUrl base_;
+    QNetworkAccessManager manager_;
+    QSslConfiguration ssl_;
+    QHash<QString, QVector<Callback>> inflight_;  // GET path -> callbacks
+
+    // A single thread decodes in arrival order, so results are delivered in
+    // the order the responses and events came in.
+    QThreadPool decoder_;
+
+    EventSource *events_;
+    quint64 seq_ = 0;  // last event applied
+    EventSource *rates_;
+    QString rateQuery_;
+};
+
+#endif  // APICLIENT_H
@@ -0,0 +1,180 @@
+#ifndef DELTAMODEL_H
+#define DELTAMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "state.h"
+
+// DeltaModel is a table of rows of type T kept in arrival order, indexed by
+// T::key(). Deltas from the cc are queued and applied once per frame, so a
+// burst of thousands of updates costs one insert, one dataChanged over the
+// updated range and one remove per run of rows, whatever the number of
+// rows: the view only ever paints the visible ones.
+template <typename T>
+class DeltaModel : public QAbstractTableModel {
+public:
+    // Deltas are applied at most once per frameInterval milliseconds.
+    explicit DeltaModel(QObject *parent = nullptr, int frameInterval = 16)
+        : QAbstractTableModel(parent) {
+        timer_.setSingleShot(true);
+        timer_.setInterval(frameInterval);
+        QObject::connect(&timer_, &QTimer::timeout, this, [this] { flush(); });
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : rows_.size();
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : T::ColumnCount;
+    }
+
+    QVariant data(const QModelIndex &index,
+                  int role = Qt::DisplayRole) const override {
+        if (!index.isValid() || index.row() >= rows_.size()) {
+            return QVariant();
+        }
+        return rows_.at(index.row()).data(index.column(), role);
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const override {
+        if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+            return T::header(section);
+        }
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    // Replace every row, for a snapshot. Queued deltas are dropped, they
+    // are older than the snapshot.
+    void reset(QVector<T> rows) {
+        timer_.stop();
+        pending_.clear();
+        order_.clear();
+
+        beginResetModel();
+        rows_ = std::move(rows);
+        index_.clear();
+        index_.reserve(rows_.size());
+        for (int i = 0; i < rows_.size(); i++) {
+            index_.insert(rows_.at(i).key(), i);
+        }
+        endResetModel();
+    }
+
+    // Queue an insert or update of the row with row.key().
+    void update(const T &row) { queue(row.key(), row, false); }
+
+    // Queue the removal of the row with key.
+    void remove(const QString &key) { queue(key, T(), true); }
+
+    const QVector<T> &rows() const { return rows_; }
+
+    // Apply the queued deltas now, only the last one of each key counts.
+    void flush() {
+        timer_.stop();
+        if (order_.isEmpty()) {
+            return;
+        }
+
+        QVector<int> removed;
+        QVector<T> inserted;
+        int first = rows_.size(), last = -1;
+
+        for (const QString &key : std::as_const(order_)) {
+            const Pending &p = pending_[key];
+            auto it = index_.constFind(key);
+            if (p.removed) {
+                if (it != index_.constEnd()) {
+                    removed.append(it.value());
+                }
+            } else if (it != index_.constEnd()) {
+                rows_[it.value()] = p.row;
+                first = qMin(first, it.value());
+                last = qMax(last, it.value());
+            } else {
+                inserted.append(p.row);
+            }
+        }
+        pending_.clear();
+        order_.clear();
+
+        if (last != -1) {
+            emit dataChanged(index(first, 0), index(last, T::ColumnCount - 1));
+        }
+
+        if (!inserted.isEmpty()) {
+            beginInsertRows(QModelIndex(), rows_.size(),
+                            rows_.size() + inserted.size() - 1);
+            for (T &row : inserted) {
+                index_.insert(row.key(), rows_.size());
+                rows_.append(std::move(row));
+            }
+            endInsertRows();
+        }
+
+        if (!removed.isEmpty()) {
+            removeKeys(removed);
+        }
+    }
+
+private:
+    struct Pending {
+        T row;
+        bool removed = false;
+    };
+
+    void queue(const QString &key, const T &row, bool removed) {
+        auto it = pending_.find(key);
+        if (it == pending_.end()) {
+            order_.append(key);
+            pending_.insert(key, Pending{row, removed});
+        } else {
+            *it = Pending{row, removed};
+        }
+        if (!timer_.isActive()) {
+            timer_.start();
+        }
+    }
+
+    // Remove rows from the bottom up, one notification per run of adjacent
+    // rows, then renumber the rows that moved up.
+    void removeKeys(QVector<int> &removed) {
+        std::sort(removed.begin(), removed.end(), std::greater<int>());
+
+        for (int i = 0; i < removed.size();) {
+            int hi = removed.at(i), lo = hi;
+            for (i++; i < removed.size() && removed.at(i) == lo - 1; i++) {
+                lo--;
+            }
+            beginRemoveRows(QModelIndex(), lo, hi);
+            for (int row = lo; row <= hi; row++) {
+                index_.remove(rows_.at(row).key());
+            }
+            rows_.erase(rows_.begin() + lo, rows_.begin() + hi + 1);
+            endRemoveRows();
+        }
+
+        for (int row = removed.last(); row < rows_.size(); row++) {
+            index_[rows_.at(row).key()] = row;
+        }
+    }
+
+    QVector<T> rows_;
+    QHash<QString, int> index_;        // key -> row
+    QHash<QString, Pending> pending_;  // last queued delta of each key
+    QVector<QString> order_;           // keys of pending_ in arrival order
+    QTimer timer_;
+};
+
+using AgentModel = DeltaModel<AgentInfo>;
+using ListenerModel = DeltaModel<ListenerInfo>;
+
+#endif  // DELTAMODEL_H
@@ -0,0 +1,71 @@
+#include "eventsource.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+namespace {
+
+constexpr int RetryMin = 1000;
+constexpr int RetryMax = 30000;
+
+}  // namespace
+
+EventSource::EventSource(QNetworkAccessManager *manager,
+                         std::function<QNetworkRequest()> request,
+                         QObject *parent)
+    : QObject(parent), manager_(manager), request_(std::move(request)) {
+    retry_.setSingleShot(true);
+    connect(&retry_, &QTimer::timeout, this, &EventSource::open);
+}
+
+EventSource::~EventSource() {
+    close();
+}
+
+void EventSource::open() {
+    close();
+
+    QNetworkRequest req = request_();
+    req.setRawHeader("Accept", "text/event-stream");
+
+    reply_ = manager_->get(req);
+    connect(reply_, &QNetworkReply::readyRead, this, &EventSource::read);
+    connect(reply_, &QNetworkReply::finished, this, &EventSource::finished);
+}
+
+void EventSource::close() {
+    retry_.stop();
+    buffer_.clear();
+    if (reply_) {
+        reply_->disconnect(this);
+        reply_->abort();
+        reply_->deleteLater();
+        reply_ = nullptr;
+    }
+}
+
+void EventSource::read() {
+    buffer_.append(reply_->readAll());
+
+    int end = buffer_.lastIndexOf("\n\n");
+    if (end == -1) {
+        return;
+    }
+    QByteArray events = buffer_.left(end + 2);
+    buffer_.remove(0, end + 2);
+    retryDelay_ = 0;
+
+    emit received(events);
+}
+
+void EventSource::finished() {
+    QString error = reply_->errorString();
+    reply_->deleteLater();
+    reply_ = nullptr;
+    buffer_.clear();
+
+    emit errorOccurred(error);
+
+    retryDelay_ = qBound(RetryMin, retryDelay_ * 2, RetryMax);
+    retry_.start(retryDelay_);
+}
@@ -0,0 +1,46 @@
+#ifndef EVENTSOURCE_H
+#define EVENTSOURCE_H
+
+#include <QByteArray>
+#include <QNetworkRequest>
+#include <QObject>
+#include <QTimer>
+
+#include <functional>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+// EventSource follows a server-sent event stream and reopens it with capped
+// backoff after errors. Complete events are handed over in chunks as they
+// arrive, the cc flushes them in bursts.
+class EventSource : public QObject {
+    Q_OBJECT
+
+public:
+    // request is called on every (re)open, so it can carry Last-Event-ID.
+    EventSource(QNetworkAccessManager *manager,
+                std::function<QNetworkRequest()> request,
+                QObject *parent = nullptr);
+    ~EventSource();
+
+    void open();
+    void close();
+
+signals:
+    void received(const QByteArray &events);
+    void errorOccurred(const QString &error);
+
+private:
+    void read();
+    void finished();
+
+    QNetworkAccessManager *manager_;
+    std::function<QNetworkRequest()> request_;
+    QNetworkReply *reply_ = nullptr;
+    QByteArray buffer_;  // partial event
+    QTimer retry_;
+    int retryDelay_ = 0;
+};
+
+#endif  // EVENTSOURCE_H
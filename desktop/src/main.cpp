@@ -4,6 +4,8 @@
 
 int main(int argc, char *argv[]) {
     QApplication a(argc, argv);
+    QApplication::setOrganizationName(QStringLiteral("h1zzz"));
+    QApplication::setApplicationName(QStringLiteral("purewater"));
     MainWindow w;
     w.show();
     return a.exec();
@@ -1,11 +1,123 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 
+#include <QHeaderView>
+#include <QSettings>
+#include <QSortFilterProxyModel>
+#include <QStatusBar>
+
+#include "apiclient.h"
+#include "statecache.h"
+#include "throughputview.h"
+
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), ui(new Ui::MainWindow) {
+    : QMainWindow(parent),
+      ui(new Ui::MainWindow),
+      client(nullptr),
+      cache(nullptr),
+      agents(new AgentModel(this)),
+      listeners(new ListenerModel(this)) {
     ui->setupUi(this);
+
+    QSortFilterProxyModel *agentProxy = setupView(ui->agentView, agents);
+    QSortFilterProxyModel *listenerProxy =
+        setupView(ui->listenerView, listeners);
+
+    connect(ui->filter, &QLineEdit::textChanged, this,
+            [agentProxy, listenerProxy](const QString &text) {
+                agentProxy->setFilterFixedString(text);
+                listenerProxy->setFilterFixedString(text);
+            });
+
+    QSettings settings;
+    QUrl url = settings
+                   .value(QStringLiteral("cc/url"),
+                          QStringLiteral("https://127.0.0.1:8080"))
+                   .toUrl();
+    client = new ApiClient(url, this);
+    QString ca = settings.value(QStringLiteral("cc/ca")).toString();
+    if (!ca.isEmpty()) {
+        client->addCaCertificates(ca);
+    }
+
+    ui->tabs->addTab(new ThroughputView(client, this), tr("Throughput"));
+
+    connect(client, &ApiClient::batchReceived, this, &MainWindow::applyBatch);
+    connect(client, &ApiClient::errorOccurred, this, [this](const QString &e) {
+        statusBar()->showMessage(e);
+    });
+
+    // Show the cached state at once, the stream then only sends what
+    // changed since, or a snapshot if the cc no longer has it.
+    cache = new StateCache(StateCache::defaultPath(), url, this);
+    StateBatch cached;
+    if (cache->load(&cached)) {
+        agents->reset(cached.agents);
+        listeners->reset(cached.listeners);
+    }
+    cache->setSource([this] {
+        StateBatch state;
+        state.snapshot = true;
+        agents->flush();
+        listeners->flush();
+        state.seq = client->sequence();
+        state.agents = agents->rows();
+        state.listeners = listeners->rows();
+        return state;
+    });
+
+    client->subscribe(cached.seq);
 }
 
 MainWindow::~MainWindow() {
+    cache->saveNow();
     delete ui;
 }
+
+void MainWindow::applyBatch(const StateBatch &batch) {
+    statusBar()->clearMessage();
+    cache->markDirty();
+
+    if (batch.snapshot) {
+        agents->reset(batch.agents);
+        listeners->reset(batch.listeners);
+        return;
+    }
+    for (const AgentInfo &agent : batch.agents) {
+        agents->update(agent);
+    }
+    for (const ListenerInfo &listener : batch.listeners) {
+        listeners->update(listener);
+    }
+    for (const QString &key : batch.removedListeners) {
+        listeners->remove(key);
+    }
+}
+
+// setupView shows model through a sorting and filtering proxy. Rows have a
+// fixed height and columns are not sized to their contents, so the view
+// never measures rows it does not paint.
+QSortFilterProxyModel *MainWindow::setupView(QTableView *view,
+                                             QAbstractItemModel *model) {
+    auto *proxy = new QSortFilterProxyModel(this);
+    proxy->setSourceModel(model);
+    proxy->setSortRole(SortRole);
+    proxy->setFilterKeyColumn(-1);
+    proxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
+    proxy->setDynamicSortFilter(true);
+
+    view->setModel(proxy);
+    view->setSortingEnabled(true);
+    view->sortByColumn(0, Qt::AscendingOrder);
+    view->setSelectionBehavior(QAbstractItemView::SelectRows);
+    view->setWordWrap(false);
+    view->setAlternatingRowColors(true);
+    view->verticalHeader()->hide();
+    view->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    view->verticalHeader()->setDefaultSectionSize(
+        view->fontMetrics().height() + 6);
+    view->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    view->horizontalHeader()->setStretchLastSection(true);
+
+    return proxy;
+}
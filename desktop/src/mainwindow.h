@@ -3,6 +3,14 @@
 
 #include <QMainWindow>
 
+#include "deltamodel.h"
+
+class ApiClient;
+class StateCache;
+class QAbstractItemModel;
+class QSortFilterProxyModel;
+class QTableView;
+
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class MainWindow;
@@ -17,6 +25,14 @@ public:
     ~MainWindow();
 
 private:
+    QSortFilterProxyModel *setupView(QTableView *view,
+                                     QAbstractItemModel *model);
+    void applyBatch(const StateBatch &batch);
+
     Ui::MainWindow *ui;
+    ApiClient *client;
+    StateCache *cache;
+    AgentModel *agents;
+    ListenerModel *listeners;
 };
 #endif  // MAINWINDOW_H
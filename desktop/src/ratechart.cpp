@@ -0,0 +1,122 @@
+#include "ratechart.h"
+
+#include <QDateTime>
+#include <QPainter>
+#include <QPolygonF>
+
+#include <algorithm>
+#include <cmath>
+
+RateChart::RateChart(const QString &title, const QString &unit,
+                     QWidget *parent)
+    : QWidget(parent), title_(title), unit_(unit) {
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void RateChart::addLine(double RatePoint::*field, const QColor &color) {
+    lines_.append(Line{field, color});
+}
+
+void RateChart::setPoints(const QVector<RatePoint> *points) {
+    points_ = points;
+    update();
+}
+
+QSize RateChart::sizeHint() const {
+    return QSize(600, 160);
+}
+
+QString RateChart::format(double value) const {
+    static const char *const prefixes[] = {"", "k", "M", "G", "T"};
+    int i = 0;
+    while (std::fabs(value) >= 1000 && i < 4) {
+        value /= 1000;
+        i++;
+    }
+    return QStringLiteral("%1 %2")
+        .arg(value, 0, 'f', value < 10 ? 1 : 0)
+        .arg(QLatin1String(prefixes[i]) + unit_);
+}
+
+void RateChart::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    const int margin = fontMetrics().height() + 4;
+    QRectF plot = QRectF(rect()).adjusted(4, margin, -4, -margin);
+
+    painter.setPen(palette().text().color());
+    painter.drawText(QPointF(4, margin - 6), title_);
+
+    if (!points_ || points_->size() < 2 || plot.width() < 2) {
+        return;
+    }
+
+    const QVector<RatePoint> &points = *points_;
+    const qint64 t0 = points.first().t, t1 = points.last().t;
+    const int columns = int(plot.width());
+    const double span = double(std::max<qint64>(1, t1 - t0));
+
+    // Decimate every line into columns, the scale is known afterwards.
+    struct Column {
+        double first, low, high, last;
+        bool used = false;
+    };
+    QVector<QVector<Column>> decimated(lines_.size(),
+                                       QVector<Column>(columns));
+    double top = 0;
+
+    for (int l = 0; l < lines_.size(); l++) {
+        QVector<Column> &cols = decimated[l];
+        for (const RatePoint &p : points) {
+            int x = std::min(columns - 1, int((p.t - t0) / span * columns));
+            double v = p.*lines_[l].field;
+            Column &c = cols[x];
+            if (!c.used) {
+                c.first = c.low = c.high = c.last = v;
+                c.used = true;
+            } else {
+                c.low = std::min(c.low, v);
+                c.high = std::max(c.high, v);
+                c.last = v;
+            }
+            top = std::max(top, v);
+        }
+    }
+    if (top <= 0) {
+        top = 1;
+    }
+
+    auto y = [&](double v) { return plot.bottom() - v / top * plot.height(); };
+
+    for (int l = 0; l < lines_.size(); l++) {
+        QPolygonF line;
+        line.reserve(columns * 4);
+        for (int x = 0; x < columns; x++) {
+            const Column &c = decimated[l][x];
+            if (!c.used) {
+                continue;
+            }
+            qreal px = plot.left() + x;
+            line << QPointF(px, y(c.first)) << QPointF(px, y(c.low))
+                 << QPointF(px, y(c.high)) << QPointF(px, y(c.last));
+        }
+        painter.setPen(lines_[l].color);
+        painter.drawPolyline(line);
+    }
+
+    painter.setPen(palette().placeholderText().color());
+    painter.drawText(QPointF(plot.right() - fontMetrics().horizontalAdvance(
+                                                format(top)),
+                             margin - 6),
+                     format(top));
+
+    QString from = QDateTime::fromSecsSinceEpoch(t0).toString(
+        QStringLiteral("MM-dd hh:mm:ss"));
+    QString to = QDateTime::fromSecsSinceEpoch(t1).toString(
+        QStringLiteral("MM-dd hh:mm:ss"));
+    painter.drawText(QPointF(4, height() - 4), from);
+    painter.drawText(
+        QPointF(width() - 4 - fontMetrics().horizontalAdvance(to), height() - 4),
+        to);
+}
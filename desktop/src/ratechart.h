@@ -0,0 +1,47 @@
+#ifndef RATECHART_H
+#define RATECHART_H
+
+#include <QColor>
+#include <QString>
+#include <QVector>
+#include <QWidget>
+
+#include "state.h"
+
+// RateChart draws lines of rate points. Each line is decimated to the
+// first, lowest, highest and last value of every pixel column before it is
+// drawn, so the cost depends on the width of the chart and not on the
+// length of the history, and spikes are never lost.
+class RateChart : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit RateChart(const QString &title, const QString &unit,
+                       QWidget *parent = nullptr);
+
+    // Draw the field of the points as a line of color.
+    void addLine(double RatePoint::*field, const QColor &color);
+
+    // Show points, which must outlive the next paint or setPoints call.
+    void setPoints(const QVector<RatePoint> *points);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    struct Line {
+        double RatePoint::*field;
+        QColor color;
+    };
+
+    QString format(double value) const;
+
+    QString title_;
+    QString unit_;
+    QVector<Line> lines_;
+    const QVector<RatePoint> *points_ = nullptr;
+};
+
+#endif  // RATECHART_H
@@ -0,0 +1,120 @@
+#include "state.h"
+
+#include <QDateTime>
+
+AgentInfo AgentInfo::fromJson(const QJsonObject &obj) {
+    AgentInfo agent;
+    agent.id = obj.value(QLatin1String("id")).toString();
+    agent.address = obj.value(QLatin1String("address")).toString();
+    agent.protocol = obj.value(QLatin1String("protocol")).toString();
+    agent.lastSeen = qint64(obj.value(QLatin1String("last_seen")).toDouble());
+    agent.pending = obj.value(QLatin1String("pending")).toInt();
+    return agent;
+}
+
+QString AgentInfo::header(int column) {
+    switch (column) {
+    case Id:
+        return QStringLiteral("ID");
+    case Address:
+        return QStringLiteral("Address");
+    case Protocol:
+        return QStringLiteral("Protocol");
+    case LastSeen:
+        return QStringLiteral("Last seen");
+    case Pending:
+        return QStringLiteral("Pending");
+    }
+    return QString();
+}
+
+QVariant AgentInfo::data(int column, int role) const {
+    if (role == Qt::DisplayRole) {
+        switch (column) {
+        case Id:
+            return id;
+        case Address:
+            return address;
+        case Protocol:
+            return protocol;
+        case LastSeen:
+            return QDateTime::fromSecsSinceEpoch(lastSeen).toString(
+                QStringLiteral("yyyy-MM-dd hh:mm:ss"));
+        case Pending:
+            return pending;
+        }
+    } else if (role == SortRole) {
+        switch (column) {
+        case LastSeen:
+            return lastSeen;
+        case Pending:
+            return pending;
+        default:
+            return data(column, Qt::DisplayRole);
+        }
+    } else if (role == Qt::TextAlignmentRole && column == Pending) {
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+    return QVariant();
+}
+
+ListenerInfo ListenerInfo::fromJson(const QJsonObject &obj) {
+    ListenerInfo listener;
+    listener.port = obj.value(QLatin1String("port")).toInt();
+    listener.protocol = obj.value(QLatin1String("protocol")).toString();
+    listener.status = obj.value(QLatin1String("status")).toInt();
+    listener.comment = obj.value(QLatin1String("comment")).toString();
+    return listener;
+}
+
+QString ListenerInfo::header(int column) {
+    switch (column) {
+    case Port:
+        return QStringLiteral("Port");
+    case Protocol:
+        return QStringLiteral("Protocol");
+    case Status:
+        return QStringLiteral("Status");
+    case Comment:
+        return QStringLiteral("Comment");
+    }
+    return QString();
+}
+
+QVariant ListenerInfo::data(int column, int role) const {
+    if (role == Qt::DisplayRole) {
+        switch (column) {
+        case Port:
+            return port;
+        case Protocol:
+            return protocol;
+        case Status:
+            return status ? QStringLiteral("online") : QStringLiteral("offline");
+        case Comment:
+            return comment;
+        }
+    } else if (role == SortRole) {
+        switch (column) {
+        case Port:
+            return port;
+        case Status:
+            return status;
+        default:
+            return data(column, Qt::DisplayRole);
+        }
+    } else if (role == Qt::TextAlignmentRole && column == Port) {
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+    return QVariant();
+}
+
+RatePoint RatePoint::fromJson(const QJsonObject &obj) {
+    RatePoint p;
+    p.t = qint64(obj.value(QLatin1String("t")).toDouble());
+    p.checkins = obj.value(QLatin1String("checkins")).toDouble();
+    p.bytesIn = obj.value(QLatin1String("bytes_in")).toDouble();
+    p.bytesOut = obj.value(QLatin1String("bytes_out")).toDouble();
+    p.errors = obj.value(QLatin1String("errors")).toDouble();
+    p.rejected = obj.value(QLatin1String("rejected")).toDouble();
+    return p;
+}
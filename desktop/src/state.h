@@ -0,0 +1,75 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+// Rows of the cc state, mirroring the JSON of server.AgentInfo and
+// server.ListenerInfo. A row type for DeltaModel provides ColumnCount,
+// header(), key() and data().
+
+// Raw value of a cell, used by the proxy models to sort.
+constexpr int SortRole = Qt::UserRole;
+
+struct AgentInfo {
+    QString id;
+    QString address;
+    QString protocol;
+    qint64 lastSeen = 0;  // unix seconds
+    int pending = 0;
+
+    enum Column { Id, Address, Protocol, LastSeen, Pending, ColumnCount };
+
+    static AgentInfo fromJson(const QJsonObject &obj);
+    static QString header(int column);
+    QString key() const { return id; }
+    QVariant data(int column, int role) const;
+};
+
+struct ListenerInfo {
+    int port = 0;
+    QString protocol;
+    int status = 0;  // 0 offline, 1 online
+    QString comment;
+
+    enum Column { Port, Protocol, Status, Comment, ColumnCount };
+
+    static ListenerInfo fromJson(const QJsonObject &obj);
+    static QString header(int column);
+    QString key() const { return QString::number(port); }
+    QVariant data(int column, int role) const;
+};
+
+// StateBatch is a run of events from the cc event stream, decoded off the UI
+// thread. A snapshot batch replaces the whole state, others are deltas.
+struct StateBatch {
+    bool snapshot = false;
+    quint64 seq = 0;  // sequence number of the last event
+    QVector<AgentInfo> agents;
+    QVector<ListenerInfo> listeners;
+    QVector<QString> removedListeners;  // keys
+};
+
+// RatePoint holds the per-second averages of a listener over a step
+// starting at t, in unix seconds, see server.RatePoint.
+struct RatePoint {
+    qint64 t = 0;
+    double checkins = 0;
+    double bytesIn = 0;
+    double bytesOut = 0;
+    double errors = 0;
+    double rejected = 0;
+
+    static RatePoint fromJson(const QJsonObject &obj);
+};
+
+// RateBatch holds the new points of a listener from the rate stream.
+struct RateBatch {
+    int port = 0;
+    QString resolution;
+    QVector<RatePoint> points;
+};
+
+#endif  // STATE_H
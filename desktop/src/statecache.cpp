@@ -0,0 +1,171 @@
+#include "statecache.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+
+constexpr quint32 Magic = 0x50574331;  // "PWC1"
+constexpr quint32 Version = 1;
+constexpr int SaveDelay = 5000;
+
+QDataStream &operator<<(QDataStream &out, const AgentInfo &agent) {
+    return out << agent.id << agent.address << agent.protocol << agent.lastSeen
+               << qint32(agent.pending);
+}
+
+QDataStream &operator>>(QDataStream &in, AgentInfo &agent) {
+    qint32 pending;
+    in >> agent.id >> agent.address >> agent.protocol >> agent.lastSeen >>
+        pending;
+    agent.pending = pending;
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const ListenerInfo &listener) {
+    return out << qint32(listener.port) << listener.protocol
+               << qint32(listener.status) << listener.comment;
+}
+
+QDataStream &operator>>(QDataStream &in, ListenerInfo &listener) {
+    qint32 port, status;
+    in >> port >> listener.protocol >> status >> listener.comment;
+    listener.port = port;
+    listener.status = status;
+    return in;
+}
+
+template <typename T>
+void writeRows(QDataStream &out, const QVector<T> &rows) {
+    out << quint32(rows.size());
+    for (const T &row : rows) {
+        out << row;
+    }
+}
+
+template <typename T>
+bool readRows(QDataStream &in, QVector<T> *rows) {
+    quint32 n;
+    in >> n;
+    // a count larger than the rest of the file is corruption
+    if (in.status() != QDataStream::Ok || n > quint32(in.device()->size())) {
+        return false;
+    }
+    rows->resize(int(n));
+    for (T &row : *rows) {
+        in >> row;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+}  // namespace
+
+StateCache::StateCache(const QString &path, const QUrl &cc, QObject *parent)
+    : QObject(parent), path_(path), cc_(cc) {
+    writer_.setMaxThreadCount(1);
+
+    timer_.setSingleShot(true);
+    timer_.setInterval(SaveDelay);
+    connect(&timer_, &QTimer::timeout, this, &StateCache::save);
+}
+
+StateCache::~StateCache() {
+    writer_.waitForDone();
+}
+
+QString StateCache::defaultPath() {
+    return QStandardPaths::writableLocation(
+               QStandardPaths::AppLocalDataLocation) +
+           QStringLiteral("/state.cache");
+}
+
+// load maps the file rather than reading it, the rows are decoded straight
+// from the page cache.
+bool StateCache::load(StateBatch *state) const {
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    uchar *data = file.map(0, file.size());
+    if (!data) {
+        return false;
+    }
+
+    QByteArray bytes =
+        QByteArray::fromRawData(reinterpret_cast<const char *>(data),
+                                int(file.size()));
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_15);
+
+    quint32 magic, version;
+    QUrl cc;
+    in >> magic >> version >> cc;
+    if (in.status() != QDataStream::Ok || magic != Magic ||
+        version != Version || cc != cc_) {
+        return false;
+    }
+
+    StateBatch cached;
+    cached.snapshot = true;
+    in >> cached.seq;
+    if (!readRows(in, &cached.agents) || !readRows(in, &cached.listeners)) {
+        return false;
+    }
+
+    *state = std::move(cached);
+    return true;
+}
+
+void StateCache::setSource(std::function<StateBatch()> source) {
+    source_ = std::move(source);
+}
+
+void StateCache::markDirty() {
+    if (!timer_.isActive()) {
+        timer_.start();
+    }
+}
+
+// save takes the state on the UI thread, the rows are implicitly shared so
+// this is cheap, and leaves the encoding and the I/O to the writer thread.
+void StateCache::save() {
+    if (!source_) {
+        return;
+    }
+    StateBatch state = source_();
+    writer_.start([this, state] { write(state); });
+}
+
+void StateCache::saveNow() {
+    timer_.stop();
+    writer_.waitForDone();
+    if (source_) {
+        write(source_());
+    }
+}
+
+bool StateCache::write(const StateBatch &state) const {
+    QDir().mkpath(QFileInfo(path_).absolutePath());
+
+    // QSaveFile replaces the cache at once, a crash never leaves half of it
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << Magic << Version << cc_ << state.seq;
+    writeRows(out, state.agents);
+    writeRows(out, state.listeners);
+
+    if (out.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
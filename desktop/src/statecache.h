@@ -0,0 +1,52 @@
+#ifndef STATECACHE_H
+#define STATECACHE_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUrl>
+
+#include <functional>
+
+#include "state.h"
+
+// StateCache keeps the last known cc state in a local file, so that the
+// window shows it at startup while the event stream catches up from the
+// cached sequence number instead of downloading everything first.
+class StateCache : public QObject {
+    Q_OBJECT
+
+public:
+    // The cache of cc lives at path, the state of another cc is ignored.
+    StateCache(const QString &path, const QUrl &cc, QObject *parent = nullptr);
+    ~StateCache();
+
+    // Default location of the cache file.
+    static QString defaultPath();
+
+    // Read the cached state, false if there is none usable.
+    bool load(StateBatch *state) const;
+
+    // The state to save, called on the UI thread when a save is due.
+    void setSource(std::function<StateBatch()> source);
+
+    // Note that the state changed, saves are batched into one every few
+    // seconds and written off the UI thread.
+    void markDirty();
+
+    // Save now and wait for the file to be written, on exit.
+    void saveNow();
+
+private:
+    void save();
+    bool write(const StateBatch &state) const;
+
+    QString path_;
+    QUrl cc_;
+    std::function<StateBatch()> source_;
+    QTimer timer_;
+    QThreadPool writer_;
+};
+
+#endif  // STATECACHE_H
@@ -0,0 +1,116 @@
+#include "throughputview.h"
+
+#include <QComboBox>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QVBoxLayout>
+
+#include "apiclient.h"
+#include "ratechart.h"
+
+namespace {
+
+// History kept per listener, the cc keeps at most 3600 points per
+// resolution and sends a downsampled history on (re)connection.
+constexpr int MaxPoints = 3600;
+
+}  // namespace
+
+ThroughputView::ThroughputView(ApiClient *client, QWidget *parent)
+    : QWidget(parent),
+      client_(client),
+      listener_(new QComboBox(this)),
+      resolution_(new QComboBox(this)),
+      checkins_(new RateChart(tr("Check-ins"), QStringLiteral("/s"), this)),
+      bytes_(new RateChart(tr("Bytes in / out"), QStringLiteral("B/s"), this)),
+      errors_(new RateChart(tr("Errors / rejected"), QStringLiteral("/s"),
+                            this)) {
+    resolution_->addItem(tr("Last hour (1s)"), QStringLiteral("1s"));
+    resolution_->addItem(tr("Last day (1m)"), QStringLiteral("1m"));
+    resolution_->addItem(tr("Last 30 days (1h)"), QStringLiteral("1h"));
+
+    checkins_->addLine(&RatePoint::checkins, QColor(0x1f, 0x77, 0xb4));
+    bytes_->addLine(&RatePoint::bytesIn, QColor(0x2c, 0xa0, 0x2c));
+    bytes_->addLine(&RatePoint::bytesOut, QColor(0xff, 0x7f, 0x0e));
+    errors_->addLine(&RatePoint::errors, QColor(0xd6, 0x27, 0x28));
+    errors_->addLine(&RatePoint::rejected, QColor(0x94, 0x67, 0xbd));
+
+    auto *controls = new QHBoxLayout;
+    controls->addWidget(new QLabel(tr("Listener"), this));
+    controls->addWidget(listener_);
+    controls->addWidget(resolution_);
+    controls->addStretch();
+
+    auto *layout = new QVBoxLayout(this);
+    layout->addLayout(controls);
+    layout->addWidget(checkins_);
+    layout->addWidget(bytes_);
+    layout->addWidget(errors_);
+
+    connect(listener_, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &ThroughputView::showListener);
+    connect(resolution_, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &ThroughputView::subscribe);
+    connect(client_, &ApiClient::ratesReceived, this,
+            &ThroughputView::addRates);
+
+    subscribe();
+}
+
+// subscribe restarts the history at the selected resolution, at most one
+// point per pixel of the widest chart is asked for.
+void ThroughputView::subscribe() {
+    history_.clear();
+    showListener();
+    client_->subscribeRates(resolution_->currentData().toString(),
+                            qMin(MaxPoints, qMax(600, checkins_->width())));
+}
+
+void ThroughputView::addRates(const QVector<RateBatch> &rates) {
+    const QString resolution = resolution_->currentData().toString();
+    bool changed = false;
+
+    for (const RateBatch &batch : rates) {
+        if (batch.resolution != resolution) {
+            continue;  // sent before the resolution changed
+        }
+
+        if (!history_.contains(batch.port)) {
+            // inserting may move the other histories, the charts point at
+            // one of them
+            changed = true;
+        }
+        if (listener_->findData(batch.port) == -1) {
+            listener_->addItem(QString::number(batch.port), batch.port);
+        }
+
+        // A reconnection sends the history again, only newer points count.
+        QVector<RatePoint> &points = history_[batch.port];
+        qint64 last = points.isEmpty() ? 0 : points.last().t;
+        for (const RatePoint &p : batch.points) {
+            if (p.t > last) {
+                points.append(p);
+            }
+        }
+        if (points.size() > MaxPoints) {
+            points.erase(points.begin(),
+                         points.begin() + (points.size() - MaxPoints));
+        }
+
+        changed |= batch.port == listener_->currentData().toInt();
+    }
+
+    if (changed) {
+        showListener();
+    }
+}
+
+void ThroughputView::showListener() {
+    auto it = history_.constFind(listener_->currentData().toInt());
+    const QVector<RatePoint> *points =
+        it == history_.constEnd() ? nullptr : &it.value();
+
+    checkins_->setPoints(points);
+    bytes_->setPoints(points);
+    errors_->setPoints(points);
+}
@@ -0,0 +1,36 @@
+#ifndef THROUGHPUTVIEW_H
+#define THROUGHPUTVIEW_H
+
+#include <QHash>
+#include <QVector>
+#include <QWidget>
+
+#include "state.h"
+
+class ApiClient;
+class QComboBox;
+class RateChart;
+
+// ThroughputView charts the check-in, byte and error rates of a listener,
+// streamed by the cc at the chosen resolution.
+class ThroughputView : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit ThroughputView(ApiClient *client, QWidget *parent = nullptr);
+
+private:
+    void subscribe();
+    void addRates(const QVector<RateBatch> &rates);
+    void showListener();
+
+    ApiClient *client_;
+    QComboBox *listener_;
+    QComboBox *resolution_;
+    RateChart *checkins_;
+    RateChart *bytes_;
+    RateChart *errors_;
+    QHash<int, QVector<RatePoint>> history_;  // port -> points, oldest first
+};
+
+#endif  // THROUGHPUTVIEW_H